@@ -0,0 +1,343 @@
+#include "Assets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define B(op) (unsigned char)(op)
+
+AssetDef asset_defs[ASSET_MAX];
+const unsigned char* asset_ptrs[ASSET_MAX];
+bool asset_owned[ASSET_MAX]; // Converted at runtime, must be freed
+int asset_count;
+
+void* atlas_map;
+size_t atlas_size;
+
+const char* dyeName(int dye);
+void addAsset(AssetDef* defs, int* n, const char* stem, int dye, bool alpha, bool pam);
+unsigned char* loadPGM(const char* path, int dye, bool alpha);
+unsigned char* loadPAM(const char* path);
+const unsigned char* findInAtlas(const char* name);
+
+int listAssets(AssetDef* defs)
+{
+	int n = 0;
+	const char sizes[] = { 'b', 'm', 's' }; // Big, medium and small numbers
+	for(int s = 0; s < 3; ++s)
+	{
+		char stem[3] = { '0', sizes[s], '\0' };
+		for(int i = 0; i < 10; ++i, ++stem[0])
+		{
+			addAsset(defs, &n, stem, WHITE_DYE, true, false);
+			addAsset(defs, &n, stem, BLACK_DYE, true, false);
+		}
+	}
+	
+	addAsset(defs, &n, "bg", NO_DYE, false, false);
+	addAsset(defs, &n, "co2bg", RED_DYE, false, false);
+	addAsset(defs, &n, "rhbg", RED_DYE, false, false);
+	addAsset(defs, &n, "rhbg", BLUE_DYE, false, false);
+	addAsset(defs, &n, "tbg", BLUE_DYE, false, false);
+	addAsset(defs, &n, "tbg", RED_DYE, false, false);
+	
+	addAsset(defs, &n, "x", NO_DYE, false, true);
+	addAsset(defs, &n, "d", BLACK_DYE, true, false);
+	addAsset(defs, &n, "d", WHITE_DYE, true, false);
+	addAsset(defs, &n, "m", BLACK_DYE, true, false);
+	addAsset(defs, &n, "m", WHITE_DYE, true, false);
+	return n;
+}
+
+unsigned char* loadAsset(const AssetDef* def)
+{
+	return def->pam ? loadPAM(def->path) : loadPGM(def->path, def->dye, def->alpha);
+}
+
+int loadAssets(const char* atlas_path)
+{
+	asset_count = listAssets(asset_defs);
+	
+	int fd = open(atlas_path, O_RDONLY);
+	struct stat st;
+	if(fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(AtlasHeader))
+	{
+		atlas_size = st.st_size;
+		atlas_map = mmap(NULL, atlas_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(atlas_map == MAP_FAILED)
+		{
+			atlas_map = NULL;
+		}
+		else
+		{
+			const AtlasHeader* hdr = (const AtlasHeader*)atlas_map;
+			if(hdr->magic != ATLAS_MAGIC || hdr->version != ATLAS_VERSION || hdr->size != atlas_size ||
+			sizeof(AtlasHeader) + hdr->count * sizeof(AtlasEntry) > atlas_size)
+			{
+				munmap(atlas_map, atlas_size);
+				atlas_map = NULL;
+			}
+			else
+			{
+				madvise(atlas_map, atlas_size, MADV_WILLNEED);
+			}
+		}
+	}
+	if(fd >= 0)
+	{
+		close(fd); // Mapping stays valid
+	}
+	
+	int converted = 0;
+	bool failed = false;
+	for(int i = 0; i < asset_count; ++i)
+	{
+		asset_ptrs[i] = findInAtlas(asset_defs[i].name);
+		asset_owned[i] = false;
+		if(asset_ptrs[i] != NULL)
+		{
+			continue;
+		}
+		
+		asset_ptrs[i] = loadAsset(asset_defs + i);
+		asset_owned[i] = true;
+		failed = failed || asset_ptrs[i] == NULL;
+		++converted;
+	}
+	return failed ? -1 : converted;
+}
+
+const unsigned char* getAsset(const char* stem, int dye)
+{
+	char name[ASSET_NAME];
+	snprintf(name, sizeof(name), "%s.%s", stem, dyeName(dye));
+	for(int i = 0; i < asset_count; ++i)
+	{
+		if(!strcmp(asset_defs[i].name, name))
+		{
+			return asset_ptrs[i];
+		}
+	}
+	return NULL;
+}
+
+bool assetsMapped()
+{
+	return atlas_map != NULL;
+}
+
+void freeAssets()
+{
+	for(int i = 0; i < asset_count; ++i)
+	{
+		if(asset_owned[i])
+		{
+			free((void*)asset_ptrs[i]);
+		}
+		asset_ptrs[i] = NULL;
+	}
+	asset_count = 0;
+	
+	if(atlas_map != NULL)
+	{
+		munmap(atlas_map, atlas_size);
+		atlas_map = NULL;
+	}
+}
+
+const char* dyeName(int dye)
+{
+	switch(dye)
+	{
+	case BLACK_DYE:
+		return "black";
+	case WHITE_DYE:
+		return "white";
+	case RED_DYE:
+		return "red";
+	case BLUE_DYE:
+		return "blue";
+	case NO_DYE:
+	default:
+		return "none";
+	}
+}
+
+void addAsset(AssetDef* defs, int* n, const char* stem, int dye, bool alpha, bool pam)
+{
+	AssetDef* d = defs + (*n)++;
+	snprintf(d->name, sizeof(d->name), "%s.%s", stem, dyeName(dye));
+	snprintf(d->path, sizeof(d->path), "./img/%s.%s", stem, pam ? "pam" : "pgm");
+	d->dye = dye;
+	d->alpha = alpha;
+	d->pam = pam;
+}
+
+const unsigned char* findInAtlas(const char* name)
+{
+	if(atlas_map == NULL)
+	{
+		return NULL;
+	}
+	
+	const AtlasHeader* hdr = (const AtlasHeader*)atlas_map;
+	const AtlasEntry* ent = (const AtlasEntry*)(hdr + 1);
+	for(unsigned int i = 0; i < hdr->count; ++i)
+	{
+		if(!strncmp(ent[i].name, name, ASSET_NAME) && ent[i].offset + ent[i].size <= atlas_size)
+		{
+			return (const unsigned char*)atlas_map + ent[i].offset;
+		}
+	}
+	return NULL;
+}
+
+unsigned char* loadPGM(const char* path, int dye, bool alpha)
+{
+	FILE* img = fopen(path, "rb");
+	if(img == NULL)
+	{
+		return NULL;
+	}
+	
+	int w, h, maxval;
+	if(fscanf(img, "P5 %d %d %d", &w, &h, &maxval) != 3 || fgetc(img) != 0x0A || w <= 0 || h <= 0)
+	{
+		fclose(img);
+		return NULL;
+	}
+	
+	unsigned char* grey = (unsigned char*)malloc(w * h);
+	if(fread(grey, 1, w * h, img) != (size_t)(w * h))
+	{
+		free(grey);
+		fclose(img);
+		return NULL;
+	}
+	fclose(img);
+	
+	const int mp = alpha ? 3 : 2; // Multiplier
+	// Screen memory accepts pixels in 2 B form -> 5 red 6 green 5 blue bits
+	int size = w * h * mp + 4; // First 4 Bs reserved for width/height, so increse size by 4
+	
+	unsigned char* dst_img = (unsigned char*)malloc(size);
+	unsigned short* wp = (unsigned short*)dst_img;
+	unsigned short* hp = (unsigned short*)(dst_img+2);
+	*wp = (unsigned short)w;
+	*hp = (unsigned short)h;
+	
+	const unsigned char* gpp = grey;
+	for(int i = 4; i < size; i+=mp) // Data starts from 5th element
+	{
+		unsigned char gp = *gpp++; // Grey Pixel
+		switch(dye)
+		{
+		case BLACK_DYE:
+			if(!alpha)
+			{
+				unsigned char inverse = B(0xFF - gp);
+				dst_img[i] = B(B(inverse & 0xF8) | B(inverse >> 5));
+				dst_img[i+1] = B(B(B(inverse & 0xFC) << 3) | B(inverse >> 3));
+			}
+			else
+			{
+				dst_img[i] = 0x00;
+				dst_img[i+1] = 0x00;
+				dst_img[i+2] = gp;
+			}
+			break;
+		case RED_DYE:
+			if(!alpha)
+			{
+				dst_img[i] = 0x00;
+				dst_img[i+1] = B(gp >> 3);
+			}
+			else
+			{
+				dst_img[i] = 0x00;
+				dst_img[i+1] = 0x1F;
+				dst_img[i+2] = gp;
+			}
+			break;
+		case BLUE_DYE:
+			if(!alpha)
+			{
+				dst_img[i] = B(gp & 0xF8);
+				dst_img[i+1] = 0x00;
+			}
+			else
+			{
+				dst_img[i] = 0xF1;
+				dst_img[i+1] = 0x00;
+				dst_img[i+2] = gp;
+			}
+			break;
+		case WHITE_DYE:
+		case NO_DYE:
+		default:
+			if(!alpha)
+			{
+				dst_img[i] = B(B(gp & 0xF8) | B(gp >> 5));
+				dst_img[i+1] = B(B(B(gp & 0xFC) << 3) | B(gp >> 3));
+			}
+			else
+			{
+				dst_img[i] = 0xFF;
+				dst_img[i+1] = 0xFF;
+				dst_img[i+2] = gp;
+			}
+			break;
+		}
+	}
+	
+	free(grey);
+	return dst_img;
+}
+
+unsigned char* loadPAM(const char* path)
+{
+	FILE* img = fopen(path, "rb");
+	if(img == NULL)
+	{
+		return NULL;
+	}
+	
+	int w = 0, h = 0;
+	char line[64];
+	while(fgets(line, sizeof(line), img) != NULL && strncmp(line, "ENDHDR", 6))
+	{
+		sscanf(line, "WIDTH %d", &w);
+		sscanf(line, "HEIGHT %d", &h);
+	}
+	
+	unsigned char* rgba = (unsigned char*)malloc(w * h * 4 + 1);
+	if(w <= 0 || h <= 0 || fread(rgba, 4, w * h, img) != (size_t)(w * h))
+	{
+		free(rgba);
+		fclose(img);
+		return NULL;
+	}
+	fclose(img);
+	
+	int size = w * h * 3 + 4;
+	
+	unsigned char* dst_img = (unsigned char*)malloc(size);
+	unsigned short* wp = (unsigned short*)dst_img;
+	unsigned short* hp = (unsigned short*)(dst_img+2);
+	*wp = (unsigned short)w;
+	*hp = (unsigned short)h;
+	
+	const unsigned char* pix = rgba;
+	for(int i = 4; i < size; i+=3, pix+=4)
+	{
+		dst_img[i] = B(B(pix[2] & 0xF8) | B(pix[1] >> 5));
+		dst_img[i+1] = B(B(B(pix[1] & 0xFC) << 3) | B(pix[0] >> 3));
+		dst_img[i+2] = pix[3]; // Alpha Channel
+	}
+	
+	free(rgba);
+	return dst_img;
+}
@@ -0,0 +1,53 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#define BLACK_DYE     0
+#define WHITE_DYE     1
+#define RED_DYE       2
+#define BLUE_DYE      3
+#define NO_DYE        4
+
+#define ATLAS_PATH    "./img/atlas.bin"
+#define ATLAS_MAGIC   0x41535752 // "RWSA"
+#define ATLAS_VERSION 1
+#define ATLAS_ALIGN   16
+#define ASSET_NAME    24
+#define ASSET_MAX     80
+
+// Atlas file: header, index of entries, then sprites in the same layout as in memory
+// (2 B width, 2 B height, 2 B per opaque pixel or 3 B per pixel with alpha), each aligned to ATLAS_ALIGN
+struct AtlasHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int count;
+	unsigned int size; // Whole file
+};
+
+struct AtlasEntry
+{
+	char name[ASSET_NAME];
+	unsigned int offset; // From beginning of the file
+	unsigned int size;
+};
+
+struct AssetDef
+{
+	char name[ASSET_NAME]; // Image file stem + dye, e.g. "5m.black"
+	char path[32];
+	int dye;
+	bool alpha; // Grey PGM used as alpha mask of dye colour
+	bool pam;   // Full colour PAM with alpha
+};
+
+int listAssets(AssetDef* defs); // Every sprite the station draws, in every dye it's drawn with. Returns count.
+unsigned char* loadAsset(const AssetDef* def); // Converts image file to screen format, malloc'd, NULL on error
+
+// Maps atlas read-only, sprites missing from it (or all of them, if there is no atlas) are converted
+// from image files. Returns number of converted sprites or -1 if some sprite couldn't be loaded at all.
+int loadAssets(const char* atlas_path);
+const unsigned char* getAsset(const char* stem, int dye);
+bool assetsMapped();
+void freeAssets();
+
+#endif /* ASSETS_H */
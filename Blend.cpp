@@ -0,0 +1,194 @@
+#include "Blend.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BLEND_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BLEND_SSE2
+#endif
+
+#define B(op) (unsigned char)(op)
+
+// Exact floor(v/255) for v < 65535, products of 8 bit channel and alpha always fit
+#define DIV255(v) (((v) + 1 + ((v) >> 8)) >> 8)
+
+// Scalar reference of the vector kernels, also handles row tails
+inline void blendPixel(unsigned char* d, const unsigned char* s)
+{
+	unsigned int a = s[2];
+	if(a == 0xFF) // This is solid pixel, just replace it
+	{
+		d[0] = s[0];
+		d[1] = s[1];
+		return;
+	}
+	else if(!a) // This is empty pixel, skip it
+	{
+		return;
+	}
+	
+	unsigned int na = 0xFF - a;
+	unsigned int fr = B(d[0] & 0xF8);
+	unsigned int fg = B(B(d[0] << 5) | B(B(d[1] >> 3) & 0xF8));
+	unsigned int fb = B(d[1] << 3);
+	unsigned int ir = B(s[0] & 0xF8);
+	unsigned int ig = B(B(s[0] << 5) | B(B(s[1] >> 3) & 0xF8));
+	unsigned int ib = B(s[1] << 3);
+	
+	unsigned int r = DIV255(fr * na) + DIV255(ir * a);
+	unsigned int g = DIV255(fg * na) + DIV255(ig * a);
+	unsigned int b = DIV255(fb * na) + DIV255(ib * a);
+	
+	d[0] = B(B(r & 0xF8) | B(g >> 5));
+	d[1] = B(B(B(g & 0xFC) << 3) | B(b >> 3));
+}
+
+#if defined(BLEND_NEON)
+inline uint8x8_t neonDiv255(uint16x8_t v)
+{
+	return vmovn_u16(vshrq_n_u16(vaddq_u16(vaddq_u16(v, vdupq_n_u16(1)), vshrq_n_u16(v, 8)), 8));
+}
+#endif
+
+void blendRow565(unsigned char* dst, const unsigned char* src, int n)
+{
+	int i = 0;
+	
+#if defined(BLEND_NEON)
+	const uint8x8_t m_f8 = vdup_n_u8(0xF8);
+	const uint8x8_t m_fc = vdup_n_u8(0xFC);
+	
+	for(; i + 8 <= n; i += 8, dst += 16, src += 24)
+	{
+		uint8x8x3_t im = vld3_u8(src); // rg, gb, a of 8 pixels
+		uint64_t a64 = vget_lane_u64(vreinterpret_u64_u8(im.val[2]), 0);
+		if(!a64) // Fully transparent, most of glyph and button corners
+		{
+			continue;
+		}
+		
+		uint8x8x2_t fb = vld2_u8(dst);
+		if(a64 == ~0ULL) // Fully opaque
+		{
+			fb.val[0] = im.val[0];
+			fb.val[1] = im.val[1];
+			vst2_u8(dst, fb);
+			continue;
+		}
+		
+		uint8x8_t a = im.val[2];
+		uint8x8_t na = vmvn_u8(a); // 255 - a
+		
+		// Same channel extraction as RED/GREEN/BLUE macros
+		uint8x8_t fr = vand_u8(fb.val[0], m_f8);
+		uint8x8_t fg = vorr_u8(vshl_n_u8(fb.val[0], 5), vand_u8(vshr_n_u8(fb.val[1], 3), m_f8));
+		uint8x8_t fbl = vshl_n_u8(fb.val[1], 3);
+		uint8x8_t ir = vand_u8(im.val[0], m_f8);
+		uint8x8_t ig = vorr_u8(vshl_n_u8(im.val[0], 5), vand_u8(vshr_n_u8(im.val[1], 3), m_f8));
+		uint8x8_t ibl = vshl_n_u8(im.val[1], 3);
+		
+		uint8x8_t r = vadd_u8(neonDiv255(vmull_u8(fr, na)), neonDiv255(vmull_u8(ir, a)));
+		uint8x8_t g = vadd_u8(neonDiv255(vmull_u8(fg, na)), neonDiv255(vmull_u8(ig, a)));
+		uint8x8_t b = vadd_u8(neonDiv255(vmull_u8(fbl, na)), neonDiv255(vmull_u8(ibl, a)));
+		
+		uint8x8_t rg = vorr_u8(vand_u8(r, m_f8), vshr_n_u8(g, 5));
+		uint8x8_t gb = vorr_u8(vshl_n_u8(vand_u8(g, m_fc), 3), vshr_n_u8(b, 3));
+		
+		// Transparent pixels keep frame buffer, solid ones are copied as is
+		uint8x8_t keep = vceq_u8(a, vdup_n_u8(0));
+		uint8x8_t solid = vceq_u8(a, vdup_n_u8(0xFF));
+		fb.val[0] = vbsl_u8(keep, fb.val[0], vbsl_u8(solid, im.val[0], rg));
+		fb.val[1] = vbsl_u8(keep, fb.val[1], vbsl_u8(solid, im.val[1], gb));
+		vst2_u8(dst, fb);
+	}
+#elif defined(BLEND_SSE2)
+	const __m128i m_ff = _mm_set1_epi16(0xFF);
+	const __m128i m_f8 = _mm_set1_epi16(0xF8);
+	const __m128i m_e0 = _mm_set1_epi16(0xE0);
+	const __m128i m_18 = _mm_set1_epi16(0x18);
+	const __m128i m_1c = _mm_set1_epi16(0x1C);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+	
+	for(; i + 8 <= n; i += 8, dst += 16, src += 24)
+	{
+		// SSE2 has no byte shuffle, so 3 B source pixels are spread into 16 bit lanes by hand
+		unsigned int any = 0, all = 0xFF;
+		for(int j = 2; j < 24; j += 3)
+		{
+			any |= src[j];
+			all &= src[j];
+		}
+		
+		if(!any) // Fully transparent, most of glyph and button corners
+		{
+			continue;
+		}
+		
+		if(all == 0xFF) // Fully opaque
+		{
+			for(int j = 0; j < 8; ++j)
+			{
+				dst[j*2] = src[j*3];
+				dst[j*2+1] = src[j*3+1];
+			}
+			continue;
+		}
+		
+		// Inserted lane by lane, going through memory would stall on store forwarding
+		__m128i irg = _mm_setr_epi16(src[0], src[3], src[6], src[9], src[12], src[15], src[18], src[21]);
+		__m128i igb = _mm_setr_epi16(src[1], src[4], src[7], src[10], src[13], src[16], src[19], src[22]);
+		__m128i a = _mm_setr_epi16(src[2], src[5], src[8], src[11], src[14], src[17], src[20], src[23]);
+		__m128i im = _mm_or_si128(irg, _mm_slli_epi16(igb, 8)); // Source as 565 in memory order
+		__m128i na = _mm_sub_epi16(m_ff, a);
+		__m128i px = _mm_loadu_si128((const __m128i*)dst);
+		__m128i frg = _mm_and_si128(px, m_ff);
+		__m128i fgb = _mm_srli_epi16(px, 8);
+		
+		// Same channel extraction as RED/GREEN/BLUE macros, in 16 bit lanes
+		__m128i fr = _mm_and_si128(frg, m_f8);
+		__m128i fg = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(frg, 5), m_e0), _mm_and_si128(_mm_srli_epi16(fgb, 3), m_18));
+		__m128i fbl = _mm_and_si128(_mm_slli_epi16(fgb, 3), m_f8);
+		__m128i ir = _mm_and_si128(irg, m_f8);
+		__m128i ig = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(irg, 5), m_e0), _mm_and_si128(_mm_srli_epi16(igb, 3), m_18));
+		__m128i ibl = _mm_and_si128(_mm_slli_epi16(igb, 3), m_f8);
+		
+#define SSE_DIV255(v) _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, one), _mm_srli_epi16(v, 8)), 8)
+#define SSE_MIX(f, c) _mm_add_epi16(SSE_DIV255(_mm_mullo_epi16(f, na)), SSE_DIV255(_mm_mullo_epi16(c, a)))
+		
+		__m128i r = SSE_MIX(fr, ir);
+		__m128i g = SSE_MIX(fg, ig);
+		__m128i b = SSE_MIX(fbl, ibl);
+#undef SSE_MIX
+#undef SSE_DIV255
+		
+		__m128i rg = _mm_or_si128(_mm_and_si128(r, m_f8), _mm_srli_epi16(g, 5));
+		__m128i gb = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(g, m_1c), 3), _mm_srli_epi16(b, 3));
+		__m128i mix = _mm_or_si128(rg, _mm_slli_epi16(gb, 8));
+		
+		// Transparent pixels keep frame buffer, solid ones are copied as is
+		__m128i keep = _mm_cmpeq_epi16(a, zero);
+		__m128i solid = _mm_cmpeq_epi16(a, m_ff);
+		mix = _mm_or_si128(_mm_and_si128(solid, im), _mm_andnot_si128(solid, mix));
+		mix = _mm_or_si128(_mm_and_si128(keep, px), _mm_andnot_si128(keep, mix));
+		_mm_storeu_si128((__m128i*)dst, mix);
+	}
+#endif
+	
+	for(; i < n; ++i, dst += 2, src += 3)
+	{
+		blendPixel(dst, src);
+	}
+}
+
+const char* blendKernel()
+{
+#if defined(BLEND_NEON)
+	return "neon";
+#elif defined(BLEND_SSE2)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
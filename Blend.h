@@ -0,0 +1,11 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+// Integer RGB565 alpha blending, vectorized with NEON on ARM and SSE2 on x86, scalar elsewhere.
+// Pixels are in frame buffer byte order: 16 bit [rg, gb], 32 bit [rg, gb, a].
+// All kernels produce identical output. Compared to the old float routine (see bench/BenchBlend.cpp)
+// a channel can differ by 1 LSB when c * alpha is an exact multiple of 255 and float rounded it down.
+void blendRow565(unsigned char* dst, const unsigned char* src, int n); // Blends n src pixels over dst in place
+const char* blendKernel(); // Name of the kernel chosen at compile time
+
+#endif /* BLEND_H */
@@ -0,0 +1,208 @@
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <string.h>
+#include "Blend.h"
+
+// Compile time display configuration: every blitter is a template over pixel format and panel policies,
+// so each configuration gets its own fully inlined loops with no format checks inside. Supporting another
+// controller or colour depth means adding a policy here, not #ifdefs in the driver.
+//
+// Sprites (see Assets.h) are always stored as 16 bit [rg, gb] or 32 bit [rg, gb, a] after a 4 B header
+// with width and height. Frame buffers hold pixels in the format that is sent to the panel.
+
+#define DIV255(v) (((v) + 1 + ((v) >> 8)) >> 8) // Exact v/255 for v <= 255*255, same as Blend.cpp
+
+// Sprite header, unaligned safe
+inline int spriteW(const unsigned char* img)
+{
+	unsigned short w;
+	memcpy(&w, img, 2);
+	return w;
+}
+
+inline int spriteH(const unsigned char* img)
+{
+	unsigned short h;
+	memcpy(&h, img+2, 2);
+	return h;
+}
+
+inline const unsigned char* spritePixels(const unsigned char* img)
+{
+	return img+4;
+}
+
+// Pixel formats --------------------------------------------------------------------------------------------
+
+// 16 bit, 2 B per pixel, same layout as sprites (COLMOD 0x55)
+struct Rgb565
+{
+	enum { BPP = 2, COLMOD = 0x55 };
+	
+	static inline void FromSprite(unsigned char* dst, const unsigned char* src, int n)
+	{
+		memcpy(dst, src, n * BPP);
+	}
+	
+	static inline void BlendRow(unsigned char* dst, const unsigned char* src, int n)
+	{
+		blendRow565(dst, src, n);
+	}
+	
+	static inline unsigned int Key(const unsigned char* px)
+	{
+		return (unsigned int)px[0] << 8 | px[1];
+	}
+};
+
+// 18 bit, 3 B per pixel, 6 most significant bits of each B are used (COLMOD 0x66)
+struct Rgb666
+{
+	enum { BPP = 3, COLMOD = 0x66 };
+	
+	static inline void FromSprite(unsigned char* dst, const unsigned char* src, int n)
+	{
+		for(int i = 0; i < n; ++i, dst += 3, src += 2)
+		{
+			unsigned int hi = src[0] >> 3, mid = (src[0] & 0x07) << 3 | src[1] >> 5, lo = src[1] & 0x1F;
+			dst[0] = (unsigned char)(hi << 3 | hi >> 2);
+			dst[1] = (unsigned char)(mid << 2 | mid >> 4);
+			dst[2] = (unsigned char)(lo << 3 | lo >> 2);
+		}
+	}
+	
+	static inline void BlendRow(unsigned char* dst, const unsigned char* src, int n)
+	{
+		for(int i = 0; i < n; ++i, dst += 3, src += 3)
+		{
+			unsigned int a = src[2], na = 255 - a;
+			if(!a)
+			{
+				continue;
+			}
+			unsigned int hi = src[0] >> 3, mid = (src[0] & 0x07) << 3 | src[1] >> 5, lo = src[1] & 0x1F;
+			unsigned int c0 = hi << 3 | hi >> 2, c1 = mid << 2 | mid >> 4, c2 = lo << 3 | lo >> 2;
+			dst[0] = (unsigned char)(DIV255(c0 * a + dst[0] * na) & 0xFC);
+			dst[1] = (unsigned char)(DIV255(c1 * a + dst[1] * na) & 0xFC);
+			dst[2] = (unsigned char)(DIV255(c2 * a + dst[2] * na) & 0xFC);
+		}
+	}
+	
+	static inline unsigned int Key(const unsigned char* px)
+	{
+		return (unsigned int)px[0] << 16 | (unsigned int)px[1] << 8 | px[2];
+	}
+};
+
+// Panels ---------------------------------------------------------------------------------------------------
+
+// 2.8" ILI9341 240x320, used in landscape with row/column exchange
+struct Ili9341Panel
+{
+	enum { WIDTH = 320, HEIGHT = 240, X_OFS = 0, Y_OFS = 0, MADCTL = 0xE0 /*Row/Column Exchange + Column + Row Address Order*/ };
+};
+
+// 1.3" ST7789 240x240, its controller has 240x320 GRAM, visible area starts at row 80 when rotated 180 degrees
+struct St7789Panel
+{
+	enum { WIDTH = 240, HEIGHT = 240, X_OFS = 0, Y_OFS = 80, MADCTL = 0xC0 /*Column + Row Address Order*/ };
+};
+
+// Blitters -------------------------------------------------------------------------------------------------
+
+// Replaces frame buffer pixels at x/y with opaque 16 bit sprite, clipped to the screen
+template<class Px, class Panel>
+inline void blitOpaque(unsigned char* fb, const unsigned char* img, int x, int y)
+{
+	if(x < 0 || y < 0 || x >= Panel::WIDTH)
+	{
+		return;
+	}
+	
+	const int w = spriteW(img);
+	const int h = spriteH(img);
+	const int row_px = x + w > Panel::WIDTH ? Panel::WIDTH - x : w;
+	const unsigned char* src = spritePixels(img);
+	
+	for(int i = y, ii = 0; i < Panel::HEIGHT && ii < h; ++i, ++ii)
+	{
+		Px::FromSprite(fb + (x + i * Panel::WIDTH) * Px::BPP, src + ii * w * 2, row_px);
+	}
+}
+
+// Same for an image that is already in frame buffer format (pre-composited glyphs)
+template<class Px, class Panel>
+inline void blitNative(unsigned char* fb, const unsigned char* img, int x, int y)
+{
+	if(x < 0 || y < 0 || x >= Panel::WIDTH)
+	{
+		return;
+	}
+	
+	const int w = spriteW(img);
+	const int h = spriteH(img);
+	const int row_bs = (x + w > Panel::WIDTH ? Panel::WIDTH - x : w) * Px::BPP;
+	const unsigned char* src = spritePixels(img);
+	
+	for(int i = y, ii = 0; i < Panel::HEIGHT && ii < h; ++i, ++ii)
+	{
+		memcpy(fb + (x + i * Panel::WIDTH) * Px::BPP, src + ii * w * Px::BPP, row_bs);
+	}
+}
+
+// Alpha blends 32 bit sprite over dst buffer of dst_w x dst_h pixels at position x/y
+template<class Px>
+inline void blendSprite(unsigned char* dst, int dst_w, int dst_h, const unsigned char* img, int x, int y)
+{
+	if(x < 0 || y < 0)
+	{
+		return;
+	}
+	
+	const int w = spriteW(img);
+	const int h = spriteH(img);
+	const int row_px = x + w > dst_w ? dst_w - x : w;
+	const unsigned char* src = spritePixels(img);
+	
+	for(int i = y, ii = 0; i < dst_h && ii < h && row_px > 0; ++i, ++ii)
+	{
+		Px::BlendRow(dst + (x + i * dst_w) * Px::BPP, src + ii * w * 3, row_px);
+	}
+}
+
+template<class Px, class Panel>
+inline void blitAlpha(unsigned char* fb, const unsigned char* img, int x, int y)
+{
+	blendSprite<Px>(fb, Panel::WIDTH, Panel::HEIGHT, img, x, y);
+}
+
+// Copies w x h rectangle of frame buffer into one contiguous block for SPI and into the panel shadow
+template<class Px, class Panel>
+inline void gatherRect(unsigned char* dst, unsigned char* shadow, const unsigned char* fb, int x, int y, int w, int h)
+{
+	const int row_bs = w * Px::BPP;
+	for(int i = y; i < y + h; ++i, dst += row_bs)
+	{
+		const int off = (i * Panel::WIDTH + x) * Px::BPP;
+		memcpy(dst, fb + off, row_bs);
+		memcpy(shadow + off, fb + off, row_bs);
+	}
+}
+
+// Tile of tw x th pixels differs between two frame buffers
+template<class Px, class Panel>
+inline bool tileDirty(const unsigned char* a, const unsigned char* b, int x, int y, int tw, int th)
+{
+	for(int i = y; i < y + th; ++i)
+	{
+		const int off = (i * Panel::WIDTH + x) * Px::BPP;
+		if(memcmp(a + off, b + off, tw * Px::BPP))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif /* BLIT_H */
@@ -1,8 +1,21 @@
 #include "Buzzer.h"
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/prctl.h>
 #include <wiringPi.h>
 #include <pthread.h>
 #include "Externs.h"
+#include "Logger.h"
+#include "Pwm.h"
+
+#define BUZZ_CMD_MAX 8 // Sequencer queue size
+
+#define BCMD_PLAY    0
+#define BCMD_STOP    1
 
 #define NOTE_B0  31
 #define NOTE_C1  33
@@ -130,37 +143,251 @@ NOTE_C3, 8, NOTE_E2, 8, NOTE_E2, 8, NOTE_AS2, 8, NOTE_E2, 8, NOTE_E2, 8, NOTE_B2
 NOTE_E2, 8, NOTE_E2, 8, NOTE_E3, 8, NOTE_E2, 8, NOTE_E2, 8, NOTE_D3, 8, NOTE_E2, 8, NOTE_E2, 8,
 NOTE_C3, 8, NOTE_E2, 8, NOTE_E2, 8, NOTE_AS2, -2 };
 
+struct BuzzCmd
+{
+	int cmd;
+	int song;
+	int prio;
+};
+
 int buzzer_pin;
+PwmChan buzz_pwm;
+bool buzz_use_pwm; // Hardware PWM makes the tone, otherwise sequencer toggles the pin itself
+
+// One sequencer thread owns the pin, so overlapping requests can't bit-bang it at the same time.
+// Note edges are absolute deadlines on CLOCK_MONOTONIC, the thread sleeps between them instead of spinning.
+pthread_t buzz_thd;
+pthread_mutex_t buzz_lock;
+pthread_cond_t buzz_cond; // New command or quit, uses CLOCK_MONOTONIC for timed waits
+BuzzCmd buzz_queue[BUZZ_CMD_MAX];
+int buzz_head, buzz_count;
+int buzz_prio;             // Priority of the song being played
+volatile bool buzz_abort;  // Current song must stop at the next edge
+volatile bool buzz_quit;
+BuzzStats buzz_stats;
+
+void* buzzThread(void* param);
 
-void* threadBuzzPlay(void* song);
+void initBuzz(int buzz_pin, const char* pwm_chip)
+{
+	buzzer_pin = buzz_pin;
+	int chan = pwmChannelOfPin(buzz_pin);
+	buzz_use_pwm = chan >= 0 && pwm_chip != NULL && pwmOpen(&buzz_pwm, pwm_chip, chan);
+	if(!buzz_use_pwm) // Pin must stay in its PWM alt function otherwise
+	{
+		pinMode(buzzer_pin, OUTPUT);
+		digitalWrite(buzzer_pin, 0);
+	}
+	
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&buzz_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&buzz_lock, NULL);
+	
+	buzz_head = buzz_count = 0;
+	buzz_abort = buzz_quit = false;
+	memset(&buzz_stats, 0, sizeof(BuzzStats));
+	buzz_stats.pwm = buzz_use_pwm;
+	pthread_create(&buzz_thd, NULL, buzzThread, NULL); // Joinable, deinitBuzz() waits until pin is released
+}
 
-void buzzPlay(int song)
+void deinitBuzz()
 {
-	pthread_t tmp_thd;
-	pthread_create(&tmp_thd, &master_thread_attr, threadBuzzPlay, (void*)song);
+	// Critical Section Beg
+	pthread_mutex_lock(&buzz_lock);
+	
+	buzz_quit = true;
+	buzz_abort = true;
+	pthread_cond_signal(&buzz_cond);
+	
+	pthread_mutex_unlock(&buzz_lock);
+	// Critical Section End
+	pthread_join(buzz_thd, NULL);
+	
+	pthread_cond_destroy(&buzz_cond);
+	pthread_mutex_destroy(&buzz_lock);
+	if(buzz_use_pwm)
+	{
+		pwmClose(&buzz_pwm);
+	}
+	else
+	{
+		digitalWrite(buzzer_pin, 0);
+	}
 }
 
-void playNote(int freq, int dur)
+void buzzPlay(int song, int prio)
 {
-	const int wait_us = 1.0/(double)freq * 1000000.0;
-	const int half_wait = wait_us/2;
-	int duration = dur * 1000.0 * 0.9;
-	int duration10 = dur * 1000 - duration;
-	duration /= wait_us;
+	if(song == SNG_NONE)
+	{
+		return;
+	}
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&buzz_lock);
 	
-	for(int i = 0; i < duration; ++i)
+	if(buzz_stats.playing != SNG_NONE && prio > buzz_prio)
+	{
+		buzz_abort = true;
+		++buzz_stats.preempted;
+		
+		// Preempting song goes before everything queued
+		if(buzz_count == BUZZ_CMD_MAX)
+		{
+			--buzz_count;
+			++buzz_stats.dropped;
+		}
+		buzz_head = (buzz_head + BUZZ_CMD_MAX - 1) % BUZZ_CMD_MAX;
+		buzz_queue[buzz_head] = { BCMD_PLAY, song, prio };
+		++buzz_count;
+	}
+	else if(buzz_count < BUZZ_CMD_MAX)
 	{
-		digitalWrite(buzzer_pin, 1); // Thread safe
-		delayMicroseconds(half_wait);
-		digitalWrite(buzzer_pin, 0); // Thread safe
-		delayMicroseconds(half_wait);
+		buzz_queue[(buzz_head + buzz_count++) % BUZZ_CMD_MAX] = { BCMD_PLAY, song, prio };
 	}
+	else
+	{
+		++buzz_stats.dropped;
+	}
+	pthread_cond_signal(&buzz_cond);
+	
+	pthread_mutex_unlock(&buzz_lock);
+	// Critical Section End
+}
+
+void buzzStop()
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&buzz_lock);
+	
+	buzz_head = buzz_count = 0;
+	buzz_queue[0] = { BCMD_STOP, SNG_NONE, 0 };
+	buzz_count = 1;
+	buzz_abort = buzz_stats.playing != SNG_NONE;
+	pthread_cond_signal(&buzz_cond);
+	
+	pthread_mutex_unlock(&buzz_lock);
+	// Critical Section End
+}
+
+void getBuzzStats(BuzzStats* st)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&buzz_lock);
+	
+	*st = buzz_stats;
 	
-	// We only play the note for 90% of the duration, leaving 10% as a pause
-	delayMicroseconds(duration10);
+	pthread_mutex_unlock(&buzz_lock);
+	// Critical Section End
+}
+
+void addNs(struct timespec* t, long ns)
+{
+	t->tv_nsec += ns;
+	while(t->tv_nsec >= 1000000000)
+	{
+		t->tv_nsec -= 1000000000;
+		++t->tv_sec;
+	}
 }
 
-void playSong(int* song, int size, int tempo, int whole_note_parts)
+// Sleeps until deadline, returns false when song was aborted in the meantime
+bool waitUntil(const struct timespec* t)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&buzz_lock);
+	
+	while(!buzz_abort && pthread_cond_timedwait(&buzz_cond, &buzz_lock, t) == 0);
+	bool ok = !buzz_abort;
+	
+	pthread_mutex_unlock(&buzz_lock);
+	// Critical Section End
+	return ok;
+}
+
+// Software square wave, every half period is an absolute deadline
+void toneSoft(int freq, struct timespec* t, const struct timespec* tone_end)
+{
+	const long half_ns = 500000000L/freq;
+	int level = 0;
+	unsigned int edges = 0, max_late = 0;
+	
+	while(!buzz_abort && (t->tv_sec < tone_end->tv_sec || (t->tv_sec == tone_end->tv_sec && t->tv_nsec < tone_end->tv_nsec)))
+	{
+		level ^= 1;
+		digitalWrite(buzzer_pin, level);
+		++edges;
+		
+		addNs(t, half_ns);
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL) == EINTR);
+		
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long late = (now.tv_sec - t->tv_sec) * 1000000L + (now.tv_nsec - t->tv_nsec)/1000;
+		max_late = late > (long)max_late ? (unsigned int)late : max_late;
+	}
+	digitalWrite(buzzer_pin, 0);
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&buzz_lock);
+	
+	buzz_stats.edges += edges + (level ? 1 : 0);
+	buzz_stats.max_late_us = max_late > buzz_stats.max_late_us ? max_late : buzz_stats.max_late_us;
+	
+	pthread_mutex_unlock(&buzz_lock);
+	// Critical Section End
+}
+
+// Hardware square wave, one or two sysfs writes to start it and one to stop it
+void tonePwm(int freq, struct timespec* t, const struct timespec* tone_end)
+{
+	if(!pwmTone(&buzz_pwm, freq))
+	{
+		logError("Buzzer: PWM write failed, switching to software tone", errno);
+		pwmClose(&buzz_pwm);
+		buzz_use_pwm = false;
+		pinMode(buzzer_pin, OUTPUT);
+		toneSoft(freq, t, tone_end);
+		return;
+	}
+	
+	waitUntil(tone_end);
+	pwmTone(&buzz_pwm, 0);
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&buzz_lock);
+	
+	buzz_stats.pwm = buzz_use_pwm;
+	buzz_stats.pwm_writes = buzz_pwm.writes;
+	
+	pthread_mutex_unlock(&buzz_lock);
+	// Critical Section End
+}
+
+// Tone for 90% of the duration, leaving 10% as a pause. Deadline t is moved to the end of the note,
+// so rounding never accumulates over the song.
+bool playNote(int freq, int dur, struct timespec* t)
+{
+	struct timespec note_end = *t, tone_end = *t;
+	addNs(&note_end, dur * 1000000L);
+	addNs(&tone_end, dur * 900000L);
+	
+	if(freq > 0 && buzz_use_pwm)
+	{
+		tonePwm(freq, t, &tone_end);
+	}
+	else if(freq > 0)
+	{
+		toneSoft(freq, t, &tone_end);
+	}
+	
+	*t = note_end;
+	return waitUntil(t);
+}
+
+bool playSong(int* song, int size, int tempo, int whole_note_parts)
 {
 	// Change tempo to make the song slower or faster
 	// Sizeof gives the number of bytes, each int value is composed of two bytes (16 bits)
@@ -169,6 +396,9 @@ void playSong(int* song, int size, int tempo, int whole_note_parts)
 	// This calculates the duration of a whole note in ms (60s/tempo)*4 beats
 	int wholenote = (60000 * whole_note_parts)/tempo;
 	
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	
 	// Iterate over the notes of the melody. 
 	// Remember, the array is twice the number of notes (notes + durations)
 	for (int thisNote = 0; thisNote < notes; thisNote+=2)
@@ -180,49 +410,97 @@ void playSong(int* song, int size, int tempo, int whole_note_parts)
 			// Regular note, just proceed
 			noteDuration = (wholenote) / divider;
 		}
-		else if (divider < 0)
+		else
 		{
 			// Dotted notes are represented with negative durations!
 			noteDuration = (wholenote) / abs(divider);
 			noteDuration *= 1.5; // Increases the duration in half for dotted notes
 		}
 
-		playNote(song[thisNote], noteDuration);
+		if(!playNote(song[thisNote], noteDuration, &t))
+		{
+			return false;
+		}
 	}
+	return true;
 }
 
-void initBuzz(int buzz_pin)
-{
-	buzzer_pin = buzz_pin;
-	pinMode(buzzer_pin, OUTPUT);
-}
-
-void* threadBuzzPlay(void* song)
+bool playSongId(int song)
 {
-	switch((int)song)
+	switch(song)
 	{
 	case SNG_BEEP:
-		playSong(beep, sizeof(beep), 140, 4);
-		break;
+		return playSong(beep, sizeof(beep), 140, 4);
 	case SNG_SOS:
-		playSong(sos, sizeof(sos), 140, 4);
-		break;
+		return playSong(sos, sizeof(sos), 140, 4);
 	case SNG_CO2:
-		playSong(co2, sizeof(co2), 140, 4);
-		break;
+		return playSong(co2, sizeof(co2), 140, 4);
 	case SNG_IMPERIAL_MARCH:
-		playSong(imperial_march, sizeof(imperial_march), 120, 4);
-		break;
+		return playSong(imperial_march, sizeof(imperial_march), 120, 4);
 	case SNG_STAR_TREK:
-		playSong(star_trek, sizeof(star_trek), 80, 4);
-		break;
+		return playSong(star_trek, sizeof(star_trek), 80, 4);
 	case SNG_DOOM:
-		playSong(doom, sizeof(doom), 255, 4);
-		break;
+		return playSong(doom, sizeof(doom), 255, 4);
 	case SNG_NONE:
 	default:
-		break;
+		return true;
 	}
+}
+
+void* buzzThread(void* param)
+{
+	sigset_t sigs;
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+	prctl(PR_SET_TIMERSLACK, 1UL); // Default 50 us slack is audible as jitter on high notes
 	
-	return NULL;
-}
\ No newline at end of file
+	while(1)
+	{
+		// Critical Section Beg
+		pthread_mutex_lock(&buzz_lock);
+		
+		while(!buzz_count && !buzz_quit)
+		{
+			pthread_cond_wait(&buzz_cond, &buzz_lock);
+		}
+		if(buzz_quit)
+		{
+			pthread_mutex_unlock(&buzz_lock);
+			return NULL;
+		}
+		
+		BuzzCmd c = buzz_queue[buzz_head];
+		buzz_head = (buzz_head + 1) % BUZZ_CMD_MAX;
+		--buzz_count;
+		buzz_abort = false;
+		buzz_prio = c.prio;
+		buzz_stats.playing = c.cmd == BCMD_PLAY ? c.song : SNG_NONE;
+		
+		pthread_mutex_unlock(&buzz_lock);
+		// Critical Section End
+		
+		if(c.cmd != BCMD_PLAY)
+		{
+			continue;
+		}
+		
+		struct timespec beg, end, cbeg, cend;
+		clock_gettime(CLOCK_MONOTONIC, &beg);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cbeg);
+		bool done = playSongId(c.song);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cend);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&buzz_lock);
+		
+		buzz_stats.songs += done ? 1 : 0;
+		buzz_stats.stopped += !done && (!buzz_count || buzz_queue[buzz_head].cmd == BCMD_STOP) ? 1 : 0;
+		buzz_stats.play_us += (end.tv_sec - beg.tv_sec) * 1000000ULL + (end.tv_nsec - beg.tv_nsec)/1000;
+		buzz_stats.cpu_us += (cend.tv_sec - cbeg.tv_sec) * 1000000ULL + (cend.tv_nsec - cbeg.tv_nsec)/1000;
+		buzz_stats.playing = SNG_NONE;
+		
+		pthread_mutex_unlock(&buzz_lock);
+		// Critical Section End
+	}
+}
@@ -1,6 +1,8 @@
 #ifndef BUZZER_H
 #define BUZZER_H
 
+#include "Pwm.h"
+
 #define SNG_NONE           0
 #define SNG_BEEP           1
 #define SNG_SOS            2
@@ -9,7 +11,30 @@
 #define SNG_STAR_TREK      5
 #define SNG_DOOM           6
 
-void initBuzz(int buzz_pin);
-void buzzPlay(int song); // Non blocking sound playback
+#define BUZZ_PRIO_INFO     0 // Played after whatever is playing now
+#define BUZZ_PRIO_ALARM    1 // Cuts off lower priority song immediately
+
+struct BuzzStats
+{
+	unsigned int songs;          // Songs played to the end
+	unsigned int preempted;      // Songs cut off by higher priority ones
+	unsigned int stopped;        // Songs cut off by buzzStop()
+	unsigned int dropped;        // Requests lost because queue was full
+	unsigned long long edges;    // Buzzer pin toggles
+	unsigned int max_late_us;    // Worst lateness of an edge against its deadline
+	unsigned long long play_us;  // Wall time spent playing
+	unsigned long long cpu_us;   // CPU time of sequencer thread while playing
+	int playing;                 // Current song, SNG_NONE when idle
+	bool pwm;                    // Tones come from hardware PWM, edges are not counted then
+	unsigned int pwm_writes;     // Sysfs PWM writes
+};
+
+// Starts sequencer thread. If buzzer is on a hardware PWM pin and pwm_chip can be opened, notes are played by PWM,
+// otherwise by toggling the pin from the sequencer thread.
+void initBuzz(int buzz_pin, const char* pwm_chip = PWM_CHIP);
+void deinitBuzz();
+void buzzPlay(int song, int prio = BUZZ_PRIO_INFO); // Non blocking sound playback
+void buzzStop(); // Cuts off current song and drops queued ones
+void getBuzzStats(BuzzStats* st);
 
-#endif /* BUZZER_H */
\ No newline at end of file
+#endif /* BUZZER_H */
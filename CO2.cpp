@@ -1,12 +1,16 @@
 #include "CO2.h"
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>	  // For UART
 #include <fcntl.h>    // For UART
 #include <termios.h>  // For UART
+#include <poll.h>
+#include <time.h>
 #include <errno.h>
 #include "Logger.h"
+#include "Metrics.h"
 
-MHZ19B::MHZ19B() : uart_fs_(-1)
+MHZ19B::MHZ19B() : uart_fs_(-1), rx_len_(0), pending_(false), req_period_ms_(5000), req_ms_(0), ppm_ms_(-1), start_ms_(NowMs()), req_ns_(0), ppm_(0)
 {
 	// Setting up UART Filestream
 	uart_fs_ = open("/dev/serial0", O_RDWR | O_NOCTTY); // blocking read/write mode
@@ -32,41 +36,111 @@ MHZ19B::~MHZ19B()
 	DeInit();
 }
 
-int MHZ19B::GetPPM()
+int MHZ19B::Request()
 {
-	int count = write(uart_fs_, (void*)tx_buff_, 9);	
-	if(count < 0)
+	if(pending_) // Previous reply never came, drop whatever part of it arrived
 	{
-		logError("MHZ19B: Error sending TX buffer", errno);
-		return 0;
+		logError("MHZ19B: No reply to previous request", 0);
+		metAdd(MC_SENSOR_ERR_CO2, 1);
+		tcflush(uart_fs_, TCIFLUSH);
 	}
 	
-	count = read(uart_fs_, (void*)rx_buff_, 8);
+	req_ms_ = NowMs();
+	req_ns_ = metNow();
+	rx_len_ = 0;
+	pending_ = false;
 	
-	if(count != 8)
+	int count = write(uart_fs_, (void*)tx_buff_, 9);
+	if(count != 9)
 	{
-		logError("MHZ19B: Error receiving 8 data bytes", errno);
-		return 0;
+		logError("MHZ19B: Error sending TX buffer", errno);
+		metAdd(MC_SENSOR_ERR_CO2, 1);
+		return -1;
 	}
 	
-	char check_sum;
-	count = read(uart_fs_, (void*)&check_sum, 1);
-	if(count != 1)
+	pending_ = true;
+	return 0;
+}
+
+int MHZ19B::Harvest()
+{
+	if(!pending_)
 	{
-		logError("MHZ19B: Error receiving checksum byte", errno);
 		return 0;
 	}
 	
-	rx_buff_[8] = check_sum;
+	struct pollfd pfd = { uart_fs_, POLLIN, 0 };
+	while(rx_len_ < 9 && poll(&pfd, 1, 0) > 0) // Only read what is already there
+	{
+		int count = read(uart_fs_, (void*)(rx_buff_ + rx_len_), 9 - rx_len_);
+		if(count <= 0)
+		{
+			logError("MHZ19B: Error receiving reply", errno);
+			metAdd(MC_SENSOR_ERR_CO2, 1);
+			pending_ = false;
+			return -1;
+		}
+		
+		if(rx_len_ == 0) // Out of sync, drop everything before start byte
+		{
+			int st = 0;
+			while(st < count && rx_buff_[st] != 0xFF)
+			{
+				++st;
+			}
+			memmove(rx_buff_, rx_buff_ + st, count - st);
+			count -= st;
+		}
+		rx_len_ += count;
+	}
 	
-	if(!(rx_buff_[0] == 0xFF && rx_buff_[1] == 0x86 && rx_buff_[8] == CheckSum(rx_buff_)))
+	if(rx_len_ < 9)
 	{
-		logError("MHZ19B: Corrupted/wrong response! Checksum failed", 0);
-		//PrintBuff(rx_buff_);
+		if(NowMs() - req_ms_ > co2_reply_timeout_ms)
+		{
+			logError("MHZ19B: Reply timed out", 0);
+			metAdd(MC_SENSOR_ERR_CO2, 1);
+			tcflush(uart_fs_, TCIFLUSH);
+			pending_ = false;
+			return -1;
+		}
 		return 0;
 	}
 	
-	return rx_buff_[2] << 8 | rx_buff_[3];
+	pending_ = false;
+	if(!(rx_buff_[1] == 0x86 && rx_buff_[8] == CheckSum(rx_buff_)))
+	{
+		logError("MHZ19B: Corrupted/wrong response! Checksum failed", 0);
+		metAdd(MC_SENSOR_ERR_CO2, 1);
+		return -1;
+	}
+	
+	ppm_ = rx_buff_[2] << 8 | rx_buff_[3];
+	ppm_ms_ = NowMs();
+	metObserve(MH_SENSOR_CO2, metNow() - req_ns_); // Harvested as reply arrives when caller waits on GetReadyFd()
+	return 1;
+}
+
+bool MHZ19B::IsRequestDue() const
+{
+	return NowMs() - req_ms_ >= req_period_ms_;
+}
+
+void MHZ19B::SetRequestPeriod(int ms)
+{
+	req_period_ms_ = ms < co2_min_req_ms ? co2_min_req_ms : ms > co2_max_req_ms ? co2_max_req_ms : ms;
+}
+
+int MHZ19B::GetAgeMs() const
+{
+	return (int)(NowMs() - (ppm_ms_ < 0 ? start_ms_ : ppm_ms_));
+}
+
+long long MHZ19B::NowMs() const
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec/1000000;
 }
 
 void MHZ19B::DeInit()
@@ -74,9 +148,9 @@ void MHZ19B::DeInit()
 	close(uart_fs_);
 }
 
-unsigned char MHZ19B::CheckSum(unsigned char* buff) // Checking check-sum
+unsigned char MHZ19B::CheckSum(const unsigned char* buff) // Checking check-sum
 {
-	char csum;
+	unsigned char csum = 0;
 	for(int i = 1; i < 8; ++i)
 	{
 		csum += buff[i];
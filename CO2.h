@@ -6,18 +6,42 @@ class MHZ19B
 public:
 	MHZ19B();
 	~MHZ19B();
-	int GetPPM();
 	void DeInit();
 	// Calibration functions can be added here
 	
+	// Split-phase reading: Request() at the end of one cycle, Harvest() once GetReadyFd() is readable
+	int Request();                                       // Sends read command, doesn't wait for reply
+	int Harvest();                                       // 1 - new PPM ready, 0 - nothing yet, -1 - error
+	bool IsRequestDue() const;                           // Request period has passed since last request
+	void SetRequestPeriod(int ms);                       // Clamped to co2_min_req_ms...co2_max_req_ms
+	int GetRequestPeriod() const { return req_period_ms_; }
+	bool IsPending() const { return pending_; }          // Request was sent, reply not harvested yet
+	int GetReadyFd() const { return uart_fs_; }          // Becomes readable (poll) while reply arrives, Harvest() then
+	int GetLastPPM() const { return ppm_; }
+	int GetAgeMs() const;                                // Staleness of last good reading, counted from start if none yet
+	
+	static unsigned char CheckSum(const unsigned char* buff); // Of a 9 byte frame, goes to its last byte
+	
 private:
-	unsigned char CheckSum(unsigned char* buff);
 	void PrintBuff(unsigned char* buff);
+	long long NowMs() const;
 
 	// Data
 	const unsigned char tx_buff_[9] = {0xFF, 0x01, 0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x79};
 	unsigned char rx_buff_[9] = {};
 	int uart_fs_;
+	int rx_len_;             // Bytes of pending reply received so far
+	bool pending_;           // Request was sent, reply not harvested yet
+	int req_period_ms_;
+	long long req_ms_;       // When last request was sent
+	long long ppm_ms_;       // When last good reading was harvested, -1 if none yet
+	long long start_ms_;     // Failed startup read must go stale too, not stay fresh forever
+	unsigned long long req_ns_; // Same moment by metNow(), for reply latency
+	int ppm_;
 };
 
+const int co2_min_req_ms = 1000;  // Reply takes ~10 ms at 9600 baud, faster requests only repeat the same value
+const int co2_max_req_ms = 60000;
+const int co2_reply_timeout_ms = 500; // Sensor normally replies in ~15 ms
+
 #endif /* CO2_H */
\ No newline at end of file
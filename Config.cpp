@@ -0,0 +1,394 @@
+#include "Config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "Settings.h"
+#include "CO2.h"
+#include "Buzzer.h"
+#include "Logger.h"
+#include "Externs.h"
+
+#define CFG_POLL_MS     250  // How often settings version is checked
+#define CFG_DEBOUNCE_MS 1000 // Save once settings stay unchanged this long
+#define CFG_MAX_WAIT_MS 5000 // But never later than this after the first unsaved change
+#define CFG_MAX_SIZE    2048 // Bigger files are truncated, real one is about 150 B
+
+struct CfgKey
+{
+	const char* name;
+	int offset; // Field in Settings
+	int shift;  // Byte of packed field, -1 for whole int
+	int min;
+	int max;
+	const char* fmt; // Zero padded like the old fixed-offset files
+};
+
+const CfgKey cfg_keys[] = {
+	{ "lcd_on_hrs",  offsetof(Settings, lcd_on_off_time),   24, 0,    23,       "%02d" },
+	{ "lcd_on_min",  offsetof(Settings, lcd_on_off_time),   16, 0,    59,       "%02d" },
+	{ "lcd_off_hrs", offsetof(Settings, lcd_on_off_time),   8,  0,    23,       "%02d" },
+	{ "lcd_off_min", offsetof(Settings, lcd_on_off_time),   0,  0,    59,       "%02d" },
+	{ "wco2",        offsetof(Settings, co2_warning),       -1, 0,    9999,     "%04d" },
+	{ "whumd_l",     offsetof(Settings, humd_warning_low),  -1, 0,    100,      "%03d" },
+	{ "whumd_h",     offsetof(Settings, humd_warning_high), -1, 0,    100,      "%03d" },
+	{ "wtemp_l",     offsetof(Settings, temp_warning_low),  -1, -128, 127,      "%03d" },
+	{ "wtemp_h",     offsetof(Settings, temp_warning_high), -1, -128, 127,      "%03d" },
+	{ "wco2_song",   offsetof(Settings, co2_warning_song),  -1, SNG_NONE, SNG_DOOM, "%02d" },
+	{ "co2_period",  offsetof(Settings, co2_req_period),    -1, co2_min_req_ms/1000, co2_max_req_ms/1000, "%02d" },
+};
+const int cfg_nkeys = sizeof(cfg_keys)/sizeof(cfg_keys[0]);
+
+char cfg_path[256];
+char cfg_tmp_path[256 + 4];
+const char* cfg_name; // File name part of cfg_path, inotify reports names relative to the directory
+int cfg_inotify = -1;
+int cfg_quit_pipe[2] = { -1, -1 };
+pthread_t cfg_thd;
+pthread_mutex_t cfg_lock = PTHREAD_MUTEX_INITIALIZER;
+ConfigStats cfg_stats;
+struct stat cfg_saved_st; // Config as this thread last wrote it, its own rename must not be reloaded
+
+void* configThread(void* param);
+bool loadConfigFile(bool external);
+bool saveConfigFile(const Settings* set);
+
+int* cfgField(Settings* set, const CfgKey* k)
+{
+	return (int*)((char*)set + k->offset);
+}
+
+int cfgGet(const Settings* set, const CfgKey* k)
+{
+	int v = *cfgField((Settings*)set, k);
+	return k->shift < 0 ? v : (v >> k->shift) & 0xFF;
+}
+
+void cfgSet(Settings* set, const CfgKey* k, int v)
+{
+	int* f = cfgField(set, k);
+	*f = k->shift < 0 ? v : (*f & ~(0xFF << k->shift)) | v << k->shift;
+}
+
+// Parses one "key= value" line into set, false if line is not usable. Blank lines and # comments are fine.
+bool parseLine(char* line, Settings* set)
+{
+	char* p = line + strspn(line, " \t");
+	if(*p == '\0' || *p == '\n' || *p == '\r' || *p == '#')
+	{
+		return true;
+	}
+	
+	char* eq = strchr(p, '=');
+	if(eq == NULL)
+	{
+		return false;
+	}
+	char* end = eq;
+	while(end > p && (end[-1] == ' ' || end[-1] == '\t'))
+	{
+		--end;
+	}
+	*end = '\0';
+	
+	char* val = eq + 1;
+	char* val_end;
+	long v = strtol(val, &val_end, 10);
+	if(val_end == val || val_end[strspn(val_end, " \t\r\n")] != '\0')
+	{
+		return false;
+	}
+	
+	for(int i = 0; i < cfg_nkeys; ++i)
+	{
+		const CfgKey* k = cfg_keys + i;
+		if(strcmp(p, k->name))
+		{
+			continue;
+		}
+		if(v < k->min || v > k->max)
+		{
+			return false;
+		}
+		cfgSet(set, k, (int)v);
+		return true;
+	}
+	return false;
+}
+
+void initConfig(const char* path)
+{
+	snprintf(cfg_path, sizeof(cfg_path), "%s", path);
+	snprintf(cfg_tmp_path, sizeof(cfg_tmp_path), "%s.tmp", cfg_path);
+	const char* slash = strrchr(cfg_path, '/');
+	cfg_name = slash != NULL ? slash + 1 : cfg_path;
+	memset(&cfg_stats, 0, sizeof(ConfigStats));
+	
+	loadConfigFile(false);
+	cfg_stats.saved_version = settingsVersion();
+	
+	// Directory is watched, not the file: saves and most editors replace it with rename
+	char dir[256];
+	snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int)(slash - cfg_path) : 1, slash != NULL ? cfg_path : ".");
+	cfg_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(cfg_inotify < 0 || inotify_add_watch(cfg_inotify, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		logError("Config: inotify watch failed, external edits need restart", errno);
+	}
+	
+	if(pipe(cfg_quit_pipe))
+	{
+		logError("Config: can't create quit pipe", errno);
+	}
+	pthread_create(&cfg_thd, NULL, configThread, NULL); // Joinable, deinitConfig() waits for the last save
+}
+
+void deinitConfig()
+{
+	if(write(cfg_quit_pipe[1], "q", 1) != 1)
+	{
+		logError("Config: can't stop config thread", errno);
+	}
+	pthread_join(cfg_thd, NULL);
+	
+	close(cfg_quit_pipe[0]);
+	close(cfg_quit_pipe[1]);
+	cfg_quit_pipe[0] = cfg_quit_pipe[1] = -1;
+	if(cfg_inotify >= 0)
+	{
+		close(cfg_inotify);
+		cfg_inotify = -1;
+	}
+}
+
+void getConfigStats(ConfigStats* st)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&cfg_lock);
+	
+	*st = cfg_stats;
+	
+	pthread_mutex_unlock(&cfg_lock);
+	// Critical Section End
+}
+
+unsigned long long cfgNowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec/1000000;
+}
+
+// True if inotify reported that config file was replaced or written
+bool drainInotify()
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool hit = false;
+	ssize_t len;
+	while((len = read(cfg_inotify, buf, sizeof(buf))) > 0)
+	{
+		for(char* p = buf; p < buf + len; )
+		{
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			hit = hit || (ev->len && !strcmp(ev->name, cfg_name));
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	return hit;
+}
+
+void* configThread(void* param)
+{
+	sigset_t sigs;
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+	
+	unsigned int seen = settingsVersion();
+	unsigned long long first_change = 0, last_change = 0; // ms, 0 if everything is saved
+	bool quit = false;
+	
+	while(!quit)
+	{
+		struct pollfd fds[2] = { { cfg_quit_pipe[0], POLLIN, 0 }, { cfg_inotify, POLLIN, 0 } };
+		int n = poll(fds, cfg_inotify >= 0 ? 2 : 1, CFG_POLL_MS);
+		if(n < 0 && errno != EINTR)
+		{
+			logError("Config: poll failed", errno);
+			break;
+		}
+		quit = n > 0 && fds[0].revents;
+		
+		if(n > 0 && fds[1].revents && drainInotify())
+		{
+			loadConfigFile(true);
+			seen = settingsVersion();
+			if(!first_change)
+			{
+				// Critical Section Beg
+				pthread_mutex_lock(&cfg_lock);
+				
+				cfg_stats.saved_version = seen;
+				
+				pthread_mutex_unlock(&cfg_lock);
+				// Critical Section End
+			}
+		}
+		
+		unsigned int ver = settingsVersion();
+		unsigned long long now = cfgNowMs();
+		if(ver != seen)
+		{
+			seen = ver;
+			last_change = now;
+			first_change = first_change ? first_change : now;
+		}
+		
+		// Burst of web changes ends up as one write
+		if(first_change && (quit || now - last_change >= CFG_DEBOUNCE_MS || now - first_change >= CFG_MAX_WAIT_MS))
+		{
+			Settings set;
+			getSettings(&set);
+			bool ok = saveConfigFile(&set);
+			
+			// Critical Section Beg
+			pthread_mutex_lock(&cfg_lock);
+			
+			if(ok)
+			{
+				++cfg_stats.saves;
+				cfg_stats.saved_version = set.version;
+			}
+			else
+			{
+				++cfg_stats.save_errors;
+			}
+			
+			pthread_mutex_unlock(&cfg_lock);
+			// Critical Section End
+			first_change = last_change = 0; // Failed save is retried with the next change
+		}
+	}
+	return NULL;
+}
+
+// Applies every usable line of text to set, returns number of bad lines
+unsigned int parseConfig(const char* text, Settings* set)
+{
+	char buf[CFG_MAX_SIZE];
+	snprintf(buf, sizeof(buf), "%s", text); // parseLine() cuts lines up
+	
+	unsigned int bad = 0;
+	for(char* line = buf; line != NULL && *line; )
+	{
+		char* nl = strchr(line, '\n');
+		if(nl != NULL)
+		{
+			*nl = '\0';
+		}
+		bad += parseLine(line, set) ? 0 : 1;
+		line = nl != NULL ? nl + 1 : NULL;
+	}
+	return bad;
+}
+
+// Missing file keeps defaults. External edit is only committed if it really changes something.
+bool loadConfigFile(bool external)
+{
+	int fd = open(cfg_path, O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	
+	struct stat st;
+	char text[CFG_MAX_SIZE];
+	ssize_t len = fstat(fd, &st) == 0 ? read(fd, text, sizeof(text) - 1) : -1;
+	close(fd);
+	if(len < 0)
+	{
+		logError("Config: can't read config", errno);
+		return false;
+	}
+	text[len] = '\0';
+	
+	if(external && st.st_ino == cfg_saved_st.st_ino && st.st_size == cfg_saved_st.st_size &&
+	st.st_mtim.tv_sec == cfg_saved_st.st_mtim.tv_sec && st.st_mtim.tv_nsec == cfg_saved_st.st_mtim.tv_nsec)
+	{
+		return true; // Our own save, settings could have moved on since then
+	}
+	
+	Settings cur, set;
+	getSettings(&cur);
+	set = cur;
+	unsigned int bad = parseConfig(text, &set);
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&cfg_lock);
+	
+	cfg_stats.bad_lines += bad;
+	
+	pthread_mutex_unlock(&cfg_lock);
+	// Critical Section End
+	
+	if(!settingsDiff(&cur, &set))
+	{
+		return true;
+	}
+	
+	// Parsed again over the locked snapshot, so a web change that came in meanwhile is not lost
+	editSettings(&set);
+	parseConfig(text, &set);
+	commitSettings(&set);
+	
+	if(external)
+	{
+		readings_dirty = true; // LCD must recolour readings against new levels
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&cfg_lock);
+		
+		++cfg_stats.reloads;
+		
+		pthread_mutex_unlock(&cfg_lock);
+		// Critical Section End
+		DBPRINT("Config: reloaded %s\n", cfg_path);
+	}
+	return true;
+}
+
+// Temp file next to config, flushed to disk and renamed over it, so power loss leaves old or new file, never half
+bool saveConfigFile(const Settings* set)
+{
+	FILE* f = fopen(cfg_tmp_path, "w");
+	if(f == NULL)
+	{
+		logError("Config: can't create temp file", errno);
+		return false;
+	}
+	
+	for(int i = 0; i < cfg_nkeys; ++i)
+	{
+		fprintf(f, "%s= ", cfg_keys[i].name);
+		fprintf(f, cfg_keys[i].fmt, cfgGet(set, cfg_keys + i));
+		fputc('\n', f);
+	}
+	
+	bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && fstat(fileno(f), &cfg_saved_st) == 0;
+	ok = fclose(f) == 0 && ok;
+	if(!ok || rename(cfg_tmp_path, cfg_path) != 0)
+	{
+		logError("Config: save failed", errno);
+		unlink(cfg_tmp_path);
+		return false;
+	}
+	return true;
+}
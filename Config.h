@@ -0,0 +1,22 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define CFG_PATH "./log/config.cfg"
+
+struct ConfigStats
+{
+	unsigned int saves;      // Files written (each one replaces config atomically)
+	unsigned int reloads;    // External edits picked up
+	unsigned int bad_lines;  // Lines ignored: unknown key, no value or value out of range
+	unsigned int save_errors;
+	unsigned int saved_version; // Settings version that is on disk
+};
+
+// Key-value config file ("key= value" lines, any order, missing keys keep their current value).
+// Loads it into Settings, then a config thread saves every settings change (debounced, temp file + rename)
+// and reloads the file when it's edited by someone else (inotify on its directory).
+void initConfig(const char* path = CFG_PATH);
+void deinitConfig(); // Writes pending changes before returning
+void getConfigStats(ConfigStats* st);
+
+#endif /* CONFIG_H */
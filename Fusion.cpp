@@ -0,0 +1,174 @@
+#include "Fusion.h"
+
+#define FUS_BIAS_RATE  0.002f // Per second, ~8 minutes time constant, sensors drift much slower than air changes
+#define FUS_NOISE_RATE 0.01f  // Per second
+#define FUS_MAX_STREAK 5      // Seconds of rejections in a row after which disagreement is a real shift, not a glitch
+
+SensorFusion::SensorFusion(float proc_noise, float meas_noise, float gate, int rate) :
+q_(proc_noise/rate), r0_(meas_noise), gate2_(gate * gate), bias_rate_(FUS_BIAS_RATE/rate),
+noise_rate_(FUS_NOISE_RATE/rate), max_streak_(FUS_MAX_STREAK * rate)
+{
+	Reset();
+}
+
+// Every sensor reading goes through here:
+// 1. Predict - the room can change a little bit between updates, so estimate variance grows by q
+// 2. Gate    - bias corrected reading that is too far from the prediction (relative to its own noise) is rejected
+// 3. Correct - accepted readings pull the estimate proportionally to their confidence
+// 4. Learn   - biases and noise variances of accepted sensors follow their residuals very slowly
+int SensorFusion::Update(const float* meas, const bool* valid)
+{
+	int nvalid = 0;
+	for(int i = 0; i < FUS_SENSORS; ++i)
+	{
+		nvalid += valid[i] ? 1 : 0;
+	}
+
+	if(!nvalid)
+	{
+		return 0;
+	}
+
+	if(!init_)
+	{
+		Init(meas, valid, false);
+		return nvalid;
+	}
+
+	p_ += q_;
+
+	bool reject[FUS_SENSORS] = {};
+	int nrej = 0;
+	for(int i = 0; i < FUS_SENSORS; ++i)
+	{
+		if(!valid[i])
+		{
+			continue;
+		}
+
+		float y = meas[i] - bias_[i] - x_; // Innovation
+		float s = p_ + r_[i];
+		if(y * y > gate2_ * s)
+		{
+			reject[i] = true;
+			++nrej;
+		}
+	}
+
+	if(nrej == nvalid) // Nobody agrees with the estimate, either all sensors glitched or air really changed
+	{
+		for(int i = 0; i < FUS_SENSORS; ++i)
+		{
+			rejects_[i] += reject[i] ? 1 : 0;
+		}
+
+		if(++all_streak_ >= max_streak_)
+		{
+			Init(meas, valid, true);
+			return nvalid;
+		}
+		return 0;
+	}
+	all_streak_ = 0;
+
+	for(int i = 0; i < FUS_SENSORS; ++i)
+	{
+		if(!valid[i])
+		{
+			continue;
+		}
+
+		if(reject[i])
+		{
+			++rejects_[i];
+			if(++streak_[i] >= max_streak_) // This sensor moved away from the others and stays there
+			{
+				bias_[i] = meas[i] - x_;
+				streak_[i] = 0;
+			}
+			continue;
+		}
+		streak_[i] = 0;
+
+		float y = meas[i] - bias_[i] - x_;
+		float s = p_ + r_[i];
+		float k = p_/s; // Kalman gain
+
+		// Innovation variance is p + r, so whatever is above p belongs to the sensor noise
+		float r = y * y - p_;
+		r_[i] += noise_rate_ * ((r > r0_ ? r : r0_) - r_[i]);
+
+		x_ += k * y;
+		p_ *= 1.0f - k;
+	}
+
+	// Only relative bias can be observed with 2 sensors, so keep biases zero-mean when all of them were used
+	float bsum = 0.0f;
+	for(int i = 0; i < FUS_SENSORS; ++i)
+	{
+		if(valid[i] && !reject[i])
+		{
+			bias_[i] += bias_rate_ * (meas[i] - x_ - bias_[i]);
+		}
+		bsum += bias_[i];
+	}
+
+	if(!nrej && nvalid == FUS_SENSORS)
+	{
+		bsum /= FUS_SENSORS;
+		for(int i = 0; i < FUS_SENSORS; ++i)
+		{
+			bias_[i] -= bsum;
+		}
+	}
+
+	return nvalid - nrej;
+}
+
+void SensorFusion::Reset()
+{
+	x_ = 0.0f;
+	p_ = r0_;
+	for(int i = 0; i < FUS_SENSORS; ++i)
+	{
+		r_[i] = r0_;
+		bias_[i] = 0.0f;
+		rejects_[i] = 0;
+		streak_[i] = 0;
+	}
+	all_streak_ = 0;
+	init_ = false;
+}
+
+// Starts (or restarts after a step change) the estimate from the mean of the current readings
+void SensorFusion::Init(const float* meas, const bool* valid, bool keep_bias)
+{
+	float sum = 0.0f;
+	int n = 0;
+	for(int i = 0; i < FUS_SENSORS; ++i)
+	{
+		if(valid[i])
+		{
+			sum += keep_bias ? meas[i] - bias_[i] : meas[i];
+			++n;
+		}
+	}
+
+	x_ = sum/n;
+	p_ = r0_;
+	all_streak_ = 0;
+
+	if(!keep_bias && n == FUS_SENSORS) // Constant offset between sensors is visible from the very first sample
+	{
+		for(int i = 0; i < FUS_SENSORS; ++i)
+		{
+			bias_[i] = meas[i] - x_;
+		}
+	}
+
+	for(int i = 0; i < FUS_SENSORS; ++i)
+	{
+		streak_[i] = 0;
+	}
+	init_ = true;
+}
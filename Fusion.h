@@ -0,0 +1,44 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#define FUS_SENSORS 2 // HTU21D + SHT31D
+
+// Scalar Kalman filter that fuses one quantity (temperature or humidity) measured by several sensors.
+// Each sensor has its own adaptive noise variance and a slowly tracked bias relative to the fused value,
+// measurements that fall outside of the innovation gate are rejected as glitches. O(1) per sample.
+// Process noise, bias and noise tracking and glitch length are per 1 s, rate is updates per second.
+class SensorFusion
+{
+public:
+	SensorFusion(float proc_noise, float meas_noise, float gate, int rate);
+	~SensorFusion() = default;
+	int Update(const float* meas, const bool* valid); // Returns number of accepted measurements
+	void Reset();
+	float GetValue() const { return x_; }
+	float GetVariance() const { return p_; }
+	float GetBias(int sens) const { return bias_[sens]; }
+	float GetNoise(int sens) const { return r_[sens]; }
+	unsigned int GetRejects(int sens) const { return rejects_[sens]; }
+	bool IsValid() const { return init_; }
+
+private:
+	void Init(const float* meas, const bool* valid, bool keep_bias);
+
+	// Data
+	float x_;     // Fused estimate
+	float p_;     // Variance of the estimate
+	float q_;     // Process noise variance, added every update
+	float r0_;    // Measurement noise variance floor
+	float gate2_; // Squared innovation gate, in standard deviations
+	float bias_rate_;
+	float noise_rate_;
+	int max_streak_;
+	float r_[FUS_SENSORS];
+	float bias_[FUS_SENSORS];
+	unsigned int rejects_[FUS_SENSORS];
+	int streak_[FUS_SENSORS]; // Consecutive rejections of one sensor while others were accepted
+	int all_streak_;          // Consecutive updates where every measurement was rejected
+	bool init_;
+};
+
+#endif /* FUSION_H */
@@ -1,9 +1,5 @@
 #include "HTU21D.h"
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
 #include <wiringPi.h> // For delay(1)
 #include <errno.h>
 #include "Logger.h"
@@ -16,16 +12,8 @@
 #define CMD_READ_USER_REG        0xE7
 #define CMD_SOFT_RESET           0xFE
 
-HTU21D::HTU21D()
+HTU21D::HTU21D(I2CBus* bus) : I2CTHSensor(bus, 0x40)
 {
-	addr_ = 0x40; // Unshifted(to the left by 1 bit for R/W bit) 7-bit I2C address for the sensor
-	int fres = ioctl(i2c_fs_, I2C_SLAVE, addr_);
-	if(fres < 0)
-	{
-		logError("HTU21D: Error acquiring bus access and/or talking to the slave", errno);
-		close(i2c_fs_);
-		return;
-	}
 }
 
 int HTU21D::Measure()
@@ -36,19 +24,11 @@ int HTU21D::Measure()
 	temp_ = bad_humd_temp;
 	humd_ = bad_humd_temp;
 	
-	// Request temperature measurement
+	// Request temperature measurement, sensor holds the bus until result is ready
 	cmd = CMD_TEMP_MEASURE_HOLD;
-	int fres = write(i2c_fs_, &cmd, 1);
-	if(fres != 1)
-	{
-		logError("HTU21D: Error writing to the I2C bus", errno);
-		return -1;
-	}
-	
-	fres = read(i2c_fs_, data, 3);
-	if(fres != 3)
+	if(bus_->Transfer(addr_, &cmd, 1, data, 3) < 0)
 	{
-		logError("HTU21D: Error reading from the I2C bus", errno);
+		logError("HTU21D: Error measuring temperature on the I2C bus", errno);
 		return -1;
 	}
 	
@@ -66,17 +46,9 @@ int HTU21D::Measure()
 	
 	// Request humidity measurement
 	cmd = CMD_HUMD_MEASURE_HOLD;
-	fres = write(i2c_fs_, &cmd, 1);
-	if(fres != 1)
-	{
-		logError("HTU21D: Error writing to the I2C bus", errno);
-		return -1;
-	}
-	
-	fres = read(i2c_fs_, data, 3);
-	if(fres != 3)
+	if(bus_->Transfer(addr_, &cmd, 1, data, 3) < 0)
 	{
-		logError("HTU21D: Error reading from the I2C bus", errno);
+		logError("HTU21D: Error measuring humidity on the I2C bus", errno);
 		return -1;
 	}
 	
@@ -96,10 +68,28 @@ int HTU21D::Measure()
 void HTU21D::SoftReset()
 {
 	unsigned char cmd = CMD_SOFT_RESET;
-	write(i2c_fs_, &cmd, 1);
+	bus_->Write(addr_, &cmd, 1);
 	delay(16);
 }
 
+void HTU21D::SetFastMode(bool fast)
+{
+	unsigned char cmd = CMD_READ_USER_REG;
+	unsigned char reg = 0;
+	if(bus_->Transfer(addr_, &cmd, 1, &reg, 1) < 0)
+	{
+		logError("HTU21D: Error reading user register", errno);
+		return;
+	}
+	
+	// Resolution bits D7 and D0: 00 -> RH 12 bit/T 14 bit, 10 -> RH 10 bit/T 13 bit, about twice as fast
+	unsigned char wr[2] = { CMD_WRITE_USER_REG, (unsigned char)(reg & 0x7E | (fast ? 0x80 : 0x00)) };
+	if(bus_->Write(addr_, wr, 2) < 0)
+	{
+		logError("HTU21D: Error writing user register", errno);
+	}
+}
+
 // If it returns 0, then the transmission was good
 // If it returns something other than 0, then the communication was corrupted
 // From: http://www.nongnu.org/avr-libc/user-manual/group__util__crc.html
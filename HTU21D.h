@@ -6,12 +6,12 @@
 class HTU21D : public I2CTHSensor
 {
 public:
-	HTU21D();
+	HTU21D(I2CBus* bus);
 	~HTU21D() = default;
 	int Measure();
 	void SoftReset();
-private:
-	unsigned char CheckSum(unsigned short sens_msg, unsigned char crc);
+	void SetFastMode(bool fast);
+	static unsigned char CheckSum(unsigned short sens_msg, unsigned char crc); // 0 if crc matches
 };
 
 #endif /* HTU21D_H */
\ No newline at end of file
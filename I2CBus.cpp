@@ -0,0 +1,125 @@
+#include "I2CBus.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <errno.h>
+#include "Logger.h"
+
+I2CBus::I2CBus(const char* dev) : i2c_fs_(-1), ndevs_(0)
+{
+	pthread_mutex_init(&lock_, NULL);
+	memset(stats_, 0, sizeof(stats_));
+	
+	i2c_fs_ = open(dev, O_RDWR);
+	if(i2c_fs_ < 0)
+	{
+		logError("I2CBus: Error opening i2c bus filestream...", errno);
+		return;
+	}
+}
+
+I2CBus::~I2CBus()
+{
+	DeInit();
+	pthread_mutex_destroy(&lock_);
+}
+
+int I2CBus::Transfer(int addr, const unsigned char* wr, int wlen, unsigned char* rd, int rlen)
+{
+	struct i2c_msg msgs[2];
+	int nmsgs = 0;
+	
+	if(wlen > 0)
+	{
+		msgs[nmsgs].addr = (unsigned short)addr;
+		msgs[nmsgs].flags = 0;
+		msgs[nmsgs].len = (unsigned short)wlen;
+		msgs[nmsgs].buf = (unsigned char*)wr;
+		++nmsgs;
+	}
+	if(rlen > 0)
+	{
+		msgs[nmsgs].addr = (unsigned short)addr;
+		msgs[nmsgs].flags = I2C_M_RD;
+		msgs[nmsgs].len = (unsigned short)rlen;
+		msgs[nmsgs].buf = rd;
+		++nmsgs;
+	}
+	
+	struct i2c_rdwr_ioctl_data xfer;
+	xfer.msgs = msgs;
+	xfer.nmsgs = nmsgs;
+	
+	struct timespec beg, end;
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&lock_);
+	
+	clock_gettime(CLOCK_MONOTONIC, &beg);
+	int res = ioctl(i2c_fs_, I2C_RDWR, &xfer);
+	int err = errno;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	I2CDevStats* st = FindStats(addr);
+	if(st != NULL)
+	{
+		unsigned int ns = (unsigned int)((end.tv_sec - beg.tv_sec) * 1000000000 + (end.tv_nsec - beg.tv_nsec));
+		++st->transfers;
+		st->errors += res != nmsgs ? 1 : 0;
+		st->total_ns += ns;
+		st->max_ns = ns > st->max_ns ? ns : st->max_ns;
+	}
+	
+	pthread_mutex_unlock(&lock_);
+	// Critical Section End
+	
+	errno = err;
+	return res == nmsgs ? 0 : -1;
+}
+
+int I2CBus::GetStats(I2CDevStats* out, int max)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&lock_);
+	
+	int n = ndevs_ < max ? ndevs_ : max;
+	memcpy(out, stats_, n * sizeof(I2CDevStats));
+	
+	pthread_mutex_unlock(&lock_);
+	// Critical Section End
+	return n;
+}
+
+void I2CBus::DeInit()
+{
+	if(i2c_fs_ >= 0)
+	{
+		close(i2c_fs_);
+		i2c_fs_ = -1;
+	}
+}
+
+// Must be called with lock_ held
+I2CDevStats* I2CBus::FindStats(int addr)
+{
+	for(int i = 0; i < ndevs_; ++i)
+	{
+		if(stats_[i].addr == addr)
+		{
+			return stats_ + i;
+		}
+	}
+	
+	if(ndevs_ == I2C_MAX_DEVS)
+	{
+		return NULL;
+	}
+	
+	stats_[ndevs_].addr = addr;
+	return stats_ + ndevs_++;
+}
@@ -0,0 +1,39 @@
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include <pthread.h>
+
+#define I2C_MAX_DEVS 8
+
+struct I2CDevStats
+{
+	int addr;                     // 7-bit slave address
+	unsigned int transfers;
+	unsigned int errors;
+	unsigned long long total_ns;  // Total time spent in transfers
+	unsigned int max_ns;          // Slowest transfer
+};
+
+// Shared I2C bus, all sensors borrow it. Each transaction is a single I2C_RDWR ioctl with a combined
+// write-then-read (repeated start) message, so no more I2C_SLAVE switching and separate write()/read() calls.
+class I2CBus
+{
+public:
+	I2CBus(const char* dev);
+	~I2CBus();
+	int Transfer(int addr, const unsigned char* wr, int wlen, unsigned char* rd, int rlen); // 0 on success
+	int Write(int addr, const unsigned char* wr, int wlen) { return Transfer(addr, wr, wlen, 0, 0); }
+	int GetStats(I2CDevStats* out, int max); // Returns number of devices copied into out
+	void DeInit();
+	
+private:
+	I2CDevStats* FindStats(int addr);
+	
+	// Data
+	int i2c_fs_;
+	pthread_mutex_t lock_; // Serializes transactions and guards stats
+	I2CDevStats stats_[I2C_MAX_DEVS];
+	int ndevs_;
+};
+
+#endif /* I2CBUS_H */
@@ -1,25 +1,27 @@
 #ifndef I2CTHSENSOR_H
 #define I2CTHSENSOR_H
 
+#include "I2CBus.h"
+
 const float bad_humd_temp = -999.0f;
 
 class I2CTHSensor
 {
 public:
-	I2CTHSensor();
-	~I2CTHSensor();
+	I2CTHSensor(I2CBus* bus, int addr);
+	~I2CTHSensor() = default;
 	virtual int Measure() = 0;
 	virtual void SoftReset() = 0;
+	virtual void SetFastMode(bool fast) = 0; // Trade repeatability/resolution for conversion time when oversampling
 	float GetTemp() const { return temp_; }
 	float GetHumd() const { return humd_; }
-	void DeInit();
 	
 protected:
 	// Data
-	int addr_;
-	int i2c_fs_;
+	I2CBus* bus_; // Shared bus, not owned by sensor
+	int addr_;    // Unshifted(to the left by 1 bit for R/W bit) 7-bit I2C address for the sensor
 	float temp_;
 	float humd_;
 };
 
-#endif /* I2CTHSENSOR_H */
\ No newline at end of file
+#endif /* I2CTHSENSOR_H */
@@ -12,20 +12,57 @@
 #include <pthread.h>
 #include <wiringPi.h>
 #include <errno.h>
+#include <time.h>
 #include "Logger.h"
 #include "Externs.h"
 #include "Buzzer.h"
+#include "Blit.h"
+#include "SpiBatch.h"
+#include "Assets.h"
+#include "Spark.h"
+#include "Snapshot.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Settings.h"
+#ifdef LCD_HEADLESS
+#include "LcdSim.h"
+#endif
 
-#define SCR_HEIGHT    240
-#define SCR_WIDTH     320
+// Display configuration, another panel or pixel format is another policy in Blit.h
+typedef Ili9341Panel LcdPanel;
+typedef Rgb565       LcdPixel;
 
-#define SCR_BPP       16
-#define IMG_BPP       24
+#define SCR_HEIGHT    LcdPanel::HEIGHT
+#define SCR_WIDTH     LcdPanel::WIDTH
 
-#define BURST_BS      2048 // Max 4096 (a C SPI limitation it seems)
 #define BITS_PER_WORD 8
 
+// Damage tracking granularity. Frame buffer is compared with what panel shows tile by tile,
+// dirty tiles are merged into rectangles and only those are sent through CASET/PASET windows
+#define TILE_W        32
+#define TILE_H        16
+#define TILES_X       (SCR_WIDTH/TILE_W)
+#define TILES_Y       (SCR_HEIGHT/TILE_H)
+#define MAX_RECTS     16
+
+#define GLYPH_SLOTS   256 // Pre-composited glyph cache size, power of 2
+
+#define LCMD_MAX      16 // Display command queue size
+
+// Display thread commands
+#define LCMD_RDINGS   0 // New readings, advances warning blinks
+#define LCMD_REDRAW   1 // Compose current scene again, X button shown or erased
+#define LCMD_ON       2 // Wake panel up, backlight on
+#define LCMD_OFF      3 // Backlight off, panel to sleep
+#define LCMD_QUIT     4
+#define LCMD_PRESS    5 // Touch events, x/y in screen coordinates
+#define LCMD_MOVE     6
+#define LCMD_RELEASE  7
+
 #define TOUCH_IRQ_PIN 1
+#define TOUCH_POLL_MS  10 // XPT2046 sampling period while finger is down
+#define TOUCH_DEBOUNCE 3  // Samples in a row that confirm press or release
+#define TOUCH_MOVE_PX  4  // Smaller position changes are noise, not moves
 
 #define DC_PIN        25
 #define LED_PIN       22
@@ -42,14 +79,26 @@
 #define TOUCH_Z1      0xB0; // CSB: 0 1 1
 #define TOUCH_Z2      0xC0; // csb: 1 0 0
 
+// Trend sparklines, in free strips under the readings. Ranges are fixed, so a new sample never moves old ones.
+#define SPARK_CO2_X   8
+#define SPARK_CO2_Y   108
+#define SPARK_CO2_W   304 // ~25 hours
+#define SPARK_CO2_H   10
+#define SPARK_HT_Y    220
+#define SPARK_HT_W    144 // 12 hours
+#define SPARK_HT_H    16
+#define SPARK_HUMD_X  8
+#define SPARK_TEMP_X  170
+#define SPARK_CO2_LO  400.0f
+#define SPARK_CO2_HI  2000.0f
+#define SPARK_HUMD_LO 20.0f
+#define SPARK_HUMD_HI 80.0f
+#define SPARK_TEMP_LO 10.0f
+#define SPARK_TEMP_HI 35.0f
+
 #define CO2_BLINKS    20
 #define HT_BLINKS     6
 
-#define BLACK_DYE     0
-#define WHITE_DYE     1
-#define RED_DYE       2
-#define BLUE_DYE      3
-#define NO_DYE        4
 
 #define FONT_BIG      0
 #define FONT_MED      1
@@ -57,11 +106,6 @@
 
 #define B(op) (unsigned char)(op)
 
-// 16 bit pixel to 24 bit pixel convertions
-#define RED(rg, gb) B(rg & 0xF8)
-#define GREEN(rg, gb) B(B(rg << 5) | B(B(gb >> 3) & 0xF8)) // Clamp least G bit, to equalise it with R&B
-#define BLUE(rg, gb) B(gb << 3)
-
 #define EXTRACT_TOUCH_DATA() ((int)rtx[2] >> 3 | (int)rtx[1] << 5)
 
 // Sends command to LCD with additional arguments Bs
@@ -80,20 +124,54 @@ delay(5);
 spiCommand(0x11 /*Sleep OUT*/); \
 delay(5);
 
-struct Pixel
+struct Rect
+{
+	int x, y, w, h;
+};
+
+// Digit glyph alpha-blended once over a uniform background colour, drawn afterwards as opaque block copy
+struct Glyph
+{
+	const unsigned char* src; // Original 32 bit glyph (2 B colour + alpha)
+	unsigned int bg;          // Background pixel it was composited over
+	unsigned char* img;       // Opaque image in frame buffer pixel format
+};
+
+struct LcdCmd
+{
+	int op;
+	int ppm;
+	float humd, temp;
+	int x, y; // Touch position
+	struct timespec queued; // For latency stats, touch events are stamped when finger went down/up
+};
+
+// Everything that defines screen content, owned by display thread
+struct LcdScene
 {
-	unsigned char rg;
-	unsigned char gb;
-	unsigned char a;
+	bool valid; // First readings arrived
+	int ppm;
+	float humd, temp;
+	const unsigned char* co2_bg; // Warning boxes visible in current blink phase, NULL if none
+	const unsigned char* humd_bg;
+	const unsigned char* temp_bg;
 };
 
 int spi0_fs; // Descriptor for the SPI0 device filestream
 int spi1_fs; // Descriptor for the SPI1 device filestream
 
-unsigned char* frame_buffer;
+unsigned char* frame_buffer; // Back buffer, display thread composes frames here
+unsigned char* front_buffer; // Last complete frame, this one is pushed to the panel
+unsigned char* scr_shadow;   // Copy of what is currently in panel GRAM
+unsigned char* rect_buffer;  // Dirty rectangle pixels gathered for SPI
+bool scr_shadow_valid;       // Panel content is unknown until first full frame
+bool backlight_deferred;     // Warm start lights the panel with the first frame, not before it
 
 struct spi_ioc_transfer spi0; // Screen SPI
 struct spi_ioc_transfer spi1; // Touch SPI
+int spi0_xfer_bs = SPI_DEF_BUFSIZ; // Largest single transfer, probed at start
+int spi0_msg_bs = SPI_DEF_BUFSIZ;  // Largest total of one SPI_IOC_MESSAGE(N), spidev bufsiz
+int spi0_calls; // ioctl calls of current frame
 const unsigned int spi0_speed = 75000000;
 const unsigned int spi1_speed = 2000000;
 
@@ -107,61 +185,106 @@ const float touch_y_factor = 3416.0f/SCR_WIDTH;
 const int touch_x_offset = 400;
 const int touch_y_offset = 280;
 
-#ifndef MODE_16_BIT
-const int lcd_size = SCR_WIDTH * SCR_HEIGHT * IMG_BPP/8; // 230400
-#else
-const int lcd_size = SCR_WIDTH * SCR_HEIGHT * 2; // 153600
-#endif
+const int lcd_size = SCR_WIDTH * SCR_HEIGHT * LcdPixel::BPP; // 153600 in 16 bit mode
 
-volatile bool box_should_be_red;
-volatile bool readings_are_updating;
 volatile bool poweroff_pending;
+volatile bool x_button_shown; // Finger is on X button, only changed by display thread
+volatile bool lcd_blinking;
+
+LcdStats lcd_stats;
+
+// Display thread owns SPI0 and both frame buffers, everybody else talks to it through this queue
+LcdCmd lcd_queue[LCMD_MAX];
+int lcd_queue_head, lcd_queue_len;
+pthread_mutex_t lcd_lock; // Guards queue, front buffer swap and stats
+pthread_cond_t lcd_cond;
+pthread_cond_t lcd_idle_cond; // Queue is empty and display thread waits for commands
+bool lcd_busy;
+pthread_t lcd_thd;
+LcdScene scene;
+
+// Touch thread owns SPI1, ISR only wakes it up
+pthread_mutex_t touch_lock;
+pthread_cond_t touch_cond;
+pthread_t touch_thd;
+bool touch_irq;                  // Pen went down since touch thread last looked
+struct timespec touch_irq_time;
+volatile bool touch_running;
+volatile bool touch_quit;
 
 // Image resources
 // Data always starts from 5th element, first 4 reserved for width/height
+// Point into read-only atlas mapping (or into heap, if atlas is missing), see Assets.h
 // Big numbers
-unsigned char* big_num_w[10];
-unsigned char* big_num_b[10];
+const unsigned char* big_num_w[10];
+const unsigned char* big_num_b[10];
 
 // Medium numbers
-unsigned char* med_num_w[10];
-unsigned char* med_num_b[10];
+const unsigned char* med_num_w[10];
+const unsigned char* med_num_b[10];
 
 // Small numbers
-unsigned char* sml_num_w[10];
-unsigned char* sml_num_b[10];
+const unsigned char* sml_num_w[10];
+const unsigned char* sml_num_b[10];
 
 // Backgrounds
-unsigned char* bg_main;
-unsigned char* bg_co2;
-unsigned char *bg_humd_low, *bg_humd_high;
-unsigned char *bg_temp_low, *bg_temp_high;
+const unsigned char* bg_main;
+const unsigned char* bg_co2;
+const unsigned char *bg_humd_low, *bg_humd_high;
+const unsigned char *bg_temp_low, *bg_temp_high;
 
 // Misc
-unsigned char* x_button;
-unsigned char *dot_b, *dot_w;
-unsigned char *minus_b, *minus_w;
+const unsigned char* x_button;
+const unsigned char *dot_b, *dot_w;
+const unsigned char *minus_b, *minus_w;
+
+Glyph glyph_cache[GLYPH_SLOTS];
+
+// Owned by display thread
+Sparkline* co2_spark;
+Sparkline* humd_spark;
+Sparkline* temp_spark;
+bool sparks_filled; // History from logger is plotted
+unsigned int spark_add_us;
 
 int spiOpenPort(int spi_device);
 int spiCommand(unsigned char cmd);
 int spiData(const unsigned char* dat, int s);
+void postLcd(int op, int ppm, float humd, float temp);
+void postTouch(int op, int x, int y, const struct timespec* when);
+void queueLcd(LcdCmd* cmd);
+void* displayThread(void* param);
+void applyReadings(const LcdCmd* cmd);
+void addSparks(int ppm, float humd, float temp);
+void fillSparks();
+void handleTouch(const LcdCmd* cmd);
+void presentFrame();
+void panelOn();
+void panelOff();
+void renderFrame();
+void swapBuffers();
 void drawScrBuffer();
+int findDamage(Rect* rects);
+void pushRect(const Rect* r);
+void setWindow(int x, int y, int w, int h);
+void spiBurst(const unsigned char* dat, int s);
 void hardwareReset();
-void onTouchInput();
-unsigned char* loadPGM(const char* path, int dye, bool alpha);
-unsigned char* loadPAM(const char* path);
-unsigned char* createBox(const unsigned char* orig_img);
+void onTouchIrq();
+void* touchThread(void* param);
+bool readTouch(int* x, int* y);
 void multiplex24(const unsigned char* img, int x, int y);
 void multiplex32(const unsigned char* img, int x, int y);
+void multiplexGlyph(const unsigned char* img, int x, int y);
+bool uniformBg(const unsigned char* bg_px, int w, int h, int x, int y);
+const unsigned char* cachedGlyph(const unsigned char* img, const unsigned char* bg);
+void freeGlyphCache();
 void multiplexInt(int num, const unsigned char *const *font, int f_size, int x, int y);
 void multiplexTempFloat(float num, const unsigned char *const *font, const unsigned char *const *smol_font,
 const unsigned char* dot, const unsigned char* minus, int x, int y);
-void loadNums(const char* suffix, int dye, unsigned char** dest);
-void freeNums(unsigned char** targ);
-void eraseX();
+void getNums(const char* suffix, int dye, const unsigned char** dest);
 
 // External functions
-void initLCD()
+void initLCD(bool warm)
 {
 	wiringPiSetupGpio();
 	
@@ -173,7 +296,6 @@ void initLCD()
 	pullUpDnControl(LED_PIN, PUD_OFF);
 	pullUpDnControl(TOUCH_IRQ_PIN, PUD_OFF);
 	pullUpDnControl(RESET_PIN, PUD_OFF);
-	wiringPiISR(TOUCH_IRQ_PIN, INT_EDGE_FALLING, &onTouchInput); // Setup Interrupt Service Routine for touch-screen
 	
 	spiOpenPort(0);
 	spi0.delay_usecs = 0;
@@ -189,111 +311,488 @@ void initLCD()
 	
 	// Load resourses
 	frame_buffer = (unsigned char*)malloc(lcd_size);
+	front_buffer = (unsigned char*)malloc(lcd_size);
+	scr_shadow = (unsigned char*)malloc(lcd_size);
+	rect_buffer = (unsigned char*)malloc(lcd_size);
+	scr_shadow_valid = false;
+	
+	struct timespec abeg, aend;
+	clock_gettime(CLOCK_MONOTONIC, &abeg);
+	int converted = loadAssets(ATLAS_PATH);
+	if(converted < 0)
+	{
+		logError("LCD: Can't load image resources! ", 0);
+	}
 	
-	loadNums("b", WHITE_DYE, big_num_w);
-	loadNums("b", BLACK_DYE, big_num_b);
-	loadNums("m", WHITE_DYE, med_num_w);
-	loadNums("m", BLACK_DYE, med_num_b);
-	loadNums("s", WHITE_DYE, sml_num_w);
-	loadNums("s", BLACK_DYE, sml_num_b);
-
-	bg_main = loadPGM("./img/bg.pgm", NO_DYE, false);
-	bg_co2 = loadPGM("./img/co2bg.pgm", RED_DYE, false);
-	bg_humd_low = loadPGM("./img/rhbg.pgm", RED_DYE, false);
-	bg_humd_high = loadPGM("./img/rhbg.pgm", BLUE_DYE, false);
-	bg_temp_low = loadPGM("./img/tbg.pgm", BLUE_DYE, false);
-	bg_temp_high = loadPGM("./img/tbg.pgm", RED_DYE, false);
-	
-	x_button = loadPAM("./img/x.pam");
-	dot_b = loadPGM("./img/d.pgm", BLACK_DYE, true);
-	dot_w = loadPGM("./img/d.pgm", WHITE_DYE, true);
-	minus_b = loadPGM("./img/m.pgm", BLACK_DYE, true);
-	minus_w = loadPGM("./img/m.pgm", WHITE_DYE, true);
+	getNums("b", WHITE_DYE, big_num_w);
+	getNums("b", BLACK_DYE, big_num_b);
+	getNums("m", WHITE_DYE, med_num_w);
+	getNums("m", BLACK_DYE, med_num_b);
+	getNums("s", WHITE_DYE, sml_num_w);
+	getNums("s", BLACK_DYE, sml_num_b);
+
+	bg_main = getAsset("bg", NO_DYE);
+	bg_co2 = getAsset("co2bg", RED_DYE);
+	bg_humd_low = getAsset("rhbg", RED_DYE);
+	bg_humd_high = getAsset("rhbg", BLUE_DYE);
+	bg_temp_low = getAsset("tbg", BLUE_DYE);
+	bg_temp_high = getAsset("tbg", RED_DYE);
+	
+	x_button = getAsset("x", NO_DYE);
+	dot_b = getAsset("d", BLACK_DYE);
+	dot_w = getAsset("d", WHITE_DYE);
+	minus_b = getAsset("m", BLACK_DYE);
+	minus_w = getAsset("m", WHITE_DYE);
+	
+	clock_gettime(CLOCK_MONOTONIC, &aend);
+	lcd_stats.assets_us = (aend.tv_sec - abeg.tv_sec) * 1000000 + (aend.tv_nsec - abeg.tv_nsec)/1000;
+	lcd_stats.assets_mapped = assetsMapped();
+	DBPRINT("LCD: images ready in %u us, atlas %s, %d converted from files\n", lcd_stats.assets_us,
+	assetsMapped() ? "mapped" : "missing", converted);
+	
+	co2_spark = new Sparkline(SPARK_CO2_W, SPARK_CO2_H, SPARK_CO2_LO, SPARK_CO2_HI);
+	humd_spark = new Sparkline(SPARK_HT_W, SPARK_HT_H, SPARK_HUMD_LO, SPARK_HUMD_HI);
+	temp_spark = new Sparkline(SPARK_HT_W, SPARK_HT_H, SPARK_TEMP_LO, SPARK_TEMP_HI);
+	sparks_filled = false;
 	
 	initBuzz(BUZZ_PIN);
 	
-	// Enable reset pin to make possible screen operation
+	// Enable reset pin to make possible screen operation. After warm restart it was never pulled low
+	// and panel sits in Sleep In where software reset below needs only 5 ms, so there is nothing to wait for.
 	digitalWrite(RESET_PIN, 1);
-	delay(120);
+	delay(warm ? 0 : 120);
 	
 	// Change screen orientation to landscape mode. This command MUST be called BEFORE Soft. Reset, otherwise screen bugs out
-	COMMAND(0x36, /*Memory Access Control*/ 0xE0 /*Row/Column Exchange + Column + Row Address Order*/);
+	COMMAND(0x36, /*Memory Access Control*/ LcdPanel::MADCTL);
 	
 	spiCommand(0x01 /*Software reset*/);
 	delay(5); // Wait some time for the supply voltages and clock circuits to stabilise
 	
-#ifdef MODE_16_BIT
-	COMMAND(0x3A, /*Pixel Format Set*/ 0x55 /*16 bit mode 65 536 colors*/);
-#endif
+	COMMAND(0x3A, /*Pixel Format Set*/ LcdPixel::COLMOD);
 	COMMAND(0xE0, /*Positive Gamma Correction*/ 0x0F, 0x31, 0x2B, 0x0C, 0x0E, 0x08, 0x4E, 0xF1, 0x37, 0x07, 0x10, 0x03, 0x0E, 0x09, 0x00);
 	COMMAND(0xE1, /*Negative Gamma Correction*/ 0x00, 0x0E, 0x14, 0x03, 0x11, 0x07, 0x31, 0xC1, 0x48, 0x08, 0x0F, 0x0C, 0x31, 0x36, 0x0F);
 	
 	EXIT_SLEEP();
 	spiCommand(0x29 /*Display ON*/);
-	delay(130); // This delay is only cosmetic, to skip few white frames at display turning ON
 	
-	digitalWrite(LED_PIN, 1); // Turn backlight ON
+	// Few white frames follow display turning ON. Cold start waits them out in the dark, warm start
+	// keeps backlight off until the first frame is in GRAM instead of waiting a fixed time.
+	backlight_deferred = warm;
+	if(!warm)
+	{
+		delay(130);
+		digitalWrite(LED_PIN, 1); // Turn backlight ON
+	}
 	lcd_is_on = true;
 	
 	spi0.speed_hz = spi0_speed;
+	
+	// Raise spidev.bufsiz in /boot/cmdline.txt (e.g. spidev.bufsiz=163840) to push whole frame in one ioctl
+	spiCommand(0x00 /*NOP - No Operation*/); // Probe data that follows is ignored by the panel
+	digitalWrite(DC_PIN, 1);
+	spi0_xfer_bs = spiProbeXfer(spi0_fs, &spi0);
+	spi0_msg_bs = spiBufsiz();
+	spi0_msg_bs = spi0_msg_bs < spi0_xfer_bs ? spi0_xfer_bs : spi0_msg_bs;
+	lcd_stats.spi_xfer_bs = spi0_xfer_bs;
+	lcd_stats.spi_msg_bs = spi0_msg_bs;
+	DBPRINT("SPI0: transfer %d B, message %d B\n", spi0_xfer_bs, spi0_msg_bs);
+	
+	pthread_mutex_init(&lcd_lock, NULL);
+	pthread_cond_init(&lcd_cond, NULL);
+	pthread_cond_init(&lcd_idle_cond, NULL);
+	lcd_queue_head = lcd_queue_len = 0;
+	lcd_busy = false;
+	scene.valid = false;
+	pthread_create(&lcd_thd, NULL, displayThread, NULL); // Joinable, deinitLCD() waits until SPI0 is released
+	
+	pthread_mutex_init(&touch_lock, NULL);
+	pthread_cond_init(&touch_cond, NULL);
+	touch_irq = touch_quit = false;
+	touch_running = true;
+	pthread_create(&touch_thd, NULL, touchThread, NULL);
+	wiringPiISR(TOUCH_IRQ_PIN, INT_EDGE_FALLING, &onTouchIrq); // Setup Interrupt Service Routine for touch-screen
 }
 
 void deinitLCD()
 {
+	// Touch goes first, its events would be lost anyway. ISR thread can't be stopped, it just stops signalling.
+	touch_running = false;
+	// Critical Section Beg
+	pthread_mutex_lock(&touch_lock);
+	
+	touch_quit = true;
+	pthread_cond_signal(&touch_cond);
+	
+	pthread_mutex_unlock(&touch_lock);
+	// Critical Section End
+	pthread_join(touch_thd, NULL);
+	
+	postLcd(LCMD_QUIT, 0, 0.0f, 0.0f);
+	if(!pthread_equal(lcd_thd, pthread_self()))
+	{
+		pthread_join(lcd_thd, NULL);
+	}
+	pthread_cond_destroy(&lcd_cond);
+	pthread_cond_destroy(&lcd_idle_cond);
+	pthread_mutex_destroy(&lcd_lock);
+	pthread_cond_destroy(&touch_cond);
+	pthread_mutex_destroy(&touch_lock);
+	deinitBuzz(); // Display thread was the only one playing songs
+	
 	digitalWrite(LED_PIN, 0); // Turn backlight OFF
 	spiCommand(0x28 /*Display OFF*/);
 	ENTER_SLEEP();
 	lcd_is_on = false;
 	
 	free(frame_buffer);
+	free(front_buffer);
+	free(scr_shadow);
+	free(rect_buffer);
 	
-	freeNums(big_num_w);
-	freeNums(big_num_b);
-	freeNums(med_num_w);
-	freeNums(med_num_b);
-	freeNums(sml_num_w);
-	freeNums(sml_num_b);
-
-	free(bg_main);
-	free(bg_co2);
-	free(bg_humd_low);
-	free(bg_humd_high);
-	free(bg_temp_low);
-	free(bg_temp_high);
-	
-	free(x_button);
-	free(dot_b);
-	free(dot_w);
-	free(minus_b);
-	free(minus_w);
+	freeAssets(); // Sprite pointers are dead after this
+	freeGlyphCache();
+	delete co2_spark;
+	delete humd_spark;
+	delete temp_spark;
 	
 	close(spi0_fs);
 	close(spi1_fs);
 }
 
+// Never waits for rendering or SPI, display thread composes and pushes the frame
 void updateReadings(int ppm, float humd, float temp)
 {
+	postLcd(LCMD_RDINGS, ppm, humd, temp);
+}
+
+void skipReadings()
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&lcd_lock);
+	
+	++lcd_stats.skipped; // Unchanged frame has no damaged regions, skipping it saves rendering, not SPI bytes
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
+}
+
+bool lcdIsBlinking()
+{
+	return lcd_blinking;
+}
+
+void getLcdStats(LcdStats* st)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&lcd_lock);
+	
+	*st = lcd_stats;
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
+}
+
+void flushLCD()
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&lcd_lock);
+	
+	while(lcd_queue_len || lcd_busy)
+	{
+		pthread_cond_wait(&lcd_idle_cond, &lcd_lock);
+	}
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
+}
+
+void onLCD()
+{
+	lcd_is_on = true;
+	postLcd(LCMD_ON, 0, 0.0f, 0.0f);
+}
+
+void offLCD()
+{
+	lcd_is_on = false;
+	postLcd(LCMD_OFF, 0, 0.0f, 0.0f);
+}
+
+// Internal functions
+// Queues command for display thread, only waits for the queue lock
+void postLcd(int op, int ppm, float humd, float temp)
+{
+	LcdCmd cmd;
+	cmd.op = op;
+	cmd.ppm = ppm;
+	cmd.humd = humd;
+	cmd.temp = temp;
+	cmd.x = cmd.y = 0;
+	clock_gettime(CLOCK_MONOTONIC, &cmd.queued);
+	queueLcd(&cmd);
+}
+
+void postTouch(int op, int x, int y, const struct timespec* when)
+{
+	LcdCmd cmd;
+	cmd.op = op;
+	cmd.ppm = 0;
+	cmd.humd = cmd.temp = 0.0f;
+	cmd.x = x;
+	cmd.y = y;
+	cmd.queued = *when;
+	queueLcd(&cmd);
+}
+
+void queueLcd(LcdCmd* cmd)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&lcd_lock);
+	
+	++lcd_stats.queued;
+	
+	// Readings (and redraws) that display thread didn't get to yet are replaced by newer ones
+	int i = lcd_queue_len;
+	if(cmd->op == LCMD_RDINGS || cmd->op == LCMD_REDRAW)
+	{
+		i = 0;
+		while(i < lcd_queue_len && lcd_queue[(lcd_queue_head + i) % LCMD_MAX].op != cmd->op)
+		{
+			++i;
+		}
+	}
+	// Only the newest finger position matters, but moves never jump over presses and releases
+	else if(cmd->op == LCMD_MOVE && lcd_queue_len && lcd_queue[(lcd_queue_head + lcd_queue_len - 1) % LCMD_MAX].op == LCMD_MOVE)
+	{
+		i = lcd_queue_len - 1;
+	}
+	
+	if(i < lcd_queue_len)
+	{
+		LcdCmd* old = lcd_queue + (lcd_queue_head + i) % LCMD_MAX;
+		cmd->queued = old->queued; // Latency counts from the oldest request
+		*old = *cmd;
+		++lcd_stats.coalesced;
+	}
+	else if(lcd_queue_len < LCMD_MAX)
+	{
+		lcd_queue[(lcd_queue_head + lcd_queue_len) % LCMD_MAX] = *cmd;
+		++lcd_queue_len;
+	}
+	else // Display thread is stuck, drop the command rather than stall the caller
+	{
+		if(cmd->op == LCMD_QUIT)
+		{
+			lcd_queue[(lcd_queue_head + LCMD_MAX - 1) % LCMD_MAX] = *cmd;
+		}
+		++lcd_stats.dropped;
+	}
+	pthread_cond_signal(&lcd_cond);
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
+}
+
+void* displayThread(void* param)
+{
+	// Signals are handled elsewhere, deinitLCD() must never run in the middle of a frame
+	sigset_t sigs;
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+	
+	while(1)
+	{
+		// Critical Section Beg
+		pthread_mutex_lock(&lcd_lock);
+		
+		lcd_busy = false;
+		if(!lcd_queue_len)
+		{
+			pthread_cond_broadcast(&lcd_idle_cond);
+		}
+		while(!lcd_queue_len)
+		{
+			pthread_cond_wait(&lcd_cond, &lcd_lock);
+		}
+		LcdCmd cmd = lcd_queue[lcd_queue_head];
+		lcd_queue_head = (lcd_queue_head + 1) % LCMD_MAX;
+		--lcd_queue_len;
+		lcd_busy = true;
+		
+		pthread_mutex_unlock(&lcd_lock);
+		// Critical Section End
+		
+		switch(cmd.op)
+		{
+		case LCMD_RDINGS:
+		case LCMD_REDRAW:
+		{
+			if(cmd.op == LCMD_RDINGS)
+			{
+				TRACE_SPAN("lcd_apply");
+				applyReadings(&cmd);
+			}
+			if(!scene.valid) // Nothing to show under X button yet
+			{
+				break;
+			}
+			
+			presentFrame();
+			
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			// Critical Section Beg
+			pthread_mutex_lock(&lcd_lock);
+			
+			lcd_stats.last_latency_us = (now.tv_sec - cmd.queued.tv_sec) * 1000000 +
+			(now.tv_nsec - cmd.queued.tv_nsec)/1000;
+			
+			pthread_mutex_unlock(&lcd_lock);
+			// Critical Section End
+			break;
+		}
+		case LCMD_ON:
+			panelOn();
+			break;
+		case LCMD_OFF:
+			panelOff();
+			break;
+		case LCMD_PRESS:
+		case LCMD_MOVE:
+		case LCMD_RELEASE:
+			handleTouch(&cmd);
+			break;
+		case LCMD_QUIT:
+		default:
+			return NULL;
+		}
+	}
+}
+
+void presentFrame()
+{
+	unsigned long long beg = traceBegin();
+	renderFrame();
+	traceEnd("lcd_render", beg);
+	swapBuffers();
+	drawScrBuffer();
+	if(backlight_deferred)
+	{
+		backlight_deferred = false;
+		digitalWrite(LED_PIN, lcd_is_on ? 1 : 0);
+	}
+}
+
+void panelOn()
+{
+	EXIT_SLEEP();
+	delay(120); // Must wait at least 120 ms until next ENTER_SLEEP command
+	digitalWrite(LED_PIN, 1);
+	backlight_deferred = false;
+}
+
+void panelOff()
+{
+	digitalWrite(LED_PIN, 0);
+	backlight_deferred = false;
+	ENTER_SLEEP();
+	delay(120); // Must wait at least 120 ms until next EXIT_SLEEP command
+}
+
+// Touch UI, runs on display thread so it never races with rendering or panel power changes.
+// Finger on X button highlights it, tap on it asks for poweroff, second tap confirms. Tap anywhere
+// else cancels pending poweroff or toggles the screen.
+void handleTouch(const LcdCmd* cmd)
+{
+	bool on_x = cmd->x >= 282 && cmd->y <= 37; // Top right corner, X-icon
+	bool redraw = false;
+	
+	if(cmd->op != LCMD_RELEASE)
+	{
+		if(lcd_is_on && on_x != x_button_shown)
+		{
+			x_button_shown = on_x;
+			redraw = true;
+		}
+	}
+	else if(lcd_is_on && on_x)
+	{
+		x_button_shown = false; // Stays drawn while poweroff is pending
+		if(poweroff_pending)
+		{
+			poweroff_pending = false;
+			allow_poweroff = true;
+			kill(getpid(), SIGINT); // Not raise(), display thread blocks all signals
+		}
+		else
+		{
+			poweroff_pending = true;
+			redraw = true;
+		}
+	}
+	else if(poweroff_pending)
+	{
+		poweroff_pending = false;
+		x_button_shown = false;
+		redraw = true;
+	}
+	else if(lcd_is_on)
+	{
+		lcd_is_on = false;
+		if(x_button_shown) // Panel keeps GRAM while asleep, highlight would be back on wake up
+		{
+			x_button_shown = false;
+			if(scene.valid)
+			{
+				presentFrame();
+			}
+		}
+		panelOff();
+	}
+	else
+	{
+		lcd_is_on = true;
+		panelOn();
+	}
+	
+	if(redraw && scene.valid)
+	{
+		presentFrame();
+	}
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	unsigned int us = (now.tv_sec - cmd->queued.tv_sec) * 1000000 + (now.tv_nsec - cmd->queued.tv_nsec)/1000;
 	// Critical Section Beg
-	pthread_mutex_lock(&warning_levels_lock);
-	
-	int co2wh = co2_warning;
-	int humdwl = humd_warning_low;
-	int humdwh = humd_warning_high;
-	int tempwl = temp_warning_low;
-	int tempwh = temp_warning_high;
-	
-	pthread_mutex_unlock(&warning_levels_lock);
-	// Critical Section End	
-	readings_are_updating = true;
-	memcpy((void*)frame_buffer, (const void*)(bg_main+4), lcd_size); // 4 first Bs are Width/Height
-	
-	unsigned char** co2_num = big_num_w;
-	unsigned char** humd_num = med_num_w;
-	unsigned char** sml_humd_num = sml_num_w;
-	unsigned char** temp_num = med_num_w;
-	unsigned char** sml_temp_num = sml_num_w;
-	unsigned char* temp_minus = minus_w;
-	unsigned char* temp_dot = dot_w;
+	pthread_mutex_lock(&lcd_lock);
+	
+	if(cmd->op == LCMD_PRESS)
+	{
+		lcd_stats.last_press_us = us;
+	}
+	else if(cmd->op == LCMD_RELEASE)
+	{
+		lcd_stats.last_tap_us = us;
+	}
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
+}
+
+// Advances warning blinks and remembers what scene should look like
+void applyReadings(const LcdCmd* cmd)
+{
+	Settings set;
+	getSettings(&set);
+	int co2wh = set.co2_warning;
+	int humdwl = set.humd_warning_low;
+	int humdwh = set.humd_warning_high;
+	int tempwl = set.temp_warning_low;
+	int tempwh = set.temp_warning_high;
+	
+	int ppm = cmd->ppm;
+	float humd = cmd->humd;
+	float temp = cmd->temp;
 	
 	static int co2_blinks = CO2_BLINKS; // 12 seconds
 	static int humd_blinks = HT_BLINKS; // 6 seconds
@@ -301,14 +800,14 @@ void updateReadings(int ppm, float humd, float temp)
 	
 	static bool co2_sound_warned;
 	
+	scene.co2_bg = scene.humd_bg = scene.temp_bg = NULL;
+	
 	// Check reading exceeding max safe levels
 	if(ppm > co2wh)
 	{
 		if(co2_blinks <= 0 || co2_blinks%2 == 0)
 		{
-			multiplex24(bg_co2, 0, 0);
-			co2_num = big_num_b;
-			box_should_be_red = true;
+			scene.co2_bg = bg_co2;
 		}
 		if(co2_blinks > 0)
 		{
@@ -318,7 +817,6 @@ void updateReadings(int ppm, float humd, float temp)
 	else
 	{
 		co2_blinks = CO2_BLINKS;
-		box_should_be_red = false;
 		co2_sound_warned = false;
 	}
 	
@@ -326,9 +824,7 @@ void updateReadings(int ppm, float humd, float temp)
 	{
 		if(humd_blinks <= 0 || humd_blinks%2 == 0)
 		{
-			multiplex24(bg_humd_high, 0, 122);
-			humd_num = med_num_b;
-			sml_humd_num = sml_num_b;
+			scene.humd_bg = bg_humd_high;
 		}
 		if(humd_blinks > 0)
 		{
@@ -339,9 +835,7 @@ void updateReadings(int ppm, float humd, float temp)
 	{
 		if(humd_blinks <= 0 || humd_blinks%2 == 0)
 		{
-			multiplex24(bg_humd_low, 0, 122);
-			humd_num = med_num_b;
-			sml_humd_num = sml_num_b;
+			scene.humd_bg = bg_humd_low;
 		}
 		if(humd_blinks > 0)
 		{
@@ -357,11 +851,7 @@ void updateReadings(int ppm, float humd, float temp)
 	{
 		if(temp_blinks <= 0 || temp_blinks%2 == 0)
 		{
-			multiplex24(bg_temp_high, 162, 122);
-			temp_num = med_num_b;
-			sml_temp_num = sml_num_b;
-			temp_minus = minus_b;
-			temp_dot = dot_b;
+			scene.temp_bg = bg_temp_high;
 		}
 		if(temp_blinks > 0)
 		{
@@ -372,11 +862,7 @@ void updateReadings(int ppm, float humd, float temp)
 	{
 		if(temp_blinks <= 0 || temp_blinks%2 == 0)
 		{
-			multiplex24(bg_temp_low, 162, 122);
-			temp_num = med_num_b;
-			sml_temp_num = sml_num_b;
-			temp_minus = minus_b;
-			temp_dot = dot_b;
+			scene.temp_bg = bg_temp_low;
 		}
 		if(temp_blinks > 0)
 		{
@@ -388,6 +874,75 @@ void updateReadings(int ppm, float humd, float temp)
 		temp_blinks = HT_BLINKS;
 	}
 	
+	lcd_blinking = ppm > co2wh && co2_blinks > 0 ||
+	((int)humd > humdwh || (int)humd < humdwl) && humd_blinks > 0 ||
+	(temp > (float)tempwh || temp < (float)tempwl) && temp_blinks > 0;
+	
+	scene.ppm = ppm;
+	scene.humd = humd;
+	scene.temp = temp;
+	scene.valid = true;
+	addSparks(ppm, humd, temp);
+	
+	if(set.co2_warning_song != SNG_NONE && !co2_sound_warned && co2_blinks <= 0)
+	{
+		buzzPlay(set.co2_warning_song, BUZZ_PRIO_ALARM);
+		co2_sound_warned = true;
+	}
+}
+
+// Composes whole scene into back buffer
+void renderFrame()
+{
+	struct timespec rbeg, rend;
+	clock_gettime(CLOCK_MONOTONIC, &rbeg);
+	blitOpaque<LcdPixel, LcdPanel>(frame_buffer, bg_main, 0, 0);
+	
+	const unsigned char** co2_num = big_num_w;
+	const unsigned char** humd_num = med_num_w;
+	const unsigned char** sml_humd_num = sml_num_w;
+	const unsigned char** temp_num = med_num_w;
+	const unsigned char** sml_temp_num = sml_num_w;
+	const unsigned char* temp_minus = minus_w;
+	const unsigned char* temp_dot = dot_w;
+	
+	if(scene.co2_bg != NULL)
+	{
+		multiplex24(scene.co2_bg, 0, 0);
+		co2_num = big_num_b;
+	}
+	if(scene.humd_bg != NULL)
+	{
+		multiplex24(scene.humd_bg, 0, 122);
+		humd_num = med_num_b;
+		sml_humd_num = sml_num_b;
+	}
+	if(scene.temp_bg != NULL)
+	{
+		multiplex24(scene.temp_bg, 162, 122);
+		temp_num = med_num_b;
+		sml_temp_num = sml_num_b;
+		temp_minus = minus_b;
+		temp_dot = dot_b;
+	}
+	
+	// Same colour as digits of the box
+	struct timespec sbeg, send;
+	clock_gettime(CLOCK_MONOTONIC, &sbeg);
+	co2_spark->SetColor(co2_num[0][4], co2_num[0][5]);
+	humd_spark->SetColor(humd_num[0][4], humd_num[0][5]);
+	temp_spark->SetColor(temp_num[0][4], temp_num[0][5]);
+	multiplex32(co2_spark->GetImage(), SPARK_CO2_X, SPARK_CO2_Y);
+	multiplex32(humd_spark->GetImage(), SPARK_HUMD_X, SPARK_HT_Y);
+	multiplex32(temp_spark->GetImage(), SPARK_TEMP_X, SPARK_HT_Y);
+	clock_gettime(CLOCK_MONOTONIC, &send);
+	unsigned int spark_us = spark_add_us + (send.tv_sec - sbeg.tv_sec) * 1000000 + (send.tv_nsec - sbeg.tv_nsec)/1000;
+	spark_add_us = 0; // Redraws without new readings only blend
+	
+	int ppm = scene.ppm;
+	float humd = scene.humd;
+	float temp = scene.temp;
+	
 	if(ppm < 0)
 	{
 		ppm = 0;
@@ -409,50 +964,91 @@ void updateReadings(int ppm, float humd, float temp)
 		humd = 0.0f;
 	}
 	
-	multiplexInt(ppm, (const unsigned char**)co2_num, FONT_BIG, 195, 99);
-	multiplexInt((int)humd, (const unsigned char**)humd_num, humd_f_size, humd_x, 214);
+	multiplexInt(ppm, co2_num, FONT_BIG, 195, 99);
+	multiplexInt((int)humd, humd_num, humd_f_size, humd_x, 214);
 	
-	multiplexTempFloat(temp, (const unsigned char**)temp_num,
-	(const unsigned char**)sml_temp_num, temp_dot, temp_minus, 285, 214);
+	multiplexTempFloat(temp, temp_num, sml_temp_num, temp_dot, temp_minus, 285, 214);
 	
-	if(poweroff_pending)
+	if(poweroff_pending || x_button_shown)
 	{
 		multiplex32(x_button, 282, 0);
 	}
 	
-	drawScrBuffer();
+	clock_gettime(CLOCK_MONOTONIC, &rend);
+	// Critical Section Beg
+	pthread_mutex_lock(&lcd_lock);
 	
-	if(co2_warning_song != SNG_NONE && !co2_sound_warned && co2_blinks <= 0)
+	lcd_stats.last_render_us = (rend.tv_sec - rbeg.tv_sec) * 1000000 + (rend.tv_nsec - rbeg.tv_nsec)/1000;
+	lcd_stats.last_spark_us = spark_us;
+	lcd_stats.spark_scrolls = co2_spark->GetScrolls();
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
+}
+
+// Newest sparkline columns follow readings, plots scroll when a column time slot is over
+void addSparks(int ppm, float humd, float temp)
+{
+	struct timespec beg, end;
+	clock_gettime(CLOCK_MONOTONIC, &beg);
+	
+	if(!sparks_filled)
 	{
-		// Critical Section Beg
-		pthread_mutex_lock(&co2_warning_song_lock);
-		
-		buzzPlay(co2_warning_song);
-		
-		pthread_mutex_unlock(&co2_warning_song_lock);
-		// Critical Section End
-		co2_sound_warned = true;
+		fillSparks();
+		sparks_filled = true;
 	}
 	
-	readings_are_updating = false;
+	unsigned int now = (unsigned int)time(NULL);
+	co2_spark->Add((float)ppm, now);
+	humd_spark->Add(humd, now);
+	temp_spark->Add(temp, now);
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	spark_add_us = (end.tv_sec - beg.tv_sec) * 1000000 + (end.tv_nsec - beg.tv_nsec)/1000;
 }
 
-void onLCD()
+// Plots history that logger already has, oldest first. Done on first readings, not in initLCD(),
+// because logger is loaded by web server thread.
+void fillSparks()
 {
-	lcd_is_on = true;
-	EXIT_SLEEP();
-	delay(120); // Must wait at least 120 ms until next ENTER_SLEEP command
-	digitalWrite(LED_PIN, 1);
+	unsigned int now = (unsigned int)time(NULL);
+	unsigned int span = SPARK_CO2_W * SPARK_COL_S;
+	
+	int n = 0;
+	while(n < LOG_SIZE)
+	{
+		Reading r = getReading(n);
+		if(r.dt == 0 || r.dt > now || r.dt + span < now)
+		{
+			break;
+		}
+		++n;
+	}
+	
+	while(n--)
+	{
+		Reading r = getReading(n);
+		co2_spark->Add((float)(r.rd >> 19), r.dt);
+		humd_spark->Add((float)((r.rd & 0x7F000) >> 12), r.dt);
+		temp_spark->Add((float)(signed char)((r.rd & 0xFF0) >> 4) + (float)(r.rd & 0xF)/10.0f, r.dt);
+	}
 }
 
-void offLCD()
+// Finished back buffer becomes front, old front is reused for the next frame. Front is only
+// replaced under the lock, so other threads can take a consistent snapshot of it.
+void swapBuffers()
 {
-	lcd_is_on = false;
-	digitalWrite(LED_PIN, 0);
-	ENTER_SLEEP();
+	// Critical Section Beg
+	pthread_mutex_lock(&lcd_lock);
+	
+	unsigned char* tmp = front_buffer;
+	front_buffer = frame_buffer;
+	frame_buffer = tmp;
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
 }
 
-// Internal functions
 int spiOpenPort(int spi_device)
 {
     int *spi_fs;
@@ -476,6 +1072,9 @@ int spiOpenPort(int spi_device)
 
 	jmp_retry:
 
+#ifdef LCD_HEADLESS
+	*spi_fs = simOpenSpi(spi_device); // Panel and touch controller in memory, see LcdSim.h
+#else
     if (spi_device)
 	{
     	*spi_fs = open("/dev/spidev0.1", O_RDWR);
@@ -484,6 +1083,7 @@ int spiOpenPort(int spi_device)
 	{
     	*spi_fs = open("/dev/spidev0.0", O_RDWR);
 	}
+#endif
 
     if (*spi_fs < 0)
     {
@@ -497,12 +1097,12 @@ int spiOpenPort(int spi_device)
     }
 	
 	int res = 0;
-    res += ioctl(*spi_fs, SPI_IOC_WR_MODE, &spi_mode);
-    res += ioctl(*spi_fs, SPI_IOC_RD_MODE, &spi_mode);
-    res += ioctl(*spi_fs, SPI_IOC_WR_BITS_PER_WORD, &spi_bits_per_word);
-    res += ioctl(*spi_fs, SPI_IOC_RD_BITS_PER_WORD, &spi_bits_per_word);
-    res += ioctl(*spi_fs, SPI_IOC_WR_MAX_SPEED_HZ, &max_spd);
-    res += ioctl(*spi_fs, SPI_IOC_RD_MAX_SPEED_HZ, &max_spd);
+    res += spi_ioctl(*spi_fs, SPI_IOC_WR_MODE, &spi_mode);
+    res += spi_ioctl(*spi_fs, SPI_IOC_RD_MODE, &spi_mode);
+    res += spi_ioctl(*spi_fs, SPI_IOC_WR_BITS_PER_WORD, &spi_bits_per_word);
+    res += spi_ioctl(*spi_fs, SPI_IOC_RD_BITS_PER_WORD, &spi_bits_per_word);
+    res += spi_ioctl(*spi_fs, SPI_IOC_WR_MAX_SPEED_HZ, &max_spd);
+    res += spi_ioctl(*spi_fs, SPI_IOC_RD_MAX_SPEED_HZ, &max_spd);
 	
 	if(res < 0)
 	{
@@ -520,7 +1120,7 @@ int spiCommand(unsigned char cmd)
 	spi0.len = 1;
 	spi0.tx_buf = (unsigned long)&cmd;
 	spi0.rx_buf = 0;		
-	return ioctl(spi0_fs, SPI_IOC_MESSAGE(1), &spi0);
+	return spi_ioctl(spi0_fs, SPI_IOC_MESSAGE(1), &spi0);
 }
 
 int spiData(const unsigned char* dat, int s)
@@ -530,22 +1130,156 @@ int spiData(const unsigned char* dat, int s)
 	spi0.len = s;
 	spi0.tx_buf = (unsigned long)dat;
 	spi0.rx_buf = 0;		
-	return ioctl(spi0_fs, SPI_IOC_MESSAGE(1), &spi0);
+	return spi_ioctl(spi0_fs, SPI_IOC_MESSAGE(1), &spi0);
 }
 
+// Sends only regions of front buffer that differ from panel content
 void drawScrBuffer()
 {
+	struct timespec beg, end;
+	clock_gettime(CLOCK_MONOTONIC, &beg);
+	
+	Rect rects[MAX_RECTS];
+	int n = findDamage(rects);
+	int bytes = 0;
+	spi0_calls = 0;
+	
+	if(n < 0) // Too much damage or unknown panel content, whole frame is cheaper
+	{
+		rects[0].x = rects[0].y = 0;
+		rects[0].w = SCR_WIDTH;
+		rects[0].h = SCR_HEIGHT;
+		n = 1;
+	}
+	
+	for(int i = 0; i < n; ++i)
+	{
+		pushRect(rects + i);
+		bytes += rects[i].w * rects[i].h * LcdPixel::BPP;
+	}
+	if(n)
+	{
+		spiCommand(0x00 /*NOP - No Operation*/);
+	}
+	scr_shadow_valid = true;
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&lcd_lock);
+	
+	++lcd_stats.frames;
+	lcd_stats.spi_bytes += bytes;
+	lcd_stats.saved_bytes += lcd_size - bytes;
+	lcd_stats.last_bytes = bytes;
+	lcd_stats.last_rects = n;
+	lcd_stats.last_spi_calls = spi0_calls;
+	lcd_stats.last_push_us = (end.tv_sec - beg.tv_sec) * 1000000 + (end.tv_nsec - beg.tv_nsec)/1000;
+	
+	pthread_mutex_unlock(&lcd_lock);
+	// Critical Section End
+	unsigned long long beg_ns = (unsigned long long)beg.tv_sec * 1000000000ULL + beg.tv_nsec;
+	unsigned long long end_ns = (unsigned long long)end.tv_sec * 1000000000ULL + end.tv_nsec;
+	metObserve(MH_LCD_PUSH, end_ns - beg_ns);
+	traceAdd("lcd_push", beg_ns, end_ns);
+	warmMark(WARM_FIRST_FRAME);
+	DBPRINT("LCD frame: %d of %d B in %d rects, render %u us, push %u us\n", bytes, lcd_size, n,
+	lcd_stats.last_render_us, lcd_stats.last_push_us);
+}
+
+// Returns number of dirty rectangles or -1 if full frame must be sent
+int findDamage(Rect* rects)
+{
+	if(!scr_shadow_valid)
+	{
+		return -1;
+	}
+	
+	int n = 0, dirty_tiles = 0;
+	
+	for(int ty = 0; ty < TILES_Y; ++ty)
+	{
+		int run_beg = -1;
+		for(int tx = 0; tx <= TILES_X; ++tx) // One step past the last tile to close the last run
+		{
+			bool dirty = tx < TILES_X &&
+				tileDirty<LcdPixel, LcdPanel>(front_buffer, scr_shadow, tx * TILE_W, ty * TILE_H, TILE_W, TILE_H);
+			
+			if(dirty)
+			{
+				++dirty_tiles;
+				run_beg = run_beg < 0 ? tx : run_beg;
+				continue;
+			}
+			if(run_beg < 0)
+			{
+				continue;
+			}
+			
+			// Run of dirty tiles ended, extend rectangle right above it if it spans the same columns
+			Rect run = { run_beg * TILE_W, ty * TILE_H, (tx - run_beg) * TILE_W, TILE_H };
+			run_beg = -1;
+			
+			int i = 0;
+			while(i < n && !(rects[i].x == run.x && rects[i].w == run.w && rects[i].y + rects[i].h == run.y))
+			{
+				++i;
+			}
+			
+			if(i < n)
+			{
+				rects[i].h += TILE_H;
+			}
+			else if(n < MAX_RECTS)
+			{
+				rects[n++] = run;
+			}
+			else
+			{
+				return -1;
+			}
+		}
+	}
+	
+	// Every window costs 3 extra commands, with this much damage one full frame is about as fast
+	if(dirty_tiles * 4 > TILES_X * TILES_Y * 3)
+	{
+		return -1;
+	}
+	return n;
+}
+
+void pushRect(const Rect* r)
+{
+	TRACE_SPAN("spi_rect");
+	// Gather rectangle rows into one contiguous block and remember them as panel content
+	gatherRect<LcdPixel, LcdPanel>(rect_buffer, scr_shadow, front_buffer, r->x, r->y, r->w, r->h);
+	
+	setWindow(r->x, r->y, r->w, r->h);
 	spiCommand(0x2C /*Memory Write*/);
-	spi0.cs_change = 1;
-	spi0.len = BURST_BS;
-	spi0.rx_buf = 0;
+	spiBurst(rect_buffer, r->w * r->h * LcdPixel::BPP);
+}
+
+void setWindow(int x, int y, int w, int h)
+{
+	x += LcdPanel::X_OFS;
+	y += LcdPanel::Y_OFS;
+	int x1 = x + w - 1;
+	int y1 = y + h - 1;
+	COMMAND(0x2A, /*Column Address Set*/ B(x >> 8), B(x), B(x1 >> 8), B(x1));
+	COMMAND(0x2B, /*Page Address Set*/ B(y >> 8), B(y), B(y1 >> 8), B(y1));
+}
+
+void spiBurst(const unsigned char* dat, int s)
+{
 	digitalWrite(DC_PIN, 1); // Switch to data mode
-	for(int i = 0; i < lcd_size; i+=BURST_BS)
+	int calls = spiWriteBatched(spi0_fs, &spi0, dat, s, spi0_xfer_bs, spi0_msg_bs);
+	if(calls < 0)
 	{
-		spi0.tx_buf = (unsigned long)&frame_buffer[i];		
-		ioctl(spi0_fs, SPI_IOC_MESSAGE(1), &spi0);
+		logError("ILI9341: SPI0 pixel data write failed", errno);
+		return;
 	}
-	spiCommand(0x00 /*NOP - No Operation*/);
+	spi0_calls += calls;
 }
 
 void hardwareReset()
@@ -558,401 +1292,295 @@ void hardwareReset()
 	delay(120);
 }
 
-// Screen was pressed WARNING: this runs in WiringPi ISR, thread sefety must be enforced!
-// BUT! Considering that this ISR will be invoked only very rarely, I replaced costly hardware locks with
-// simple custom software boolean locks and just blocked LCD updates while screen is pressed.
-void onTouchInput()
+// Screen was pressed WARNING: this runs in WiringPi ISR thread! It only wakes touch thread up.
+void onTouchIrq()
 {
-//  Response:
-//  0111 1111  1111 1000 => Only 12 bits are data, skip 1 most sig. bit and 3 least sig. bits
-
-	if(digitalRead(TOUCH_IRQ_PIN))
+	if(!touch_running)
 	{
 		return;
 	}
-	while(readings_are_updating)
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	// Critical Section Beg
+	pthread_mutex_lock(&touch_lock);
+	
+	if(!touch_irq)
 	{
-		delay(10);
+		touch_irq = true;
+		touch_irq_time = now;
 	}
-	update_allowed = false; // Block any LCD updates while touch screen input is processed
+	pthread_cond_signal(&touch_cond);
 	
-	unsigned char rtx[3] = {0};
-	int x = 0, y = 0;
-#ifdef CALC_TOUCH_PRESSURE
-	int x_raw = 0, z1 = 0, z2 = 0;;
-	float prs = 0.0f; // Pressure
-#endif
-	spi1.tx_buf = (unsigned long)rtx;
-	spi1.rx_buf = (unsigned long)rtx;
-	
-	bool x_button_drawn = false;
+	pthread_mutex_unlock(&touch_lock);
+	// Critical Section End
+}
+
+// Turns pen IRQs into debounced press, move and release events for display thread. Never draws
+// or blocks readings, screen keeps updating for as long as the finger is down.
+void* touchThread(void* param)
+{
+	sigset_t sigs;
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
 	
-	while(!digitalRead(TOUCH_IRQ_PIN))
+	while(1)
 	{
-		rtx[1] = rtx[2] = 0;
-		rtx[0] = TOUCH_X;
-		ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
-#ifdef CALC_TOUCH_PRESSURE
-		x_raw = EXTRACT_TOUCH_DATA();
-		y = (x_raw - touch_x_offset)/touch_x_factor; // Touch Scr. X = Screen Y
-#else
-		y = (EXTRACT_TOUCH_DATA() - touch_x_offset)/touch_x_factor;
-#endif
-		
-		rtx[1] = rtx[2] = 0;
-		rtx[0] = TOUCH_Y;
-		ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
-		x = (EXTRACT_TOUCH_DATA() - touch_y_offset)/touch_y_factor;  // Touch Scr. Y = Screen X
-		
-#ifdef CALC_TOUCH_PRESSURE
-		rtx[1] = rtx[2] = 0;
-		rtx[0] = TOUCH_Z1;
-		ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
-		z1 = EXTRACT_TOUCH_DATA();
+		// Critical Section Beg
+		pthread_mutex_lock(&touch_lock);
 		
-		rtx[1] = rtx[2] = 0;
-		rtx[0] = TOUCH_Z2;
-		ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
-		z2 = EXTRACT_TOUCH_DATA();
+		while(!touch_irq && !touch_quit)
+		{
+			pthread_cond_wait(&touch_cond, &touch_lock);
+		}
+		struct timespec down = touch_irq_time;
+		touch_irq = false;
 		
-		prs = 1000.0f * (float)x_raw/4096.0f * ((float)z2/z1 - 1.0f);
-#endif		
+		pthread_mutex_unlock(&touch_lock);
+		// Critical Section End
 		
-		if(lcd_is_on && x >= 282 && y <= 37 && !x_button_drawn)
+		if(touch_quit)
 		{
-			x_button_drawn = true;
-			multiplex32(x_button, 282, 0);
-			drawScrBuffer();
+			return NULL;
 		}
-		else if(lcd_is_on && x < 282 && y > 37 && x_button_drawn)
+		
+		// Finger must stay down for several samples, single spikes on IRQ line are not touches
+		int x = 0, y = 0, n = 0;
+		while(n < TOUCH_DEBOUNCE && readTouch(&x, &y))
 		{
-			x_button_drawn = false;
-			eraseX();
+			++n;
+			delay(TOUCH_POLL_MS);
 		}
 		
-		delay(100); // 10 Hz touch screen sampling rate
-	}
-	
-	if(lcd_is_on && x >= 282 && y <= 37) // Top right corner, X-icon
-	{
-		if(poweroff_pending)
+		// Critical Section Beg
+		pthread_mutex_lock(&lcd_lock);
+		
+		if(n < TOUCH_DEBOUNCE)
 		{
-			poweroff_pending = false;
-			allow_poweroff = true;
-			raise(SIGINT);
+			++lcd_stats.bounces;
 		}
 		else
 		{
-			poweroff_pending = true;
-			multiplex32(x_button, 282, 0);
-			drawScrBuffer();
-		}
-	}
-	else
-	{
-		if(poweroff_pending)
-		{
-			poweroff_pending = false;
-			eraseX();
-			update_allowed = true;
-			delay(120);
-			return;
+			++lcd_stats.touches;
 		}
 		
-		if(lcd_is_on)
+		pthread_mutex_unlock(&lcd_lock);
+		// Critical Section End
+		
+		if(n < TOUCH_DEBOUNCE)
 		{
-			lcd_is_on = false;
-			digitalWrite(LED_PIN, 0);
-			eraseX();
-			ENTER_SLEEP();
-			delay(120); // Must wait at least 120 ms until next EXIT_SLEEP command
+			continue;
 		}
-		else
+		postTouch(LCMD_PRESS, x, y, &down);
+		
+		// Same for release, contact is often lost for a sample or two while finger slides
+		int last_x = x, last_y = y;
+		struct timespec up = down;
+		n = 0;
+		while(n < TOUCH_DEBOUNCE && !touch_quit)
 		{
-			lcd_is_on = true;
-			EXIT_SLEEP();
-			delay(120); // Must wait at least 120 ms until next ENTER_SLEEP command
-			digitalWrite(LED_PIN, 1);
+			delay(TOUCH_POLL_MS);
+			
+			int sx, sy;
+			if(!readTouch(&sx, &sy))
+			{
+				if(!n++)
+				{
+					clock_gettime(CLOCK_MONOTONIC, &up);
+				}
+				continue;
+			}
+			n = 0;
+			x = sx;
+			y = sy;
+			
+			if(abs(x - last_x) + abs(y - last_y) >= TOUCH_MOVE_PX)
+			{
+				clock_gettime(CLOCK_MONOTONIC, &up);
+				postTouch(LCMD_MOVE, x, y, &up);
+				last_x = x;
+				last_y = y;
+			}
 		}
+		postTouch(LCMD_RELEASE, x, y, &up); // Tap latency counts from the moment finger went up
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&touch_lock);
+		
+		touch_irq = false; // Edges while finger was down belong to this touch
+		
+		pthread_mutex_unlock(&touch_lock);
+		// Critical Section End
 	}
-	
-	delay(80); // Wait some time to not mess up 2 LCD redraw commands together
-	update_allowed = true;
 }
 
-unsigned char* loadPGM(const char* path, int dye, bool alpha)
+// One XPT2046 sample in screen coordinates, false if finger is not on the screen
+bool readTouch(int* x, int* y)
 {
-	FILE* img = fopen(path, "rb");
-	
-	char wa[4] = {0}, ha[4] = {0}; // Max width/height -> 9999
-	fseek(img, 3, SEEK_SET);
-	char c;
-	for(int i = 0; i < 5; ++i) // i < 5 not 4, to catch 0x20 for w with 4 digits
+//  Response:
+//  0111 1111  1111 1000 => Only 12 bits are data, skip 1 most sig. bit and 3 least sig. bits
+
+	if(digitalRead(TOUCH_IRQ_PIN))
 	{
-		fread((void*)&c, 1, 1, img);
-		if(c == 0x20)
-		{
-			int* tmp = (int*)wa;
-			*tmp <<= (4 - i) * 8; // This will effectively shift all arr. elements to its end
-			break;
-		}
-		wa[i] = B(c & 0x0F); // For example: 0x37 -> 0x07 aka char to number
-	}
-	for(int i = 0; i < 5; ++i)
-	{
-		fread((void*)&c, 1, 1, img);
-		if(c == 0x0A)
-		{
-			int* tmp = (int*)ha;
-			*tmp <<= (4 - i) * 8; // Direction of shift must be reversed cos memory holds/reads ints in little endian...
-			break;                // ...while char array holds decimal numbers in big endian mode!
-		}
-		ha[i] = B(c & 0x0F);
+		return false;
 	}
 	
-	int w = wa[0] * 1000 + wa[1] * 100 + wa[2] * 10 + wa[3];
-	int h = ha[0] * 1000 + ha[1] * 100 + ha[2] * 10 + ha[3];
+	unsigned char rtx[3] = {0};
+#ifdef CALC_TOUCH_PRESSURE
+	int x_raw = 0, z1 = 0, z2 = 0;;
+	float prs = 0.0f; // Pressure
+#endif
+	spi1.tx_buf = (unsigned long)rtx;
+	spi1.rx_buf = (unsigned long)rtx;
 	
-	c = 0;
-	while(c != 0x0A)
-	{
-		fread((void*)&c, 1, 1, img);
-	}
+	rtx[0] = TOUCH_X;
+	spi_ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
+#ifdef CALC_TOUCH_PRESSURE
+	x_raw = EXTRACT_TOUCH_DATA();
+	*y = (x_raw - touch_x_offset)/touch_x_factor; // Touch Scr. X = Screen Y
+#else
+	*y = (EXTRACT_TOUCH_DATA() - touch_x_offset)/touch_x_factor;
+#endif
 	
-	const int mp = alpha ? 3 : 2; // Multiplier
-	// Screen memory accepts pixels in 2 B form -> 5 red 6 green 5 blue bits
-	int size = w * h * mp + 4; // First 4 Bs reserved for width/height, so increse size by 4
+	rtx[1] = rtx[2] = 0;
+	rtx[0] = TOUCH_Y;
+	spi_ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
+	*x = (EXTRACT_TOUCH_DATA() - touch_y_offset)/touch_y_factor;  // Touch Scr. Y = Screen X
 	
-	unsigned char* dst_img = (unsigned char*)malloc(size);
-	unsigned short* wp = (unsigned short*)dst_img;
-	unsigned short* hp = (unsigned short*)(dst_img+2);
-	*wp = (unsigned short)w;
-	*hp = (unsigned short)h;
-
-	unsigned char gp; // Grey Pixel
-	for(int i = 4; i < size; i+=mp) // Data starts from 5th element
-	{
-		fread((void*)&gp, 1, 1, img);
-		switch(dye)
-		{
-		case BLACK_DYE:
-			if(!alpha)
-			{
-				unsigned char inverse = B(0xFF - gp);
-				dst_img[i] = B(B(inverse & 0xF8) | B(inverse >> 5));
-				dst_img[i+1] = B(B(B(inverse & 0xFC) << 3) | B(inverse >> 3));
-			}
-			else
-			{
-				dst_img[i] = 0x00;
-				dst_img[i+1] = 0x00;
-				dst_img[i+2] = gp;
-			}
-			break;
-		case RED_DYE:
-			if(!alpha)
-			{
-				dst_img[i] = 0x00;
-				dst_img[i+1] = B(gp >> 3);
-			}
-			else
-			{
-				dst_img[i] = 0x00;
-				dst_img[i+1] = 0x1F;
-				dst_img[i+2] = gp;
-			}
-			break;
-		case BLUE_DYE:
-			if(!alpha)
-			{
-				dst_img[i] = B(gp & 0xF8);
-				dst_img[i+1] = 0x00;
-			}
-			else
-			{
-				dst_img[i] = 0xF1;
-				dst_img[i+1] = 0x00;
-				dst_img[i+2] = gp;
-			}
-			break;
-		case WHITE_DYE:
-		case NO_DYE:
-		default:
-			if(!alpha)
-			{
-				dst_img[i] = B(B(gp & 0xF8) | B(gp >> 5));
-				dst_img[i+1] = B(B(B(gp & 0xFC) << 3) | B(gp >> 3));
-			}
-			else
-			{
-				dst_img[i] = 0xFF;
-				dst_img[i+1] = 0xFF;
-				dst_img[i+2] = gp;
-			}
-			break;
-		}
-	}
+#ifdef CALC_TOUCH_PRESSURE
+	rtx[1] = rtx[2] = 0;
+	rtx[0] = TOUCH_Z1;
+	spi_ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
+	z1 = EXTRACT_TOUCH_DATA();
 	
-	fclose(img);
-	return dst_img;
+	rtx[1] = rtx[2] = 0;
+	rtx[0] = TOUCH_Z2;
+	spi_ioctl(spi1_fs, SPI_IOC_MESSAGE(1), &spi1);
+	z2 = EXTRACT_TOUCH_DATA();
+	
+	prs = 1000.0f * (float)x_raw/4096.0f * ((float)z2/z1 - 1.0f);
+#endif
+	
+	return !digitalRead(TOUCH_IRQ_PIN); // Finger could be lifted in the middle of conversion
 }
 
-unsigned char* loadPAM(const char* path)
+// Replaces pixels of screen buffer at position x/y with img pixels
+void multiplex24(const unsigned char* img, int x, int y)
 {
-	FILE* img = fopen(path, "rb");
-	
-	char wa[4] = {0}, ha[4] = {0};
-	fseek(img, 0x09, SEEK_SET);
-	char c;
-	for(int i = 0; i < 5; ++i)
+	blitOpaque<LcdPixel, LcdPanel>(frame_buffer, img, x, y);
+}
+
+void multiplex32(const unsigned char* img, int x, int y)
+{
+	blitAlpha<LcdPixel, LcdPanel>(frame_buffer, img, x, y);
+}
+
+// Digits are mostly placed on uniform background (black, or dyed warning box), there their composition
+// only depends on glyph and background colour. Minus sign can cross the box border, so it is checked.
+void multiplexGlyph(const unsigned char* img, int x, int y)
+{
+	if(x < 0 || y < 0 || x >= SCR_WIDTH || y >= SCR_HEIGHT)
 	{
-		fread((void*)&c, 1, 1, img);
-		if(c == 0x0A)
-		{
-			int* tmp = (int*)wa;
-			*tmp <<= (4 - i) * 8;
-			break;
-		}
-		wa[i] = B(c & 0x0F);
+		return;
 	}
-	fseek(img, 0x13, SEEK_SET);
-	for(int i = 0; i < 5; ++i)
+	
+	const unsigned char* bg_px = frame_buffer + (x + y*SCR_WIDTH) * LcdPixel::BPP;
+	const unsigned char* cached = NULL;
+	if(uniformBg(bg_px, spriteW(img), spriteH(img), x, y))
 	{
-		fread((void*)&c, 1, 1, img);
-		if(c == 0x0A)
-		{
-			int* tmp = (int*)ha;
-			*tmp <<= (4 - i) * 8;
-			break;
-		}
-		ha[i] = B(c & 0x0F);
+		cached = cachedGlyph(img, bg_px);
 	}
 	
-	int w = wa[0] * 1000 + wa[1] * 100 + wa[2] * 10 + wa[3];
-	int h = ha[0] * 1000 + ha[1] * 100 + ha[2] * 10 + ha[3];
-	
-	c = 0;
-	int lf_count = 0;
-	while(lf_count < 4)
+	if(cached != NULL)
 	{
-		fread((void*)&c, 1, 1, img);
-		lf_count += c == 0x0A ? 1 : 0;
+		blitNative<LcdPixel, LcdPanel>(frame_buffer, cached, x, y);
 	}
-	
-	int size = w * h * 3 + 4;
-	
-	unsigned char* dst_img = (unsigned char*)malloc(size);
-	unsigned short* wp = (unsigned short*)dst_img;
-	unsigned short* hp = (unsigned short*)(dst_img+2);
-	*wp = (unsigned short)w;
-	*hp = (unsigned short)h;
-	
-	unsigned char pix[4];
-	for(int i = 4; i < size; i+=3)
+	else // Mixed background or cache is full
 	{
-		fread((void*)pix, 1, 4, img);
-		dst_img[i] = B(B(pix[2] & 0xF8) | B(pix[1] >> 5));
-		dst_img[i+1] = B(B(B(pix[1] & 0xFC) << 3) | B(pix[0] >> 3));
-		dst_img[i+2] = pix[3]; // Alpha Channel
+		multiplex32(img, x, y);
 	}
-	
-	fclose(img);	
-	return dst_img;
 }
 
-unsigned char* createBox(const unsigned char* orig_img)
+// Every frame buffer pixel of w x h box at x/y (clipped to screen) has the colour of its corner bg_px
+bool uniformBg(const unsigned char* bg_px, int w, int h, int x, int y)
 {
-	int w = *(unsigned short*)orig_img;
-	int h = *(unsigned short*)(orig_img+2);
-	int s = w * h * 2 + 4;
-	unsigned char* black_box = (unsigned char*)malloc(s);
-	memset((void*)black_box, 0, s);
-	unsigned short* wp = (unsigned short*)black_box;
-	unsigned short* hp = (unsigned short*)(black_box+2);
-	*wp = (unsigned short)w;
-	*hp = (unsigned short)h;
-	
-	if(box_should_be_red)
-	{
-		for(int i = 5; i < s; i+=2)
+	w = x + w > SCR_WIDTH ? SCR_WIDTH - x : w;
+	h = y + h > SCR_HEIGHT ? SCR_HEIGHT - y : h;
+	for(int i = 1; i < w; ++i)
+	{
+		if(memcmp(bg_px + i * LcdPixel::BPP, bg_px, LcdPixel::BPP))
 		{
-			black_box[i] = 0x1F;
+			return false;
 		}
 	}
-	return black_box;
-}
-
-// Replaces pixels of screen buffer at position x/y with img pixels
-void multiplex24(const unsigned char* img, int x, int y)
-{
-	if(x < 0 || y < 0)
-	{
-		return;
-	}
-	
-	const int fbw = SCR_WIDTH;
-	const int fbh = SCR_HEIGHT;
-	const int w = *(unsigned short*)img;
-	const int h = *(unsigned short*)(img+2);
-	
-	// Data starts from 5th element, first 4 reserved for width/height
-	unsigned short* im = (unsigned short*)(img+4);
-	unsigned short* fb = (unsigned short*)frame_buffer;
 	
-	for(int i = y, ii = 0; i < fbh && ii < h; ++i, ++ii)
+	const int row = w * LcdPixel::BPP;
+	for(int j = 1; j < h; ++j)
 	{
-		for(int j = x, jj = 0; j < fbw && jj < w; ++j, ++jj)
+		if(memcmp(bg_px + j * SCR_WIDTH * LcdPixel::BPP, bg_px, row)) // First row is uniform already
 		{
-			fb[j + i*fbw] = im[jj + ii*w];
+			return false;
 		}
 	}
+	return true;
 }
 
-void multiplex32(const unsigned char* img, int x, int y)
+// Finds glyph composited over bg, creates it on the first use
+const unsigned char* cachedGlyph(const unsigned char* img, const unsigned char* bg_px)
 {
-	if(x < 0 || y < 0)
+	unsigned int bg = LcdPixel::Key(bg_px);
+	unsigned int hash = (unsigned int)((unsigned long)img >> 4) ^ bg * 0x9E37u;
+	for(int probe = 0; probe < GLYPH_SLOTS; ++probe)
 	{
-		return;
-	}
-	
-	const int fbw = SCR_WIDTH;
-	const int fbh = SCR_HEIGHT;
-	const int w = *(unsigned short*)img;
-	const int h = *(unsigned short*)(img+2);	
-	
-	// Data starts from 5th element, first 4 reserved for width/height
-	Pixel* im = (Pixel*)(img+4);
-	unsigned short* fb = (unsigned short*)frame_buffer;
-	
-	for(int i = y, ii = 0; i < fbh && ii < h; ++i, ++ii)
-	{
-		for(int j = x, jj = 0; j < fbw && jj < w; ++j, ++jj)
+		Glyph* g = glyph_cache + (hash + probe) % GLYPH_SLOTS;
+		if(g->img != NULL)
 		{
-			unsigned short* fb_p = fb + j + i*fbw; // Frame Buffer Pixel			
-			Pixel* im_p = im + jj + ii*w; // Image Pixel
-			unsigned char* fb_pb = (unsigned char*)fb_p; // Frame Buffer Pixel Bs
-			
-			if(im_p->a == 0xFF) // This is solid pixel, just replace it
-			{
-				*fb_p = *(unsigned short*)im_p;
-				continue;
-			}
-			else if(!im_p->a) // This is empty pixel, skip it
+			if(g->src == img && g->bg == bg)
 			{
-				continue;
+				return g->img;
 			}
-			
-			// Alpha Blending Routine
-			float scale = im_p->a/255.0f;
-			
-			unsigned char r = B(B(RED(fb_pb[0], fb_pb[1]) * (1.0f - scale)) + B(RED(im_p->rg, im_p->gb) * scale));
-			unsigned char g = B(B(GREEN(fb_pb[0], fb_pb[1]) * (1.0f - scale)) + B(GREEN(im_p->rg, im_p->gb) * scale));
-			unsigned char b = B(B(BLUE(fb_pb[0], fb_pb[1]) * (1.0f - scale)) + B(BLUE(im_p->rg, im_p->gb) * scale));
-			
-			fb_pb[0] = B(B(r & 0xF8) | B(g >> 5));
-			fb_pb[1] = B(B(B(g & 0xFC) << 3) | B(b >> 3));
+			continue;
+		}
+		
+		const int w = spriteW(img);
+		const int h = spriteH(img);
+		const int size = w * h * LcdPixel::BPP + 4;
+		
+		unsigned char* comp = (unsigned char*)malloc(size);
+		memcpy(comp, img, 4); // Width/height
+		unsigned char* px = comp+4;
+		for(int i = 0; i < w * h; ++i)
+		{
+			memcpy(px + i * LcdPixel::BPP, bg_px, LcdPixel::BPP);
 		}
+		blendSprite<LcdPixel>(px, w, h, img, 0, 0); // Same routine as on screen, so result is identical
+		
+		g->src = img;
+		g->bg = bg;
+		g->img = comp;
+		// Critical Section Beg
+		pthread_mutex_lock(&lcd_lock);
+		
+		++lcd_stats.glyphs;
+		lcd_stats.glyph_bytes += size;
+		
+		pthread_mutex_unlock(&lcd_lock);
+		// Critical Section End
+		return comp;
 	}
+	
+	return NULL;
+}
+
+void freeGlyphCache()
+{
+	for(int i = 0; i < GLYPH_SLOTS; ++i)
+	{
+		free(glyph_cache[i].img);
+		glyph_cache[i].img = NULL;
+	}
+	lcd_stats.glyphs = 0;
+	lcd_stats.glyph_bytes = 0;
 }
 
 void multiplexInt(int num, const unsigned char *const *font, int f_size, int x, int y)
@@ -978,13 +1606,13 @@ void multiplexInt(int num, const unsigned char *const *font, int f_size, int x,
 	for(int i = size; i >= 0; --i)
 	{
 		int w, h;
-		h = *(unsigned short*)(font[snum[i]&0x0F]+2);
+		h = spriteH(font[snum[i]&0x0F]);
 		if(i < size)
 		{
-			w = *(unsigned short*)font[snum[i]&0x0F];
+			w = spriteW(font[snum[i]&0x0F]);
 			x -= w + 4 + (w_max-w)/2 + (w_max-w)%2;
 		}
-		multiplex32(font[snum[i]&0x0F], x, y-h);
+		multiplexGlyph(font[snum[i]&0x0F], x, y-h);
 		if(i < size)
 		{
 			x -= (w_max-w)/2;
@@ -1001,13 +1629,13 @@ const unsigned char* dot, const unsigned char* minus, int x, int y)
 	sprintf(snum, "%-3.1f", num);
 	int size = strlen(snum) - 1;
 	
-	int h = *(unsigned short*)(smol_font[snum[size]&0x0F]+2);
-	multiplex32(smol_font[snum[size]&0x0F], x, y-h);
+	int h = spriteH(smol_font[snum[size]&0x0F]);
+	multiplexGlyph(smol_font[snum[size]&0x0F], x, y-h);
 	
-	int w = *(unsigned short*)dot;
-	h = *(unsigned short*)(dot+2);
+	int w = spriteW(dot);
+	h = spriteH(dot);
 	x -= w + 7;
-	multiplex32(dot, x, y-h);
+	multiplexGlyph(dot, x, y-h);
 	x -= 3;
 	size -= 2;
 	
@@ -1015,10 +1643,10 @@ const unsigned char* dot, const unsigned char* minus, int x, int y)
 	{
 		for(int i = size; i >= 0; --i)
 		{
-			w = *(unsigned short*)font[snum[i]&0x0F];
-			h = *(unsigned short*)(font[snum[i]&0x0F]+2);
+			w = spriteW(font[snum[i]&0x0F]);
+			h = spriteH(font[snum[i]&0x0F]);
 			x -= w + 4 + (w_max-w)/2 + (w_max-w)%2;
-			multiplex32(font[snum[i]&0x0F], x, y-h);
+			multiplexGlyph(font[snum[i]&0x0F], x, y-h);
 			x -= (w_max-w)/2;
 		}
 	}
@@ -1026,59 +1654,28 @@ const unsigned char* dot, const unsigned char* minus, int x, int y)
 	{
 		for(int i = size; i >= 1; --i)
 		{
-			w = *(unsigned short*)font[snum[i]&0x0F];
-			h = *(unsigned short*)(font[snum[i]&0x0F]+2);
+			w = spriteW(font[snum[i]&0x0F]);
+			h = spriteH(font[snum[i]&0x0F]);
 			x -= w + 4 + (w_max-w)/2 + (w_max-w)%2;
-			multiplex32(font[snum[i]&0x0F], x, y-h);
+			multiplexGlyph(font[snum[i]&0x0F], x, y-h);
 			x -= (w_max-w)/2;
 		}
 		
-		w = *(unsigned short*)minus;
-		h = *(unsigned short*)(minus+2);
-		multiplex32(minus, x-w-2, y-32-h);
-	}
-}
-
-void loadNums(const char* suffix, int dye, unsigned char** dest)
-{
-	char fn[14] = { '.', '/', 'i', 'm', 'g', '/', '\0', suffix[0], '.', 'p', 'g', 'm', '\0' };
-	for(int i = 0; i < 10; ++i)
-	{
-		fn[6] = (char)((char)i | (char)0x30);
-		dest[i] = loadPGM(fn, dye, true);		
+		w = spriteW(minus);
+		h = spriteH(minus);
+		multiplexGlyph(minus, x-w-2, y-32-h);
 	}
 }
 
-void freeNums(unsigned char** targ)
+void getNums(const char* suffix, int dye, const unsigned char** dest)
 {
-	for(int i = 0; i < 10; ++i)
+	char stem[3] = { '0', suffix[0], '\0' };
+	for(int i = 0; i < 10; ++i, ++stem[0])
 	{
-		free(targ[i]);
+		dest[i] = getAsset(stem, dye);
 	}
 }
 
-void eraseX() // Erase X button by overwriting with black box
-{
-	unsigned char* black_box = createBox(x_button);
-	multiplex24(black_box, 282, 0);
-	drawScrBuffer();
-	free(black_box);
-}
-
-/* Save Screenshot /////////////////////////////
-FILE* out = fopen("post_x.ppm", "wb");
-fprintf(out, "P6\n320 240\n255\n");
-for(int i = 0; i < lcd_size; i+=2)
-{
-	unsigned char rgb[3];
-	rgb[0] = BLUE(frame_buffer[i], frame_buffer[i+1]);
-	rgb[1] = GREEN(frame_buffer[i], frame_buffer[i+1]);
-	rgb[2] = RED(frame_buffer[i], frame_buffer[i+1]);
-	fwrite(rgb, 1, 3, out);
-}
-fclose(out);
-/////////////////////////////////////////////*/
-
 // Usefull commands
 //COMMAND(0x55, /*Write Content Adaptive Brightness Control*/ 0x00 /*Off*/);
 //COMMAND(0x55, /*Write Content Adaptive Brightness Control*/ 0x01 /*User Interface Image*/);
@@ -1,12 +1,44 @@
 #ifndef ILI9341_H
 #define ILI9341_H
 
-#define MODE_16_BIT
 //#define CALC_TOUCH_PRESSURE
 
-void initLCD();
+struct LcdStats
+{
+	unsigned int frames;            // Frames pushed to the screen
+	unsigned int skipped;           // Readings redraws skipped because nothing changed
+	unsigned long long spi_bytes;   // Pixel bytes pushed over SPI
+	unsigned long long saved_bytes; // Pixel bytes not pushed thanks to partial updates
+	unsigned int last_bytes;        // Last frame: pixel bytes pushed (full frame is 153600)
+	unsigned int last_rects;        // Last frame: dirty rectangles sent
+	unsigned int last_spi_calls;    // Last frame: pixel data ioctls
+	unsigned int spi_xfer_bs;       // Probed max SPI transfer
+	unsigned int spi_msg_bs;        // spidev bufsiz, max total of one batched message
+	unsigned int last_render_us;    // Last readings frame: time to compose it in frame buffer
+	unsigned int last_push_us;      // Last frame: time to push it over SPI
+	unsigned int last_spark_us;     // Last frame: sparkline update and blending
+	unsigned int spark_scrolls;     // Times plots moved one column left
+	unsigned int glyphs;            // Pre-composited glyphs in cache
+	unsigned int glyph_bytes;       // Memory used by them
+	unsigned int assets_us;         // Time to load all sprites at startup
+	bool assets_mapped;             // Sprites come from mapped atlas, not converted from image files
+	unsigned int queued;            // Commands sent to display thread
+	unsigned int coalesced;         // Readings/redraws replaced by newer ones before display thread got to them
+	unsigned int dropped;           // Commands lost because queue was full
+	unsigned int last_latency_us;   // Last frame: from request to pixels on the panel
+	unsigned int touches;           // Debounced presses
+	unsigned int bounces;           // Pen IRQs that didn't last long enough to be a press
+	unsigned int last_press_us;     // From finger down to X button highlighted (includes debounce)
+	unsigned int last_tap_us;       // From finger up to tap handled: poweroff prompt, screen on/off
+};
+
+void initLCD(bool warm = false); // warm: panel was left asleep by deinitLCD() since it was powered, skips long reset wait
 void deinitLCD();
-void updateReadings(int ppm, float humd, float temp);
+void updateReadings(int ppm, float humd, float temp); // Queued, rendered and pushed by display thread
+void skipReadings(); // Readings are unchanged, only count the skipped redraw
+bool lcdIsBlinking(); // Warning backgrounds are still blinking, screen needs redraw every update
+void getLcdStats(LcdStats* st);
+void flushLCD(); // Waits until display thread has handled everything queued so far
 void onLCD();
 void offLCD();
 
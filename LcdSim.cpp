@@ -0,0 +1,415 @@
+#include "LcdSim.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <wiringPi.h>
+#include "SpiBatch.h"
+
+// Same wiring as in ILI9341.cpp
+#define SIM_DC_PIN    25
+#define SIM_LED_PIN   22
+#define SIM_PINS      64
+
+#define B(op) (unsigned char)(op)
+
+struct SimPanel
+{
+	unsigned char cmd;    // Last command, following data Bs are its parameters
+	int nparam;           // Parameters received for cmd
+	unsigned char param[4];
+	int cs, ce, ps, pe;   // Column/page window
+	int col, page;        // Memory write cursor
+	unsigned char part[3];
+	int nparts;           // Bs of a pixel split between transfers
+	unsigned char madctl;
+	unsigned char colmod;
+};
+
+unsigned char sim_gram[SIM_SCR_WIDTH * SIM_SCR_HEIGHT * 2];
+SimPanel sim_panel;
+SimStats sim_stats;
+int sim_spi_fd[2] = { -1, -1 };
+
+volatile int sim_pins[SIM_PINS];
+volatile unsigned int sim_edges[SIM_PINS]; // Level changes, buzzer output is checked through them
+void (*sim_isr)(void);
+int sim_isr_pin = -1;
+
+pthread_mutex_t sim_touch_lock = PTHREAD_MUTEX_INITIALIZER;
+bool sim_pen_down;
+int sim_raw_x, sim_raw_y;
+
+int simIoctl(int fd, unsigned long req, void* arg);
+void panelXfer(const unsigned char* dat, int s);
+void panelCommand(unsigned char c);
+void panelData(const unsigned char* dat, int s);
+void touchXfer(const struct spi_ioc_transfer* x);
+
+int simOpenSpi(int spi_device)
+{
+	if(sim_spi_fd[spi_device] < 0)
+	{
+		sim_spi_fd[spi_device] = open("/dev/null", O_RDWR); // Real descriptor, so close() works as usual
+		if(!spi_device)
+		{
+			simReset();
+		}
+	}
+	spi_ioctl = simIoctl;
+	return sim_spi_fd[spi_device];
+}
+
+void simReset()
+{
+	memset(sim_gram, 0, sizeof(sim_gram));
+	memset(&sim_panel, 0, sizeof(SimPanel));
+	memset(&sim_stats, 0, sizeof(SimStats));
+	sim_panel.ce = SIM_SCR_WIDTH - 1;
+	sim_panel.pe = SIM_SCR_HEIGHT - 1;
+	sim_stats.sleeping = true;
+}
+
+unsigned int simPinEdges(int pin)
+{
+	return pin >= 0 && pin < SIM_PINS ? sim_edges[pin] : 0;
+}
+
+const unsigned char* simGram()
+{
+	return sim_gram;
+}
+
+void simGetStats(SimStats* st)
+{
+	*st = sim_stats;
+	st->backlight = sim_pins[SIM_LED_PIN] != 0;
+}
+
+bool simDumpPPM(const char* path)
+{
+	FILE* out = fopen(path, "wb");
+	if(out == NULL)
+	{
+		return false;
+	}
+	
+	bool lit = sim_stats.display_on && !sim_stats.sleeping && sim_pins[SIM_LED_PIN];
+	fprintf(out, "P6\n%d %d\n255\n", SIM_SCR_WIDTH, SIM_SCR_HEIGHT);
+	for(int i = 0; i < SIM_SCR_WIDTH * SIM_SCR_HEIGHT * 2; i+=2)
+	{
+		// Panel is wired BGR: blue in the top 5 bits, red in the bottom 5
+		unsigned int px = lit ? (unsigned int)sim_gram[i] << 8 | sim_gram[i+1] : 0;
+		unsigned int b5 = px >> 11, g6 = (px >> 5) & 0x3F, r5 = px & 0x1F;
+		unsigned char rgb[3] = { B(r5 << 3 | r5 >> 2), B(g6 << 2 | g6 >> 4), B(b5 << 3 | b5 >> 2) };
+		fwrite(rgb, 1, 3, out);
+	}
+	return fclose(out) == 0;
+}
+
+void simPress(int raw_x, int raw_y)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&sim_touch_lock);
+	
+	bool edge = !sim_pen_down;
+	sim_pen_down = true;
+	sim_raw_x = raw_x;
+	sim_raw_y = raw_y;
+	
+	pthread_mutex_unlock(&sim_touch_lock);
+	// Critical Section End
+	
+	if(edge && sim_isr != NULL)
+	{
+		sim_isr(); // wiringPi calls it from its own thread, any thread will do here
+	}
+}
+
+void simRelease()
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&sim_touch_lock);
+	
+	sim_pen_down = false;
+	
+	pthread_mutex_unlock(&sim_touch_lock);
+	// Critical Section End
+}
+
+// spidev replacement, messages are checked against bufsiz just like the driver does
+int simIoctl(int fd, unsigned long req, void* arg)
+{
+	if(_IOC_TYPE(req) != SPI_IOC_MAGIC || _IOC_NR(req) != 0)
+	{
+		return 0; // Mode, bits per word, speed
+	}
+	
+	int n = _IOC_SIZE(req)/sizeof(struct spi_ioc_transfer);
+	const struct spi_ioc_transfer* x = (const struct spi_ioc_transfer*)arg;
+	int total = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		total += x[i].len;
+	}
+	if(total > spiBufsiz())
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+	
+	for(int i = 0; i < n; ++i)
+	{
+		if(fd == sim_spi_fd[0])
+		{
+			panelXfer((const unsigned char*)x[i].tx_buf, x[i].len);
+		}
+		else if(fd == sim_spi_fd[1])
+		{
+			touchXfer(x + i);
+		}
+		else
+		{
+			errno = EBADF;
+			return -1;
+		}
+	}
+	return total;
+}
+
+void panelXfer(const unsigned char* dat, int s)
+{
+	if(sim_pins[SIM_DC_PIN])
+	{
+		sim_stats.data += s;
+		panelData(dat, s);
+		return;
+	}
+	
+	for(int i = 0; i < s; ++i)
+	{
+		panelCommand(dat[i]);
+	}
+}
+
+void panelCommand(unsigned char c)
+{
+	SimPanel* p = &sim_panel;
+	++sim_stats.commands;
+	p->cmd = c;
+	p->nparam = 0;
+	p->nparts = 0;
+	
+	switch(c)
+	{
+	case 0x01: // Software reset
+		p->cs = p->ps = 0;
+		p->ce = SIM_SCR_WIDTH - 1;
+		p->pe = SIM_SCR_HEIGHT - 1;
+		sim_stats.sleeping = true;
+		sim_stats.display_on = false;
+		break;
+	case 0x10: // Sleep IN
+		sim_stats.sleeping = true;
+		break;
+	case 0x11: // Sleep OUT
+		sim_stats.sleeping = false;
+		break;
+	case 0x28: // Display OFF
+		sim_stats.display_on = false;
+		break;
+	case 0x29: // Display ON
+		sim_stats.display_on = true;
+		break;
+	case 0x2C: // Memory Write
+		++sim_stats.writes;
+		p->col = p->cs;
+		p->page = p->ps;
+		break;
+	default:
+		break;
+	}
+}
+
+void panelData(const unsigned char* dat, int s)
+{
+	SimPanel* p = &sim_panel;
+	int i = 0;
+	
+	switch(p->cmd)
+	{
+	case 0x2A: // Column Address Set
+	case 0x2B: // Page Address Set
+		for(; i < s && p->nparam < 4; ++i)
+		{
+			p->param[p->nparam++] = dat[i];
+		}
+		if(p->nparam == 4)
+		{
+			int beg = p->param[0] << 8 | p->param[1];
+			int end = p->param[2] << 8 | p->param[3];
+			int lim = p->cmd == 0x2A ? SIM_SCR_WIDTH : SIM_SCR_HEIGHT;
+			if(beg > end || end >= lim)
+			{
+				++sim_stats.errors;
+			}
+			else if(p->cmd == 0x2A)
+			{
+				p->cs = beg;
+				p->ce = end;
+			}
+			else
+			{
+				p->ps = beg;
+				p->pe = end;
+				++sim_stats.windows;
+			}
+			p->nparam = 5; // Extra parameters are ignored
+		}
+		break;
+	case 0x2C: // Memory Write
+		for(; i < s; ++i)
+		{
+			p->part[p->nparts++] = dat[i];
+			if(p->nparts < (p->colmod == 0x66 ? 3 : 2)) // 18 bit pixels are 3 Bs, everything else is 16 bit
+			{
+				continue;
+			}
+			p->nparts = 0;
+			if(p->page > p->pe) // Station never writes past the window
+			{
+				++sim_stats.errors;
+				return;
+			}
+			
+			// GRAM is kept in 16 bit, 18 bit pixels lose their lowest bits
+			unsigned char* dst = sim_gram + (p->page * SIM_SCR_WIDTH + p->col) * 2;
+			if(p->colmod == 0x66)
+			{
+				dst[0] = B((p->part[0] & 0xF8) | p->part[1] >> 5);
+				dst[1] = B((p->part[1] & 0x1C) << 3 | p->part[2] >> 3);
+			}
+			else
+			{
+				dst[0] = p->part[0];
+				dst[1] = p->part[1];
+			}
+			++sim_stats.pixels;
+			
+			if(++p->col > p->ce)
+			{
+				p->col = p->cs;
+				++p->page;
+			}
+		}
+		break;
+	case 0x36: // Memory Access Control
+		p->madctl = dat[0];
+		break;
+	case 0x3A: // Pixel Format Set
+		p->colmod = dat[0];
+		break;
+	default: // Gamma tables and such don't change GRAM, data after NOP is ignored by the panel too
+		break;
+	}
+}
+
+void touchXfer(const struct spi_ioc_transfer* x)
+{
+	const unsigned char* tx = (const unsigned char*)x->tx_buf;
+	unsigned char* rx = (unsigned char*)x->rx_buf;
+	if(x->len < 3 || tx == NULL || rx == NULL)
+	{
+		return;
+	}
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&sim_touch_lock);
+	
+	int v = 0;
+	if(sim_pen_down)
+	{
+		switch(tx[0] >> 4 & 0x07) // Channel select bits
+		{
+		case 5:
+			v = sim_raw_x;
+			break;
+		case 1:
+			v = sim_raw_y;
+			break;
+		case 3: // Z1, Z2 - light, constant pressure
+			v = 400;
+			break;
+		case 4:
+			v = 3600;
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&sim_touch_lock);
+	// Critical Section End
+	
+	rx[0] = 0;
+	rx[1] = B(v >> 5);
+	rx[2] = B(v << 3);
+}
+
+// wiringPi
+extern "C" {
+
+int wiringPiSetupGpio(void)
+{
+	return 0;
+}
+
+void pinMode(int pin, int mode)
+{
+}
+
+void pullUpDnControl(int pin, int pud)
+{
+}
+
+int wiringPiISR(int pin, int mode, void (*function)(void))
+{
+	sim_isr_pin = pin;
+	sim_isr = function;
+	return 0;
+}
+
+void digitalWrite(int pin, int value)
+{
+	if(pin >= 0 && pin < SIM_PINS)
+	{
+		sim_edges[pin] += sim_pins[pin] != value ? 1 : 0;
+		sim_pins[pin] = value;
+	}
+}
+
+int digitalRead(int pin)
+{
+	if(pin == sim_isr_pin)
+	{
+		return sim_pen_down ? 0 : 1; // Pen IRQ is active low
+	}
+	return pin >= 0 && pin < SIM_PINS ? sim_pins[pin] : 0;
+}
+
+void delay(unsigned int how_long)
+{
+	struct timespec ts = { (time_t)(how_long / 1000), (long)(how_long % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+}
+
+void delayMicroseconds(unsigned int how_long)
+{
+	struct timespec ts = { (time_t)(how_long / 1000000), (long)(how_long % 1000000) * 1000 };
+	nanosleep(&ts, NULL);
+}
+
+}
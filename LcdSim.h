@@ -0,0 +1,35 @@
+#ifndef LCDSIM_H
+#define LCDSIM_H
+
+// Simulated board for headless builds (LCD_HEADLESS): replaces wiringPi GPIO and spidev, models ILI9341
+// GRAM on SPI0 and XPT2046 touch controller on SPI1 in memory. Linked instead of libwiringPi.
+
+#define SIM_SCR_WIDTH  320 // Panel in landscape mode (MADCTL row/column exchange)
+#define SIM_SCR_HEIGHT 240
+
+struct SimStats
+{
+	unsigned int commands;   // Command bytes (DC low)
+	unsigned int windows;    // CASET/PASET pairs
+	unsigned int writes;     // Memory Write commands
+	unsigned long long data; // Data bytes (DC high), including parameters
+	unsigned long long pixels;
+	unsigned int errors;     // Protocol errors: bad window, pixels outside of the window, data without command
+	bool sleeping;
+	bool display_on;
+	bool backlight;
+};
+
+int simOpenSpi(int spi_device); // Returns descriptor for spiOpenPort(), routes spi_ioctl into the model
+void simReset();                // Clears GRAM, stats and panel state
+const unsigned char* simGram(); // SIM_SCR_WIDTH x SIM_SCR_HEIGHT 2 B pixels, exactly as sent by the station
+void simGetStats(SimStats* st);
+bool simDumpPPM(const char* path); // GRAM as it would look on the panel
+
+// Finger on the touch screen, raw 12 bit XPT2046 readings. Pen IRQ goes low and ISR is called.
+void simPress(int raw_x, int raw_y);
+void simRelease();
+
+unsigned int simPinEdges(int pin); // Level changes of GPIO output since start
+
+#endif /* LCDSIM_H */
@@ -4,33 +4,52 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include "Metrics.h"
+#include "Trace.h"
 
-#define SIZE     17280 // Enough for 24 hrs of readigns taken every 5 seconds
 #define LOG_INTR 60    // Each 5 minutes if readings taken every 5 seconds
 
-Reading ouroboros[SIZE];
+Reading ouroboros[LOG_SIZE];
 int pos; // Current position in Ouroboros
 int ints_to_log = LOG_INTR; // Intervals to log in file
+char rws_db_path[256];
 FILE* rws_db;
 pthread_mutex_t rws_db_lock;
+pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER; // Readers of single readings don't need it, snapshots do
 pthread_mutex_t msg_log_lock;
 
 void time2str(time_t t, char* out, bool fname);
 
-void initLogger()
+bool initLogger(const LogState* warm, const char* path)
 {
 	pthread_mutex_init(&msg_log_lock, NULL);
 	pthread_mutex_init(&rws_db_lock, NULL);
+	snprintf(rws_db_path, sizeof(rws_db_path), "%s", path);
 	// Critical Section Beg
 	pthread_mutex_lock(&rws_db_lock);
 	
-	rws_db = fopen("./log/readings.rws", "a+b");
-	int res = fseek(rws_db, -SIZE * sizeof(Reading), SEEK_END);
-	res = fread(ouroboros, sizeof(Reading), SIZE, rws_db);
-	pos = res % SIZE;
+	rws_db = fopen(rws_db_path, "a+b");
+	struct stat st;
+	bool use_warm = warm != NULL && fstat(fileno(rws_db), &st) == 0 && st.st_size == warm->file_size &&
+	warm->pos >= 0 && warm->pos < LOG_SIZE && warm->ints_to_log >= 0 && warm->ints_to_log <= LOG_SIZE;
+	if(use_warm) // Includes readings that didn't make it to the file yet
+	{
+		memcpy(ouroboros, warm->ring, sizeof(ouroboros));
+		pos = warm->pos;
+		ints_to_log = warm->ints_to_log;
+	}
+	else
+	{
+		int res = fseek(rws_db, -LOG_SIZE * sizeof(Reading), SEEK_END);
+		res = fread(ouroboros, sizeof(Reading), LOG_SIZE, rws_db);
+		pos = res % LOG_SIZE;
+		ints_to_log = LOG_INTR;
+	}
 	
 	pthread_mutex_unlock(&rws_db_lock);
 	// Critical Section End
+	return use_warm;
 }
 
 void deinitLogger()
@@ -48,14 +67,18 @@ void deinitLogger()
 
 void logReading(Reading rd)
 {
+	// Critical Section Beg
+	pthread_mutex_lock(&ring_lock);
+	
 	ouroboros[pos] = rd;
-	pos = (pos + 1) % SIZE;
+	pos = (pos + 1) % LOG_SIZE;
 	
 	if(pos % LOG_INTR == 0)
 	{
 		// Critical Section Beg
 		if(pthread_mutex_trylock(&rws_db_lock) == 0)
 		{
+			unsigned long long beg = metNow();
 			int oft = ints_to_log - 1;
 			while(oft >= 0)
 			{
@@ -65,25 +88,50 @@ void logReading(Reading rd)
 			
 			pthread_mutex_unlock(&rws_db_lock);
 			// Critical Section End
+			unsigned long long end = metNow();
+			metObserve(MH_LOG_FLUSH, end - beg);
+			traceAdd("log_flush", beg, end);
 			ints_to_log = LOG_INTR;
 		}
 		else // While file is being downloaded, just increase next logging amount to compensate
 		{
 			ints_to_log += LOG_INTR;
+			metAdd(MC_LOG_DEFERRED, 1);
 		}
 	}
+	
+	pthread_mutex_unlock(&ring_lock);
+	// Critical Section End
+}
+
+void getLogState(LogState* st)
+{
+	// File lock goes first, logReading() only tries it while holding the ring
+	// Critical Section Beg
+	pthread_mutex_lock(&rws_db_lock);
+	pthread_mutex_lock(&ring_lock);
+	
+	struct stat fst;
+	st->file_size = rws_db != NULL && fflush(rws_db) == 0 && fstat(fileno(rws_db), &fst) == 0 ? fst.st_size : -1;
+	st->pos = pos;
+	st->ints_to_log = ints_to_log;
+	memcpy(st->ring, ouroboros, sizeof(ouroboros));
+	
+	pthread_mutex_unlock(&ring_lock);
+	pthread_mutex_unlock(&rws_db_lock);
+	// Critical Section End
 }
 
 Reading getReading(unsigned int offset)
 {
-	assert(offset < SIZE);
-	if((int)offset <= pos)
+	assert(offset < LOG_SIZE);
+	if((int)offset < pos)
 	{
 		return ouroboros[pos - offset - 1];
 	}
 	else
 	{
-		return ouroboros[SIZE - offset + pos - 1];
+		return ouroboros[LOG_SIZE - offset + pos - 1];
 	}
 }
 
@@ -106,8 +154,8 @@ void deleteDBfile()
 	pthread_mutex_lock(&rws_db_lock);
 	
 	fclose(rws_db);
-	remove("./log/readings.rws");
-	rws_db = fopen("./log/readings.rws", "a+b");
+	remove(rws_db_path);
+	rws_db = fopen(rws_db_path, "a+b");
 	
 	pthread_mutex_unlock(&rws_db_lock);
 	// Critical Section End
@@ -133,10 +181,14 @@ void logError(const char* descript, int err_num)
 	pthread_mutex_lock(&msg_log_lock);
 	
 	FILE* err_log = fopen("./log/err.log", "a");
+	FILE* out = err_log != NULL ? err_log : stderr; // Out of descriptors is an error worth reporting too
 	char tstr[20];
 	time2str(time(NULL), tstr, 0);
-	fprintf(err_log, "%s: %s - Error: %s\n", tstr, descript, strerror(err_num));
-	fclose(err_log);
+	fprintf(out, "%s: %s - Error: %s\n", tstr, descript, strerror(err_num));
+	if(err_log != NULL)
+	{
+		fclose(err_log);
+	}
 	
 	pthread_mutex_unlock(&msg_log_lock);
 	// Critical Section End
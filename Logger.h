@@ -3,15 +3,30 @@
 
 #include <stdio.h>
 
+#define LOG_SIZE 17280 // Enough for 24 hrs of readigns taken every 5 seconds
+#define LOG_DB_PATH "./log/readings.rws"
+
 struct Reading
 {
 	unsigned int dt; // UNIX Timestamp (datetime)
 	unsigned int rd; // Actual readings: 0000000000000 0000000 00000000 0000
 };                   //                          CO2 ^  humd ^   temp ^ t/10
 
-void initLogger();
+// Ring of the last 24 hrs and how far it is written to the database file
+struct LogState
+{
+	int pos;
+	int ints_to_log;         // Readings waiting for the next file write
+	long long file_size;     // Database file the ring belongs to
+	Reading ring[LOG_SIZE];
+};
+
+// Ring is taken from warm if it belongs to the database file as it is now, otherwise it's read from the file.
+// Returns true if warm state was used.
+bool initLogger(const LogState* warm = NULL, const char* path = LOG_DB_PATH);
 void deinitLogger();
 void logReading(Reading rd);
+void getLogState(LogState* st); // Consistent copy, waits while database file is being downloaded
 Reading getReading(unsigned int offset); // Returns latest data, offset gets data from the past
 FILE* getDBfileAndLock();
 void unlockDBfile();
@@ -0,0 +1,223 @@
+#include "Metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+struct MetDef
+{
+	const char* name;
+	const char* labels; // Without braces, "" for none
+	const char* help;
+};
+
+// Entries of one family follow each other, HELP/TYPE are printed for the first of them
+const MetDef met_counters[MC_COUNT] = {
+	{ "rws_sensor_errors_total", "sensor=\"htu21d\"", "Failed sensor reads" },
+	{ "rws_sensor_errors_total", "sensor=\"sht31d\"", "" },
+	{ "rws_sensor_errors_total", "sensor=\"mhz19b\"", "" },
+	{ "rws_web_written_bytes_total", "", "Bytes written to web client sockets" },
+	{ "rws_web_write_errors_total", "", "Failed writes to web client sockets" },
+	{ "rws_log_flush_deferred_total", "", "Logger file writes postponed because database file was being downloaded" },
+};
+
+const MetDef met_hists[MH_COUNT] = {
+	{ "rws_loop_period_seconds", "loop=\"update\"", "Time between starts of loop iterations" },
+	{ "rws_loop_period_seconds", "loop=\"th_sampler\"", "" },
+	{ "rws_loop_jitter_seconds", "loop=\"update\"", "Deviation of loop period from nominal one" },
+	{ "rws_loop_jitter_seconds", "loop=\"th_sampler\"", "" },
+	{ "rws_sensor_read_seconds", "sensor=\"htu21d\"", "Sensor read duration, split-phase CO2 reads from request to harvest" },
+	{ "rws_sensor_read_seconds", "sensor=\"sht31d\"", "" },
+	{ "rws_sensor_read_seconds", "sensor=\"mhz19b\"", "" },
+	{ "rws_web_queue_put_wait_seconds", "", "Time putWebQueue() blocked on full web queue" },
+	{ "rws_web_queue_wait_seconds", "", "Time updates spent in web queue before writer took them" },
+	{ "rws_lcd_push_seconds", "", "drawScrBuffer() duration, damage search and SPI transfers" },
+	{ "rws_log_flush_seconds", "", "Logger write of buffered readings to database file" },
+};
+
+const MetDef met_gauges[MG_COUNT] = {
+	{ "rws_web_queue_depth", "", "Updates waiting for web writer thread" },
+	{ "rws_web_clients", "", "Connected web clients" },
+	{ "rws_co2_age_milliseconds", "", "Age of last good CO2 reading, since start if there is none yet" },
+	{ "rws_co2_stale", "", "CO2 reading is older than allowed, 1 or 0" },
+	{ "rws_co2_request_period_milliseconds", "", "How often CO2 sensor is asked for a reading" },
+};
+
+// Upper bounds of buckets in ns, 10 us ... 2.5 s and +Inf
+const unsigned long long met_bounds[MET_BUCKETS - 1] = {
+	10000ULL, 50000ULL, 100000ULL, 250000ULL, 500000ULL, 1000000ULL, 2500000ULL, 5000000ULL,
+	10000000ULL, 25000000ULL, 100000000ULL, 250000000ULL, 1000000000ULL, 2500000000ULL
+};
+
+struct MetHist
+{
+	unsigned long long buckets[MET_BUCKETS];
+	unsigned long long sum_ns;
+};
+
+// One per thread, aligned so that shards of different threads never share a cache line
+struct alignas(64) MetShard
+{
+	unsigned long long counters[MC_COUNT];
+	MetHist hists[MH_COUNT];
+};
+
+MetShard met_shards[MET_MAX_THREADS];
+int met_nshards;
+long long met_gauges_v[MG_COUNT];
+__thread MetShard* met_shard; // This thread's shard, picked on first use
+MetShard* const met_shared = met_shards + MET_MAX_THREADS - 1; // Threads past the others all go here
+
+MetShard* metShard()
+{
+	if(met_shard == NULL)
+	{
+		int i = __atomic_fetch_add(&met_nshards, 1, __ATOMIC_RELAXED);
+		met_shard = i < MET_MAX_THREADS - 1 ? met_shards + i : met_shared;
+	}
+	return met_shard;
+}
+
+// Own shard has a single writer, so a plain add is enough; atomic store only keeps collection from seeing torn values
+inline void metInc(MetShard* s, unsigned long long* p, unsigned long long v)
+{
+	if(s == met_shared)
+	{
+		__atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+	}
+	else
+	{
+		__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+	}
+}
+
+unsigned long long metNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void metAdd(int counter, unsigned long long v)
+{
+	MetShard* s = metShard();
+	metInc(s, &s->counters[counter], v);
+}
+
+void metObserve(int hist, unsigned long long ns)
+{
+	int b = 0;
+	while(b < MET_BUCKETS - 1 && ns > met_bounds[b])
+	{
+		++b;
+	}
+	MetShard* s = metShard();
+	MetHist* h = s->hists + hist;
+	metInc(s, &h->buckets[b], 1);
+	metInc(s, &h->sum_ns, ns);
+}
+
+void metGaugeAdd(int gauge, long long d)
+{
+	__atomic_fetch_add(&met_gauges_v[gauge], d, __ATOMIC_RELAXED);
+}
+
+void metGaugeSet(int gauge, long long v)
+{
+	__atomic_store_n(&met_gauges_v[gauge], v, __ATOMIC_RELAXED);
+}
+
+// Appends to buf at *len, never past size
+void metAppend(char* buf, int size, int* len, const char* fmt, ...) __attribute__((format(printf, 4, 5)));
+void metAppend(char* buf, int size, int* len, const char* fmt, ...)
+{
+	if(*len >= size - 1)
+	{
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf + *len, size - *len, fmt, args);
+	va_end(args);
+	*len = n < 0 ? *len : *len + n < size - 1 ? *len + n : size - 1;
+}
+
+void metHeader(char* buf, int size, int* len, const MetDef* defs, int i, const char* type)
+{
+	if(i == 0 || strcmp(defs[i].name, defs[i - 1].name))
+	{
+		metAppend(buf, size, len, "# HELP %s %s\n# TYPE %s %s\n", defs[i].name, defs[i].help, defs[i].name, type);
+	}
+}
+
+int metPrint(char* buf, int size, const char* name, const char* type, const char* help, const char* labels, double v)
+{
+	int len = 0;
+	if(help != NULL)
+	{
+		metAppend(buf, size, &len, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	}
+	metAppend(buf, size, &len, labels[0] ? "%s{%s} %.17g\n" : "%s%s %.17g\n", name, labels, v);
+	return len;
+}
+
+int metricsText(char* buf, int size)
+{
+	int len = 0;
+	int nshards = __atomic_load_n(&met_nshards, __ATOMIC_RELAXED);
+	nshards = nshards < MET_MAX_THREADS ? nshards : MET_MAX_THREADS;
+	
+	for(int i = 0; i < MC_COUNT; ++i)
+	{
+		unsigned long long v = 0;
+		for(int s = 0; s < nshards; ++s)
+		{
+			v += __atomic_load_n(&met_shards[s].counters[i], __ATOMIC_RELAXED);
+		}
+		metHeader(buf, size, &len, met_counters, i, "counter");
+		const MetDef* d = met_counters + i;
+		metAppend(buf, size, &len, d->labels[0] ? "%s{%s} %llu\n" : "%s%s %llu\n", d->name, d->labels, v);
+	}
+	
+	for(int i = 0; i < MH_COUNT; ++i)
+	{
+		unsigned long long buckets[MET_BUCKETS] = {}, sum = 0;
+		for(int s = 0; s < nshards; ++s)
+		{
+			const MetHist* h = met_shards[s].hists + i;
+			for(int b = 0; b < MET_BUCKETS; ++b)
+			{
+				buckets[b] += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+			}
+			sum += __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+		}
+		
+		metHeader(buf, size, &len, met_hists, i, "histogram");
+		const MetDef* d = met_hists + i;
+		const char* sep = d->labels[0] ? "," : "";
+		unsigned long long cum = 0; // Count is the sum of buckets, so it always agrees with them
+		for(int b = 0; b < MET_BUCKETS; ++b)
+		{
+			cum += buckets[b];
+			if(b < MET_BUCKETS - 1)
+			{
+				metAppend(buf, size, &len, "%s_bucket{%s%sle=\"%g\"} %llu\n", d->name, d->labels, sep, met_bounds[b]/1e9, cum);
+			}
+			else
+			{
+				metAppend(buf, size, &len, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", d->name, d->labels, sep, cum);
+			}
+		}
+		const char* fmt = d->labels[0] ? "%s_sum{%s} %.9f\n%s_count{%s} %llu\n" : "%s_sum%s %.9f\n%s_count%s %llu\n";
+		metAppend(buf, size, &len, fmt, d->name, d->labels, sum/1e9, d->name, d->labels, cum);
+	}
+	
+	for(int i = 0; i < MG_COUNT; ++i)
+	{
+		metHeader(buf, size, &len, met_gauges, i, "gauge");
+		const MetDef* d = met_gauges + i;
+		long long v = __atomic_load_n(&met_gauges_v[i], __ATOMIC_RELAXED);
+		metAppend(buf, size, &len, d->labels[0] ? "%s{%s} %lld\n" : "%s%s %lld\n", d->name, d->labels, v);
+	}
+	return len;
+}
@@ -0,0 +1,51 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#define MET_MAX_THREADS 32    // Threads with their own shard, later ones share the last one
+#define MET_BUCKETS     15    // Histogram buckets, last one is +Inf
+#define MET_TEXT_MAX    32768 // Whole /metrics page
+
+// Counters
+#define MC_SENSOR_ERR_HTU 0
+#define MC_SENSOR_ERR_SHT 1
+#define MC_SENSOR_ERR_CO2 2
+#define MC_WEB_BYTES      3
+#define MC_WEB_WRITE_ERR  4
+#define MC_LOG_DEFERRED   5
+#define MC_COUNT          6
+
+// Histograms of durations
+#define MH_LOOP_PERIOD    0
+#define MH_TH_PERIOD      1
+#define MH_LOOP_JITTER    2
+#define MH_TH_JITTER      3
+#define MH_SENSOR_HTU     4
+#define MH_SENSOR_SHT     5
+#define MH_SENSOR_CO2     6
+#define MH_WEB_PUT_WAIT   7
+#define MH_WEB_QUEUE_WAIT 8
+#define MH_LCD_PUSH       9
+#define MH_LOG_FLUSH      10
+#define MH_COUNT          11
+
+// Gauges, current levels shared by all threads
+#define MG_WEB_QUEUE      0
+#define MG_WEB_CLIENTS    1
+#define MG_CO2_AGE        2
+#define MG_CO2_STALE      3
+#define MG_CO2_PERIOD     4
+#define MG_COUNT          5
+
+// Hot path side is a relaxed atomic add into the calling thread's own cache lines: no locks, no sharing.
+// Collection sums all shards, so a scrape may miss updates that are in flight, never corrupt them.
+unsigned long long metNow(); // CLOCK_MONOTONIC in nanoseconds
+void metAdd(int counter, unsigned long long v);
+void metObserve(int hist, unsigned long long ns);
+void metGaugeAdd(int gauge, long long d);
+void metGaugeSet(int gauge, long long v);
+
+// Prometheus text format (0.0.4), return number of characters written
+int metricsText(char* buf, int size); // Every registered metric
+int metPrint(char* buf, int size, const char* name, const char* type, const char* help, const char* labels, double v);
+
+#endif /* METRICS_H */
@@ -0,0 +1,145 @@
+#include "Pwm.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "Logger.h"
+
+#define PWM_EXPORT_TRIES 20 // udev sets permissions of exported channel a bit later
+
+bool pwmWrite(PwmChan* p, int fd, unsigned int val);
+
+int pwmChannelOfPin(int bcm_pin)
+{
+	switch(bcm_pin)
+	{
+	case 12:
+	case 18:
+		return 0;
+	case 13:
+	case 19:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+bool pwmOpen(PwmChan* p, const char* chip, int chan)
+{
+	memset(p, 0, sizeof(PwmChan));
+	p->period_fd = p->duty_fd = p->enable_fd = -1;
+	
+	char path[256];
+	snprintf(path, sizeof(path), "%s/pwm%d/period", chip, chan);
+	if(access(path, W_OK))
+	{
+		char exp[256], ch[16];
+		snprintf(exp, sizeof(exp), "%s/export", chip);
+		int fd = open(exp, O_WRONLY);
+		if(fd < 0)
+		{
+			return false; // No PWM on this board, not an error
+		}
+		int len = snprintf(ch, sizeof(ch), "%d\n", chan);
+		bool ok = write(fd, ch, len) == len;
+		close(fd);
+		
+		for(int i = 0; ok && i < PWM_EXPORT_TRIES && access(path, W_OK); ++i)
+		{
+			struct timespec ts = { 0, 10000000 };
+			nanosleep(&ts, NULL);
+		}
+	}
+	
+	p->period_fd = open(path, O_WRONLY);
+	snprintf(path, sizeof(path), "%s/pwm%d/duty_cycle", chip, chan);
+	p->duty_fd = open(path, O_WRONLY);
+	snprintf(path, sizeof(path), "%s/pwm%d/enable", chip, chan);
+	p->enable_fd = open(path, O_WRONLY);
+	
+	if(p->period_fd < 0 || p->duty_fd < 0 || p->enable_fd < 0)
+	{
+		logError("PWM: can't open exported channel", errno);
+		pwmClose(p);
+		return false;
+	}
+	
+	// Period can't be 0 while enabled, any valid one will do until the first note
+	if(!pwmWrite(p, p->duty_fd, 0) || !pwmWrite(p, p->period_fd, 1000000) || !pwmWrite(p, p->enable_fd, 1))
+	{
+		logError("PWM: can't enable channel", errno);
+		pwmClose(p);
+		return false;
+	}
+	p->period = 1000000;
+	return true;
+}
+
+bool pwmTone(PwmChan* p, int freq)
+{
+	if(freq <= 0)
+	{
+		if(!p->duty)
+		{
+			return true;
+		}
+		p->duty = 0;
+		return pwmWrite(p, p->duty_fd, 0);
+	}
+	
+	unsigned int period = 1000000000u/freq;
+	unsigned int duty = period/2;
+	
+	// Kernel rejects duty_cycle above period, so order of the writes depends on the direction of change
+	if(period != p->period && period < p->duty)
+	{
+		if(!pwmWrite(p, p->duty_fd, duty) || !pwmWrite(p, p->period_fd, period))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		if(period != p->period && !pwmWrite(p, p->period_fd, period))
+		{
+			return false;
+		}
+		if(duty != p->duty && !pwmWrite(p, p->duty_fd, duty))
+		{
+			return false;
+		}
+	}
+	p->period = period;
+	p->duty = duty;
+	return true;
+}
+
+void pwmClose(PwmChan* p)
+{
+	if(p->duty_fd >= 0 && p->enable_fd >= 0)
+	{
+		pwmWrite(p, p->duty_fd, 0);
+		pwmWrite(p, p->enable_fd, 0);
+	}
+	
+	int* fds[] = { &p->period_fd, &p->duty_fd, &p->enable_fd };
+	for(int i = 0; i < 3; ++i)
+	{
+		if(*fds[i] >= 0)
+		{
+			close(*fds[i]);
+		}
+		*fds[i] = -1;
+	}
+}
+
+// pwrite at offset 0, so plain files used instead of sysfs always start with the last value
+bool pwmWrite(PwmChan* p, int fd, unsigned int val)
+{
+	char buf[16];
+	int len = snprintf(buf, sizeof(buf), "%u\n", val);
+	++p->writes;
+	return pwrite(fd, buf, len, 0) == len;
+}
@@ -0,0 +1,23 @@
+#ifndef PWM_H
+#define PWM_H
+
+#define PWM_CHIP "/sys/class/pwm/pwmchip0" // BCM2835 PWM with dtoverlay=pwm or pwm-2chan
+
+// One channel of Linux sysfs PWM. Files are kept open, every change is a single write.
+// Any directory with export and pwmN/{period,duty_cycle,enable} files works, so tests can use plain files.
+struct PwmChan
+{
+	int period_fd;
+	int duty_fd;
+	int enable_fd;
+	unsigned int period; // ns, as last written
+	unsigned int duty;   // ns, as last written
+	unsigned int writes; // Sysfs writes since pwmOpen()
+};
+
+int pwmChannelOfPin(int bcm_pin); // PWM channel wired to GPIO pin, -1 if pin has no hardware PWM
+bool pwmOpen(PwmChan* p, const char* chip, int chan); // Exports channel when needed, enables it silent
+bool pwmTone(PwmChan* p, int freq); // 50% square wave of freq Hz, 0 silences. At most 2 writes, 1 for silence.
+void pwmClose(PwmChan* p);          // Silences and disables channel
+
+#endif /* PWM_H */
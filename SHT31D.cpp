@@ -1,26 +1,15 @@
 #include "SHT31D.h"
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
 #include <wiringPi.h> // For delay(1)
 #include <errno.h>
 #include "Logger.h"
 
 const unsigned char cmd_measure[2]    = { 0x2C, 0x06 }; // Single shot mode, blocking
+const unsigned char cmd_measure_m[2]  = { 0x2C, 0x0D }; // Single shot mode, blocking, medium repeatability
 const unsigned char cmd_soft_reset[2] = { 0x30, 0xA2 };
 
-SHT31D::SHT31D()
+SHT31D::SHT31D(I2CBus* bus) : I2CTHSensor(bus, 0x44), cmd_measure_(cmd_measure)
 {
-	addr_ = 0x44; // Unshifted(to the left by 1 bit for R/W bit) 7-bit I2C address for the sensor
-	int fres = ioctl(i2c_fs_, I2C_SLAVE, addr_);
-	if(fres < 0)
-	{
-		logError("SHT31D: Error acquiring bus access and/or talking to the slave", errno);
-		close(i2c_fs_);
-		return;
-	}
 }
 
 int SHT31D::Measure()
@@ -30,18 +19,10 @@ int SHT31D::Measure()
 	temp_ = bad_humd_temp;
 	humd_ = bad_humd_temp;
 	
-	// Request both temp and humidity measurements
-	int fres = write(i2c_fs_, &cmd_measure, 2);
-	if(fres != 2)
+	// Request both temp and humidity measurements, clock stretching holds the read until they are ready
+	if(bus_->Transfer(addr_, cmd_measure_, 2, data, 6) < 0)
 	{
-		logError("SHT31D: Error writing to the I2C bus", errno);
-		return -1;
-	}
-	
-	fres = read(i2c_fs_, data, 6);
-	if(fres != 6)
-	{
-		logError("SHT31D: Error reading from the I2C bus", errno);
+		logError("SHT31D: Error measuring on the I2C bus", errno);
 		return -1;
 	}
 	
@@ -62,13 +43,19 @@ int SHT31D::Measure()
 
 void SHT31D::SoftReset()
 {
-	write(i2c_fs_, &cmd_soft_reset, 2);
+	bus_->Write(addr_, cmd_soft_reset, 2);
 	delay(16);
 }
 
+// High repeatability takes up to 15 ms, medium up to 6 ms
+void SHT31D::SetFastMode(bool fast)
+{
+	cmd_measure_ = fast ? cmd_measure_m : cmd_measure;
+}
+
 // This is very unconvetional SRC-8 algorithm
 // IDK how this works, but it works... Only Chinese programmers know it secrets!
-unsigned char SHT31D::CheckSum(unsigned char* data)
+unsigned char SHT31D::CheckSum(const unsigned char* data)
 {
 	/*
         Polynomial: 0x31 (x8 + x5 + x4 + 1) -> NOT CORRECT!
@@ -6,12 +6,16 @@
 class SHT31D : public I2CTHSensor
 {
 public:
-	SHT31D();
+	SHT31D(I2CBus* bus);
 	~SHT31D() = default;
 	int Measure();
 	void SoftReset();
+	void SetFastMode(bool fast);
+	static unsigned char CheckSum(const unsigned char* data); // CRC of 2 data bytes
+	
 private:
-	unsigned char CheckSum(unsigned char* data);
+	// Data
+	const unsigned char* cmd_measure_;
 };
 
 #endif /* SHT31D_H */
\ No newline at end of file
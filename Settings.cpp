@@ -0,0 +1,76 @@
+#include "Settings.h"
+#include <sched.h>
+#include <pthread.h>
+#include "Buzzer.h"
+
+#define SET_WORDS (int)(sizeof(Settings)/sizeof(int))
+
+// Sequence is odd while writer is copying new values in, reader retries if it saw odd or changed sequence.
+// Fields are copied with relaxed atomic loads/stores, so a torn copy is only ever discarded, never used.
+unsigned int settings_seq;
+Settings settings_data = { 0, 0, 1000 /*ASHRAE 2006 / EN 13779:2008 / WHO 1990*/, 30, 50, 20, 27, SNG_BEEP, 5 };
+pthread_mutex_t settings_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void getSettings(Settings* s)
+{
+	const int* src = (const int*)&settings_data;
+	int* dst = (int*)s;
+	
+	while(1)
+	{
+		unsigned int seq = __atomic_load_n(&settings_seq, __ATOMIC_ACQUIRE);
+		if(!(seq & 1))
+		{
+			for(int i = 0; i < SET_WORDS; ++i)
+			{
+				dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+			}
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(__atomic_load_n(&settings_seq, __ATOMIC_RELAXED) == seq)
+			{
+				return;
+			}
+		}
+		sched_yield(); // Writer could be preempted in the middle, don't spin on one core
+	}
+}
+
+unsigned int settingsVersion()
+{
+	return __atomic_load_n(&settings_data.version, __ATOMIC_ACQUIRE);
+}
+
+void editSettings(Settings* s)
+{
+	pthread_mutex_lock(&settings_write_lock);
+	*s = settings_data; // Only writers change it and this one holds the lock
+}
+
+void commitSettings(const Settings* s)
+{
+	const int* src = (const int*)s;
+	int* dst = (int*)&settings_data;
+	unsigned int seq = settings_seq;
+	
+	__atomic_store_n(&settings_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for(int i = 1; i < SET_WORDS; ++i) // Version goes last
+	{
+		__atomic_store_n(dst + i, src[i], __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&settings_data.version, settings_data.version + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&settings_seq, seq + 2, __ATOMIC_RELEASE);
+	
+	pthread_mutex_unlock(&settings_write_lock);
+}
+
+int settingsDiff(const Settings* a, const Settings* b)
+{
+	int diff = 0;
+	diff |= a->lcd_on_off_time != b->lcd_on_off_time ? SET_LCD : 0;
+	diff |= a->co2_warning != b->co2_warning || a->humd_warning_low != b->humd_warning_low ||
+	a->humd_warning_high != b->humd_warning_high || a->temp_warning_low != b->temp_warning_low ||
+	a->temp_warning_high != b->temp_warning_high ? SET_WARN : 0;
+	diff |= a->co2_warning_song != b->co2_warning_song ? SET_SOUND : 0;
+	return diff;
+}
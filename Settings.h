@@ -0,0 +1,30 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+// Groups of settings, web clients get one event per changed group
+#define SET_LCD   0x1
+#define SET_WARN  0x2
+#define SET_SOUND 0x4
+
+// Runtime settings, published as one immutable snapshot. Readers copy it without locks (seqlock),
+// writers are serialized and every commit bumps the version. Only 32 bit fields, see Settings.cpp.
+struct Settings
+{
+	unsigned int version;  // Number of commits, 0 means built-in defaults
+	int lcd_on_off_time;   // 2 MSB - ON time, 2 LSB - OFF time (Both: B1 - h, B2 - m)
+	int co2_warning;
+	int humd_warning_low;
+	int humd_warning_high;
+	int temp_warning_low;
+	int temp_warning_high;
+	int co2_warning_song;
+	int co2_req_period;    // Seconds between CO2 sensor requests
+};
+
+void getSettings(Settings* s);   // Consistent snapshot, never takes a lock
+unsigned int settingsVersion();  // Cheap check whether snapshot is still current
+void editSettings(Settings* s);  // Locks out other writers until commitSettings(), s gets current values
+void commitSettings(const Settings* s); // Publishes s as the next version
+int settingsDiff(const Settings* a, const Settings* b); // SET_* groups that differ
+
+#endif /* SETTINGS_H */
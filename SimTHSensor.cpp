@@ -0,0 +1,48 @@
+#include "SimTHSensor.h"
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#define SIM_GLITCH_EVERY 997 // Samples between checksum-passing garbage readings
+
+SimTHSensor::SimTHSensor(float bias, unsigned int seed) : I2CTHSensor(0, 0), bias_(bias), seed_(seed), count_(0),
+fast_(false), delay_(true)
+{
+}
+
+int SimTHSensor::Measure()
+{
+	if(delay_) // Same as HTU21D/SHT31D conversion times, normal and fast modes
+	{
+		struct timespec conv = { 0, fast_ ? 8000000 : 20000000 };
+		nanosleep(&conv, NULL);
+	}
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	float t = (float)(now.tv_sec % 3600) + now.tv_nsec/1000000000.0f;
+	
+	// 10 minutes period oscillation, like a thermostat cycling
+	float phase = t * 2.0f * (float)M_PI/600.0f;
+	temp_ = 24.0f + 1.5f * sinf(phase) + bias_ + Noise(fast_ ? 0.08f : 0.04f);
+	humd_ = 40.0f - 5.0f * sinf(phase) + bias_ * 2.0f + Noise(fast_ ? 0.3f : 0.15f);
+	
+	if(++count_ % SIM_GLITCH_EVERY == 0)
+	{
+		temp_ -= 7.5f;
+		humd_ += 20.0f;
+	}
+	
+	return 0;
+}
+
+// Sum of 4 uniforms is close enough to normal distribution for simulation
+float SimTHSensor::Noise(float sigma)
+{
+	float s = 0.0f;
+	for(int i = 0; i < 4; ++i)
+	{
+		s += (float)rand_r(&seed_)/RAND_MAX - 0.5f;
+	}
+	return s * sigma * 1.732f; // Variance of the sum is 4/12
+}
@@ -0,0 +1,30 @@
+#ifndef SIMTHSENSOR_H
+#define SIMTHSENSOR_H
+
+#include "I2CTHSensor.h"
+
+// Simulated temperature/humidity sensor for running without Raspberry Pi hardware (SIM_SENSORS build)
+// and for benchmarks. Produces slowly changing room climate with noise, own bias and rare glitches,
+// sleeps for the same conversion time a real sensor would hold the bus for.
+class SimTHSensor : public I2CTHSensor
+{
+public:
+	SimTHSensor(float bias, unsigned int seed);
+	~SimTHSensor() = default;
+	int Measure();
+	void SoftReset() {}
+	void SetFastMode(bool fast) { fast_ = fast; }
+	void SetConversionDelay(bool on) { delay_ = on; }
+	
+private:
+	float Noise(float sigma);
+	
+	// Data
+	float bias_;
+	unsigned int seed_;
+	unsigned int count_;
+	bool fast_;
+	bool delay_;
+};
+
+#endif /* SIMTHSENSOR_H */
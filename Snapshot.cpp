@@ -0,0 +1,314 @@
+#include "Snapshot.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ThreadPool.h"
+
+#define SNAP_MAX_AGE_S 600   // Older readings are not shown after start, sensors will have new ones in seconds
+#define SNAP_STACK     65536 // State is copied into a static buffer, not on stack
+#define SNAP_EXIT_MS   2000  // Periodic save that is in progress on shutdown
+#define BOOT_ID_PATH   "/proc/sys/kernel/random/boot_id"
+
+char snap_path[256];
+char snap_tmp_path[256 + 4];
+const SnapFile* snap_map; // Valid snapshot this process started from, NULL on cold start
+size_t snap_map_size;
+char boot_id[40];
+unsigned long long snap_t0; // initSnapshot(), ms
+
+pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER; // Guards readings, timers and stats
+int snap_ppm = -1;
+float snap_humd, snap_temp;
+unsigned long long snap_next_ms; // Next periodic save
+bool snap_marked[WARM_FIRST_REQUEST + 1];
+WarmStats snap_stats;
+
+pthread_mutex_t snap_save_lock = PTHREAD_MUTEX_INITIALIZER; // Periodic and shutdown saves share the buffer
+SnapFile snap_buf;
+ThreadPool snap_pool;
+
+unsigned long long snapNowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec/1000000;
+}
+
+// FNV-1a over 32 bit words of everything after the sum field
+unsigned int snapSum(const SnapFile* s)
+{
+	const unsigned int* w = (const unsigned int*)((const char*)s + offsetof(SnapFile, saved));
+	size_t n = (sizeof(SnapFile) - offsetof(SnapFile, saved))/sizeof(unsigned int);
+	unsigned int h = 2166136261u;
+	for(size_t i = 0; i < n; ++i)
+	{
+		h = (h ^ w[i]) * 16777619u;
+	}
+	return h;
+}
+
+void readBootId(char* out, size_t size)
+{
+	memset(out, 0, size);
+	FILE* f = fopen(BOOT_ID_PATH, "r");
+	if(f != NULL)
+	{
+		if(fgets(out, size, f) == NULL)
+		{
+			out[0] = '\0';
+		}
+		fclose(f);
+	}
+}
+
+bool initSnapshot(const char* path)
+{
+	snap_t0 = snapNowMs();
+	snprintf(snap_path, sizeof(snap_path), "%s", path);
+	snprintf(snap_tmp_path, sizeof(snap_tmp_path), "%s.tmp", snap_path);
+	readBootId(boot_id, sizeof(boot_id));
+	memset(&snap_stats, 0, sizeof(WarmStats));
+	memset(snap_marked, 0, sizeof(snap_marked));
+	snap_next_ms = snap_t0 + SNAP_PERIOD_S * 1000ULL;
+	
+	// Mapping instead of reading: pages are only touched by checksum and by whoever resumes from them
+	struct timespec beg, end;
+	clock_gettime(CLOCK_MONOTONIC, &beg);
+	int fd = open(snap_path, O_RDONLY);
+	struct stat st;
+	if(fd >= 0 && fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(SnapFile))
+	{
+		void* map = mmap(NULL, sizeof(SnapFile), PROT_READ, MAP_SHARED, fd, 0);
+		const SnapFile* s = (const SnapFile*)map;
+		if(map == MAP_FAILED)
+		{
+			logError("Snapshot: can't map it, cold start", errno);
+		}
+		else if(s->magic != SNAP_MAGIC || s->version != SNAP_VERSION || s->size != sizeof(SnapFile) || s->sum != snapSum(s))
+		{
+			logError("Snapshot: invalid or from other version, cold start", 0);
+			munmap(map, sizeof(SnapFile));
+		}
+		else
+		{
+			snap_map = s;
+			snap_map_size = sizeof(SnapFile);
+		}
+	}
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	snap_stats.load_us = (end.tv_sec - beg.tv_sec) * 1000000 + (end.tv_nsec - beg.tv_nsec)/1000;
+	snap_stats.warm = snap_map != NULL;
+	if(snap_map != NULL)
+	{
+		unsigned int now = (unsigned int)time(NULL);
+		snap_stats.age_s = now > snap_map->saved ? now - snap_map->saved : 0;
+		
+		Settings set;
+		editSettings(&set);
+		set = snap_map->settings; // Version is bumped by commit, not taken from the file
+		commitSettings(&set);
+	}
+	
+	poolInit(&snap_pool, "snap", 1, 1, SNAP_STACK);
+	return snap_map != NULL;
+}
+
+void deinitSnapshot()
+{
+	poolDeinit(&snap_pool, SNAP_EXIT_MS);
+	saveSnapshot(true);
+	
+	if(snap_map != NULL)
+	{
+		munmap((void*)snap_map, snap_map_size);
+		snap_map = NULL;
+	}
+}
+
+const LogState* warmLog()
+{
+	return snap_map != NULL ? &snap_map->log : NULL;
+}
+
+bool warmReadings(int* ppm, float* humd, float* temp)
+{
+	if(snap_map == NULL || snap_map->ppm < 0 || snap_stats.age_s > SNAP_MAX_AGE_S)
+	{
+		return false;
+	}
+	*ppm = snap_map->ppm;
+	*humd = snap_map->humd;
+	*temp = snap_map->temp;
+	return true;
+}
+
+bool warmPanel()
+{
+	return snap_map != NULL && snap_map->clean && boot_id[0] && !strncmp(boot_id, snap_map->boot_id, sizeof(boot_id));
+}
+
+void snapSaveTask(void* param)
+{
+	saveSnapshot(false);
+}
+
+void snapshotTick(int ppm, float humd, float temp)
+{
+	unsigned long long now = snapNowMs();
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&snap_lock);
+	
+	snap_ppm = ppm;
+	snap_humd = humd;
+	snap_temp = temp;
+	bool due = now >= snap_next_ms;
+	
+	pthread_mutex_unlock(&snap_lock);
+	// Critical Section End
+	
+	// Refused only while previous save still runs, then it's retried with next update
+	if(due && poolSubmit(&snap_pool, snapSaveTask, NULL))
+	{
+		// Critical Section Beg
+		pthread_mutex_lock(&snap_lock);
+		
+		snap_next_ms = now + SNAP_PERIOD_S * 1000ULL;
+		
+		pthread_mutex_unlock(&snap_lock);
+		// Critical Section End
+	}
+}
+
+bool saveSnapshot(bool clean)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&snap_save_lock);
+	
+	struct timespec beg, end;
+	clock_gettime(CLOCK_MONOTONIC, &beg);
+	
+	SnapFile* s = &snap_buf;
+	memset(s, 0, offsetof(SnapFile, log));
+	s->magic = SNAP_MAGIC;
+	s->version = SNAP_VERSION;
+	s->size = sizeof(SnapFile);
+	s->saved = (unsigned int)time(NULL);
+	s->clean = clean ? 1 : 0;
+	memcpy(s->boot_id, boot_id, sizeof(s->boot_id));
+	getSettings(&s->settings);
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&snap_lock);
+	
+	s->ppm = snap_ppm;
+	s->humd = snap_humd;
+	s->temp = snap_temp;
+	
+	pthread_mutex_unlock(&snap_lock);
+	// Critical Section End
+	
+	getLogState(&s->log);
+	s->sum = snapSum(s);
+	
+	// Same as config: temp file, flushed to disk and renamed, so there is always one whole snapshot
+	bool ok = false;
+	int fd = open(snap_tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd >= 0)
+	{
+		const char* p = (const char*)s;
+		size_t left = sizeof(SnapFile);
+		while(left)
+		{
+			ssize_t n = write(fd, p, left);
+			if(n <= 0 && errno != EINTR)
+			{
+				break;
+			}
+			p += n > 0 ? n : 0;
+			left -= n > 0 ? n : 0;
+		}
+		ok = !left && fsync(fd) == 0;
+		ok = close(fd) == 0 && ok;
+		ok = ok && rename(snap_tmp_path, snap_path) == 0;
+	}
+	if(!ok)
+	{
+		logError("Snapshot: save failed", errno);
+		unlink(snap_tmp_path);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	pthread_mutex_unlock(&snap_save_lock);
+	// Critical Section End
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&snap_lock);
+	
+	snap_stats.saves += ok ? 1 : 0;
+	snap_stats.save_errors += ok ? 0 : 1;
+	snap_stats.last_save_us = (end.tv_sec - beg.tv_sec) * 1000000 + (end.tv_nsec - beg.tv_nsec)/1000;
+	
+	pthread_mutex_unlock(&snap_lock);
+	// Critical Section End
+	return ok;
+}
+
+void warmMark(int event)
+{
+	if(!snap_t0 || event < 0 || event > WARM_FIRST_REQUEST)
+	{
+		return; // Snapshot isn't used by this program
+	}
+	unsigned long long dt = snapNowMs() - snap_t0;
+	unsigned int ms = dt ? (unsigned int)dt : 1; // 0 means not yet
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&snap_lock);
+	
+	if(!snap_marked[event])
+	{
+		snap_marked[event] = true;
+		switch(event)
+		{
+		case WARM_LOG_RESUMED:
+			snap_stats.log_warm = true;
+			// Fall through
+		case WARM_LOG_READ:
+			snap_stats.log_ms = ms;
+			break;
+		case WARM_FIRST_FRAME:
+			snap_stats.first_frame_ms = ms;
+			break;
+		case WARM_FIRST_REQUEST:
+			snap_stats.first_request_ms = ms;
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&snap_lock);
+	// Critical Section End
+}
+
+void getWarmStats(WarmStats* st)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&snap_lock);
+	
+	*st = snap_stats;
+	
+	pthread_mutex_unlock(&snap_lock);
+	// Critical Section End
+}
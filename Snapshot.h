@@ -0,0 +1,61 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "Settings.h"
+#include "Logger.h"
+
+#define SNAP_PATH     "./log/state.snap"
+#define SNAP_MAGIC    0x53535752 // "RWSS"
+#define SNAP_VERSION  2
+#define SNAP_PERIOD_S 300        // Same as logger file writes
+
+// Start-up events for warmMark()
+#define WARM_LOG_READ      0 // Logger ring read from database file
+#define WARM_LOG_RESUMED   1 // Logger ring taken from snapshot
+#define WARM_FIRST_FRAME   2
+#define WARM_FIRST_REQUEST 3
+
+// Snapshot file, written whole with temp file + rename and mapped read-only on start
+struct SnapFile
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int size;  // Whole file
+	unsigned int sum;   // Of everything after this field
+	unsigned int saved; // UNIX time
+	unsigned int clean; // Written on shutdown, after display was put to sleep
+	char boot_id[40];   // Kernel boot the snapshot was taken in, panel kept its power if it's the same
+	Settings settings;
+	int ppm;            // Last published readings
+	float humd;
+	float temp;
+	LogState log;
+};
+
+struct WarmStats
+{
+	bool warm;                     // Valid snapshot was found
+	bool log_warm;                 // Logger ring came from it, database file wasn't read
+	unsigned int age_s;            // Age of the snapshot at start
+	unsigned int load_us;          // Map and check it
+	unsigned int saves;
+	unsigned int save_errors;
+	unsigned int last_save_us;
+	unsigned int log_ms;           // From initSnapshot() to logger ring ready, 0 until then
+	unsigned int first_frame_ms;   // ... to the first frame on the panel
+	unsigned int first_request_ms; // ... to the first response to a web client
+};
+
+// Maps and checks the snapshot and commits its settings (config file loaded after it still wins).
+// Must be called first, it's also the reference point of start-up times. Returns true if snapshot is usable.
+bool initSnapshot(const char* path = SNAP_PATH);
+void deinitSnapshot(); // Stops periodic saves and writes the clean shutdown snapshot
+const LogState* warmLog(); // Logger ring to resume from, NULL on cold start
+bool warmReadings(int* ppm, float* humd, float* temp); // Last readings, if they are recent enough to show
+bool warmPanel(); // Display was put to sleep by clean shutdown in this boot, so it needs no long reset wait
+void snapshotTick(int ppm, float humd, float temp); // Every update, saves periodically on its own thread
+bool saveSnapshot(bool clean);
+void warmMark(int event); // Only the first call of each event counts
+void getWarmStats(WarmStats* st);
+
+#endif /* SNAPSHOT_H */
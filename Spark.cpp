@@ -0,0 +1,112 @@
+#include "Spark.h"
+#include <stdlib.h>
+#include <string.h>
+
+Sparkline::Sparkline(int w, int h, float lo, float hi) :
+w_(w), h_(h), lo_(lo), hi_(hi), rg_(0xFF), gb_(0xFF), col_t_(0), min_(0.0f), max_(0.0f), prev_row_(-1),
+last_row_(-1), empty_(true), scrolls_(0)
+{
+	img_ = (unsigned char*)malloc(w * h * 3 + 4);
+	unsigned short* wp = (unsigned short*)img_;
+	unsigned short* hp = (unsigned short*)(img_+2);
+	*wp = (unsigned short)w;
+	*hp = (unsigned short)h;
+	
+	for(int i = 4; i < w * h * 3 + 4; i+=3)
+	{
+		img_[i] = rg_;
+		img_[i+1] = gb_;
+		img_[i+2] = 0x00; // Fully transparent
+	}
+}
+
+Sparkline::~Sparkline()
+{
+	free(img_);
+}
+
+void Sparkline::Add(float v, unsigned int t)
+{
+	if(empty_ && !scrolls_) // Very first sample starts the time grid
+	{
+		col_t_ = t;
+	}
+	
+	if(t >= col_t_ + SPARK_COL_S)
+	{
+		unsigned int cols = (t - col_t_)/SPARK_COL_S;
+		col_t_ += cols * SPARK_COL_S;
+		if(!empty_)
+		{
+			prev_row_ = cols == 1 ? last_row_ : -1; // Line isn't joined over gaps
+		}
+		empty_ = true;
+		Scroll(cols > (unsigned int)w_ ? w_ : (int)cols);
+	}
+	
+	if(empty_ || v < min_)
+	{
+		min_ = v;
+	}
+	if(empty_ || v > max_)
+	{
+		max_ = v;
+	}
+	empty_ = false;
+	last_row_ = Row(v);
+	DrawColumn();
+}
+
+void Sparkline::SetColor(unsigned char rg, unsigned char gb)
+{
+	if(rg == rg_ && gb == gb_)
+	{
+		return;
+	}
+	rg_ = rg;
+	gb_ = gb;
+	
+	for(int i = 4; i < w_ * h_ * 3 + 4; i+=3)
+	{
+		img_[i] = rg;
+		img_[i+1] = gb;
+	}
+}
+
+void Sparkline::Scroll(int cols)
+{
+	const int row_bs = w_ * 3;
+	const int keep_bs = (w_ - cols) * 3;
+	for(int y = 0; y < h_; ++y)
+	{
+		unsigned char* row = img_ + 4 + y * row_bs;
+		memmove(row, row + cols * 3, keep_bs);
+		for(int i = keep_bs; i < row_bs; i+=3)
+		{
+			row[i+2] = 0x00;
+		}
+	}
+	++scrolls_;
+}
+
+void Sparkline::DrawColumn()
+{
+	int top = Row(max_), bot = Row(min_);
+	if(prev_row_ >= 0) // Join with previous column, so fast changes stay a line instead of scattered dots
+	{
+		top = prev_row_ < top ? prev_row_ : top;
+		bot = prev_row_ > bot ? prev_row_ : bot;
+	}
+	
+	unsigned char* px = img_ + 4 + (w_ - 1) * 3 + 2;
+	for(int y = 0; y < h_; ++y, px += w_ * 3)
+	{
+		*px = y >= top && y <= bot ? 0xFF : 0x00;
+	}
+}
+
+int Sparkline::Row(float v) const // Top row is the highest value
+{
+	int r = (int)((hi_ - v)/(hi_ - lo_) * (h_ - 1) + 0.5f);
+	return r < 0 ? 0 : r >= h_ ? h_ - 1 : r;
+}
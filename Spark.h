@@ -0,0 +1,37 @@
+#ifndef SPARK_H
+#define SPARK_H
+
+#define SPARK_COL_S 300 // Seconds of history in one column
+
+// Scrolling trend plot of one reading, kept as ready to blend 32 bit sprite (2 B colour + alpha).
+// Each column spans min..max of its samples and joins the previous column, values are clamped to lo..hi.
+// New sample only redraws the newest column, when its time slot is over image moves one column left.
+class Sparkline
+{
+public:
+	Sparkline(int w, int h, float lo, float hi);
+	~Sparkline();
+	void Add(float v, unsigned int t); // t - UNIX time of the sample
+	void SetColor(unsigned char rg, unsigned char gb); // Only rewrites the image when colour changes
+	const unsigned char* GetImage() const { return img_; }
+	unsigned int GetScrolls() const { return scrolls_; }
+
+private:
+	void Scroll(int cols);
+	void DrawColumn();
+	int Row(float v) const;
+
+	// Data
+	unsigned char* img_; // Width/height, then w*h pixels
+	int w_, h_;
+	float lo_, hi_;
+	unsigned char rg_, gb_;
+	unsigned int col_t_; // Start of newest column time slot
+	float min_, max_;    // Of the newest column
+	int prev_row_;       // Last value of previous column, -1 if there is none
+	int last_row_;       // Last value of newest column
+	bool empty_;         // No samples in newest column yet
+	unsigned int scrolls_;
+};
+
+#endif /* SPARK_H */
@@ -0,0 +1,89 @@
+#include "SpiBatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+#define SPI_MIN_XFER   256
+
+int ioctlSpidev(int fd, unsigned long req, void* arg);
+
+SpiIoctl spi_ioctl = ioctlSpidev;
+
+int spiBufsiz()
+{
+	FILE* f = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+	if(f == NULL)
+	{
+		return SPI_DEF_BUFSIZ;
+	}
+	
+	int bs = 0;
+	if(fscanf(f, "%d", &bs) != 1 || bs <= 0)
+	{
+		bs = SPI_DEF_BUFSIZ;
+	}
+	fclose(f);
+	return bs;
+}
+
+int spiProbeXfer(int fd, const struct spi_ioc_transfer* tmpl)
+{
+	int bs = spiBufsiz();
+	bs = bs > SPI_MAX_XFER ? SPI_MAX_XFER : bs & ~3;
+	
+	unsigned char* zeros = (unsigned char*)calloc(bs, 1);
+	struct spi_ioc_transfer x = *tmpl;
+	x.tx_buf = (unsigned long)zeros;
+	x.rx_buf = 0;
+	x.cs_change = 0;
+	
+	for(; bs > SPI_MIN_XFER; bs /= 2)
+	{
+		x.len = bs;
+		if(spi_ioctl(fd, SPI_IOC_MESSAGE(1), &x) >= 0)
+		{
+			break;
+		}
+	}
+	
+	free(zeros);
+	return bs;
+}
+
+int spiWriteBatched(int fd, const struct spi_ioc_transfer* tmpl, const unsigned char* dat, int s, int xfer_bs, int msg_bs)
+{
+	struct spi_ioc_transfer xfers[SPI_MAX_XFERS];
+	int calls = 0;
+	
+	for(int i = 0; i < s; ++calls)
+	{
+		int n = 0, total = 0;
+		while(i < s && n < SPI_MAX_XFERS && total < msg_bs)
+		{
+			int len = s - i;
+			len = len > xfer_bs ? xfer_bs : len;
+			len = len > msg_bs - total ? msg_bs - total : len;
+			
+			xfers[n] = *tmpl;
+			xfers[n].tx_buf = (unsigned long)(dat + i);
+			xfers[n].rx_buf = 0;
+			xfers[n].len = len;
+			xfers[n].cs_change = 0;
+			
+			i += len;
+			total += len;
+			++n;
+		}
+		
+		if(spi_ioctl(fd, SPI_IOC_MESSAGE(n), xfers) < 0)
+		{
+			return -1;
+		}
+	}
+	return calls;
+}
+
+int ioctlSpidev(int fd, unsigned long req, void* arg)
+{
+	return ioctl(fd, req, arg);
+}
@@ -0,0 +1,24 @@
+#ifndef SPIBATCH_H
+#define SPIBATCH_H
+
+#include <linux/spi/spidev.h>
+
+#define SPI_DEF_BUFSIZ 4096  // spidev default, total of all transfers in one message can't exceed it
+#define SPI_MAX_XFER   65532 // BCM2835 controller limit for one transfer, kept 4 B aligned
+#define SPI_MAX_XFERS  32    // Transfers in one SPI_IOC_MESSAGE(N)
+
+// Everything goes through this hook, so benchmarks can replace spidev with a mock
+typedef int (*SpiIoctl)(int fd, unsigned long req, void* arg);
+extern SpiIoctl spi_ioctl;
+
+int spiBufsiz(); // spidev bufsiz module parameter, SPI_DEF_BUFSIZ if it can't be read
+
+// Largest transfer spidev really accepts, starts from bufsiz and halves it until transfer of zeros goes through.
+// Bus must be in a state where such data is ignored (ILI9341: after NOP command).
+int spiProbeXfer(int fd, const struct spi_ioc_transfer* tmpl);
+
+// Writes s Bs split into transfers of up to xfer_bs, packed into as few SPI_IOC_MESSAGE(N) as msg_bs allows.
+// Chip select stays asserted inside of a message. Returns number of ioctl calls or -1 on error.
+int spiWriteBatched(int fd, const struct spi_ioc_transfer* tmpl, const unsigned char* dat, int s, int xfer_bs, int msg_bs);
+
+#endif /* SPIBATCH_H */
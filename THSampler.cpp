@@ -0,0 +1,266 @@
+#include "THSampler.h"
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "Fusion.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+#define TAPS_MAX (2 * TH_MAX_RATE - 1)
+
+#define NSEC_PASSED(ts0, ts1) (((long long)ts1.tv_sec - ts0.tv_sec) * 1000000000LL + (ts1.tv_nsec - ts0.tv_nsec))
+
+// Decimating filter, equivalent to 2nd order CIC (boxcar convolved with boxcar) of rate R.
+// Triangular weights over the last 2R-1 samples suppress everything above 0.5 Hz much better
+// than plain averaging, while the gain stays exactly 1.
+struct Decimator
+{
+	float buff[TAPS_MAX];
+	int taps;
+	int rate;
+	int pos;
+};
+
+I2CTHSensor* th_sens[FUS_SENSORS];
+int th_rate;
+volatile bool sampler_running; // Changed under th_lock, so the sampler can't miss the wake up
+pthread_t th_thd;
+pthread_cond_t th_wake; // Sampler sleeps on it between rounds
+
+float th_humd, th_temp;
+bool th_ready;
+SamplerStats th_stats;
+pthread_mutex_t th_lock = PTHREAD_MUTEX_INITIALIZER; // Guards published sample and stats, also readable after deinit
+
+void* samplerThread(void* param);
+void decimInit(Decimator* d, int rate, float v);
+void decimPut(Decimator* d, float v);
+float decimOut(const Decimator* d);
+
+void initTHSampler(I2CTHSensor* sens1, I2CTHSensor* sens2, int rate_hz)
+{
+	th_sens[0] = sens1;
+	th_sens[1] = sens2;
+	th_rate = rate_hz < 1 ? 1 : rate_hz > TH_MAX_RATE ? TH_MAX_RATE : rate_hz;
+	
+	memset(&th_stats, 0, sizeof(SamplerStats));
+	th_stats.rate_hz = th_rate;
+	th_ready = false;
+	
+	bool fast = th_rate > 2;
+	th_sens[0]->SetFastMode(fast);
+	th_sens[1]->SetFastMode(fast);
+	
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&th_wake, &attr);
+	pthread_condattr_destroy(&attr);
+	
+	sampler_running = true;
+	pthread_create(&th_thd, NULL, samplerThread, NULL); // Joinable, sensors and bus must outlive the thread
+}
+
+void deinitTHSampler()
+{
+	if(!sampler_running)
+	{
+		return;
+	}
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&th_lock);
+	
+	sampler_running = false;
+	pthread_cond_signal(&th_wake);
+	
+	pthread_mutex_unlock(&th_lock);
+	// Critical Section End
+	pthread_join(th_thd, NULL);
+	pthread_cond_destroy(&th_wake);
+}
+
+bool getTHSample(float* humd, float* temp)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&th_lock);
+	
+	bool ready = th_ready;
+	*humd = th_humd;
+	*temp = th_temp;
+	
+	pthread_mutex_unlock(&th_lock);
+	// Critical Section End
+	return ready;
+}
+
+void getSamplerStats(SamplerStats* st)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&th_lock);
+	
+	*st = th_stats;
+	
+	pthread_mutex_unlock(&th_lock);
+	// Critical Section End
+}
+
+void* samplerThread(void* param)
+{
+	SensorFusion humd_fus(0.0025f, 0.04f, 4.0f, th_rate);
+	SensorFusion temp_fus(0.0004f, 0.01f, 4.0f, th_rate);
+	Decimator humd_dec, temp_dec;
+	
+	const long period_ns = 1000000000L/th_rate;
+	const int read_hist[FUS_SENSORS] = { MH_SENSOR_HTU, MH_SENSOR_SHT };
+	const int err_counter[FUS_SENSORS] = { MC_SENSOR_ERR_HTU, MC_SENSOR_ERR_SHT };
+	const char* const read_span[FUS_SENSORS] = { "htu21d_read", "sht31d_read" };
+	unsigned long long prev_ns = 0;
+	int phase = 0;
+	unsigned int samples = 0, failed = 0, overruns = 0;
+	long long bus_ns = 0;
+	
+	struct timespec next, win_beg, cpu_beg, mb, me;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	win_beg = next;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_beg);
+	
+	while(sampler_running)
+	{
+		float hs[FUS_SENSORS], ts[FUS_SENSORS];
+		bool ok[FUS_SENSORS];
+		
+		clock_gettime(CLOCK_MONOTONIC, &mb);
+		unsigned long long t = (unsigned long long)mb.tv_sec * 1000000000ULL + mb.tv_nsec;
+		if(prev_ns)
+		{
+			long long jit = (long long)(t - prev_ns) - period_ns;
+			metObserve(MH_TH_PERIOD, t - prev_ns);
+			metObserve(MH_TH_JITTER, jit < 0 ? -jit : jit);
+		}
+		prev_ns = t;
+		
+		for(int i = 0; i < FUS_SENSORS; ++i)
+		{
+			ok[i] = th_sens[i]->Measure() == 0;
+			hs[i] = th_sens[i]->GetHumd();
+			ts[i] = th_sens[i]->GetTemp();
+			
+			unsigned long long end = metNow();
+			metObserve(read_hist[i], end - t);
+			metAdd(err_counter[i], ok[i] ? 0 : 1);
+			traceAdd(read_span[i], t, end);
+			t = end;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &me);
+		bus_ns += NSEC_PASSED(mb, me);
+		++samples;
+		
+		// Sensor that glitches or drifts but still passes its checksum is filtered out here
+		unsigned long long fus_beg = traceBegin();
+		humd_fus.Update(hs, ok);
+		temp_fus.Update(ts, ok);
+		traceEnd("th_fuse", fus_beg);
+		failed += !ok[0] && !ok[1] ? 1 : 0;
+		
+		if(humd_fus.IsValid())
+		{
+			if(!th_ready) // Very first sample is published right away, so main loop doesn't start from zeroes
+			{
+				decimInit(&humd_dec, th_rate, humd_fus.GetValue());
+				decimInit(&temp_dec, th_rate, temp_fus.GetValue());
+				phase = th_rate - 1;
+			}
+			else
+			{
+				decimPut(&humd_dec, humd_fus.GetValue());
+				decimPut(&temp_dec, temp_fus.GetValue());
+			}
+			
+			if(++phase >= th_rate)
+			{
+				phase = 0;
+				
+				struct timespec now, cpu;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+				float wall = (float)NSEC_PASSED(win_beg, now);
+				
+				// Critical Section Beg
+				pthread_mutex_lock(&th_lock);
+				
+				th_humd = decimOut(&humd_dec);
+				th_temp = decimOut(&temp_dec);
+				th_ready = true;
+				th_stats.samples = samples;
+				th_stats.failed = failed;
+				th_stats.overruns = overruns;
+				th_stats.cpu_load = wall > 0.0f ? NSEC_PASSED(cpu_beg, cpu)/wall : 0.0f;
+				th_stats.bus_load = wall > 0.0f ? bus_ns/wall : 0.0f;
+				
+				pthread_mutex_unlock(&th_lock);
+				// Critical Section End
+				
+				win_beg = now;
+				cpu_beg = cpu;
+				bus_ns = 0;
+			}
+		}
+		
+		// Absolute deadlines, so sampling period doesn't drift with measurement time
+		next.tv_nsec += period_ns;
+		if(next.tv_nsec >= 1000000000L)
+		{
+			next.tv_nsec -= 1000000000L;
+			++next.tv_sec;
+		}
+		
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(NSEC_PASSED(now, next) < 0) // Sensors were too slow for this rate, skip missed slots
+		{
+			++overruns;
+			next = now;
+			continue;
+		}
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&th_lock);
+		
+		while(sampler_running && pthread_cond_timedwait(&th_wake, &th_lock, &next) == 0);
+		
+		pthread_mutex_unlock(&th_lock);
+		// Critical Section End
+	}
+	
+	return NULL;
+}
+
+void decimInit(Decimator* d, int rate, float v)
+{
+	d->rate = rate;
+	d->taps = 2 * rate - 1;
+	d->pos = 0;
+	for(int i = 0; i < d->taps; ++i)
+	{
+		d->buff[i] = v;
+	}
+}
+
+void decimPut(Decimator* d, float v)
+{
+	d->buff[d->pos] = v;
+	d->pos = (d->pos + 1) % d->taps;
+}
+
+// Only evaluated once per R samples, so O(R) here is O(1) per sample
+float decimOut(const Decimator* d)
+{
+	float sum = 0.0f;
+	for(int k = 0; k < d->taps; ++k)
+	{
+		int w = k < d->rate ? k + 1 : d->taps - k; // 1, 2 ... R ... 2, 1
+		sum += w * d->buff[(d->pos + k) % d->taps];
+	}
+	return sum/(d->rate * d->rate);
+}
@@ -0,0 +1,25 @@
+#ifndef THSAMPLER_H
+#define THSAMPLER_H
+
+#include "I2CTHSensor.h"
+
+#define TH_MAX_RATE 20 // Hz
+
+struct SamplerStats
+{
+	int rate_hz;           // Oversampling rate, decimated to 1 Hz
+	unsigned int samples;  // Total sampling rounds
+	unsigned int failed;   // Rounds where no sensor returned valid data
+	unsigned int overruns; // Rounds that didn't fit into sampling period
+	float cpu_load;        // Sampler thread CPU time / wall time, last second
+	float bus_load;        // Time spent inside sensor Measure() / wall time, last second
+};
+
+// Samples both temperature/humidity sensors at rate_hz on its own thread, fuses them and publishes
+// decimated 1 Hz value through getTHSample(). At more than 2 Hz sensors are switched to fast mode.
+void initTHSampler(I2CTHSensor* sens1, I2CTHSensor* sens2, int rate_hz);
+void deinitTHSampler();
+bool getTHSample(float* humd, float* temp); // Returns false until first sample is ready
+void getSamplerStats(SamplerStats* st);
+
+#endif /* THSAMPLER_H */
@@ -0,0 +1,267 @@
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include "Logger.h"
+
+void* poolWorker(void* param);
+
+unsigned long long poolNowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool poolInit(ThreadPool* p, const char* name, int nthreads, int queue_cap, size_t stack_size)
+{
+	memset(p, 0, sizeof(ThreadPool));
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	p->nthreads = nthreads < 1 ? 1 : nthreads > POOL_MAX_THREADS ? POOL_MAX_THREADS : nthreads;
+	p->queue_cap = queue_cap < 1 ? 1 : queue_cap > POOL_MAX_QUEUE ? POOL_MAX_QUEUE : queue_cap;
+	p->stats.threads = p->nthreads;
+	
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_condattr_t cattr;
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&p->wake, NULL);
+	pthread_cond_init(&p->gone, &cattr);
+	pthread_condattr_destroy(&cattr);
+	
+	// Default 8 MB stacks are only address space, but every thread still pins its touched pages and guard
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, stack_size < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : stack_size);
+	
+	bool ok = true;
+	for(int i = 0; i < p->nthreads; ++i)
+	{
+		PoolQueue* q = p->queues + i;
+		q->pool = p;
+		pthread_mutex_init(&q->lock, NULL);
+		
+		pthread_t thd;
+		int err = pthread_create(&thd, &attr, poolWorker, q);
+		if(err)
+		{
+			logError("Pool: can't create worker", err);
+			ok = false;
+			continue;
+		}
+		
+		char tname[16];
+		snprintf(tname, sizeof(tname), "%s%u", p->name, (unsigned char)i); // Kernel keeps 15 chars
+		pthread_setname_np(thd, tname);
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&p->lock);
+		
+		++p->running;
+		
+		pthread_mutex_unlock(&p->lock);
+		// Critical Section End
+	}
+	pthread_attr_destroy(&attr);
+	return ok;
+}
+
+bool poolSubmit(ThreadPool* p, PoolFn fn, void* arg)
+{
+	PoolTask t = { fn, arg, poolNowNs() };
+	
+	// Queues are tried round robin from the next one, first with free space gets the task
+	unsigned int start = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED);
+	bool queued = false;
+	for(int i = 0; i < p->nthreads && !queued; ++i)
+	{
+		PoolQueue* q = p->queues + (start + i) % p->nthreads;
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&q->lock);
+		
+		if(q->count < p->queue_cap)
+		{
+			q->tasks[(q->first + q->count) % POOL_MAX_QUEUE] = t;
+			++q->count;
+			queued = true;
+		}
+		
+		pthread_mutex_unlock(&q->lock);
+		// Critical Section End
+	}
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&p->lock);
+	
+	if(queued && !p->quit)
+	{
+		++p->pending;
+		++p->stats.submitted;
+		p->stats.queued = p->pending;
+		p->stats.max_queued = p->pending > (int)p->stats.max_queued ? p->pending : p->stats.max_queued;
+		pthread_cond_signal(&p->wake);
+	}
+	else
+	{
+		queued = false;
+		++p->stats.rejected;
+	}
+	
+	pthread_mutex_unlock(&p->lock);
+	// Critical Section End
+	return queued;
+}
+
+int poolDeinit(ThreadPool* p, int wait_ms)
+{
+	struct timespec until;
+	clock_gettime(CLOCK_MONOTONIC, &until);
+	until.tv_sec += wait_ms/1000;
+	until.tv_nsec += (wait_ms % 1000) * 1000000L;
+	if(until.tv_nsec >= 1000000000L)
+	{
+		++until.tv_sec;
+		until.tv_nsec -= 1000000000L;
+	}
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&p->lock);
+	
+	p->quit = true;
+	p->pending = 0; // Nobody takes queued tasks anymore
+	p->stats.queued = 0;
+	pthread_cond_broadcast(&p->wake);
+	while(p->running > 0 && pthread_cond_timedwait(&p->gone, &p->lock, &until) != ETIMEDOUT);
+	int left = p->running;
+	
+	pthread_mutex_unlock(&p->lock);
+	// Critical Section End
+	
+	if(left)
+	{
+		return left;
+	}
+	
+	for(int i = 0; i < p->nthreads; ++i)
+	{
+		pthread_mutex_destroy(&p->queues[i].lock);
+	}
+	pthread_cond_destroy(&p->gone);
+	pthread_cond_destroy(&p->wake);
+	pthread_mutex_destroy(&p->lock);
+	return 0;
+}
+
+void getPoolStats(ThreadPool* p, PoolStats* st)
+{
+	// Critical Section Beg
+	pthread_mutex_lock(&p->lock);
+	
+	*st = p->stats;
+	
+	pthread_mutex_unlock(&p->lock);
+	// Critical Section End
+}
+
+// Oldest task of own queue or, when it's empty, newest task of another one
+bool takeTask(ThreadPool* p, int own, PoolTask* t, bool* stolen)
+{
+	for(int i = 0; i < p->nthreads; ++i)
+	{
+		PoolQueue* q = p->queues + (own + i) % p->nthreads;
+		bool found = false;
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&q->lock);
+		
+		if(q->count)
+		{
+			if(i == 0)
+			{
+				*t = q->tasks[q->first];
+				q->first = (q->first + 1) % POOL_MAX_QUEUE;
+			}
+			else
+			{
+				*t = q->tasks[(q->first + q->count - 1) % POOL_MAX_QUEUE];
+			}
+			--q->count;
+			found = true;
+		}
+		
+		pthread_mutex_unlock(&q->lock);
+		// Critical Section End
+		
+		if(found)
+		{
+			*stolen = i != 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+void* poolWorker(void* param)
+{
+	sigset_t sigs;
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+	
+	PoolQueue* own = (PoolQueue*)param;
+	ThreadPool* p = own->pool;
+	int idx = own - p->queues;
+	
+	while(1)
+	{
+		// Critical Section Beg
+		pthread_mutex_lock(&p->lock);
+		
+		while(!p->pending && !p->quit)
+		{
+			pthread_cond_wait(&p->wake, &p->lock);
+		}
+		if(p->quit)
+		{
+			--p->running;
+			pthread_cond_broadcast(&p->gone);
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		
+		// One queued task is reserved for this worker, it is in some queue already
+		--p->pending;
+		++p->stats.busy;
+		p->stats.queued = p->pending;
+		
+		pthread_mutex_unlock(&p->lock);
+		// Critical Section End
+		
+		PoolTask t;
+		bool stolen;
+		while(!takeTask(p, idx, &t, &stolen));
+		
+		unsigned long long beg = poolNowNs();
+		t.fn(t.arg);
+		unsigned long long end = poolNowNs();
+		
+		// Critical Section Beg
+		pthread_mutex_lock(&p->lock);
+		
+		unsigned long long wait = beg - t.queued_ns;
+		--p->stats.busy;
+		++p->stats.completed;
+		p->stats.stolen += stolen ? 1 : 0;
+		p->stats.wait_ns += wait;
+		p->stats.max_wait_ns = wait > p->stats.max_wait_ns ? wait : p->stats.max_wait_ns;
+		p->stats.run_ns += end - beg;
+		
+		pthread_mutex_unlock(&p->lock);
+		// Critical Section End
+	}
+	return NULL;
+}
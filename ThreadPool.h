@@ -0,0 +1,70 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+#define POOL_MAX_THREADS 16
+#define POOL_MAX_QUEUE   16 // Per worker
+
+typedef void (*PoolFn)(void* arg);
+
+struct PoolTask
+{
+	PoolFn fn;
+	void* arg;
+	unsigned long long queued_ns; // CLOCK_MONOTONIC of submit
+};
+
+// Ring of tasks owned by one worker. Owner takes the oldest task, idle workers steal the newest.
+struct ThreadPool;
+
+struct PoolQueue
+{
+	ThreadPool* pool;
+	pthread_mutex_t lock;
+	PoolTask tasks[POOL_MAX_QUEUE];
+	int first;
+	int count;
+};
+
+struct PoolStats
+{
+	int threads;
+	int busy;                        // Workers running a task right now
+	unsigned int queued;             // Tasks waiting for a worker right now
+	unsigned int max_queued;         // Highest queue depth seen
+	unsigned long long submitted;
+	unsigned long long rejected;     // All queues were full
+	unsigned long long stolen;       // Tasks run by another worker than the one they were queued to
+	unsigned long long completed;
+	unsigned long long wait_ns;      // Sum of submit-to-start latencies of completed tasks
+	unsigned long long max_wait_ns;
+	unsigned long long run_ns;       // Sum of task run times
+};
+
+struct ThreadPool
+{
+	char name[12];
+	int nthreads;
+	int queue_cap;
+	PoolQueue queues[POOL_MAX_THREADS];
+	pthread_mutex_t lock; // Guards everything below
+	pthread_cond_t wake;  // Idle workers wait here for tasks
+	pthread_cond_t gone;  // poolDeinit() waits here for workers to exit
+	int pending;          // Queued tasks not yet taken by any worker
+	int running;          // Worker threads alive
+	unsigned int next;    // Round robin queue for submits
+	bool quit;
+	PoolStats stats;
+};
+
+// Fixed set of detached worker threads named "<name><n>" with stack_size bytes of stack each.
+// Every worker has its own bounded queue, so at most nthreads * queue_cap tasks wait at any time.
+bool poolInit(ThreadPool* p, const char* name, int nthreads, int queue_cap, size_t stack_size);
+bool poolSubmit(ThreadPool* p, PoolFn fn, void* arg); // False when every queue is full, task is not run
+// Drops queued tasks and returns number of workers still busy after wait_ms,
+// pool must stay allocated if that is not 0 (workers exit after their current task)
+int poolDeinit(ThreadPool* p, int wait_ms);
+void getPoolStats(ThreadPool* p, PoolStats* st);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,167 @@
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+struct TraceEvent
+{
+	const char* name;
+	unsigned long long beg;
+	unsigned long long dur;
+};
+
+// Written only by its thread. Collector copies it without stopping the writer and drops slots
+// that could have been overwritten meanwhile, head tells which ones.
+struct TraceRing
+{
+	unsigned long long head; // Events ever recorded, next one goes to head % TRACE_RING
+	int tid;
+	char tname[16];
+	TraceEvent ev[TRACE_RING];
+};
+
+int trace_on;
+TraceRing* trace_rings[TRACE_MAX_THREADS]; // Allocated on first event of a thread, live as long as the process
+int trace_nrings;
+__thread TraceRing* trace_ring;
+__thread bool trace_no_ring; // All rings were taken by other threads
+
+TraceRing* traceAttach()
+{
+	if(trace_no_ring)
+	{
+		return NULL;
+	}
+	
+	int i = __atomic_fetch_add(&trace_nrings, 1, __ATOMIC_RELAXED);
+	if(i >= TRACE_MAX_THREADS)
+	{
+		trace_no_ring = true;
+		return NULL;
+	}
+	
+	TraceRing* r = (TraceRing*)calloc(1, sizeof(TraceRing));
+	if(r == NULL)
+	{
+		trace_no_ring = true;
+		return NULL;
+	}
+	r->tid = (int)syscall(SYS_gettid);
+	pthread_getname_np(pthread_self(), r->tname, sizeof(r->tname));
+	__atomic_store_n(&trace_rings[i], r, __ATOMIC_RELEASE);
+	trace_ring = r;
+	return r;
+}
+
+unsigned long long traceNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void traceRecord(const char* name, unsigned long long beg, unsigned long long end)
+{
+	TraceRing* r = trace_ring != NULL ? trace_ring : traceAttach();
+	if(r == NULL)
+	{
+		return;
+	}
+	
+	unsigned long long h = r->head;
+	TraceEvent* e = r->ev + (h & (TRACE_RING - 1));
+	// Previous head must be visible before this slot changes, collector relies on it to spot overwritten slots
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&e->name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->beg, beg, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->dur, end > beg ? end - beg : 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+unsigned long long traceStart()
+{
+	__atomic_fetch_add(&trace_on, 1, __ATOMIC_RELAXED);
+	return traceNow();
+}
+
+void traceStop()
+{
+	__atomic_fetch_sub(&trace_on, 1, __ATOMIC_RELAXED);
+}
+
+int traceJSON(string* out, unsigned long long since_ns)
+{
+	TraceEvent* copy = (TraceEvent*)malloc(sizeof(TraceEvent) * TRACE_RING);
+	if(copy == NULL)
+	{
+		return 0;
+	}
+	
+	char line[160];
+	int events = 0, wrapped = 0;
+	bool first = true;
+	out->append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	
+	int nrings = __atomic_load_n(&trace_nrings, __ATOMIC_RELAXED);
+	nrings = nrings < TRACE_MAX_THREADS ? nrings : TRACE_MAX_THREADS;
+	for(int i = 0; i < nrings; ++i)
+	{
+		TraceRing* r = __atomic_load_n(&trace_rings[i], __ATOMIC_ACQUIRE);
+		if(r == NULL) // Thread is still setting it up
+		{
+			continue;
+		}
+		
+		unsigned long long h1 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned long long from = h1 > TRACE_RING ? h1 - TRACE_RING : 0;
+		for(unsigned long long j = from; j < h1; ++j)
+		{
+			const TraceEvent* e = r->ev + (j & (TRACE_RING - 1));
+			TraceEvent* c = copy + (j & (TRACE_RING - 1));
+			c->name = __atomic_load_n(&e->name, __ATOMIC_RELAXED);
+			c->beg = __atomic_load_n(&e->beg, __ATOMIC_RELAXED);
+			c->dur = __atomic_load_n(&e->dur, __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		
+		// Slot of event h2 - TRACE_RING may be half way to become event h2, older ones surely are gone
+		unsigned long long h2 = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		if(h2 >= TRACE_RING && h2 - TRACE_RING + 1 > from)
+		{
+			from = h2 - TRACE_RING + 1;
+		}
+		if(from && h1 > from && copy[from & (TRACE_RING - 1)].beg > since_ns) // Older part of window was lost
+		{
+			++wrapped;
+		}
+		
+		snprintf(line, sizeof(line), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+		first ? "" : ",", r->tid, r->tname);
+		out->append(line);
+		first = false;
+		
+		for(unsigned long long j = from; j < h1; ++j)
+		{
+			const TraceEvent* c = copy + (j & (TRACE_RING - 1));
+			if(c->beg < since_ns)
+			{
+				continue;
+			}
+			snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":1,\"tid\":%d}",
+			c->name, c->beg/1000, c->beg % 1000, c->dur/1000, c->dur % 1000, r->tid);
+			out->append(line);
+			++events;
+		}
+	}
+	
+	snprintf(line, sizeof(line), "\n],\"otherData\":{\"events\":\"%d\",\"wrapped_threads\":\"%d\"}}\n", events, wrapped);
+	out->append(line);
+	free(copy);
+	return events;
+}
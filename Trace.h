@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+#define TRACE_MAX_THREADS 32   // Threads with their own ring, later ones aren't traced
+#define TRACE_RING        4096 // Events per thread, power of 2
+#define TRACE_DEF_S       5    // /trace without seconds=
+#define TRACE_MAX_S       30
+
+extern int trace_on; // Number of captures running right now
+
+// The only cost of a span while nobody captures: one load and a branch that is always predicted right
+#define TRACE_ON __builtin_expect(__atomic_load_n(&trace_on, __ATOMIC_RELAXED) != 0, 0)
+
+unsigned long long traceNow(); // CLOCK_MONOTONIC in nanoseconds
+void traceRecord(const char* name, unsigned long long beg, unsigned long long end); // name must be a literal
+
+// For spans that don't match a scope, returns 0 when not capturing and traceEnd() then does nothing
+inline unsigned long long traceBegin()
+{
+	return TRACE_ON ? traceNow() : 0;
+}
+
+inline void traceEnd(const char* name, unsigned long long beg)
+{
+	if(beg)
+	{
+		traceRecord(name, beg, traceNow());
+	}
+}
+
+// For code that already has both timestamps
+inline void traceAdd(const char* name, unsigned long long beg, unsigned long long end)
+{
+	if(TRACE_ON)
+	{
+		traceRecord(name, beg, end);
+	}
+}
+
+struct TraceSpan
+{
+	const char* name;
+	unsigned long long beg;
+	TraceSpan(const char* n) : name(n), beg(traceBegin()) {}
+	~TraceSpan() { traceEnd(name, beg); }
+};
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CAT(trace_span_, __LINE__)(name) // Until the end of current scope
+
+// Capture window, several of them may overlap. traceStart() returns its beginning.
+unsigned long long traceStart();
+void traceStop();
+
+// Chrome/Perfetto JSON of every retained event that began after since_ns, returns number of events
+int traceJSON(std::string* out, unsigned long long since_ns);
+
+#endif /* TRACE_H */
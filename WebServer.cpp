@@ -4,19 +4,29 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
 #include <string>
 #include <sstream>
 #include <iomanip>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/statvfs.h>
 #include <math.h>
+#include <stdint.h>
 #include "Externs.h"
 #include "Buzzer.h"
 #include "ILI9341.h"
 #include "Logger.h"
+#include "Settings.h"
+#include "ThreadPool.h"
+#include "Snapshot.h"
+#include "THSampler.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 #define PORT             80
 
@@ -24,6 +34,17 @@
 
 #define FILE_BUFF_SIZE   32768
 
+// Readers only run while a request is parsed, idle connections and event streams wait in web_epoll
+#define WEB_CONN_THREADS 16
+#define WEB_CONN_QUEUE   4     // Per worker, requests waiting for a reader
+#define WEB_POLL_EVENTS  16
+#define WEB_CONN_STACK   65536
+#define WEB_IO_THREADS   2     // Database downloads
+#define WEB_IO_QUEUE     2
+#define WEB_IO_STACK     (FILE_BUFF_SIZE + 65536)
+#define WEB_POOL_EXIT_MS 100
+#define WEB_ACCEPT_WAIT  100   // ms, out of descriptors, some clients have to leave first
+
 #define CHART_CO2        0
 #define CHART_HUMD       1
 #define CHART_TEMP       2
@@ -57,6 +78,14 @@ struct ClientSock
 	float x_scale;
 	int status;
 	int id;
+	unsigned int gen; // Unique for the server's life, address of a deleted client may be reused by a new one
+};
+
+// Trace export, handed from Master Writer to file writers pool
+struct TraceJob
+{
+	int sock;
+	unsigned long long since_ns;
 };
 
 const string head =
@@ -66,6 +95,19 @@ Cache-Control: no-store\n\
 Content-Type: text/html\n\
 Content-Length: ";
 
+const string metrics_head =
+"HTTP/1.1 200 OK\n\
+Connection: keep-alive\n\
+Cache-Control: no-store\n\
+Content-Type: text/plain; version=0.0.4\n\
+Content-Length: ";
+
+const string trace_head =
+"HTTP/1.1 200 OK\n\
+Content-Type: application/json\n\
+Content-Disposition: attachment; filename=\"rws_trace.json\"\n\
+Content-Length: ";
+
 const string update_head =
 "HTTP/1.1 200 OK\n\
 Connection: keep-alive\n\
@@ -82,6 +124,12 @@ const string update_ok =
 "HTTP/1.1 200 OK\n\
 Content-Length: 0\n\n";
 
+const string update_503 =
+"HTTP/1.1 503 Service Unavailable\n\
+Connection: close\n\
+Retry-After: 5\n\
+Content-Length: 0\n\n";
+
 const string update_404 =
 "HTTP/1.1 404 Not Found\n\
 Connection: close\n\
@@ -104,10 +152,18 @@ const char* debug_wrts[] = {
 "WRT_MAIN_HTML",
 "WRT_DEFAULTS",
 "WRT_UPDATE_HEAD",
-"WRT_ERROR" };
+"WRT_ERROR",
+"WRT_METRICS",
+"WRT_TRACE",
+"WRT_BUSY" };
 #endif
 
 int listen_sock;
+int web_epoll; // Idle client sockets wait here, a reader only runs while a request is being parsed
+volatile bool web_quit;
+int trace_timer; // Ends /trace capture in the listener, so no reader waits for it
+WebUpdate trace_cap; // Update that capture end queues, cdst is NULL while nothing is captured
+pthread_mutex_t trace_cap_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Pointers to the Master Web Queue that will supply Master Writer thread with updates
 volatile WebUpdate* web_queue_h;
@@ -115,21 +171,36 @@ volatile WebUpdate* web_queue_t;
 pthread_mutex_t web_queue_lock;
 volatile ClientSock* client_socks; // List of Client connections
 pthread_mutex_t client_socks_lock;
+unsigned int client_gen;
 sem_t sem_empty; // Semaphore that represents empty spaces in queue
 sem_t sem_full; // Semaphore that represents full spaces in queue
+WebStats web_stats; // Only Master Writer thread writes here
+ThreadPool web_conn_pool; // Client readers, one request per task
+ThreadPool web_io_pool;   // File writers
 
 void loadWebPage(string* str);
 void* writerThread(void* param);
-void* fileWriterThread(void* sock);
-void* readerThread(void* client_sock);
+void fileWriterTask(void* sock);
+void traceWriterTask(void* trace_job);
+void readerTask(void* client_sock);
+void armClient(ClientSock* c, int op);
+bool startCapture(ClientSock* c, int secs);
+void endCapture();
+void initWebQueue();
 WebUpdate* popWebQueue(); // Users must free recieved struct themselves
 void freeWebQueue();
 ClientSock* addClient(int sock);
 void delClient(ClientSock* to_del);
-ClientSock* findClientById(int id);
+ClientSock* findClientById(int id, unsigned int* gen);
+bool clientListed(const ClientSock* c, unsigned int gen);
+bool isCdst(const WebUpdate* upd, const ClientSock* c);
 void closeClientSocks();
 void updStorageSpace(float* free, float* fill_circ);
+ssize_t webWrite(int sock, const void* data, size_t size);
+string formMetrics();
 string formEvent(const string& name, const string& data);
+string settingsEvents(const Settings* set, int groups);
+string settingsEvents(Settings* sent);
 string formDataCSV(int chart, int scale);
 string cht2str(int chart);
 string scl2str(int scale);
@@ -141,16 +212,12 @@ int byte2int(int c);
 
 void* serverMain(void* param)
 {
+	int port = param != NULL ? *(const int*)param : PORT;
 	struct sockaddr_in addr;
 	int addr_len = sizeof(addr);
 	
-	// Init locks and semaphores
-	pthread_mutex_init(&web_queue_lock, NULL);
-	pthread_mutex_init(&client_socks_lock, NULL);
-
-	sem_init(&sem_empty, 0, MAX_WEB_QUEUE);
-	sem_init(&sem_full, 0, 0);
-	initLogger();
+	initWebQueue();
+	warmMark(initLogger(warmLog()) ? WARM_LOG_RESUMED : WARM_LOG_READ);
 	
 	listen_sock = socket(AF_INET, SOCK_STREAM, 0);
 	if(listen_sock == 0)
@@ -161,10 +228,13 @@ void* serverMain(void* param)
 	
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = htons(PORT);
+	addr.sin_port = htons(port);
 	
 	memset(addr.sin_zero, 0, sizeof(addr.sin_zero));
 	
+	int enable = 1; // Restart doesn't have to wait until connections of the previous run leave TIME_WAIT
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+	
 	int ret = bind(listen_sock, (struct sockaddr*)&addr, addr_len);
 	if(ret < 0)
 	{
@@ -179,27 +249,80 @@ void* serverMain(void* param)
 		return NULL;
 	}
 	
+	poolInit(&web_conn_pool, "web-conn", WEB_CONN_THREADS, WEB_CONN_QUEUE, WEB_CONN_STACK);
+	poolInit(&web_io_pool, "web-io", WEB_IO_THREADS, WEB_IO_QUEUE, WEB_IO_STACK);
+	
+	// Listener socket has NULL data, capture timer its own address, clients have their ClientSock
+	web_epoll = epoll_create1(0);
+	trace_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	struct epoll_event ev, tev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	tev = ev;
+	tev.data.ptr = &trace_timer;
+	if(web_epoll < 0 || trace_timer < 0 || epoll_ctl(web_epoll, EPOLL_CTL_ADD, listen_sock, &ev) < 0 ||
+	epoll_ctl(web_epoll, EPOLL_CTL_ADD, trace_timer, &tev) < 0)
+	{
+		perror("Error setting up client sockets polling");
+		return NULL;
+	}
+	
 	pthread_t wthd;
 	pthread_create(&wthd, &master_thread_attr, writerThread, NULL);
 
-	while(1)
+	struct epoll_event evs[WEB_POLL_EVENTS];
+	bool accept_failing = false;
+	while(!web_quit)
 	{		
-		DBPRINT("Listener Thread. Waiting for clients...\n\n");
-		int new_client = accept(listen_sock, (struct sockaddr*)&addr, (socklen_t*)&addr_len);
-		if(new_client < 0)
+		DBPRINT("Listener Thread. Waiting for clients and requests...\n\n");
+		int n = epoll_wait(web_epoll, evs, WEB_POLL_EVENTS, -1);
+		if(n < 0 && errno != EINTR)
 		{
-			perror("Error accepting client connection into new socket");
+			perror("Error waiting for client sockets");
 			return NULL;
 		}
 		
-		int enable = 1;
-		setsockopt(new_client, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(int));
+		for(int i = 0; i < n; ++i)
+		{
+			ClientSock* cs = (ClientSock*)evs[i].data.ptr;
+			if(evs[i].data.ptr == &trace_timer)
+			{
+				endCapture();
+			}
+			else if(cs == NULL)
+			{
+				int new_client = accept(listen_sock, (struct sockaddr*)&addr, (socklen_t*)&addr_len);
+				if(new_client < 0)
+				{
+					if(web_quit)
+					{
+						return NULL;
+					}
+					if(!accept_failing) // EMFILE lasts the whole reconnect storm, once is enough
+					{
+						logError("Web: error accepting client connection", errno);
+					}
+					accept_failing = true;
+					usleep(WEB_ACCEPT_WAIT * 1000); // Connection stays in backlog, listener tries again
+					continue;
+				}
+				accept_failing = false;
+				
+				setsockopt(new_client, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(int));
 #ifndef NDEBUG
-		int a = (int)ntohl(addr.sin_addr.s_addr);
-		printf("Client ADDR: %d.%d.%d.%d:%d\n", MSBYTE0(a), MSBYTE1(a), MSBYTE2(a), a & 0xFF, ntohs(addr.sin_port));
+				int a = (int)ntohl(addr.sin_addr.s_addr);
+				printf("Client ADDR: %d.%d.%d.%d:%d\n", MSBYTE0(a), MSBYTE1(a), MSBYTE2(a), a & 0xFF, ntohs(addr.sin_port));
 #endif
-		pthread_t rthd;
-		pthread_create(&rthd, &master_thread_attr, readerThread, (void*)addClient(new_client));
+				armClient(addClient(new_client), EPOLL_CTL_ADD);
+			}
+			else if(!web_quit && !poolSubmit(&web_conn_pool, readerTask, cs)) // Request storm, shed it instead of growing threads
+			{
+				// Socket is disarmed, so nobody else touches this client
+				DBPRINT("No free reader for client %d, closing...\n", cs->sock);
+				webWrite(cs->sock, update_503.c_str(), update_503.size());
+				delClient(cs);
+			}
+		}
 	}
 	
 	return NULL;
@@ -208,11 +331,18 @@ void* serverMain(void* param)
 void loadWebPage(string* str)
 {
 	FILE* f = fopen("./web/main.html", "rb");
-	char c = 0;
-	while(fread(&c, 1, 1, f))
+	if(f == NULL)
 	{
-		str->push_back(c);
+		logError("Web: can't open main.html", errno);
+		return;
 	}
+	
+	// One read instead of a call per byte, writer thread serves nothing until page is loaded
+	fseek(f, 0L, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	str->resize(size > 0 ? size : 0);
+	str->resize(fread(&(*str)[0], 1, str->size(), f));
 	fclose(f);
 }
 
@@ -227,54 +357,78 @@ void* writerThread(void* param)
 	float fil = 0.0f;
 	
 	unsigned int msec = 0;
-	int ppm;
-	float humd, temp;
+	int ppm = 0;
+	float humd = 0.0f, temp = 0.0f;
+	bool have_rdings = false;
+	
+	Settings sent; // What web clients were last told
+	getSettings(&sent);
 	
 	while(1)
 	{
 		WebUpdate* upd = popWebQueue(); // Semaphore blocks here if Queue is empty
+		TRACE_SPAN("web_update");
 		DBPRINT("Master Writer update operation: %s!\n", debug_wrts[upd->op]);
 		string update;
+		size_t skipped_len = 0; // Size of unchanged readings event that wasn't sent
 
-		switch(upd->op)
+		// Reader deletes its client as soon as the connection drops, even while this update still waits in the queue
+		int ch_sc_xd = 0;
+		float x_scale = 0.0f;
+		bool cdst_listed = false;
+		if(upd->cdst != NULL)
 		{
-		case WRT_WARN:
-		{
-			int cw = MSSHORT(upd->co2w_snd);
-			int hwl = MSBYTE0(upd->ht_warn);
-			int hwh = MSBYTE1(upd->ht_warn);
-			int twl = byte2int(MSBYTE2(upd->ht_warn));
-			int twh = byte2int(upd->ht_warn & 0xFF);
-			update = formEvent("warnings", TSC(cw) + TSC(hwl) + TSC(hwh) + TSC(twl) + TS(twh));
 			// Critical Section Beg
-			pthread_mutex_lock(&warning_levels_lock);
+			pthread_mutex_lock(&client_socks_lock);
 			
-			co2_warning = cw;
-			humd_warning_low = hwl;
-			humd_warning_high = hwh;
-			temp_warning_low = twl;
-			temp_warning_high = twh;
+			cdst_listed = clientListed(upd->cdst, upd->cdst_gen);
+			if(cdst_listed)
+			{
+				ch_sc_xd = upd->cdst->ch_sc_xd;
+				x_scale = upd->cdst->x_scale;
+			}
 			
-			pthread_mutex_unlock(&warning_levels_lock);
+			pthread_mutex_unlock(&client_socks_lock);
 			// Critical Section End
 		}
+		
+		switch(upd->op)
+		{
+		case WRT_WARN:
+		{
+			Settings set;
+			editSettings(&set);
+			set.co2_warning = MSSHORT(upd->co2w_snd);
+			set.humd_warning_low = MSBYTE0(upd->ht_warn);
+			set.humd_warning_high = MSBYTE1(upd->ht_warn);
+			set.temp_warning_low = byte2int(MSBYTE2(upd->ht_warn));
+			set.temp_warning_high = byte2int(upd->ht_warn & 0xFF);
+			commitSettings(&set);
+			
+			update = settingsEvents(&sent);
+			readings_dirty = true; // LCD must recolour readings against new levels
+		}
 			break;
 		case WRT_SOUND:
-			update = formEvent("sound", sng2str(upd->co2w_snd & 0xFFFF));
-			// Critical Section Beg
-			pthread_mutex_lock(&co2_warning_song_lock);
-			
-			co2_warning_song = upd->co2w_snd & 0xFFFF;
+		{
+			Settings set;
+			editSettings(&set);
+			set.co2_warning_song = upd->co2w_snd & 0xFFFF;
+			commitSettings(&set);
 			
-			pthread_mutex_unlock(&co2_warning_song_lock);
-			// Critical Section End
+			update = settingsEvents(&sent);
+		}
 			break;
 		case WRT_SWITCH:
 		case WRT_SCALE:
-		{			
-			int active_chart = MSBYTE0(upd->cdst->ch_sc_xd);
-			int active_scale = MSBYTE1(upd->cdst->ch_sc_xd);
-			int x_divs = upd->cdst->ch_sc_xd & 0xFFFF;
+		{
+			if(!cdst_listed) // Gone, client who asked for it still gets OK
+			{
+				break;
+			}
+			int active_chart = MSBYTE0(ch_sc_xd);
+			int active_scale = MSBYTE1(ch_sc_xd);
+			int x_divs = ch_sc_xd & 0xFFFF;
 			if(upd->op == WRT_SWITCH)
 			{
 				update += formEvent("chart_switch", cht2str(active_chart));
@@ -285,25 +439,41 @@ void* writerThread(void* param)
 			}
 			
 			update += formEvent("data", formDataCSV(active_chart, active_scale));
-			update += formEvent("chart_vars", TSC(x_divs) + f2sNo0(upd->cdst->x_scale));
+			update += formEvent("chart_vars", TSC(x_divs) + f2sNo0(x_scale));
 		}
 			break;
 		case WRT_LCD:
-			update = formEvent("lcd_times", tim2str(upd->lcd));
-			// Critical Section Beg
-			pthread_mutex_lock(&lcd_on_off_time_lock);
-			
-			lcd_on_off_time = upd->lcd;
+		{
+			Settings set;
+			editSettings(&set);
+			set.lcd_on_off_time = upd->lcd;
+			commitSettings(&set);
 			
-			pthread_mutex_unlock(&lcd_on_off_time_lock);
-			// Critical Section End
+			update = settingsEvents(&sent);
+		}
 			break;
 		case WRT_RDINGS:
 		{
 			ppm = upd->ppm;
 			humd = upd->humd;
 			temp = upd->temp;
-			update += formEvent("readings", TSC(ppm) + f2s(humd, 1) + f2s(temp, 0));
+			have_rdings = true;
+			
+			if(settingsVersion() != sent.version) // Changed by someone else than web clients
+			{
+				update += settingsEvents(&sent);
+			}
+			
+			string rdings = formEvent("readings", TSC(ppm) + f2s(humd, 1) + f2s(temp, 0));
+			if(upd->publish)
+			{
+				update += rdings;
+			}
+			else
+			{
+				skipped_len = rdings.size();
+				++web_stats.rdings_skipped;
+			}
 			
 			if(msec % 5000 == 0)
 			{
@@ -322,40 +492,30 @@ void* writerThread(void* param)
 			break;
 		case WRT_DEFAULTS:
 		{
-			// Critical Section Beg
-			pthread_mutex_lock(&warning_levels_lock);
-			
-			int cw = co2_warning;
-			int hwl = humd_warning_low;
-			int hwh = humd_warning_high;
-			int twl = temp_warning_low;
-			int twh = temp_warning_high;
-			
-			pthread_mutex_unlock(&warning_levels_lock);
-			pthread_mutex_lock(&co2_warning_song_lock);
-			
-			int song = co2_warning_song;
-			
-			pthread_mutex_unlock(&co2_warning_song_lock);
-			pthread_mutex_lock(&lcd_on_off_time_lock);
-			
-			int lcd_times = lcd_on_off_time;
-			
-			pthread_mutex_unlock(&lcd_on_off_time_lock);
-			// Critical Section End
+			if(!cdst_listed) // Left before it got them
+			{
+				break;
+			}
+			// New client gets the current snapshot, others will get the diff with next update anyway
+			Settings set;
+			getSettings(&set);
 			updStorageSpace(&fil_text, &fil);
-			int active_chart = MSBYTE0(upd->cdst->ch_sc_xd);
-			int active_scale = MSBYTE1(upd->cdst->ch_sc_xd);
-			int x_divs = upd->cdst->ch_sc_xd & 0xFFFF;
+			int active_chart = MSBYTE0(ch_sc_xd);
+			int active_scale = MSBYTE1(ch_sc_xd);
+			int x_divs = ch_sc_xd & 0xFFFF;
 			
-			update += formEvent("warnings", TSC(cw) + TSC(hwl) + TSC(hwh) + TSC(twl) + TS(twh));
+			update += settingsEvents(&set, SET_WARN);
 			update += formEvent("storage", f2sNo0(fil) + "," + f2s(fil_text, 0));
-			update += formEvent("sound", sng2str(song));
+			update += settingsEvents(&set, SET_SOUND);
 			update += formEvent("chart_switch", cht2str(active_chart));
 			update += formEvent("chart_scale", scl2str(active_scale));
 			update += formEvent("data", formDataCSV(active_chart, active_scale));
-			update += formEvent("chart_vars", TSC(x_divs) + f2sNo0(upd->cdst->x_scale));
-			update += formEvent("lcd_times", tim2str(lcd_times));
+			update += formEvent("chart_vars", TSC(x_divs) + f2sNo0(x_scale));
+			update += settingsEvents(&set, SET_LCD);
+			if(have_rdings) // Readings are only sent when they change, so new client needs the last ones
+			{
+				update += formEvent("readings", TSC(ppm) + f2s(humd, 1) + f2s(temp, 0));
+			}
 		}
 			break;
 		case WRT_UPDATE_HEAD:
@@ -364,14 +524,22 @@ void* writerThread(void* param)
 		case WRT_ERROR:
 			update = update_404;
 			break;
+		case WRT_BUSY:
+			update = update_503;
+			break;
+		case WRT_METRICS:
+			update = formMetrics();
+			break;
 		case WRT_DB_FILE:
 		case WRT_DEL_FILE:
+		case WRT_TRACE:
 			break;
 		default:
 			free(upd);
 			continue;
 		}
 		
+		unsigned long long fan_beg = traceBegin();
 		// Critical Section Beg
 		pthread_mutex_lock(&client_socks_lock);
 		
@@ -425,7 +593,7 @@ void* writerThread(void* param)
 				{
 					DBPRINT("Master Writer writing DATA_UPD to THD %d...\n", tmp->sock);
 					string data_update = formEvent("data_upd", f2sNo0(current_data_val));
-					write(tmp->sock, data_update.c_str(), data_update.size());
+					webWrite(tmp->sock, data_update.c_str(), data_update.size());
 				}
 				
 				if(msec % 60000 == 0)
@@ -435,8 +603,13 @@ void* writerThread(void* param)
 					update += formEvent("storage", f2sNo0(fil) + "," + f2s(fil_text, 0));
 				}
 				
-				DBPRINT("Master Writer writing RDINGZ to THD %d...\n", tmp->sock);
-				write(tmp->sock, update.c_str(), update.size());
+				web_stats.saved_bytes += skipped_len; // Per client it wasn't sent to
+				
+				if(!update.empty())
+				{
+					DBPRINT("Master Writer writing RDINGZ to THD %d...\n", tmp->sock);
+					webWrite(tmp->sock, update.c_str(), update.size());
+				}
 			}
 				break;
 			// Global program settings
@@ -446,42 +619,58 @@ void* writerThread(void* param)
 				if(tmp->status & 0x1)
 				{
 					DBPRINT("Master Writer writing WARN/SOUND/LCD to THD %d...\n", tmp->sock);
-					write(tmp->sock, update.c_str(), update.size());
+					webWrite(tmp->sock, update.c_str(), update.size());
 				}
 				else if(upd->csrc == tmp)
 				{
 					DBPRINT("Master Writer writing OK to THD %d...\n", tmp->sock);
-					write(tmp->sock, update_ok.c_str(), update_ok.size());
+					webWrite(tmp->sock, update_ok.c_str(), update_ok.size());
 				}
 				break;
 			// Local client settings
 			case WRT_SWITCH:
 			case WRT_SCALE:
-				if(upd->cdst == tmp)
+				if(isCdst(upd, tmp))
 				{
 					DBPRINT("Master Writer writing SWITCH/SCALE to THD %d...\n", tmp->sock);
-					write(tmp->sock, update.c_str(), update.size());
+					webWrite(tmp->sock, update.c_str(), update.size());
 				}
 				else if(upd->csrc == tmp)
 				{
 					DBPRINT("Master Writer writing OK to THD %d...\n", tmp->sock);
-					write(tmp->sock, update_ok.c_str(), update_ok.size());
+					webWrite(tmp->sock, update_ok.c_str(), update_ok.size());
 				}
 				break;
 			// Database file operations
 			case WRT_DB_FILE:
-				if(upd->cdst == tmp)
+				if(isCdst(upd, tmp))
 				{
-					DBPRINT("Master Writer Spawns File Writer...\n");
-					pthread_t fwthd;
-					pthread_create(&fwthd, &master_thread_attr, fileWriterThread, (void*)tmp->sock);
+					DBPRINT("Master Writer Queues File Writer...\n");
+					if(!poolSubmit(&web_io_pool, fileWriterTask, (void*)(intptr_t)tmp->sock))
+					{
+						webWrite(tmp->sock, update_503.c_str(), update_503.size());
+					}
+				}
+				break;
+			case WRT_TRACE:
+				if(isCdst(upd, tmp))
+				{
+					DBPRINT("Master Writer Queues Trace Writer...\n");
+					TraceJob* job = (TraceJob*)malloc(sizeof(TraceJob));
+					job->sock = tmp->sock;
+					job->since_ns = upd->since_ns;
+					if(!poolSubmit(&web_io_pool, traceWriterTask, job))
+					{
+						webWrite(tmp->sock, update_503.c_str(), update_503.size());
+						free(job);
+					}
 				}
 				break;
 			case WRT_DEL_FILE:
-				if(upd->cdst == tmp)
+				if(isCdst(upd, tmp))
 				{
 					DBPRINT("Master Writer writing OK to THD %d...\n", tmp->sock);
-					write(tmp->sock, update_ok.c_str(), update_ok.size());					
+					webWrite(tmp->sock, update_ok.c_str(), update_ok.size());					
 					deleteDBfile();
 					DBPRINT("Master Writer removed readings DB file...\n");
 					
@@ -492,22 +681,31 @@ void* writerThread(void* param)
 						if(tmp2->status & 0x1)
 						{
 							string stor_upd = formEvent("storage", f2sNo0(fil) + "," + f2s(fil_text, 0));
-							write(tmp2->sock, stor_upd.c_str(), stor_upd.size());
+							webWrite(tmp2->sock, stor_upd.c_str(), stor_upd.size());
 						}
 						tmp2 = tmp2->tail;
 					}
 					DBPRINT("Master Writer updated all storage spaces...\n");
 				}
 				break;
+			case WRT_BUSY:
+				if(isCdst(upd, tmp))
+				{
+					DBPRINT("Master Writer writing BUSY to THD %d...\n", tmp->sock);
+					webWrite(tmp->sock, update.c_str(), update.size());
+				}
+				break;
 			// Page setup
 			case WRT_UPDATE_HEAD:
 			case WRT_DEFAULTS:
 			case WRT_MAIN_HTML:
 			case WRT_ERROR:
-				if(upd->cdst == tmp)
+			case WRT_METRICS:
+				if(isCdst(upd, tmp))
 				{
-					DBPRINT("Master Writer writing UPD_HEAD/DEFS/MAIN_HTML/ERR to THD %d...\n", tmp->sock);
-					write(tmp->sock, update.c_str(), update.size());
+					DBPRINT("Master Writer writing UPD_HEAD/DEFS/MAIN_HTML/ERR/METRICS to THD %d...\n", tmp->sock);
+					webWrite(tmp->sock, update.c_str(), update.size());
+					warmMark(WARM_FIRST_REQUEST);
 				}
 				break;
 			default:
@@ -519,6 +717,7 @@ void* writerThread(void* param)
 		
 		pthread_mutex_unlock(&client_socks_lock);
 		// Citical Section End
+		traceEnd("web_fanout", fan_beg);
 		if(msec >= MSEC_PER_UPD_1D) // Reset counter to avoid potential overflow issues
 		{
 			msec = 0;
@@ -532,9 +731,10 @@ void* writerThread(void* param)
 	}
 }
 
-void* fileWriterThread(void* sock)
+void fileWriterTask(void* sock)
 {
-	DBPRINT("File Writer writing DATA FILE to THD %d...\n", (int)sock);
+	TRACE_SPAN("db_download");
+	DBPRINT("File Writer writing DATA FILE to THD %d...\n", (int)(intptr_t)sock);
 	FILE* f = getDBfileAndLock();
 	fseek(f, 0L, SEEK_END);
 	size_t fs = ftell(f);
@@ -543,7 +743,7 @@ void* fileWriterThread(void* sock)
 	char fname[45];
 	formDBfilename(fname);
 	string fhead = db_file_head + string(fname) + "\"\nContent-Length: " + to_string(fs) + "\n\n";
-	write((int)sock, fhead.c_str(), fhead.size());
+	webWrite((int)(intptr_t)sock, fhead.c_str(), fhead.size());
 	
 	fseek(f, 0, SEEK_SET);
 	char buff[FILE_BUFF_SIZE];
@@ -557,12 +757,12 @@ void* fileWriterThread(void* sock)
 		}
 		else if(rd < FILE_BUFF_SIZE) // Last pice of file left
 		{
-			res = write((int)sock, buff, rd);
+			res = webWrite((int)(intptr_t)sock, buff, rd);
 			break;
 		}
 		else // Full file segment
 		{
-			res = write((int)sock, buff, FILE_BUFF_SIZE);
+			res = webWrite((int)(intptr_t)sock, buff, FILE_BUFF_SIZE);
 		}
 		
 		if(res < 0)
@@ -572,194 +772,292 @@ void* fileWriterThread(void* sock)
 	}
 	unlockDBfile();
 	DBPRINT("File Writer finished successfully...\n");
-	return NULL;
 }
 
-void* readerThread(void* client_sock)
+// JSON of a busy capture is megabytes, so it's formed here instead of Master Writer thread
+void traceWriterTask(void* trace_job)
+{
+	TraceJob* job = (TraceJob*)trace_job;
+	string json;
+	traceJSON(&json, job->since_ns);
+	DBPRINT("Trace Writer writing %u B to THD %d...\n", (unsigned int)json.size(), job->sock);
+	
+	string thead = trace_head + to_string(json.size()) + "\n\n";
+	webWrite(job->sock, thead.c_str(), thead.size());
+	webWrite(job->sock, json.c_str(), json.size());
+	free(job);
+}
+
+// Runs when client socket became readable and it's disarmed in web_epoll, so no other reader has this client.
+// Parses one request and hands socket back to the listener, open event streams don't hold a worker.
+void readerTask(void* client_sock)
 {	
 	ClientSock* s = (ClientSock*)client_sock;
+	int sock = s->sock;
 	int res;
 	
 	//logError("Test loggin from reader thread", 1);
 	
-	// Critical Section Beg
-	pthread_mutex_lock(&client_socks_lock);
-	
-	int sock = s->sock;
-	// Load default Client values of client specific data
-	s->ch_sc_xd = CHART_CO2 << 24 | SCALE_5M << 16 | 60;
-	s->x_scale = 0.083333f;
-	
-	pthread_mutex_unlock(&client_socks_lock);
-	// Critical Section End
+	char buff[2048];
+	DBPRINT("Client Reader Thread %d reading client input...\n", sock);
+	res = read(sock, buff, 2048 - 1);
+	if(res < 0)
+	{
+		perror("Client Reader Thread %d Read failed... Client Thread terminating!");
+		delClient(s);
+		return; // Will this even work? IDK...
+	}
+	else if(res == 0) // Client closed connection, terminate thread!
+	{
+		DBPRINT("Client Reader Thread %d received empty request... Terminating!\n", sock);
+		delClient(s);
+		return; // No, THIS will work!
+	}
+	buff[res] = '\0';
 	
-	DBPRINT("Client Reader Thread UP! Socket ID: %d!\n", sock);
+	string req = buff;// Request
+	DBPRINT("CTHD%d REQ: %s\n\n",sock, req.substr(0, 60).c_str());
+	req = req.substr(4, req.find("HTTP")-5);
 	
-	char buff[2048];
-	while(1)
+	WebUpdate wupd;
+	memset(&wupd, 0, sizeof(WebUpdate));
+	wupd.cdst = s;
+	wupd.cdst_gen = s->gen;
+	wupd.csrc = s;
+
+	size_t qmark = req.find('?');
+	if(!req.compare("/"))
 	{
-		DBPRINT("Client Reader Thread %d waiting for client input...\n", sock);
-		res = read(sock, buff, 2048);
-		if(res < 0)
-		{
-			perror("Client Reader Thread %d Read failed... Client Thread terminating!");
-			delClient(s);
-			return NULL; // Will this even work? IDK...
-		}
-		else if(res == 0) // Client closed connection, terminate thread!
-		{
-			DBPRINT("Client Reader Thread %d received empty request... Terminating!\n", sock);
-			delClient(s);
-			return NULL; // No, THIS will work!
-		}
+		wupd.op = WRT_MAIN_HTML;
+	}
+	else if(!req.substr(0, 4).compare("/upd"))
+	{			
+		WebUpdate defs;
+		memset(&defs, 0, sizeof(WebUpdate));
+		defs.op = WRT_UPDATE_HEAD;
+		defs.cdst = s;
+		defs.cdst_gen = s->gen;
+		putWebQueue(&defs);
 		
-		string req = buff;// Request
-		DBPRINT("CTHD%d REQ: %s\n\n",sock, req.substr(0, 60).c_str());
-		req = req.substr(4, req.find("HTTP")-5);
+		int id = atoi(req.substr(8).c_str());
+		// Critical Section Beg
+		pthread_mutex_lock(&client_socks_lock);
 		
-		WebUpdate wupd;
-		memset(&wupd, 0, sizeof(WebUpdate));
-		wupd.cdst = s;
-		wupd.csrc = s;
-
-		size_t qmark = req.find('?');
-		if(!req.compare("/"))
+		s->status |= 0x1; // This client is ready to recive updates
+		s->id = id;
+		
+		pthread_mutex_unlock(&client_socks_lock);
+		// Critical Section End
+		
+		wupd.op = WRT_DEFAULTS;
+	}
+	else if(!req.compare("/download"))
+	{
+		wupd.op = WRT_DB_FILE;
+	}
+	else if(!req.compare("/delete"))
+	{
+		wupd.op = WRT_DEL_FILE;
+	}
+	else if(!req.compare("/metrics"))
+	{
+		wupd.op = WRT_METRICS;
+	}
+	else if(!req.substr(0, 6).compare("/trace")) // Answered when capture ends, one capture at a time
+	{
+		size_t sp = req.find("seconds=");
+		int secs = sp != string::npos ? atoi(req.substr(sp + 8).c_str()) : TRACE_DEF_S;
+		secs = secs < 1 ? 1 : secs > TRACE_MAX_S ? TRACE_MAX_S : secs;
+		wupd.op = startCapture(s, secs) ? WRT_TRACE : WRT_BUSY;
+	}
+	else if(qmark != string::npos) // Param changes came
+	{
+		req = req.substr(qmark+1);
+		if(req.find("cw=") != string::npos) // Change Warnings levels
 		{
-			wupd.op = WRT_MAIN_HTML;
-		}
-		else if(!req.substr(0, 4).compare("/upd"))
-		{			
-			WebUpdate defs;
-			memset(&defs, 0, sizeof(WebUpdate));
-			defs.op = WRT_UPDATE_HEAD;
-			defs.cdst = s;
-			putWebQueue(&defs);
+			size_t amp = req.find('&');
+			int co2_w = atoi(req.substr(3, amp-3).c_str());
+			size_t p_amp = amp;
+			amp = req.find('&', amp+1);
+			int hwl = atoi(req.substr(p_amp+5, amp-p_amp-5).c_str()) & 0xFF;
+			p_amp = amp;
+			amp = req.find('&', amp+1);
+			int hwh = atoi(req.substr(p_amp+5, amp-p_amp-5).c_str()) & 0xFF;
+			p_amp = amp;
+			amp = req.find('&', amp+1);
+			int twl = atoi(req.substr(p_amp+5, amp-p_amp-5).c_str()) & 0xFF;
+			p_amp = amp;
+			amp = req.find('&', amp+1);
+			int twh = atoi(req.substr(p_amp+5).c_str()) & 0xFF;
 			
-			int id = atoi(req.substr(8).c_str());
+			wupd.op = WRT_WARN;
+			wupd.co2w_snd = co2_w << 16;
+			wupd.ht_warn = hwl << 24 | hwh << 16 | twl << 8 | twh;
+			wupd.cdst = NULL; // This is global update
+		}
+		else if(req.find("cs=") != string::npos) // Change Sound
+		{
+			wupd.op = WRT_SOUND;
+			wupd.co2w_snd = atoi(req.substr(3).c_str());
+			wupd.cdst = NULL;
+		}
+		else if(req.find("sw=") != string::npos) // Chart Switch
+		{				
+			wupd.op = WRT_SWITCH;
+			int id = atoi(req.substr(req.find('&')+4).c_str());
+			unsigned int gen = 0;
+			ClientSock* mc = findClientById(id, &gen); // Main Client
+			wupd.cdst = mc;
+			wupd.cdst_gen = gen;
 			// Critical Section Beg
 			pthread_mutex_lock(&client_socks_lock);
 			
-			s->status |= 0x1; // This client is ready to recive updates
-			s->id = id;
+			if(clientListed(mc, gen)) // Its page may be closed already, then only this client gets OK
+			{
+				mc->ch_sc_xd = atoi(req.substr(3).c_str()) << 24 | mc->ch_sc_xd & 0xFFFFFF;
+			}
 			
 			pthread_mutex_unlock(&client_socks_lock);
 			// Critical Section End
-			
-			wupd.op = WRT_DEFAULTS;
-		}
-		else if(!req.compare("/download"))
-		{
-			wupd.op = WRT_DB_FILE;
-		}
-		else if(!req.compare("/delete"))
-		{
-			wupd.op = WRT_DEL_FILE;
 		}
-		else if(qmark != string::npos) // Param changes came
+		else if(req.find("sc=") != string::npos) // Chart Scale
 		{
-			req = req.substr(qmark+1);
-			if(req.find("cw=") != string::npos) // Change Warnings levels
+			int ascale = atoi(req.substr(3).c_str());
+			int x_divs;
+			float x_scale;
+			switch(ascale)
 			{
-				size_t amp = req.find('&');
-				int co2_w = atoi(req.substr(3, amp-3).c_str());
-				size_t p_amp = amp;
-				amp = req.find('&', amp+1);
-				int hwl = atoi(req.substr(p_amp+5, amp-p_amp-5).c_str()) & 0xFF;
-				p_amp = amp;
-				amp = req.find('&', amp+1);
-				int hwh = atoi(req.substr(p_amp+5, amp-p_amp-5).c_str()) & 0xFF;
-				p_amp = amp;
-				amp = req.find('&', amp+1);
-				int twl = atoi(req.substr(p_amp+5, amp-p_amp-5).c_str()) & 0xFF;
-				p_amp = amp;
-				amp = req.find('&', amp+1);
-				int twh = atoi(req.substr(p_amp+5).c_str()) & 0xFF;
-				
-				wupd.op = WRT_WARN;
-				wupd.co2w_snd = co2_w << 16;
-				wupd.ht_warn = hwl << 24 | hwh << 16 | twl << 8 | twh;
-				wupd.cdst = NULL; // This is global update
-			}
-			else if(req.find("cs=") != string::npos) // Change Sound
-			{
-				wupd.op = WRT_SOUND;
-				wupd.co2w_snd = atoi(req.substr(3).c_str());
-				wupd.cdst = NULL;
-			}
-			else if(req.find("sw=") != string::npos) // Chart Switch
-			{				
-				wupd.op = WRT_SWITCH;
-				int id = atoi(req.substr(req.find('&')+4).c_str());
-				ClientSock* mc = findClientById(id); // Main Client
-				wupd.cdst = mc;
-				// Critical Section Beg
-				pthread_mutex_lock(&client_socks_lock);
-				
-				mc->ch_sc_xd = atoi(req.substr(3).c_str()) << 24 | mc->ch_sc_xd & 0xFFFFFF;
-				
-				pthread_mutex_unlock(&client_socks_lock);
-				// Critical Section End
+			case SCALE_5M:
+				x_divs = 60; // Total number of x line coordinates (seconds, minues, etc.)
+				x_scale = 0.083333f; // Multiplier of x coordinate index (i of the loop * x_scale)
+				break;
+			case SCALE_1H:
+				x_divs = 30;
+				x_scale = 2.0f;
+				break;
+			case SCALE_1D:
+				x_divs = 40;
+				x_scale = 0.6;
+				break;
+			default:
+				break;
 			}
-			else if(req.find("sc=") != string::npos) // Chart Scale
+			
+			wupd.op = WRT_SCALE;
+			int id = atoi(req.substr(req.find('&')+4).c_str());
+			unsigned int gen = 0;
+			ClientSock* mc = findClientById(id, &gen);
+			wupd.cdst = mc;
+			wupd.cdst_gen = gen;
+			// Critical Section Beg
+			pthread_mutex_lock(&client_socks_lock);
+			
+			if(clientListed(mc, gen))
 			{
-				int ascale = atoi(req.substr(3).c_str());
-				int x_divs;
-				float x_scale;
-				switch(ascale)
-				{
-				case SCALE_5M:
-					x_divs = 60; // Total number of x line coordinates (seconds, minues, etc.)
-					x_scale = 0.083333f; // Multiplier of x coordinate index (i of the loop * x_scale)
-					break;
-				case SCALE_1H:
-					x_divs = 30;
-					x_scale = 2.0f;
-					break;
-				case SCALE_1D:
-					x_divs = 40;
-					x_scale = 0.6;
-					break;
-				default:
-					break;
-				}
-				
-				wupd.op = WRT_SCALE;
-				int id = atoi(req.substr(req.find('&')+4).c_str());
-				ClientSock* mc = findClientById(id);
-				wupd.cdst = mc;
-				// Critical Section Beg
-				pthread_mutex_lock(&client_socks_lock);
-				
 				mc->ch_sc_xd = ascale << 16 | mc->ch_sc_xd & 0xFF00FFFF;
 				mc->ch_sc_xd = x_divs | mc->ch_sc_xd & 0xFFFF0000;
 				mc->x_scale = x_scale;
-				
-				pthread_mutex_unlock(&client_socks_lock);
-				// Critical Section End
-			}
-			else if(req.find("lo=") != string::npos) // LCD ON/OFF times
-			{
-				int onh = atoi(req.substr(3, 2).c_str());
-				int onm = atoi(req.substr(6, 2).c_str());
-				int offh = atoi(req.substr(12, 2).c_str());
-				int offm =  atoi(req.substr(15, 2).c_str());
-
-				wupd.op = WRT_LCD;
-				wupd.lcd = onh << 24 | onm << 16 | offh << 8 | offm;
-				wupd.cdst = NULL;
 			}
+			
+			pthread_mutex_unlock(&client_socks_lock);
+			// Critical Section End
 		}
-		else
+		else if(req.find("lo=") != string::npos) // LCD ON/OFF times
 		{
-			wupd.op = WRT_ERROR;
-			DBPRINT("\nCTHD%d: ERRRQ: %s\n\n", sock, req.c_str());
+			int onh = atoi(req.substr(3, 2).c_str());
+			int onm = atoi(req.substr(6, 2).c_str());
+			int offh = atoi(req.substr(12, 2).c_str());
+			int offm =  atoi(req.substr(15, 2).c_str());
+
+			wupd.op = WRT_LCD;
+			wupd.lcd = onh << 24 | onm << 16 | offh << 8 | offm;
+			wupd.cdst = NULL;
 		}
-		
-		putWebQueue(&wupd);		
+	}
+	else
+	{
+		wupd.op = WRT_ERROR;
+		DBPRINT("\nCTHD%d: ERRRQ: %s\n\n", sock, req.c_str());
 	}
 	
-	DBPRINT("It's almost impossible but, Client Thread %d is out of the loop, terminating...\n", sock);
-	return NULL;
+	if(wupd.op != WRT_TRACE) // Capture end queues its own update
+	{
+		putWebQueue(&wupd);
+	}
+	
+	armClient(s, EPOLL_CTL_MOD); // Next request is parsed by whichever reader is free then
+}
+
+// False when another capture is running already
+bool startCapture(ClientSock* c, int secs)
+{
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = secs;
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&trace_cap_lock);
+	
+	bool start = trace_cap.cdst == NULL;
+	if(start)
+	{
+		memset(&trace_cap, 0, sizeof(WebUpdate));
+		trace_cap.op = WRT_TRACE;
+		trace_cap.cdst = c;
+		trace_cap.cdst_gen = c->gen;
+		trace_cap.csrc = c;
+		trace_cap.since_ns = traceStart();
+		timerfd_settime(trace_timer, 0, &its, NULL);
+	}
+	
+	pthread_mutex_unlock(&trace_cap_lock);
+	// Critical Section End
+	return start;
+}
+
+// Listener runs it when capture timer expires, writer hands the export to a file writer
+void endCapture()
+{
+	unsigned long long expired;
+	if(read(trace_timer, &expired, sizeof(expired)) != sizeof(expired))
+	{
+		return;
+	}
+	traceStop();
+	
+	// Critical Section Beg
+	pthread_mutex_lock(&trace_cap_lock);
+	
+	WebUpdate wupd = trace_cap;
+	trace_cap.cdst = NULL;
+	
+	pthread_mutex_unlock(&trace_cap_lock);
+	// Critical Section End
+	putWebQueue(&wupd); // Client that left meanwhile doesn't match its generation anymore
+}
+
+// One shot, so a readable socket is handed to exactly one reader until that reader arms it again
+void armClient(ClientSock* c, int op)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	ev.data.ptr = c;
+	if(epoll_ctl(web_epoll, op, c->sock, &ev) < 0)
+	{
+		logError("Web: can't poll client socket", errno);
+		delClient(c);
+	}
+}
+
+// Init locks and semaphores
+void initWebQueue()
+{
+	pthread_mutex_init(&web_queue_lock, NULL);
+	pthread_mutex_init(&client_socks_lock, NULL);
+
+	sem_init(&sem_empty, 0, MAX_WEB_QUEUE);
+	sem_init(&sem_full, 0, 0);
 }
 
 void putWebQueue(const WebUpdate* update)
@@ -768,8 +1066,11 @@ void putWebQueue(const WebUpdate* update)
 	memcpy(tmp, update, sizeof(WebUpdate));
 	tmp->head = NULL;
 	
+	unsigned long long beg = metNow();
 	// Critical Section Beg
 	sem_wait(&sem_empty);
+	tmp->queued_ns = metNow();
+	metObserve(MH_WEB_PUT_WAIT, tmp->queued_ns - beg);
 	pthread_mutex_lock(&web_queue_lock);
 	
 	if(web_queue_h != NULL)
@@ -782,6 +1083,7 @@ void putWebQueue(const WebUpdate* update)
 	}
 	tmp->tail = (WebUpdate*)web_queue_h;
 	web_queue_h = tmp;
+	metGaugeAdd(MG_WEB_QUEUE, 1);
 	
 	pthread_mutex_unlock(&web_queue_lock);
 	sem_post(&sem_full);
@@ -805,11 +1107,13 @@ WebUpdate* popWebQueue()
 		web_queue_h = NULL;
 		web_queue_t = NULL;
 	}
+	metGaugeAdd(MG_WEB_QUEUE, -1);
 	
 	pthread_mutex_unlock(&web_queue_lock);
 	sem_post(&sem_empty);
 	// Critical Section End
 	tmp->head = NULL;
+	metObserve(MH_WEB_QUEUE_WAIT, metNow() - tmp->queued_ns);
 	return tmp;
 }
 
@@ -838,29 +1142,55 @@ void freeWebQueue()
 
 void deinitWebServer()
 {
+	web_quit = true;
+	shutdown(listen_sock, SHUT_RDWR); // Wakes listener, it hands no more clients to readers
 	freeWebQueue();
+	
+	// Readers and file writers use clients, so clients are freed only when no worker is left
+	int left = poolDeinit(&web_io_pool, WEB_POOL_EXIT_MS);
+	left += poolDeinit(&web_conn_pool, WEB_POOL_EXIT_MS);
 	close(listen_sock);
-	closeClientSocks();	
+	close(web_epoll);
+	close(trace_timer);
+	if(left)
+	{
+		logError("Web: workers still busy on exit, clients are left to the process exit", 0);
+		return;
+	}
+	
+	closeClientSocks();
 	pthread_mutex_destroy(&web_queue_lock);
 	pthread_mutex_destroy(&client_socks_lock);
 	sem_destroy(&sem_empty);
 	sem_destroy(&sem_full);
 }
 
+void getWebStats(WebStats* st)
+{
+	*st = web_stats;
+	getPoolStats(&web_conn_pool, &st->conn_pool);
+	getPoolStats(&web_io_pool, &st->io_pool);
+}
+
 ClientSock* addClient(int sock)
 {
 	ClientSock* tmp = (ClientSock*)malloc(sizeof(ClientSock));
 	memset(tmp, 0, sizeof(ClientSock));
 	tmp->sock = sock;
+	// Load default Client values of client specific data
+	tmp->ch_sc_xd = CHART_CO2 << 24 | SCALE_5M << 16 | 60;
+	tmp->x_scale = 0.083333f;
 	// Critical Section Beg
 	pthread_mutex_lock(&client_socks_lock);
 	
+	tmp->gen = ++client_gen;
 	if(client_socks != NULL)
 	{
 		client_socks->head = tmp;
 	}
 	tmp->tail = (ClientSock*)client_socks;
 	client_socks = (volatile ClientSock*)tmp;
+	metGaugeAdd(MG_WEB_CLIENTS, 1);
 	
 	pthread_mutex_unlock(&client_socks_lock);
 	// Critical Section End
@@ -895,6 +1225,7 @@ void delClient(ClientSock* to_del)
 	{
 		client_socks = NULL;
 	}
+	metGaugeAdd(MG_WEB_CLIENTS, -1);
 	pthread_mutex_unlock(&client_socks_lock);
 	// Critical Section End
 	close(to_del->sock);
@@ -902,7 +1233,8 @@ void delClient(ClientSock* to_del)
 	DBPRINT("Deleted!\n");
 }
 
-ClientSock* findClientById(int id)
+// gen is only meaningful when a client was found
+ClientSock* findClientById(int id, unsigned int* gen)
 {
 	// Critical Section Beg
 	pthread_mutex_lock(&client_socks_lock);
@@ -912,6 +1244,7 @@ ClientSock* findClientById(int id)
 	{
 		if(tmp->id == id)
 		{
+			*gen = tmp->gen;
 			break;
 		}
 		tmp = tmp->tail;
@@ -923,6 +1256,23 @@ ClientSock* findClientById(int id)
 	return tmp;
 }
 
+// Caller holds client_socks_lock
+bool clientListed(const ClientSock* c, unsigned int gen)
+{
+	const ClientSock* tmp = (const ClientSock*)client_socks;
+	while(tmp != NULL && (tmp != c || tmp->gen != gen))
+	{
+		tmp = tmp->tail;
+	}
+	return tmp != NULL;
+}
+
+// Update is meant for this very client, not for a deleted one that had the same address
+bool isCdst(const WebUpdate* upd, const ClientSock* c)
+{
+	return upd->cdst == c && upd->cdst_gen == c->gen;
+}
+
 void closeClientSocks()
 {
 	// Critical Section Beg
@@ -959,11 +1309,117 @@ void updStorageSpace(float* free, float* fill_circ)
 	*fill_circ = (1.0f - *free/max) * 2.0f;
 }
 
+// Every write to a client socket goes through here, so traffic and broken connections are counted in one place.
+// Client that went away while being written to is an EPIPE error here, not SIGPIPE that kills the station.
+ssize_t webWrite(int sock, const void* data, size_t size)
+{
+	ssize_t res = send(sock, data, size, MSG_NOSIGNAL);
+	if(res < 0)
+	{
+		metAdd(MC_WEB_WRITE_ERR, 1);
+	}
+	else
+	{
+		metAdd(MC_WEB_BYTES, res);
+	}
+	return res;
+}
+
+// Registered metrics plus module statistics that are already kept elsewhere, collected at scrape time
+string formMetrics()
+{
+	char* buf = (char*)malloc(MET_TEXT_MAX);
+	int len = metricsText(buf, MET_TEXT_MAX);
+	
+	PoolStats ps[2];
+	getPoolStats(&web_conn_pool, ps);
+	getPoolStats(&web_io_pool, ps + 1);
+	const char* pools[] = { "pool=\"web-conn\"", "pool=\"web-io\"" };
+	for(int i = 0; i < 2; ++i)
+	{
+		len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_pool_busy_threads", "gauge", i ? NULL : "Workers running a task", pools[i], ps[i].busy);
+	}
+	for(int i = 0; i < 2; ++i)
+	{
+		len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_pool_queued_tasks", "gauge", i ? NULL : "Tasks waiting for a worker", pools[i], ps[i].queued);
+	}
+	for(int i = 0; i < 2; ++i)
+	{
+		len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_pool_rejected_total", "counter", i ? NULL : "Tasks refused because all queues were full", pools[i], ps[i].rejected);
+	}
+	for(int i = 0; i < 2; ++i)
+	{
+		len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_pool_wait_seconds_total", "counter", i ? NULL : "Sum of submit to start latencies", pools[i], ps[i].wait_ns/1e9);
+	}
+	
+	LcdStats lst;
+	getLcdStats(&lst);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_lcd_frames_total", "counter", "Frames pushed to the panel", "", lst.frames);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_lcd_skipped_total", "counter", "Redraws skipped because nothing changed", "", lst.skipped);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_lcd_spi_bytes_total", "counter", "Pixel bytes pushed over SPI", "", lst.spi_bytes);
+	
+	SamplerStats sst;
+	getSamplerStats(&sst);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_th_rounds_total", "counter", "Temperature/humidity sampling rounds", "", sst.samples);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_th_failed_total", "counter", "Rounds where no sensor returned valid data", "", sst.failed);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_th_overruns_total", "counter", "Rounds that didn't fit into sampling period", "", sst.overruns);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_th_bus_load_ratio", "gauge", "Time inside sensor reads / wall time, last second", "", sst.bus_load);
+	
+	struct statvfs vfs;
+	if(!statvfs("./log", &vfs))
+	{
+		len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_storage_free_bytes", "gauge", "Free space for the readings database", "", (double)vfs.f_bsize * vfs.f_bavail);
+		len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_storage_size_bytes", "gauge", "Size of the filesystem holding the readings database", "", (double)vfs.f_frsize * vfs.f_blocks);
+	}
+	
+	WarmStats wst;
+	getWarmStats(&wst);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_warm_start", "gauge", "Started from a valid snapshot", "", wst.warm);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_start_seconds", "gauge", "Time from start to the milestone, 0 until reached", "stage=\"log\"", wst.log_ms/1e3);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_start_seconds", "gauge", NULL, "stage=\"first_frame\"", wst.first_frame_ms/1e3);
+	len += metPrint(buf + len, MET_TEXT_MAX - len, "rws_start_seconds", "gauge", NULL, "stage=\"first_request\"", wst.first_request_ms/1e3);
+	
+	string page = metrics_head + to_string(len) + "\n\n";
+	page.append(buf, len);
+	free(buf);
+	return page;
+}
+
 string formEvent(const string& name, const string& data)
 {
 	return string("event: ") + name + "\n" + "data: " + data + "\n\n";
 }
 
+// Events for SET_* groups of settings snapshot
+string settingsEvents(const Settings* set, int groups)
+{
+	string events;
+	if(groups & SET_WARN)
+	{
+		events += formEvent("warnings", TSC(set->co2_warning) + TSC(set->humd_warning_low) + TSC(set->humd_warning_high) +
+		TSC(set->temp_warning_low) + TS(set->temp_warning_high));
+	}
+	if(groups & SET_SOUND)
+	{
+		events += formEvent("sound", sng2str(set->co2_warning_song));
+	}
+	if(groups & SET_LCD)
+	{
+		events += formEvent("lcd_times", tim2str(set->lcd_on_off_time));
+	}
+	return events;
+}
+
+// Events for everything that changed since sent snapshot, which becomes the current one
+string settingsEvents(Settings* sent)
+{
+	Settings cur;
+	getSettings(&cur);
+	int diff = settingsDiff(sent, &cur);
+	*sent = cur;
+	return settingsEvents(&cur, diff);
+}
+
 string formDataCSV(int chart, int scale)
 {
 	int max_off, step;
@@ -1,6 +1,8 @@
 #ifndef WEBSERVER_H
 #define WEBSERVER_H
 
+#include "ThreadPool.h"
+
 #define WRT_WARN         0
 #define WRT_SOUND        1
 #define WRT_SWITCH       2
@@ -13,6 +15,9 @@
 #define WRT_DEFAULTS     9
 #define WRT_UPDATE_HEAD  10
 #define WRT_ERROR        11
+#define WRT_METRICS      12
+#define WRT_TRACE        13
+#define WRT_BUSY         14
 
 struct ClientSock;
 
@@ -21,6 +26,7 @@ struct WebUpdate
 	WebUpdate* head;
 	WebUpdate* tail;
 	ClientSock* cdst; // Client Destination. Who wants this update? NULL for global update
+	unsigned int cdst_gen; // Generation of cdst when the update was made
 	ClientSock* csrc; // Client who originally produced this update
 	int op;             // Operation that needs to be performed by writer
 	// Data
@@ -30,10 +36,22 @@ struct WebUpdate
 	int ppm;
 	float humd;
 	float temp;
+	int publish;        // WRT_RDINGS: readings changed, send them to clients. Logger gets them anyway
+	unsigned long long queued_ns; // Set by putWebQueue()
+	unsigned long long since_ns;  // WRT_TRACE: beginning of captured window
+};
+
+struct WebStats
+{
+	unsigned int rdings_skipped;    // Readings events not fanned out, because they didn't change
+	unsigned long long saved_bytes; // Bytes of these events times number of clients they would go to
+	PoolStats conn_pool;            // Client readers, one busy worker per request being parsed
+	PoolStats io_pool;              // Database downloads
 };
 
-void* serverMain(void* param);
+void* serverMain(void* param); // param: int* port to listen on, NULL for the default one
 void putWebQueue(const WebUpdate* update); // Caller must send stack-allocated struct
 void deinitWebServer();
+void getWebStats(WebStats* st);
 
 #endif /* WEBSERVER_H */
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Runs fn(arg) in a loop for at least min_ms milliseconds, prints and returns average ns per call of the fastest round.
+// Result and heap allocations per call go to the JSON results too.
+double benchRun(const char* name, void (*fn)(void*), void* arg, int min_ms);
+void benchRecord(const char* name, double ns, double spread, unsigned long long ops, double allocs); // Own measurements
+extern __thread unsigned long long bench_allocs; // Heap allocations of the calling thread so far
+unsigned long long benchNow(); // CLOCK_MONOTONIC in nanoseconds
+bool benchCheck(bool ok);      // Returns ok, rws_bench exits with 1 if any check failed
+
+// Benchmark groups
+void benchFusion();
+void benchSampler();
+void benchBlend();
+void benchBlit(); // Every pixel format and panel instantiation of Blit.h
+void benchSettings();
+void benchPool();
+void benchMetrics();
+void benchTrace();
+void benchConfig(); // Runs config thread on a file in /tmp
+void benchSpi();
+void benchRender(); // Also checks golden frames of headless display
+void benchHot();    // Per-update functions of web server, logger, renderer and sensor drivers
+void benchBuzz();   // Sequencer CPU use and preemption on simulated GPIO
+void benchSnapshot(); // Warm start against cold one, after render bench (restarts the display)
+
+#endif /* BENCH_H */
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Bench.h"
+#include "../Blend.h"
+
+#define B(op) (unsigned char)(op)
+#define RED(rg, gb) B(rg & 0xF8)
+#define GREEN(rg, gb) B(B(rg << 5) | B(B(gb >> 3) & 0xF8))
+#define BLUE(rg, gb) B(gb << 3)
+
+#define SCR_W 320
+#define SCR_H 240
+
+// Original float blend from ILI9341.cpp multiplex32(), kept as golden reference
+void blendRowFloat(unsigned char* dst, const unsigned char* src, int n)
+{
+	for(int i = 0; i < n; ++i, dst += 2, src += 3)
+	{
+		if(src[2] == 0xFF)
+		{
+			dst[0] = src[0];
+			dst[1] = src[1];
+			continue;
+		}
+		else if(!src[2])
+		{
+			continue;
+		}
+		
+		float scale = src[2]/255.0f;
+		unsigned char r = B(B(RED(dst[0], dst[1]) * (1.0f - scale)) + B(RED(src[0], src[1]) * scale));
+		unsigned char g = B(B(GREEN(dst[0], dst[1]) * (1.0f - scale)) + B(GREEN(src[0], src[1]) * scale));
+		unsigned char b = B(B(BLUE(dst[0], dst[1]) * (1.0f - scale)) + B(BLUE(src[0], src[1]) * scale));
+		dst[0] = B(B(r & 0xF8) | B(g >> 5));
+		dst[1] = B(B(B(g & 0xFC) << 3) | B(b >> 3));
+	}
+}
+
+struct Overlay
+{
+	void (*blend)(unsigned char*, const unsigned char*, int);
+	const unsigned char* img; // SCR_W x SCR_H 32 bit pixels
+	unsigned char* fb;
+	const unsigned char* bg;
+};
+
+void blendScreen(void* arg)
+{
+	Overlay* o = (Overlay*)arg;
+	memcpy(o->fb, o->bg, SCR_W * SCR_H * 2);
+	for(int y = 0; y < SCR_H; ++y)
+	{
+		o->blend(o->fb + y * SCR_W * 2, o->img + y * SCR_W * 3, SCR_W);
+	}
+}
+
+int absDiff(int a, int b) { return a > b ? a - b : b - a; }
+
+// Every frame buffer colour under every alpha, rows of odd length to hit vector body and scalar tail
+void golden()
+{
+	const int row = 317;
+	unsigned char* src = (unsigned char*)malloc(row * 3);
+	unsigned char* ref = (unsigned char*)malloc(row * 2);
+	unsigned char* out = (unsigned char*)malloc(row * 2);
+	unsigned long long total = 0, diff = 0;
+	int max_r = 0, max_g = 0, max_b = 0;
+	srand(565);
+	
+	for(int a = 0; a < 256; ++a)
+	{
+		for(int c = 0; c < 0x10000; c += row)
+		{
+			for(int i = 0; i < row; ++i)
+			{
+				unsigned int fb = (c + i) & 0xFFFF;
+				ref[i*2] = out[i*2] = B(fb >> 8);
+				ref[i*2+1] = out[i*2+1] = B(fb);
+				src[i*3] = B(rand());
+				src[i*3+1] = B(rand());
+				src[i*3+2] = B(i % 9 ? a : rand()); // Mixed alpha inside of one vector too
+			}
+			
+			blendRowFloat(ref, src, row);
+			blendRow565(out, src, row);
+			
+			for(int i = 0; i < row; ++i)
+			{
+				unsigned char* p = ref + i*2;
+				unsigned char* q = out + i*2;
+				++total;
+				if(p[0] == q[0] && p[1] == q[1])
+				{
+					continue;
+				}
+				++diff;
+				int dr = absDiff(RED(p[0], p[1]), RED(q[0], q[1]));
+				int dg = absDiff(B(B(p[0] << 5) | B(B(p[1] >> 3) & 0x1C)), B(B(q[0] << 5) | B(B(q[1] >> 3) & 0x1C)));
+				int db = absDiff(BLUE(p[0], p[1]), BLUE(q[0], q[1]));
+				max_r = dr > max_r ? dr : max_r;
+				max_g = dg > max_g ? dg : max_g;
+				max_b = db > max_b ? db : max_b;
+			}
+		}
+	}
+	
+	// 1 LSB of 5 bit red/blue is 8, of 6 bit green is 4
+	bool ok = max_r <= 8 && max_g <= 4 && max_b <= 8;
+	printf("Blend golden (%s): %llu px, %llu differ from float (%.4f%%), max diff R %d G %d B %d -> %s\n",
+	blendKernel(), total, diff, 100.0 * diff/total, max_r, max_g, max_b, benchCheck(ok) ? "within 1 LSB" : "FAILED");
+	
+	free(src);
+	free(ref);
+	free(out);
+}
+
+void benchBlend()
+{
+	golden();
+	
+	unsigned char* bg = (unsigned char*)malloc(SCR_W * SCR_H * 2);
+	unsigned char* fb = (unsigned char*)malloc(SCR_W * SCR_H * 2);
+	unsigned char* disc = (unsigned char*)malloc(SCR_W * SCR_H * 3);
+	unsigned char* noise = (unsigned char*)malloc(SCR_W * SCR_H * 3);
+	
+	// Dyed warning box background under anti-aliased disc (like X button scaled to full screen)
+	// and under random alpha (worst case, no solid or empty runs)
+	for(int i = 0; i < SCR_W * SCR_H; ++i)
+	{
+		int x = i % SCR_W - SCR_W/2, y = i / SCR_W - SCR_H/2;
+		int d = (x*x + y*y)/4 - 3000;
+		bg[i*2] = 0x00;
+		bg[i*2+1] = 0x1F;
+		disc[i*3] = disc[i*3+1] = 0xFF;
+		disc[i*3+2] = B(d <= 0 ? 0xFF : d >= 255 ? 0 : 255 - d);
+		noise[i*3] = B(rand());
+		noise[i*3+1] = B(rand());
+		noise[i*3+2] = B(rand());
+	}
+	
+	Overlay o = { blendRowFloat, disc, fb, bg };
+	double f = benchRun("blend 320x240 disc, float", blendScreen, &o, 500);
+	o.blend = blendRow565;
+	double k = benchRun("blend 320x240 disc, kernel", blendScreen, &o, 500);
+	printf("%-40s %12.1fx\n", "  speedup", f/k);
+	
+	o.img = noise;
+	o.blend = blendRowFloat;
+	f = benchRun("blend 320x240 random alpha, float", blendScreen, &o, 500);
+	o.blend = blendRow565;
+	k = benchRun("blend 320x240 random alpha, kernel", blendScreen, &o, 500);
+	printf("%-40s %12.1fx\n", "  speedup", f/k);
+	
+	free(bg);
+	free(fb);
+	free(disc);
+	free(noise);
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Bench.h"
+#include "../Blit.h"
+
+#define B(op) (unsigned char)(op)
+
+// Sprites like the ones drawn every readings frame: big digit with anti-aliased edges and CO2 background
+#define DIGIT_W 55
+#define DIGIT_H 86
+#define BOX_W   320
+#define BOX_H   120
+
+struct BlitArgs
+{
+	unsigned char* fb;
+	unsigned char* shadow;
+	unsigned char* rect;
+	const unsigned char* bg;    // Full screen 16 bit background
+	const unsigned char* box;   // 16 bit
+	const unsigned char* digit; // 32 bit
+	unsigned char* native;      // Digit pre-composited in frame buffer format
+};
+
+unsigned char* makeSprite(int w, int h, int bpp)
+{
+	unsigned char* img = (unsigned char*)malloc(w * h * bpp + 4);
+	unsigned short wh[2] = { (unsigned short)w, (unsigned short)h };
+	memcpy(img, wh, 4);
+	for(int i = 0; i < w * h * bpp; ++i)
+	{
+		img[i+4] = B(rand());
+	}
+	return img;
+}
+
+template<class Px, class Panel> void runBackground(void* arg)
+{
+	BlitArgs* a = (BlitArgs*)arg;
+	blitOpaque<Px, Panel>(a->fb, a->bg, 0, 0);
+}
+
+template<class Px, class Panel> void runBox(void* arg)
+{
+	BlitArgs* a = (BlitArgs*)arg;
+	blitOpaque<Px, Panel>(a->fb, a->box, 0, 0);
+}
+
+template<class Px, class Panel> void runDigit(void* arg)
+{
+	BlitArgs* a = (BlitArgs*)arg;
+	blitAlpha<Px, Panel>(a->fb, a->digit, 100, 20);
+}
+
+template<class Px, class Panel> void runCached(void* arg)
+{
+	BlitArgs* a = (BlitArgs*)arg;
+	blitNative<Px, Panel>(a->fb, a->native, 100, 20);
+}
+
+template<class Px, class Panel> void runGather(void* arg)
+{
+	BlitArgs* a = (BlitArgs*)arg;
+	gatherRect<Px, Panel>(a->rect, a->shadow, a->fb, 0, 0, Panel::WIDTH, Panel::HEIGHT);
+}
+
+template<class Px, class Panel> void runDamage(void* arg)
+{
+	BlitArgs* a = (BlitArgs*)arg;
+	int dirty = 0;
+	for(int y = 0; y < Panel::HEIGHT; y += 16)
+	{
+		for(int x = 0; x < Panel::WIDTH; x += 16)
+		{
+			dirty += tileDirty<Px, Panel>(a->fb, a->shadow, x, y, 16, 16);
+		}
+	}
+	a->rect[0] = B(dirty); // Keep the scan
+}
+
+// Every instantiation that driver can be built with gets the same set of operations
+template<class Px, class Panel> void benchConfig(const char* name, const unsigned char* bg, const unsigned char* box,
+const unsigned char* digit)
+{
+	const int size = Panel::WIDTH * Panel::HEIGHT * Px::BPP;
+	BlitArgs a = { (unsigned char*)malloc(size), (unsigned char*)malloc(size), (unsigned char*)malloc(size), bg, box, digit,
+	(unsigned char*)malloc(DIGIT_W * DIGIT_H * Px::BPP + 4) };
+	
+	memcpy(a.native, digit, 4);
+	memset(a.native + 4, 0, DIGIT_W * DIGIT_H * Px::BPP);
+	blendSprite<Px>(a.native + 4, DIGIT_W, DIGIT_H, digit, 0, 0);
+	memset(a.fb, 0, size);
+	memset(a.shadow, 0, size);
+	
+	char label[64];
+	printf("Blit %s: %dx%d, %d B per pixel\n", name, Panel::WIDTH, Panel::HEIGHT, Px::BPP);
+	snprintf(label, sizeof(label), "  %s background", name);
+	benchRun(label, runBackground<Px, Panel>, &a, 200);
+	snprintf(label, sizeof(label), "  %s box %dx%d", name, BOX_W, BOX_H);
+	benchRun(label, runBox<Px, Panel>, &a, 200);
+	snprintf(label, sizeof(label), "  %s digit blend", name);
+	benchRun(label, runDigit<Px, Panel>, &a, 200);
+	snprintf(label, sizeof(label), "  %s digit cached", name);
+	benchRun(label, runCached<Px, Panel>, &a, 200);
+	snprintf(label, sizeof(label), "  %s damage scan, clean", name);
+	memcpy(a.shadow, a.fb, size);
+	benchRun(label, runDamage<Px, Panel>, &a, 200);
+	snprintf(label, sizeof(label), "  %s gather full frame", name);
+	benchRun(label, runGather<Px, Panel>, &a, 200);
+	
+	free(a.fb);
+	free(a.shadow);
+	free(a.rect);
+	free(a.native);
+}
+
+// 18 bit path must show the same picture: opaque pixels survive 565 -> 666 -> 565, blended ones are within 1 LSB
+void checkRgb666(const unsigned char* box, const unsigned char* digit)
+{
+	const int n = BOX_W * BOX_H;
+	unsigned char* f16 = (unsigned char*)malloc(n * 2);
+	unsigned char* f18 = (unsigned char*)malloc(n * 3);
+	
+	blitOpaque<Rgb565, Ili9341Panel>(f16, box, 0, 0);
+	blitOpaque<Rgb666, Ili9341Panel>(f18, box, 0, 0);
+	int opaque_diff = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		const unsigned char* p = f18 + i*3;
+		unsigned char rg = B((p[0] & 0xF8) | p[1] >> 5), gb = B((p[1] & 0x1C) << 3 | p[2] >> 3);
+		opaque_diff += rg != f16[i*2] || gb != f16[i*2+1];
+	}
+	
+	blitAlpha<Rgb565, Ili9341Panel>(f16, digit, 0, 0);
+	blitAlpha<Rgb666, Ili9341Panel>(f18, digit, 0, 0);
+	int max_diff = 0;
+	for(int y = 0; y < DIGIT_H; ++y)
+	{
+		for(int x = 0; x < DIGIT_W; ++x)
+		{
+			const unsigned char* p = f18 + (y * BOX_W + x) * 3;
+			const unsigned char* q = f16 + (y * BOX_W + x) * 2;
+			int c16[3] = { q[0] & 0xF8, (q[0] << 5 | q[1] >> 3) & 0xFC, q[1] << 3 & 0xF8 };
+			for(int c = 0; c < 3; ++c)
+			{
+				int d = (p[c] & 0xF8) - c16[c];
+				d = d < 0 ? -d : d;
+				max_diff = d > max_diff ? d : max_diff;
+			}
+		}
+	}
+	
+	bool ok = !opaque_diff && max_diff <= 8;
+	printf("Blit RGB666 check: %d opaque px differ, blended max diff %d -> %s\n", opaque_diff, max_diff, benchCheck(ok) ? "OK" : "FAILED");
+	free(f16);
+	free(f18);
+}
+
+void benchBlit()
+{
+	srand(666);
+	unsigned char* bg = makeSprite(Ili9341Panel::WIDTH, Ili9341Panel::HEIGHT, 2);
+	unsigned char* box = makeSprite(BOX_W, BOX_H, 2);
+	unsigned char* digit = makeSprite(DIGIT_W, DIGIT_H, 3);
+	
+	// Glyph alpha is mostly 0 or 255 with soft edges, like real digits
+	for(int i = 0; i < DIGIT_W * DIGIT_H; ++i)
+	{
+		unsigned char* a = digit + 4 + i*3 + 2;
+		*a = *a < 96 ? 0 : *a > 160 ? 0xFF : *a;
+	}
+	
+	checkRgb666(box, digit);
+	benchConfig<Rgb565, Ili9341Panel>("ILI9341 RGB565", bg, box, digit);
+	benchConfig<Rgb666, Ili9341Panel>("ILI9341 RGB666", bg, box, digit);
+	benchConfig<Rgb565, St7789Panel>("ST7789 RGB565", bg, box, digit);
+	
+	free(bg);
+	free(box);
+	free(digit);
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "Bench.h"
+#include "../Buzzer.h"
+#include "../LcdSim.h"
+
+#define BUZZ_BENCH_PIN   0  // Same as station's BUZZ_PIN
+#define BUZZ_CPU_BUDGET  5.0 // % of one core while playing
+#define BUZZ_WAIT_MS     10000
+#define BUZZ_PWM_PIN     18 // PWM0 on BCM2835
+#define BEEP_NOTES       12
+
+typedef bool (*BuzzCond)(const BuzzStats* st, int arg);
+
+bool songsDone(const BuzzStats* st, int n) { return st->songs >= (unsigned int)n; }
+bool songPlaying(const BuzzStats* st, int song) { return st->playing == song; }
+
+// Polls sequencer stats until cond is met, returns how long it took in us or -1 on timeout
+long waitBuzz(BuzzCond cond, int arg, BuzzStats* st)
+{
+	unsigned long long beg = benchNow();
+	while(1)
+	{
+		getBuzzStats(st);
+		unsigned long long dur = benchNow() - beg;
+		if(cond(st, arg))
+		{
+			return (long)(dur/1000);
+		}
+		if(dur > BUZZ_WAIT_MS * 1000000ULL)
+		{
+			return -1;
+		}
+		struct timespec ts = { 0, 200000 };
+		nanosleep(&ts, NULL);
+	}
+}
+
+// Plain files standing in for /sys/class/pwm/pwmchipN with channel 0 already exported
+bool makePwmChip(char* dir)
+{
+	if(mkdtemp(dir) == NULL)
+	{
+		return false;
+	}
+	
+	char path[256];
+	const char* files[] = { "export", "pwm0/period", "pwm0/duty_cycle", "pwm0/enable" };
+	snprintf(path, sizeof(path), "%s/pwm0", dir);
+	mkdir(path, 0755);
+	for(int i = 0; i < 4; ++i)
+	{
+		snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+		FILE* f = fopen(path, "w");
+		if(f == NULL)
+		{
+			return false;
+		}
+		fclose(f);
+	}
+	return true;
+}
+
+unsigned int readPwm(const char* dir, const char* file)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/pwm0/%s", dir, file);
+	FILE* f = fopen(path, "r");
+	unsigned int v = 0;
+	if(f != NULL)
+	{
+		if(fscanf(f, "%u", &v) != 1)
+		{
+			v = 0;
+		}
+		fclose(f);
+	}
+	return v;
+}
+
+void removePwmChip(const char* dir)
+{
+	char path[256];
+	const char* files[] = { "pwm0/period", "pwm0/duty_cycle", "pwm0/enable", "pwm0", "export" };
+	for(int i = 0; i < 5; ++i)
+	{
+		snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+		remove(path);
+	}
+	rmdir(dir);
+}
+
+// Same song through PWM backend: a few writes per note instead of edges every half period
+void benchBuzzPwm()
+{
+	char dir[] = "/tmp/rws_pwmXXXXXX";
+	if(!makePwmChip(dir))
+	{
+		printf("buzz pwm: can't create stand-in chip -> FAILED\n");
+		benchCheck(false);
+		return;
+	}
+	
+	BuzzStats st;
+	initBuzz(BUZZ_PWM_PIN, dir);
+	bool enabled = readPwm(dir, "enable") == 1;
+	unsigned int pin_beg = simPinEdges(BUZZ_PWM_PIN);
+	
+	buzzPlay(SNG_BEEP);
+	long us = waitBuzz(songsDone, 1, &st);
+	unsigned int period = readPwm(dir, "period"), duty = readPwm(dir, "duty_cycle");
+	deinitBuzz();
+	
+	// Beep ends with G3, silenced after the last note and disabled on deinit
+	bool ok = us >= 0 && st.pwm && enabled && !st.edges && simPinEdges(BUZZ_PWM_PIN) == pin_beg && period == 1000000000u/196 &&
+	!duty && !readPwm(dir, "enable") && st.pwm_writes <= 3 + BEEP_NOTES * 3;
+	double cpu = st.play_us ? 100.0 * st.cpu_us/st.play_us : 0.0;
+	printf("buzz beep pwm: %llu ms, cpu %llu us (%.2f%%), %u writes for %d notes, last period %u ns -> %s\n",
+	st.play_us/1000, st.cpu_us, cpu, st.pwm_writes, BEEP_NOTES, period, benchCheck(ok) ? "ok" : "FAILED");
+	
+	removePwmChip(dir);
+}
+
+void benchBuzz()
+{
+	BuzzStats st;
+	initBuzz(BUZZ_BENCH_PIN);
+	unsigned int pin_beg = simPinEdges(BUZZ_BENCH_PIN);
+	
+	// Whole song, sequencer should sleep between note edges
+	buzzPlay(SNG_BEEP);
+	long us = waitBuzz(songsDone, 1, &st);
+	unsigned int pin_edges = simPinEdges(BUZZ_BENCH_PIN) - pin_beg;
+	double cpu = st.play_us ? 100.0 * st.cpu_us/st.play_us : 0.0;
+	bool ok = us >= 0 && pin_edges == st.edges && cpu <= BUZZ_CPU_BUDGET;
+	printf("buzz beep: %llu ms, cpu %llu us (%.2f%%), %llu edges (pin saw %u), max late %u us -> %s\n",
+	st.play_us/1000, st.cpu_us, cpu, st.edges, pin_edges, st.max_late_us, benchCheck(ok) ? "ok" : "FAILED");
+	
+	// Alarm cuts off long info song, then stop drops everything
+	buzzPlay(SNG_DOOM);
+	waitBuzz(songPlaying, SNG_DOOM, &st);
+	struct timespec ts = { 0, 300000000 };
+	nanosleep(&ts, NULL);
+	
+	buzzPlay(SNG_CO2, BUZZ_PRIO_ALARM);
+	buzzPlay(SNG_STAR_TREK); // Queued behind the alarm
+	long preempt_us = waitBuzz(songPlaying, SNG_CO2, &st);
+	unsigned int preempted = st.preempted;
+	
+	buzzStop();
+	long stop_us = waitBuzz(songPlaying, SNG_NONE, &st);
+	nanosleep(&ts, NULL);
+	getBuzzStats(&st);
+	
+	ok = preempt_us >= 0 && stop_us >= 0 && preempted == 1 && st.stopped == 1 && st.playing == SNG_NONE && st.songs == 1;
+	printf("buzz preempt %ld us, stop %ld us, %u preempted, %u stopped, queue dropped %s -> %s\n",
+	preempt_us, stop_us, preempted, st.stopped, st.playing == SNG_NONE ? "yes" : "no", benchCheck(ok) ? "ok" : "FAILED");
+	
+	deinitBuzz();
+	
+	benchBuzzPwm();
+}
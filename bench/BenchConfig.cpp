@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "Bench.h"
+#include "../Config.h"
+#include "../Settings.h"
+#include "../Buzzer.h"
+#include "../Externs.h"
+
+#define CFG_DIR      "/tmp/rws_bench_cfg"
+#define CFG_FILE     CFG_DIR "/config.cfg"
+#define CFG_BURST    20
+#define CFG_BURST_MS 20   // Faster than debounce, whole burst must end up in one file
+#define CFG_WAIT_MS  8000 // Longer than the max wait of config thread
+
+// Out of order, one key missing, comments and three lines that must be ignored
+const char cfg_text[] =
+"# Edited by hand\n"
+"wtemp_h= 26\n"
+"wco2= 1200\n"
+"lcd_off_hrs= 22\n"
+"\n"
+"lcd_on_hrs= 07\n"
+"lcd_on_min= 30\n"
+"lcd_off_min= 15\n"
+"whumd_l= 300\n"
+"whumd_h= 55\n"
+"wtemp_l=19\n"
+"humidity= 40\n"
+"whumd_l= abc\n";
+
+void sleepMs(int ms)
+{
+	struct timespec ts = { ms/1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+bool writeFile(const char* path, const char* text)
+{
+	FILE* f = fopen(path, "w");
+	if(f == NULL)
+	{
+		return false;
+	}
+	fputs(text, f);
+	return fclose(f) == 0;
+}
+
+// Waits until cond() holds or CFG_WAIT_MS passes, returns ms waited or -1
+double waitFor(bool (*cond)())
+{
+	unsigned long long beg = benchNow();
+	while(!cond())
+	{
+		if(benchNow() - beg > CFG_WAIT_MS * 1000000ULL)
+		{
+			return -1.0;
+		}
+		sleepMs(1);
+	}
+	return (benchNow() - beg)/1e6;
+}
+
+bool cfgSaved()
+{
+	ConfigStats st;
+	getConfigStats(&st);
+	return st.saved_version == settingsVersion();
+}
+
+bool cfgReloaded()
+{
+	Settings s;
+	getSettings(&s);
+	return s.co2_warning == 1500;
+}
+
+void benchConfig()
+{
+	Settings saved, s;
+	getSettings(&saved);
+	
+	mkdir(CFG_DIR, 0755);
+	unlink(CFG_FILE);
+	bool ok = writeFile(CFG_FILE, cfg_text);
+	
+	// Known state for the key that is missing in the file
+	editSettings(&s);
+	s.co2_warning_song = SNG_BEEP;
+	commitSettings(&s);
+	
+	initConfig(CFG_FILE);
+	ConfigStats st;
+	getConfigStats(&st);
+	getSettings(&s);
+	bool parsed = s.lcd_on_off_time == (7 << 24 | 30 << 16 | 22 << 8 | 15) && s.co2_warning == 1200 &&
+	s.humd_warning_low == saved.humd_warning_low && s.humd_warning_high == 55 && s.temp_warning_low == 19 &&
+	s.temp_warning_high == 26 && s.co2_warning_song == SNG_BEEP && st.bad_lines == 3;
+	printf("config: parse any order, missing key, %u bad lines -> %s\n", st.bad_lines, benchCheck(parsed) ? "ok" : "FAILED");
+	
+	// Burst of web edits
+	for(int i = 0; i < CFG_BURST; ++i)
+	{
+		editSettings(&s);
+		s.co2_warning = 1000 + i;
+		commitSettings(&s);
+		sleepMs(CFG_BURST_MS);
+	}
+	double save_ms = waitFor(cfgSaved);
+	getConfigStats(&st);
+	bool burst = save_ms >= 0 && st.saves == 1;
+	printf("config: %d commits -> %u save(s), %.0f ms after last one -> %s\n", CFG_BURST, st.saves, save_ms, benchCheck(burst) ? "ok" : "FAILED");
+	
+	// Own rename is seen by inotify too, a web change that lands right after it must survive
+	editSettings(&s);
+	s.temp_warning_high = 28;
+	commitSettings(&s);
+	sleepMs(300);
+	getSettings(&s);
+	getConfigStats(&st);
+	bool echo = s.temp_warning_high == 28 && s.co2_warning == 1000 + CFG_BURST - 1 && st.reloads == 0;
+	printf("config: own save not reloaded, later edit kept -> %s\n", benchCheck(echo) ? "ok" : "FAILED");
+	waitFor(cfgSaved);
+	
+	// Editor style save, temp file renamed over config
+	readings_dirty = false;
+	char text[sizeof(cfg_text) + 32];
+	snprintf(text, sizeof(text), "%swco2= 1500\n", cfg_text);
+	ok = writeFile(CFG_DIR "/edit.tmp", text) && ok;
+	unsigned long long beg = benchNow();
+	ok = rename(CFG_DIR "/edit.tmp", CFG_FILE) == 0 && ok;
+	double reload_ms = waitFor(cfgReloaded) >= 0 ? (benchNow() - beg)/1e6 : -1.0;
+	getConfigStats(&st);
+	bool reload = reload_ms >= 0 && st.reloads == 1 && readings_dirty;
+	printf("config: external edit reloaded in %.2f ms -> %s\n", reload_ms, benchCheck(reload) ? "ok" : "FAILED");
+	
+	// Pending change is written on exit without waiting for debounce
+	editSettings(&s);
+	s.humd_warning_high = 60;
+	commitSettings(&s);
+	unsigned int saves = st.saves;
+	deinitConfig();
+	getConfigStats(&st);
+	
+	editSettings(&s);
+	s.humd_warning_high = 0;
+	commitSettings(&s);
+	initConfig(CFG_FILE);
+	deinitConfig();
+	getSettings(&s);
+	bool exit_save = st.saves == saves + 1 && s.humd_warning_high == 60 && s.co2_warning == 1500;
+	printf("config: pending change saved by deinit -> %s\n", benchCheck(exit_save) ? "ok" : "FAILED");
+	
+	unlink(CFG_FILE);
+	rmdir(CFG_DIR);
+	editSettings(&s);
+	saved.version = s.version;
+	s = saved;
+	commitSettings(&s);
+	printf("config: %s\n", benchCheck(ok && parsed && burst && echo && reload && exit_save) ? "ok" : "FAILED");
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <math.h>
+#include "Bench.h"
+#include "../Fusion.h"
+
+#define FUS_GLITCH_EVERY 10
+#define FUS_GLITCH_GAIN  4.0f  // Fused deviation must be this many times below plain average's with glitches
+#define FUS_CLEAN_MAX    0.75f // %RH, lag of the filter behind clean average, measured 0.59
+#define FUS_BIAS_MAX     1.0f  // %RH, glitch must never become SHT31D bias, real offset is a few tenths
+#define FUS_FAST_RATE    5     // Hz, oversampling rate of the sampler thread
+
+struct PairSample
+{
+	float t1, h1; // HTU21D
+	float t2, h2; // SHT31D
+};
+
+// Recorded side by side at 1 Hz (see measurements comparisons at the end of main.cpp)
+const PairSample recorded[] = {
+	{ 26.4, 37.8, 26.4, 37.5 }, { 26.4, 37.9, 26.5, 37.5 }, { 26.4, 37.9, 26.4, 37.6 },
+	{ 26.4, 37.9, 26.4, 37.6 }, { 26.4, 38.0, 26.5, 37.6 }, { 26.4, 38.0, 26.5, 37.7 },
+	{ 26.5, 38.1, 26.4, 37.8 }, { 26.5, 38.2, 26.4, 37.9 }, { 26.5, 38.3, 26.5, 37.7 },
+	{ 26.5, 38.4, 26.4, 37.7 }, { 26.5, 38.5, 26.4, 37.7 }, { 26.5, 38.6, 26.5, 37.8 },
+	{ 26.5, 38.7, 26.4, 37.9 }, { 26.5, 38.8, 26.5, 38.0 }, { 26.5, 38.9, 26.5, 38.0 },
+	{ 26.6, 38.9, 26.5, 38.0 }, { 26.6, 38.9, 26.5, 38.0 }, { 26.6, 38.8, 26.5, 37.9 },
+	{ 26.6, 38.7, 26.5, 37.9 }, { 26.6, 38.7, 26.5, 37.9 }, { 26.6, 38.6, 26.5, 37.9 },
+	{ 26.6, 38.6, 26.5, 37.9 }, { 26.6, 38.6, 26.5, 37.8 }, { 26.6, 38.6, 26.4, 37.8 },
+	{ 26.6, 38.5, 26.5, 37.8 }, { 26.6, 38.5, 26.5, 37.8 }, { 26.6, 38.5, 26.5, 37.8 },
+	{ 26.6, 38.4, 26.5, 38.1 }, { 26.6, 38.4, 26.5, 38.2 }, { 26.6, 38.3, 26.5, 38.1 },
+	{ 26.6, 38.2, 26.5, 38.0 }, { 26.6, 38.2, 26.5, 37.9 }, { 26.6, 38.1, 26.5, 37.8 },
+	{ 26.6, 38.1, 26.5, 37.8 }, { 26.6, 38.2, 26.5, 37.8 }, { 26.6, 38.2, 26.5, 38.4 },
+	{ 26.6, 38.2, 26.5, 39.2 }, { 26.6, 38.3, 26.5, 39.1 }, { 26.6, 38.4, 26.6, 38.8 },
+	{ 26.6, 38.5, 26.5, 38.6 }, { 26.6, 38.5, 26.6, 38.5 }, { 26.6, 38.5, 26.6, 38.2 },
+	{ 26.6, 38.5, 26.5, 38.0 }, { 26.6, 38.5, 26.5, 37.9 }, { 26.6, 38.4, 26.6, 37.9 },
+};
+
+const int recorded_n = sizeof(recorded)/sizeof(recorded[0]);
+
+// Same filter parameters as in THSampler.cpp
+SensorFusion newHumdFusion(int rate) { return SensorFusion(0.0025f, 0.04f, 4.0f, rate); }
+SensorFusion newTempFusion(int rate) { return SensorFusion(0.0004f, 0.01f, 4.0f, rate); }
+
+// Replays recorded pairs, every one of them rate times a second, optionally with a glitching SHT31D
+// that still passes its checksum. Glitch lasts a whole second, so at 5 Hz it is 5 samples in a row.
+bool replay(int rate, bool glitch)
+{
+	SensorFusion hf = newHumdFusion(rate);
+	SensorFusion tf = newTempFusion(rate);
+	float max_avg_err = 0.0f, max_fus_err = 0.0f, max_bias = 0.0f;
+	int glitches = 0;
+	
+	for(int i = 0; i < recorded_n * rate; ++i)
+	{
+		const PairSample& rs = recorded[i/rate];
+		float h[FUS_SENSORS] = { rs.h1, rs.h2 };
+		float t[FUS_SENSORS] = { rs.t1, rs.t2 };
+		bool ok[FUS_SENSORS] = { true, true };
+		float clean_avg = (h[0] + h[1])/2.0f;
+		
+		if(glitch && i/rate % FUS_GLITCH_EVERY == FUS_GLITCH_EVERY/2)
+		{
+			h[1] += 12.5f;
+			t[1] -= 3.0f;
+			++glitches;
+		}
+		
+		hf.Update(h, ok);
+		tf.Update(t, ok);
+		
+		float avg_err = fabsf((h[0] + h[1])/2.0f - clean_avg);
+		float fus_err = fabsf(hf.GetValue() - clean_avg);
+		float bias = fabsf(hf.GetBias(1));
+		max_avg_err = avg_err > max_avg_err ? avg_err : max_avg_err;
+		max_fus_err = fus_err > max_fus_err ? fus_err : max_fus_err;
+		max_bias = bias > max_bias ? bias : max_bias;
+	}
+	
+	// Every glitch rejected and never learned as bias, fusion keeps well below what plain average lets through
+	bool ok = glitch ? hf.GetRejects(1) >= (unsigned int)glitches && max_fus_err * FUS_GLITCH_GAIN < max_avg_err &&
+	max_bias < FUS_BIAS_MAX : max_fus_err < FUS_CLEAN_MAX;
+	printf("Replay %-8s %d Hz %3d samples: humd deviation from clean avg: plain avg %.2f%% fused %.2f%%, "
+	"bias HTU %+.2f SHT %+.2f (max %.2f), rejects %u/%u, temp %.2f *C -> %s\n",
+	glitch ? "glitchy" : "clean", rate, recorded_n * rate, max_avg_err, max_fus_err, hf.GetBias(0), hf.GetBias(1),
+	max_bias, hf.GetRejects(0), hf.GetRejects(1), tf.GetValue(), benchCheck(ok) ? "ok" : "FAILED");
+	return ok;
+}
+
+void fusionUpdate(void* arg)
+{
+	SensorFusion* f = (SensorFusion*)arg;
+	static int i;
+	const PairSample& s = recorded[i++ % recorded_n];
+	float h[FUS_SENSORS] = { s.h1, s.h2 };
+	bool ok[FUS_SENSORS] = { true, true };
+	f->Update(h, ok);
+}
+
+void benchFusion()
+{
+	bool ok = replay(1, false);
+	ok = replay(1, true) && ok;
+	ok = replay(FUS_FAST_RATE, true) && ok;
+	printf("fusion: %s\n", benchCheck(ok) ? "ok" : "FAILED");
+	
+	SensorFusion hf = newHumdFusion(1);
+	benchRun("SensorFusion::Update", fusionUpdate, &hf, 200);
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string>
+#include "Bench.h"
+#include "../Logger.h"
+#include "../WebServer.h"
+#include "../ILI9341.h"
+#include "../CO2.h"
+#include "../HTU21D.h"
+#include "../SHT31D.h"
+#include "../Externs.h"
+
+#define HOT_DB  "/tmp/rws_bench_hot.rws"
+#define HOT_MS  200
+
+using namespace std;
+
+// Internals of WebServer.cpp, declared the same way it declares them for itself
+string formDataCSV(int chart, int scale);
+string formEvent(const string& name, const string& data);
+string f2s(float f, bool comma);
+string f2sNo0(float f);
+void initWebQueue();
+WebUpdate* popWebQueue();
+
+// Internals of ILI9341.cpp, images come from the atlas initLCD() maps
+void multiplex24(const unsigned char* img, int x, int y);
+void multiplex32(const unsigned char* img, int x, int y);
+void multiplexInt(int num, const unsigned char *const *font, int f_size, int x, int y);
+void multiplexTempFloat(float num, const unsigned char *const *font, const unsigned char *const *smol_font,
+const unsigned char* dot, const unsigned char* minus, int x, int y);
+extern const unsigned char* big_num_w[10];
+extern const unsigned char* med_num_w[10];
+extern const unsigned char* sml_num_w[10];
+extern const unsigned char* bg_main;
+extern const unsigned char* x_button;
+extern const unsigned char *dot_w, *minus_w;
+
+struct CsvArg
+{
+	int chart;
+	int scale;
+};
+
+unsigned int hot_n;
+
+Reading hotReading(unsigned int i)
+{
+	Reading r;
+	r.dt = 1700000000 + i * 5;
+	r.rd = (400 + i % 1600) << 19 | (20 + i % 60) << 12 | (15 + i % 20) << 4 | i % 10;
+	return r;
+}
+
+void runCSV(void* arg)
+{
+	CsvArg* a = (CsvArg*)arg;
+	string csv = formDataCSV(a->chart, a->scale);
+	hot_n += csv.size();
+}
+
+void runEvent(void* arg)
+{
+	string ev = formEvent("readings", "650,45.0,22.5");
+	hot_n += ev.size();
+}
+
+void runF2s(void* arg)
+{
+	string s = f2s(22.5f + (hot_n & 7), true);
+	hot_n += s.size();
+}
+
+void runF2sNo0(void* arg)
+{
+	string s = f2sNo0(45.0f + (hot_n & 7) * 0.1f);
+	hot_n += s.size();
+}
+
+void runMux24(void* arg)
+{
+	multiplex24(bg_main, 0, 0);
+}
+
+void runMux32(void* arg)
+{
+	multiplex32(x_button, 282, 0);
+}
+
+void runMuxInt(void* arg)
+{
+	multiplexInt(400 + (hot_n++ & 1023), big_num_w, 0 /*FONT_BIG*/, 195, 99);
+}
+
+void runMuxTemp(void* arg)
+{
+	multiplexTempFloat(-12.3f + (hot_n++ & 31), med_num_w, sml_num_w, dot_w, minus_w, 285, 214);
+}
+
+void runGetReading(void* arg)
+{
+	hot_n += getReading(hot_n % LOG_SIZE).rd;
+}
+
+void runLogReading(void* arg)
+{
+	logReading(hotReading(hot_n++));
+}
+
+void runWebQueue(void* arg)
+{
+	putWebQueue((WebUpdate*)arg);
+	free(popWebQueue());
+}
+
+volatile unsigned char hot_sum;
+
+void runCO2Sum(void* arg)
+{
+	hot_sum += MHZ19B::CheckSum((const unsigned char*)arg);
+}
+
+void runHTUSum(void* arg)
+{
+	hot_sum += HTU21D::CheckSum(0x683A, 0x7C);
+}
+
+void runSHTSum(void* arg)
+{
+	hot_sum += SHT31D::CheckSum((const unsigned char*)arg);
+}
+
+// Number of comma separated values
+int csvCount(const string& csv)
+{
+	int n = 1;
+	for(size_t i = 0; i < csv.size(); ++i)
+	{
+		n += csv[i] == ',' ? 1 : 0;
+	}
+	return n;
+}
+
+void benchHot()
+{
+	unlink(HOT_DB);
+	initLogger(NULL, HOT_DB);
+	for(unsigned int i = 0; i < LOG_SIZE; ++i) // A full day of history, so 1 day charts read real values
+	{
+		logReading(hotReading(i));
+	}
+	
+	// Charts: data points of each scale are fixed (60 x 5 s, 30 x 2 min, 40 x 36 min)
+	const char* charts[] = { "co2", "humd", "temp" };
+	const char* scales[] = { "5m", "1h", "1d" };
+	const int points[] = { 60, 30, 40 };
+	bool csv_ok = true;
+	for(int c = 0; c < 3; ++c)
+	{
+		for(int s = 0; s < 3; ++s)
+		{
+			CsvArg a = { c, s };
+			char label[48];
+			snprintf(label, sizeof(label), "formDataCSV %s %s", charts[c], scales[s]);
+			benchRun(label, runCSV, &a, HOT_MS);
+			csv_ok = csv_ok && csvCount(formDataCSV(c, s)) == points[s];
+		}
+	}
+	
+	benchRun("formEvent", runEvent, NULL, HOT_MS);
+	benchRun("f2s", runF2s, NULL, HOT_MS);
+	benchRun("f2sNo0", runF2sNo0, NULL, HOT_MS);
+	bool fmt_ok = f2s(22.5f, true) == "22.5," && f2s(-3.0f, false) == "-3.0" && f2sNo0(45.0f) == "45" &&
+	f2sNo0(22.25f) == "22.25" && formEvent("a", "1") == "event: a\ndata: 1\n\n";
+	
+	benchRun("getReading", runGetReading, NULL, HOT_MS);
+	benchRun("logReading", runLogReading, NULL, HOT_MS); // Every LOG_INTR-th call writes to the file
+	Reading last = getReading(0);
+	bool log_ok = last.dt == hotReading(hot_n - 1).dt && last.rd == hotReading(hot_n - 1).rd;
+	deinitLogger();
+	unlink(HOT_DB);
+	
+	initWebQueue();
+	WebUpdate upd;
+	memset(&upd, 0, sizeof(WebUpdate));
+	upd.op = WRT_RDINGS;
+	upd.ppm = 650;
+	benchRun("putWebQueue + popWebQueue", runWebQueue, &upd, HOT_MS);
+	
+	// Renderer writes into the back buffer, display thread only reads it while presenting a frame
+	lcd_is_on = true;
+	initLCD();
+	flushLCD();
+	benchRun("multiplex24 background", runMux24, NULL, HOT_MS);
+	benchRun("multiplex32 X button", runMux32, NULL, HOT_MS);
+	benchRun("multiplexInt CO2", runMuxInt, NULL, HOT_MS);
+	benchRun("multiplexTempFloat", runMuxTemp, NULL, HOT_MS);
+	deinitLCD();
+	
+	// Examples from datasheets
+	unsigned char co2_frame[9] = { 0xFF, 0x86, 0x02, 0x60, 0x47, 0x00, 0x00, 0x00, 0xD1 };
+	unsigned char sht_data[2] = { 0xBE, 0xEF };
+	benchRun("MHZ19B::CheckSum", runCO2Sum, co2_frame, HOT_MS);
+	benchRun("HTU21D::CheckSum", runHTUSum, NULL, HOT_MS);
+	benchRun("SHT31D::CheckSum", runSHTSum, sht_data, HOT_MS);
+	bool sum_ok = MHZ19B::CheckSum(co2_frame) == 0xD1 && SHT31D::CheckSum(sht_data) == 0x92 &&
+	!HTU21D::CheckSum(0xDC, 0x79) && !HTU21D::CheckSum(0x683A, 0x7C) && !HTU21D::CheckSum(0x4E85, 0x6B) &&
+	HTU21D::CheckSum(0x683A, 0x7D);
+	
+	printf("hot: charts %s, formatting %s, logger %s, checksums %s\n", benchCheck(csv_ok) ? "ok" : "FAILED",
+	benchCheck(fmt_ok) ? "ok" : "FAILED", benchCheck(log_ok) ? "ok" : "FAILED", benchCheck(sum_ok) ? "ok" : "FAILED");
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "Bench.h"
+#include "../Metrics.h"
+
+#define MET_THREADS_MAX 4
+#define MET_OPS         1000000 // Per thread
+
+// What instrumentation would cost with one lock around shared counters
+pthread_mutex_t met_old_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long met_old_counter;
+unsigned long long met_old_hist[MET_BUCKETS];
+
+struct MetRun
+{
+	bool mutex;
+	unsigned long long ns;
+};
+
+void runAddMutex(void* arg)
+{
+	pthread_mutex_lock(&met_old_lock);
+	++met_old_counter;
+	pthread_mutex_unlock(&met_old_lock);
+}
+
+void runAdd(void* arg)
+{
+	metAdd(MC_WEB_BYTES, 1);
+}
+
+void runObserve(void* arg)
+{
+	metObserve(MH_LCD_PUSH, 123456);
+}
+
+void runText(void* arg)
+{
+	metricsText((char*)arg, MET_TEXT_MAX);
+}
+
+void* metWorker(void* param)
+{
+	MetRun* r = (MetRun*)param;
+	for(int i = 0; i < MET_OPS; ++i)
+	{
+		if(r->mutex)
+		{
+			pthread_mutex_lock(&met_old_lock);
+			++met_old_counter;
+			++met_old_hist[i & 7];
+			pthread_mutex_unlock(&met_old_lock);
+		}
+		else
+		{
+			metAdd(MC_WEB_BYTES, 1);
+			metObserve(MH_LOG_FLUSH, (i & 7) * 1000);
+		}
+	}
+	return NULL;
+}
+
+double runMetContention(bool mutex, int threads)
+{
+	pthread_t thd[MET_THREADS_MAX];
+	MetRun r = { mutex, 0 };
+	unsigned long long beg = benchNow();
+	for(int i = 0; i < threads; ++i)
+	{
+		pthread_create(thd + i, NULL, metWorker, &r);
+	}
+	for(int i = 0; i < threads; ++i)
+	{
+		pthread_join(thd[i], NULL);
+	}
+	return (double)(benchNow() - beg)/MET_OPS; // ns per op on each thread
+}
+
+// Value of the first sample line that starts with prefix
+unsigned long long metValue(const char* text, const char* prefix)
+{
+	const char* p = text;
+	size_t n = strlen(prefix);
+	while(p != NULL && *p)
+	{
+		if(!strncmp(p, prefix, n))
+		{
+			return strtoull(p + n, NULL, 10);
+		}
+		p = strchr(p, '\n');
+		p = p != NULL ? p + 1 : NULL;
+	}
+	return 0;
+}
+
+int countLines(const char* text, const char* prefix)
+{
+	int cnt = 0;
+	size_t n = strlen(prefix);
+	for(const char* p = text; p != NULL && *p; p = strchr(p, '\n'), p = p != NULL ? p + 1 : NULL)
+	{
+		cnt += strncmp(p, prefix, n) ? 0 : 1;
+	}
+	return cnt;
+}
+
+void benchMetrics()
+{
+	char* text = (char*)malloc(MET_TEXT_MAX);
+	
+	benchRun("metrics counter, mutex", runAddMutex, NULL, 200);
+	benchRun("metrics counter, sharded", runAdd, NULL, 200);
+	benchRun("metrics histogram, sharded", runObserve, NULL, 200);
+	
+	metricsText(text, MET_TEXT_MAX);
+	unsigned long long bytes0 = metValue(text, "rws_web_written_bytes_total ");
+	unsigned long long flush0 = metValue(text, "rws_log_flush_seconds_count ");
+	
+	bool ok = true;
+	int total = 0;
+	for(int threads = 1; threads <= MET_THREADS_MAX; threads *= 2)
+	{
+		met_old_counter = 0;
+		double old_ns = runMetContention(true, threads);
+		double met_ns = runMetContention(false, threads);
+		printf("metrics update, %d threads    mutex %8.1f ns  sharded %8.1f ns  %5.1fx\n", threads, old_ns, met_ns, old_ns/met_ns);
+		ok = ok && met_old_counter == (unsigned long long)threads * MET_OPS;
+		total += threads;
+	}
+	
+	// Sums over shards must be exact once writers are done, buckets cumulative and ending in the count
+	int len = metricsText(text, MET_TEXT_MAX);
+	unsigned long long want = (unsigned long long)total * MET_OPS;
+	unsigned long long bytes = metValue(text, "rws_web_written_bytes_total ") - bytes0;
+	unsigned long long flush = metValue(text, "rws_log_flush_seconds_count ") - flush0;
+	unsigned long long inf = metValue(text, "rws_log_flush_seconds_bucket{le=\"+Inf\"} ");
+	ok = ok && bytes == want && flush == want && inf == flush + flush0;
+	ok = ok && countLines(text, "# TYPE rws_sensor_errors_total counter") == 1;
+	ok = ok && countLines(text, "rws_sensor_read_seconds_bucket{") == 3 * MET_BUCKETS;
+	ok = ok && len < MET_TEXT_MAX - 1 && text[len - 1] == '\n';
+	
+	benchRun("metrics text", runText, text, 200);
+	printf("metrics: %d bytes of text, %llu/%llu updates counted -> %s\n", len, bytes, want, benchCheck(ok) ? "ok" : "FAILED");
+	free(text);
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "Bench.h"
+#include "../ThreadPool.h"
+
+#define POOL_TASKS      2000
+#define POOL_THREADS    4
+#define POOL_STACK      65536
+#define POOL_WAIT_MS    5000
+
+struct PoolRun
+{
+	volatile unsigned int done;
+	unsigned long long start_ns; // Sum of submit-to-start latencies
+	volatile bool gate;          // Blocking tasks wait until this opens
+	size_t stack;
+	char name[16];
+};
+
+PoolRun pool_run;
+
+void poolCount(void* arg)
+{
+	unsigned long long queued = (unsigned long long)(size_t)arg;
+	__atomic_add_fetch(&pool_run.start_ns, benchNow() - queued, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool_run.done, 1, __ATOMIC_RELEASE);
+}
+
+void* poolCountThread(void* arg)
+{
+	poolCount(arg);
+	return NULL;
+}
+
+void poolBlock(void* arg)
+{
+	while(!pool_run.gate)
+	{
+		struct timespec ts = { 0, 100000 };
+		nanosleep(&ts, NULL);
+	}
+	__atomic_add_fetch(&pool_run.done, 1, __ATOMIC_RELEASE);
+}
+
+void poolInspect(void* arg)
+{
+	pthread_attr_t attr;
+	pthread_getattr_np(pthread_self(), &attr);
+	pthread_attr_getstacksize(&attr, &pool_run.stack);
+	pthread_attr_destroy(&attr);
+	pthread_getname_np(pthread_self(), pool_run.name, sizeof(pool_run.name));
+	__atomic_add_fetch(&pool_run.done, 1, __ATOMIC_RELEASE);
+}
+
+bool poolWaitDone(unsigned int n)
+{
+	unsigned long long beg = benchNow();
+	while(__atomic_load_n(&pool_run.done, __ATOMIC_ACQUIRE) < n)
+	{
+		if(benchNow() - beg > POOL_WAIT_MS * 1000000ULL)
+		{
+			return false;
+		}
+		sched_yield();
+	}
+	return true;
+}
+
+void benchPool()
+{
+	ThreadPool pool;
+	PoolStats st;
+	bool ok = true;
+	
+	// Old way, one detached thread per task with default stack
+	memset(&pool_run, 0, sizeof(PoolRun));
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	unsigned long long beg = benchNow();
+	for(int i = 0; i < POOL_TASKS; ++i)
+	{
+		pthread_t thd;
+		while(pthread_create(&thd, &attr, poolCountThread, (void*)(size_t)benchNow()) != 0)
+		{
+			sched_yield(); // Out of threads, exactly what happens in reconnect storms
+		}
+	}
+	ok = poolWaitDone(POOL_TASKS) && ok;
+	double spawn_us = (benchNow() - beg)/1e3/POOL_TASKS;
+	double spawn_lat = pool_run.start_ns/1e3/POOL_TASKS;
+	pthread_attr_destroy(&attr);
+	
+	memset(&pool_run, 0, sizeof(PoolRun));
+	ok = poolInit(&pool, "bench", POOL_THREADS, POOL_MAX_QUEUE, POOL_STACK) && ok;
+	beg = benchNow();
+	for(int i = 0; i < POOL_TASKS; ++i)
+	{
+		while(!poolSubmit(&pool, poolCount, (void*)(size_t)benchNow()))
+		{
+			sched_yield();
+		}
+	}
+	ok = poolWaitDone(POOL_TASKS) && ok;
+	double pool_us = (benchNow() - beg)/1e3/POOL_TASKS;
+	double pool_lat = pool_run.start_ns/1e3/POOL_TASKS;
+	getPoolStats(&pool, &st);
+	printf("pool: %d tasks, thread each %6.1f us/task (%.1f us to start), pool %6.1f us/task (%.1f us to start) %5.1fx\n",
+	POOL_TASKS, spawn_us, spawn_lat, pool_us, pool_lat, spawn_us/pool_us);
+	printf("pool: %llu completed, %llu stolen, %llu rejected (full, retried), max depth %u, avg wait %.1f us\n",
+	st.completed, st.stolen, st.rejected, st.max_queued, st.completed ? st.wait_ns/1e3/st.completed : 0.0);
+	
+	memset(&pool_run, 0, sizeof(PoolRun));
+	ok = poolSubmit(&pool, poolInspect, NULL) && poolWaitDone(1) && ok;
+	bool named = !strncmp(pool_run.name, "bench", 5);
+	printf("pool: worker \"%s\", stack %zu KB -> %s\n", pool_run.name, pool_run.stack/1024,
+	benchCheck(named && pool_run.stack == POOL_STACK) ? "ok" : "FAILED");
+	ok = ok && named && pool_run.stack == POOL_STACK;
+	ok = poolDeinit(&pool, POOL_WAIT_MS) == 0 && ok;
+	
+	// Every worker blocked (like readers on idle sockets): queue fills up, then submits are refused
+	memset(&pool_run, 0, sizeof(PoolRun));
+	poolInit(&pool, "bench", 2, 2, POOL_STACK);
+	int accepted = 0;
+	for(int i = 0; i < 8; ++i)
+	{
+		accepted += poolSubmit(&pool, poolBlock, NULL) ? 1 : 0;
+		for(int j = 0; i == 1 && j < POOL_WAIT_MS && (getPoolStats(&pool, &st), st.busy < 2); ++j)
+		{
+			struct timespec ts = { 0, 1000000 };
+			nanosleep(&ts, NULL); // Both workers are stuck before the rest is queued
+		}
+	}
+	getPoolStats(&pool, &st);
+	pool_run.gate = true;
+	ok = poolWaitDone(accepted) && ok;
+	bool bounded = accepted == 6 && st.rejected == 2 && st.busy + st.queued == 6;
+	printf("pool: 2 workers x 2 queued, 8 blocking tasks -> %d accepted, %llu refused -> %s\n",
+	accepted, st.rejected, benchCheck(bounded) ? "ok" : "FAILED");
+	ok = ok && bounded;
+	
+	// One long task holds its worker, the others must steal what was queued behind it
+	memset(&pool_run, 0, sizeof(PoolRun));
+	ok = poolDeinit(&pool, POOL_WAIT_MS) == 0 && ok;
+	poolInit(&pool, "bench", POOL_THREADS, POOL_MAX_QUEUE, POOL_STACK);
+	for(int i = 0; i < POOL_THREADS; ++i)
+	{
+		poolSubmit(&pool, i ? poolCount : poolBlock, (void*)(size_t)benchNow());
+	}
+	for(int i = 0; i < 4 * POOL_THREADS; ++i)
+	{
+		poolSubmit(&pool, poolCount, (void*)(size_t)benchNow());
+	}
+	bool drained = poolWaitDone(5 * POOL_THREADS - 1);
+	pool_run.gate = true;
+	ok = poolWaitDone(5 * POOL_THREADS) && ok;
+	getPoolStats(&pool, &st);
+	printf("pool: tasks behind a blocked worker %s, %llu stolen -> %s\n", drained ? "done" : "stuck", st.stolen,
+	benchCheck(drained && st.stolen) ? "ok" : "FAILED");
+	ok = ok && drained && st.stolen && poolDeinit(&pool, POOL_WAIT_MS) == 0;
+	printf("pool: %s\n", benchCheck(ok) ? "ok" : "FAILED");
+}
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "Bench.h"
+#include "../ILI9341.h"
+#include "../LcdSim.h"
+#include "../Buzzer.h"
+#include "../Spark.h"
+#include "../Settings.h"
+
+#define GOLDEN_PATH "./bench/golden/render.txt"
+#define GOLDEN_OUT  "./build/golden"  // Rendered frames for eyeballing, always written
+#define GOLDEN_MAX  16
+#define TOUCH_WAIT  2000              // ms, touch thread debounces and queues events on its own
+#define SPARK_BUDGET_US 200           // Sparklines must stay a small part of a frame
+
+// Raw XPT2046 readings for screen position, inverse of calibration in ILI9341.cpp
+#define RAW_X(scr_y) (400 + (scr_y) * 3450/240)
+#define RAW_Y(scr_x) (280 + (scr_x) * 3416/320)
+
+// Station globals normally defined in main.cpp
+volatile bool allow_poweroff;
+volatile bool lcd_is_on;
+volatile bool readings_dirty;
+
+struct Golden
+{
+	char name[32];
+	unsigned long long hash;
+};
+
+Golden goldens[GOLDEN_MAX];
+int golden_count;
+bool golden_update; // RWS_GOLDEN=update rewrites the file from current output
+int golden_fails;
+
+unsigned long long gramHash()
+{
+	// FNV-1a 64
+	const unsigned char* p = simGram();
+	unsigned long long h = 0xCBF29CE484222325ULL;
+	for(int i = 0; i < SIM_SCR_WIDTH * SIM_SCR_HEIGHT * 2; ++i)
+	{
+		h = (h ^ p[i]) * 0x100000001B3ULL;
+	}
+	return h;
+}
+
+void loadGoldens()
+{
+	const char* env = getenv("RWS_GOLDEN");
+	golden_update = env != NULL && !strcmp(env, "update");
+	golden_count = 0;
+	
+	FILE* f = fopen(GOLDEN_PATH, "r");
+	if(f == NULL)
+	{
+		return;
+	}
+	while(golden_count < GOLDEN_MAX &&
+	fscanf(f, "%31s %llx", goldens[golden_count].name, &goldens[golden_count].hash) == 2)
+	{
+		++golden_count;
+	}
+	fclose(f);
+}
+
+void saveGoldens()
+{
+	FILE* f = fopen(GOLDEN_PATH, "w");
+	if(f == NULL)
+	{
+		printf("golden: can't write %s\n", GOLDEN_PATH);
+		return;
+	}
+	for(int i = 0; i < golden_count; ++i)
+	{
+		fprintf(f, "%s %016llx\n", goldens[i].name, goldens[i].hash);
+	}
+	fclose(f);
+}
+
+// Compares panel content with the stored frame, missing entries are added in update mode
+void checkGolden(const char* name)
+{
+	unsigned long long h = gramHash();
+	char path[64];
+	snprintf(path, sizeof(path), "%s/%s.ppm", GOLDEN_OUT, name);
+	simDumpPPM(path);
+	
+	SimStats st;
+	simGetStats(&st);
+	
+	int i = 0;
+	while(i < golden_count && strcmp(goldens[i].name, name))
+	{
+		++i;
+	}
+	
+	const char* res = "ok";
+	if(st.errors)
+	{
+		res = "FAIL (panel protocol errors)";
+		++golden_fails;
+	}
+	else if(i == golden_count || goldens[i].hash != h)
+	{
+		if(golden_update)
+		{
+			if(i == golden_count && golden_count < GOLDEN_MAX)
+			{
+				strcpy(goldens[golden_count++].name, name);
+			}
+			goldens[i].hash = h;
+			res = "updated";
+		}
+		else
+		{
+			res = i == golden_count ? "FAIL (no golden, run with RWS_GOLDEN=update)" : "FAIL";
+			++golden_fails;
+		}
+	}
+	printf("golden %-24s %016llx %s\n", name, h, res);
+}
+
+// Alarm backgrounds blink, normal readings in between restart every blink sequence from its visible phase
+void showReadings(int ppm, float humd, float temp)
+{
+	updateReadings(650, 45.0f, 22.5f);
+	flushLCD();
+	updateReadings(ppm, humd, temp);
+	flushLCD();
+}
+
+void tap(int scr_x, int scr_y)
+{
+	LcdStats st;
+	getLcdStats(&st);
+	unsigned int touches = st.touches;
+	
+	simPress(RAW_X(scr_y), RAW_Y(scr_x));
+	for(int ms = 0; ms < TOUCH_WAIT && st.touches == touches; ms += 5)
+	{
+		usleep(5000);
+		getLcdStats(&st);
+	}
+	
+	unsigned int tap_us = st.last_tap_us;
+	simRelease();
+	for(int ms = 0; ms < TOUCH_WAIT && st.last_tap_us == tap_us; ms += 5)
+	{
+		usleep(5000);
+		getLcdStats(&st);
+	}
+	flushLCD();
+}
+
+struct FrameArg
+{
+	int ppm[2];
+	float humd[2], temp[2];
+	int i;
+};
+
+void renderReadings(void* arg)
+{
+	FrameArg* a = (FrameArg*)arg;
+	int i = a->i++ & 1;
+	updateReadings(a->ppm[i], a->humd[i], a->temp[i]);
+	flushLCD();
+}
+
+void benchFrames(const char* name, FrameArg* arg)
+{
+	LcdStats beg, end;
+	getLcdStats(&beg);
+	benchRun(name, renderReadings, arg, 300);
+	getLcdStats(&end);
+	
+	unsigned int frames = end.frames - beg.frames;
+	printf("%52s %6llu B/frame, last: render %u us (spark %u us), push %u us, %u rects\n", "",
+	frames ? (end.spi_bytes - beg.spi_bytes)/frames : 0, end.last_render_us, end.last_spark_us, end.last_push_us,
+	end.last_rects);
+}
+
+struct SparkArg
+{
+	Sparkline* spark;
+	unsigned int t;
+	unsigned int step; // Seconds between samples
+};
+
+void sparkAdd(void* arg)
+{
+	SparkArg* a = (SparkArg*)arg;
+	a->t += a->step;
+	a->spark->Add((float)(a->t % 1600 + 400), a->t);
+}
+
+void benchSpark()
+{
+	Sparkline spark(304, 10, 400.0f, 2000.0f);
+	SparkArg same = { &spark, 0, 0 };
+	SparkArg scroll = { &spark, 0, SPARK_COL_S };
+	benchRun("spark add, same column", sparkAdd, &same, 200);
+	benchRun("spark add, scroll one column", sparkAdd, &scroll, 200);
+}
+
+void benchRender()
+{
+	mkdir(GOLDEN_OUT, 0755);
+	loadGoldens();
+	
+	// Warning levels the goldens were rendered with, alarm song would only slow frames down
+	Settings set;
+	editSettings(&set);
+	set.co2_warning = 1000;
+	set.humd_warning_low = 30;
+	set.humd_warning_high = 60;
+	set.temp_warning_low = 18;
+	set.temp_warning_high = 26;
+	set.co2_warning_song = SNG_NONE;
+	commitSettings(&set);
+	
+	lcd_is_on = true;
+	initLCD();
+	
+	showReadings(650, 45.0f, 22.5f);
+	checkGolden("normal");
+	
+	showReadings(1500, 45.0f, 22.5f);
+	checkGolden("co2_alarm");
+	showReadings(650, 75.0f, 22.5f);
+	checkGolden("humidity_high");
+	showReadings(650, 45.0f, 30.4f);
+	checkGolden("temperature_high");
+	showReadings(650, 45.0f, -12.3f);
+	checkGolden("temperature_negative");
+	
+	showReadings(650, 45.0f, 22.5f);
+	unsigned long long before = gramHash();
+	tap(300, 18); // X button
+	checkGolden("poweroff_pending");
+	
+	LcdStats st;
+	getLcdStats(&st);
+	printf("touch: press -> X highlighted %u us, release -> poweroff prompt %u us\n", st.last_press_us, st.last_tap_us);
+	
+	tap(160, 120); // Anywhere else cancels poweroff
+	printf("golden %-24s %016llx %s\n", "poweroff_cancelled", gramHash(), gramHash() == before ? "ok" : "FAIL");
+	golden_fails += gramHash() != before;
+	
+	if(golden_update)
+	{
+		saveGoldens();
+	}
+	
+	FrameArg unchanged = { { 650, 650 }, { 45.0f, 45.0f }, { 22.5f, 22.5f }, 0 };
+	FrameArg one_digit = { { 650, 651 }, { 45.0f, 45.0f }, { 22.5f, 22.5f }, 0 };
+	FrameArg all_digits = { { 650, 888 }, { 45.0f, 55.0f }, { 22.5f, 25.9f }, 0 };
+	benchFrames("lcd updateReadings, unchanged", &unchanged);
+	benchFrames("lcd updateReadings, 1 digit", &one_digit);
+	benchFrames("lcd updateReadings, all readings", &all_digits);
+	benchSpark();
+	
+	getLcdStats(&st);
+	printf("spark: %u us per frame, budget %u us %s\n", st.last_spark_us, SPARK_BUDGET_US,
+	benchCheck(st.last_spark_us <= SPARK_BUDGET_US) ? "ok" : "OVER");
+	
+	deinitLCD();
+	
+	SimStats ss;
+	simGetStats(&ss);
+	printf("panel: %u commands, %u windows, %llu pixels, %u protocol errors, %s\n", ss.commands, ss.windows,
+	ss.pixels, ss.errors, benchCheck(!golden_fails) ? "all goldens match" : "GOLDEN FAILED");
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "Bench.h"
+#include "../SimTHSensor.h"
+#include "../THSampler.h"
+
+int threadCount()
+{
+	DIR* d = opendir("/proc/self/task");
+	int n = 0;
+	while(d != NULL && readdir(d) != NULL)
+	{
+		++n;
+	}
+	if(d != NULL)
+	{
+		closedir(d);
+	}
+	return n - 2; // . and ..
+}
+
+// CPU and (simulated) bus utilisation of the T/H sampler thread at different oversampling rates
+void benchSampler()
+{
+	const int rates[] = { 1, 2, 5, 10, 20 };
+	int threads = threadCount(), left = 0;
+	
+	for(unsigned int i = 0; i < sizeof(rates)/sizeof(rates[0]); ++i)
+	{
+		SimTHSensor s1(0.1f, 1), s2(-0.1f, 2);
+		initTHSampler(&s1, &s2, rates[i]);
+		sleep(3); // First second only fills the filter
+		
+		SamplerStats st;
+		getSamplerStats(&st);
+		deinitTHSampler(); // Joins sampler thread, sensors can go out of scope
+		left += threadCount() - threads;
+		
+		printf("THSampler %2d Hz: cpu %5.2f%% bus %5.1f%% samples %4u overruns %u\n",
+		st.rate_hz, st.cpu_load * 100.0f, st.bus_load * 100.0f, st.samples, st.overruns);
+	}
+	
+	// Sampler still running after deinit would go on using sensors of a round that already ended
+	printf("sampler: %d thread(s) outlived deinit in %d restarts -> %s\n", left, (int)(sizeof(rates)/sizeof(rates[0])), benchCheck(!left) ? "ok" : "FAILED");
+}
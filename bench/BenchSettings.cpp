@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "Bench.h"
+#include "../Settings.h"
+
+#define SET_READERS_MAX 4
+#define SET_RUN_MS      300
+#define SET_WRITE_US    100 // Way more often than web clients ever change settings
+
+// Old scheme for comparison: values guarded by a mutex, readers copy them under lock
+pthread_mutex_t old_lock = PTHREAD_MUTEX_INITIALIZER;
+Settings old_data;
+
+struct SetRun
+{
+	bool seqlock;
+	volatile bool stop;
+	unsigned long long reads[SET_READERS_MAX];
+	unsigned long long torn[SET_READERS_MAX]; // Snapshots mixing two commits
+	unsigned int commits;
+	int id;
+};
+
+SetRun set_run;
+pthread_mutex_t set_id_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void readOld(Settings* s)
+{
+	pthread_mutex_lock(&old_lock);
+	*s = old_data;
+	pthread_mutex_unlock(&old_lock);
+}
+
+// Every commit writes the same value into all fields, so any mix is visible
+void* setReader(void* param)
+{
+	SetRun* r = (SetRun*)param;
+	pthread_mutex_lock(&set_id_lock);
+	int id = r->id++;
+	pthread_mutex_unlock(&set_id_lock);
+	
+	unsigned long long n = 0, torn = 0;
+	Settings s;
+	while(!r->stop)
+	{
+		for(int i = 0; i < 256; ++i)
+		{
+			if(r->seqlock)
+			{
+				getSettings(&s);
+			}
+			else
+			{
+				readOld(&s);
+			}
+			torn += s.co2_warning != s.temp_warning_high || s.humd_warning_low != s.co2_warning_song ? 1 : 0;
+		}
+		n += 256;
+	}
+	r->reads[id] = n;
+	r->torn[id] = torn;
+	return NULL;
+}
+
+void* setWriter(void* param)
+{
+	SetRun* r = (SetRun*)param;
+	struct timespec ts = { 0, SET_WRITE_US * 1000 };
+	int v = 0;
+	while(!r->stop)
+	{
+		++v;
+		Settings s;
+		if(r->seqlock)
+		{
+			editSettings(&s);
+		}
+		else
+		{
+			pthread_mutex_lock(&old_lock);
+			s = old_data;
+		}
+		
+		s.lcd_on_off_time = s.co2_warning = s.humd_warning_low = s.humd_warning_high = v;
+		s.temp_warning_low = s.temp_warning_high = s.co2_warning_song = v;
+		
+		if(r->seqlock)
+		{
+			commitSettings(&s);
+		}
+		else
+		{
+			++s.version;
+			old_data = s;
+			pthread_mutex_unlock(&old_lock);
+		}
+		++r->commits;
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+double runContention(bool seqlock, int readers, unsigned long long* torn)
+{
+	memset(&set_run, 0, sizeof(SetRun));
+	set_run.seqlock = seqlock;
+	
+	// Readers only see commits of the writer, all fields equal
+	Settings s;
+	editSettings(&s);
+	s.lcd_on_off_time = s.co2_warning = s.humd_warning_low = s.humd_warning_high = 0;
+	s.temp_warning_low = s.temp_warning_high = s.co2_warning_song = 0;
+	commitSettings(&s);
+	old_data = s;
+	
+	pthread_t thd[SET_READERS_MAX + 1];
+	unsigned long long beg = benchNow();
+	for(int i = 0; i < readers; ++i)
+	{
+		pthread_create(thd + i, NULL, setReader, &set_run);
+	}
+	pthread_create(thd + readers, NULL, setWriter, &set_run);
+	
+	struct timespec ts = { 0, SET_RUN_MS * 1000000L };
+	nanosleep(&ts, NULL);
+	set_run.stop = true;
+	for(int i = 0; i <= readers; ++i)
+	{
+		pthread_join(thd[i], NULL);
+	}
+	unsigned long long dur = benchNow() - beg;
+	
+	unsigned long long reads = 0;
+	*torn = 0;
+	for(int i = 0; i < readers; ++i)
+	{
+		reads += set_run.reads[i];
+		*torn += set_run.torn[i];
+	}
+	return (double)dur * readers/reads; // ns per read on each reader
+}
+
+void runReadOld(void* arg)
+{
+	readOld((Settings*)arg);
+}
+
+void runReadSeq(void* arg)
+{
+	getSettings((Settings*)arg);
+}
+
+void benchSettings()
+{
+	Settings saved;
+	getSettings(&saved);
+	
+	Settings s;
+	benchRun("settings read, mutex", runReadOld, &s, 200);
+	benchRun("settings read, seqlock", runReadSeq, &s, 200);
+	
+	bool ok = true;
+	for(int readers = 1; readers <= SET_READERS_MAX; readers *= 2)
+	{
+		unsigned long long torn_old, torn_seq;
+		double old_ns = runContention(false, readers, &torn_old);
+		unsigned int old_commits = set_run.commits;
+		double seq_ns = runContention(true, readers, &torn_seq);
+		
+		printf("settings read, %d readers + writer    mutex %8.1f ns  seqlock %8.1f ns  %5.1fx  (%u/%u commits, %llu torn)\n",
+		readers, old_ns, seq_ns, old_ns/seq_ns, old_commits, set_run.commits, torn_seq);
+		ok = ok && !torn_seq && !torn_old;
+	}
+	
+	editSettings(&s);
+	unsigned int ver = s.version;
+	saved.version = 0;
+	s = saved;
+	commitSettings(&s);
+	getSettings(&s);
+	ok = ok && s.version == ver + 1 && !settingsDiff(&s, &saved);
+	printf("settings: snapshots consistent, version monotonic -> %s\n", benchCheck(ok) ? "ok" : "FAILED");
+}
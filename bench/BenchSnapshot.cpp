@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "Bench.h"
+#include "../Snapshot.h"
+#include "../ILI9341.h"
+#include "../Externs.h"
+
+#define SNAP_DIR      "/tmp/rws_bench_snap"
+#define SNAP_DB       SNAP_DIR "/readings.rws"
+#define SNAP_FILE     SNAP_DIR "/state.snap"
+#define SNAP_HISTORY  (LOG_SIZE + 1000)  // More than a day in database file
+#define SNAP_NEW      37                 // Readings logged after start, some of them not in the file yet
+#define SNAP_WAIT_MS  5000
+#define SNAP_FRAME_MS 100                // Warm start budget for the first frame on the panel
+
+LogState snap_before, snap_after; // Too big for stack
+
+unsigned long long snapLoggerInit(const LogState* warm, bool* used)
+{
+	unsigned long long beg = benchNow();
+	*used = initLogger(warm, SNAP_DB);
+	return benchNow() - beg;
+}
+
+bool makeHistory()
+{
+	FILE* f = fopen(SNAP_DB, "wb");
+	if(f == NULL)
+	{
+		return false;
+	}
+	unsigned int t0 = (unsigned int)time(NULL) - SNAP_HISTORY * 5;
+	for(int i = 0; i < SNAP_HISTORY; ++i)
+	{
+		Reading r = { t0 + i * 5, (unsigned int)(600 + i % 400) << 19 | 45 << 12 | 22 << 4 | 5 };
+		fwrite(&r, sizeof(Reading), 1, f);
+	}
+	return fclose(f) == 0;
+}
+
+bool sameLog(const LogState* a, const LogState* b)
+{
+	return a->pos == b->pos && a->ints_to_log == b->ints_to_log && a->file_size == b->file_size &&
+	!memcmp(a->ring, b->ring, sizeof(a->ring));
+}
+
+// Start-up of headless display, from initSnapshot() to first frame
+unsigned int snapFirstFrame(bool warm)
+{
+	initSnapshot(SNAP_FILE);
+	lcd_is_on = true;
+	initLCD(warm && warmPanel());
+	updateReadings(650, 45.0f, 22.5f);
+	
+	WarmStats ws;
+	unsigned long long beg = benchNow();
+	do
+	{
+		struct timespec ts = { 0, 200000 };
+		nanosleep(&ts, NULL);
+		getWarmStats(&ws);
+	}
+	while(!ws.first_frame_ms && benchNow() - beg < SNAP_WAIT_MS * 1000000ULL);
+	deinitLCD();
+	deinitSnapshot(); // Clean snapshot, display asleep
+	return ws.first_frame_ms;
+}
+
+void benchSnapshot()
+{
+	Settings saved, s;
+	getSettings(&saved);
+	mkdir(SNAP_DIR, 0755);
+	unlink(SNAP_FILE);
+	bool ok = makeHistory();
+	
+	// Cold start: ring comes from the database file
+	bool used;
+	unsigned long long cold_ns = snapLoggerInit(NULL, &used);
+	ok = ok && !used;
+	unsigned int t = (unsigned int)time(NULL);
+	for(int i = 0; i < SNAP_NEW; ++i)
+	{
+		Reading r = { t + i * 5, 777u << 19 | 50 << 12 | 21 << 4 };
+		logReading(r);
+	}
+	ok = !initSnapshot(SNAP_FILE) && ok;
+	editSettings(&s);
+	s.co2_warning = 1234;
+	commitSettings(&s);
+	snapshotTick(777, 50.5f, 21.3f);
+	getLogState(&snap_before);
+	
+	unsigned long long beg = benchNow();
+	deinitSnapshot();
+	double save_ms = (benchNow() - beg)/1e6;
+	deinitLogger();
+	
+	// Restart: settings and readings come back, ring with readings that never reached the file
+	editSettings(&s);
+	s.co2_warning = 1000;
+	commitSettings(&s);
+	beg = benchNow();
+	bool warm = initSnapshot(SNAP_FILE);
+	double load_us = (benchNow() - beg)/1e3;
+	unsigned long long warm_ns = snapLoggerInit(warmLog(), &used);
+	getLogState(&snap_after);
+	int ppm;
+	float humd, temp;
+	getSettings(&s);
+	bool resumed = warm && used && sameLog(&snap_before, &snap_after) && s.co2_warning == 1234 &&
+	warmReadings(&ppm, &humd, &temp) && ppm == 777 && humd == 50.5f && temp == 21.3f;
+	printf("snapshot: %zu KB saved in %.2f ms, mapped in %.1f us\n", sizeof(SnapFile)/1024, save_ms, load_us);
+	printf("snapshot: logger ring from file %8.1f us, from snapshot %8.1f us, %d readings not in file kept -> %s\n",
+	cold_ns/1e3, warm_ns/1e3, SNAP_NEW, benchCheck(resumed) ? "ok" : "FAILED");
+	ok = ok && resumed;
+	deinitSnapshot();
+	deinitLogger();
+	
+	// Database changed behind snapshot's back: ring must be read from the file
+	FILE* f = fopen(SNAP_DB, "ab");
+	Reading extra = { t, 0 };
+	ok = f != NULL && fwrite(&extra, sizeof(Reading), 1, f) == 1 && fclose(f) == 0 && ok;
+	initSnapshot(SNAP_FILE);
+	snapLoggerInit(warmLog(), &used);
+	bool stale = !used;
+	deinitSnapshot();
+	deinitLogger();
+	
+	// Damaged snapshot is not used at all
+	f = fopen(SNAP_FILE, "r+b");
+	ok = f != NULL && fseek(f, sizeof(SnapFile)/2, SEEK_SET) == 0 && fputc(0x5A, f) != EOF && fclose(f) == 0 && ok;
+	bool damaged = !initSnapshot(SNAP_FILE) && warmLog() == NULL;
+	initLogger(NULL, SNAP_DB);
+	deinitSnapshot();
+	deinitLogger();
+	printf("snapshot: changed database -> %s, damaged snapshot -> %s\n", benchCheck(stale) ? "read from file" : "FAILED",
+	benchCheck(damaged) ? "cold start" : "FAILED");
+	ok = ok && stale && damaged;
+	
+	// Display: full reset wait on cold start, none after clean shutdown in the same boot
+	unsigned int cold_ms = snapFirstFrame(false);
+	unsigned int warm_ms = snapFirstFrame(true);
+	bool frame_ok = cold_ms && warm_ms && warm_ms < cold_ms && warm_ms <= SNAP_FRAME_MS;
+	printf("snapshot: first LCD frame cold %u ms, warm %u ms (budget %d ms) -> %s\n", cold_ms, warm_ms,
+	SNAP_FRAME_MS, benchCheck(frame_ok) ? "ok" : "FAILED");
+	ok = ok && frame_ok;
+	
+	unlink(SNAP_FILE);
+	unlink(SNAP_DB);
+	rmdir(SNAP_DIR);
+	editSettings(&s);
+	saved.version = s.version;
+	s = saved;
+	commitSettings(&s);
+	printf("snapshot: %s\n", benchCheck(ok) ? "ok" : "FAILED");
+}
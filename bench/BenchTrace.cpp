@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <string>
+#include "Bench.h"
+#include "../Trace.h"
+
+#define TRC_WRITERS 2
+#define TRC_EVENTS  200000 // Per writer, rings wrap many times while collector copies them
+#define TRC_BASE_NS 1000000000ULL
+
+using namespace std;
+
+volatile int trc_sink;
+
+void runNoSpan(void* arg)
+{
+	trc_sink = trc_sink + 1;
+}
+
+void runSpan(void* arg)
+{
+	TRACE_SPAN("bench_span");
+	trc_sink = trc_sink + 1;
+}
+
+// Duration of every event is a function of its start, so a slot mixing two events is visible
+void* trcWriter(void* param)
+{
+	volatile bool* stop = (volatile bool*)param;
+	for(unsigned long long i = 0; i < TRC_EVENTS && !*stop; ++i)
+	{
+		unsigned long long beg = TRC_BASE_NS + i * 1000;
+		traceRecord("bench_torn", beg, beg + (i % 97) * 1000);
+	}
+	return NULL;
+}
+
+// Checks bench_torn events and their order on each thread, returns number of them or -1 if any is wrong
+int checkTrace(const string& json)
+{
+	int n = 0;
+	int last_tid[TRC_WRITERS + 1] = {};
+	unsigned long long last_ts[TRC_WRITERS + 1] = {};
+	for(size_t p = json.find("{\"name\":\"bench_torn\""); p != string::npos; p = json.find("{\"name\":\"bench_torn\"", p + 1))
+	{
+		unsigned long long ts, ts_frac, dur, dur_frac;
+		int tid;
+		if(sscanf(json.c_str() + p, "{\"name\":\"bench_torn\",\"ph\":\"X\",\"ts\":%llu.%llu,\"dur\":%llu.%llu,\"pid\":1,\"tid\":%d}",
+		&ts, &ts_frac, &dur, &dur_frac, &tid) != 5)
+		{
+			return -1;
+		}
+		unsigned long long i = ts - TRC_BASE_NS/1000;
+		if(ts_frac || dur_frac || dur != i % 97)
+		{
+			return -1;
+		}
+		
+		int w = 0;
+		while(w < TRC_WRITERS && last_tid[w] && last_tid[w] != tid)
+		{
+			++w;
+		}
+		if(last_tid[w] == tid && ts <= last_ts[w])
+		{
+			return -1;
+		}
+		last_tid[w] = tid;
+		last_ts[w] = ts;
+		++n;
+	}
+	return n;
+}
+
+void benchTrace()
+{
+	double none_ns = benchRun("trace off, no span", runNoSpan, NULL, 200);
+	double off_ns = benchRun("trace off, span", runSpan, NULL, 200);
+	traceStart();
+	double on_ns = benchRun("trace on, span", runSpan, NULL, 200);
+	traceStop();
+	printf("trace span: %.1f ns while off, %.1f ns while capturing\n", off_ns - none_ns, on_ns - none_ns);
+	
+	// Collector runs while writers overwrite their rings
+	volatile bool stop = false;
+	pthread_t thd[TRC_WRITERS];
+	for(int i = 0; i < TRC_WRITERS; ++i)
+	{
+		pthread_create(thd + i, NULL, trcWriter, (void*)&stop);
+	}
+	int exports = 0, bad = 0;
+	unsigned long long json_ns = 0, json_len = 0;
+	for(int i = 0; i < 20; ++i)
+	{
+		string json;
+		unsigned long long beg = benchNow();
+		traceJSON(&json, 0);
+		json_ns += benchNow() - beg;
+		json_len += json.size();
+		bad += checkTrace(json) < 0 ? 1 : 0;
+		++exports;
+	}
+	for(int i = 0; i < TRC_WRITERS; ++i)
+	{
+		pthread_join(thd[i], NULL);
+	}
+	
+	// Quiet rings: collector can't tell if the oldest slot is being reused, so TRACE_RING - 1 events are kept
+	string json;
+	traceJSON(&json, 0);
+	int kept = checkTrace(json);
+	bool ok = !bad && kept == TRC_WRITERS * (TRACE_RING - 1) && json[0] == '{' && json.compare(json.size() - 3, 3, "}}\n") == 0;
+	
+	// Window filter: nothing of the above is newer than a capture that starts now
+	string win;
+	unsigned long long since = traceStart();
+	runSpan(NULL);
+	traceStop();
+	int n = traceJSON(&win, since);
+	ok = ok && n == 1 && win.find("bench_span") != string::npos && win.find("bench_torn") == string::npos;
+	
+	printf("trace: %d exports during writes, %.1f ms and %llu KB each, %d torn, %d kept -> %s\n", exports,
+	json_ns/1e6/exports, json_len/1024/exports, bad, kept, benchCheck(ok) ? "ok" : "FAILED");
+}
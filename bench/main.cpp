@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+#include "Bench.h"
+#include "../Externs.h"
+
+#define BENCH_ROUNDS      3   // benchRun() reports the fastest round, the others only absorb noise
+#define BENCH_MAX_RESULTS 256
+
+pthread_attr_t master_thread_attr; // Normally defined in main.cpp of the station
+const int update_period_ms = 1000;
+
+struct BenchGroup
+{
+	const char* name;
+	void (*fn)();
+};
+
+// In the order they run, later groups rely on state some earlier ones leave (settings, warm LCD)
+const BenchGroup bench_groups[] = {
+	{ "fusion", benchFusion },
+	{ "sampler", benchSampler },
+	{ "settings", benchSettings },
+	{ "config", benchConfig },
+	{ "pool", benchPool },
+	{ "metrics", benchMetrics },
+	{ "trace", benchTrace },
+	{ "blend", benchBlend },
+	{ "blit", benchBlit },
+	{ "spi", benchSpi },
+	{ "render", benchRender },
+	{ "hot", benchHot },
+	{ "buzz", benchBuzz },
+	{ "snapshot", benchSnapshot },
+};
+const int bench_ngroups = sizeof(bench_groups)/sizeof(bench_groups[0]);
+
+struct BenchResult
+{
+	const char* group;
+	char name[48];
+	double ns;
+	double spread; // Slowest round / fastest one
+	unsigned long long ops;
+	double allocs;
+};
+
+BenchResult bench_results[BENCH_MAX_RESULTS];
+int bench_nresults;
+const char* bench_group;
+int bench_failed; // Checks that printed FAILED
+
+// Every heap allocation of the calling thread, malloc() below replaces the C library one for the whole binary,
+// so operator new, std::string and C library internals are counted too
+__thread unsigned long long bench_allocs;
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size)
+{
+	++bench_allocs;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+	++bench_allocs;
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	++bench_allocs;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+	__libc_free(ptr);
+}
+}
+
+bool writeJSON(const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if(f == NULL)
+	{
+		perror("Error opening benchmark results file");
+		return false;
+	}
+	
+	struct utsname un;
+	uname(&un);
+	fprintf(f, "{\n\"machine\": \"%s\",\n\"kernel\": \"%s\",\n\"rounds\": %d,\n\"results\": [", un.machine, un.release, BENCH_ROUNDS);
+	for(int i = 0; i < bench_nresults; ++i)
+	{
+		const BenchResult* r = bench_results + i;
+		fprintf(f, "%s\n{\"group\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.2f, \"spread\": %.3f, \"ops\": %llu, \"allocs_per_op\": %.3f}",
+		i ? "," : "", r->group, r->name, r->ns, r->spread, r->ops, r->allocs);
+	}
+	fprintf(f, "\n]\n}\n");
+	fclose(f);
+	return true;
+}
+
+// rws_bench [-j results.json] [group ...], all groups by default
+int main(int argc, char** argv)
+{
+	pthread_attr_init(&master_thread_attr);
+	pthread_attr_setdetachstate(&master_thread_attr, PTHREAD_CREATE_DETACHED);
+	
+	const char* json = NULL;
+	int first = 1;
+	if(argc > 2 && !strcmp(argv[1], "-j"))
+	{
+		json = argv[2];
+		first = 3;
+	}
+	
+	for(int i = first; i < argc; ++i)
+	{
+		int g = 0;
+		while(g < bench_ngroups && strcmp(argv[i], bench_groups[g].name))
+		{
+			++g;
+		}
+		if(g == bench_ngroups)
+		{
+			fprintf(stderr, "Unknown benchmark group %s, groups are:", argv[i]);
+			for(g = 0; g < bench_ngroups; ++g)
+			{
+				fprintf(stderr, " %s", bench_groups[g].name);
+			}
+			fprintf(stderr, "\n");
+			return 1;
+		}
+	}
+	
+	for(int g = 0; g < bench_ngroups; ++g)
+	{
+		bool run = first == argc;
+		for(int i = first; i < argc && !run; ++i)
+		{
+			run = !strcmp(argv[i], bench_groups[g].name);
+		}
+		if(run)
+		{
+			bench_group = bench_groups[g].name;
+			bench_groups[g].fn();
+		}
+	}
+	
+	if(json != NULL && writeJSON(json))
+	{
+		printf("bench: %d results written to %s\n", bench_nresults, json);
+	}
+	if(bench_failed)
+	{
+		printf("bench: %d check(s) FAILED\n", bench_failed);
+		return 1;
+	}
+	return 0;
+}
+
+unsigned long long benchNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool benchCheck(bool ok)
+{
+	bench_failed += ok ? 0 : 1;
+	return ok;
+}
+
+void benchRecord(const char* name, double ns, double spread, unsigned long long ops, double allocs)
+{
+	if(bench_nresults == BENCH_MAX_RESULTS)
+	{
+		return;
+	}
+	BenchResult* r = bench_results + bench_nresults++;
+	r->group = bench_group;
+	const char* n = name;
+	while(*n == ' ') // Indented sub-results of console output
+	{
+		++n;
+	}
+	snprintf(r->name, sizeof(r->name), "%s", n);
+	r->ns = ns;
+	r->spread = spread;
+	r->ops = ops;
+	r->allocs = allocs;
+}
+
+double benchRun(const char* name, void (*fn)(void*), void* arg, int min_ms)
+{
+	fn(arg); // Warm up caches
+	
+	unsigned long long lim = (unsigned long long)min_ms * 1000000ULL/BENCH_ROUNDS;
+	unsigned long long total_ops = 0, allocs = bench_allocs;
+	double best = 0.0, worst = 0.0;
+	for(int r = 0; r < BENCH_ROUNDS; ++r)
+	{
+		unsigned long long ops = 0;
+		unsigned long long beg = benchNow(), dur = 0;
+		do
+		{
+			for(int i = 0; i < 64; ++i)
+			{
+				fn(arg);
+			}
+			ops += 64;
+			dur = benchNow() - beg;
+		}
+		while(dur < lim);
+		
+		double ns = (double)dur/ops;
+		best = r == 0 || ns < best ? ns : best;
+		worst = ns > worst ? ns : worst;
+		total_ops += ops;
+	}
+	
+	double per_op = (double)(bench_allocs - allocs)/total_ops;
+	printf("%-40s %12.1f ns/op %12llu ops %8.2f allocs/op\n", name, best, total_ops, per_op);
+	benchRecord(name, best, worst/best, total_ops, per_op);
+	return best;
+}
@@ -0,0 +1,36 @@
+#ifndef WIRINGPI_STUB_H
+#define WIRINGPI_STUB_H
+
+// Subset of wiringPi API used by the station, for headless builds on machines without wiringPi.
+// Implemented by LcdSim.cpp.
+
+#define INPUT            0
+#define OUTPUT           1
+
+#define PUD_OFF          0
+#define PUD_DOWN         1
+#define PUD_UP           2
+
+#define INT_EDGE_SETUP   0
+#define INT_EDGE_FALLING 1
+#define INT_EDGE_RISING  2
+#define INT_EDGE_BOTH    3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int wiringPiSetupGpio(void);
+void pinMode(int pin, int mode);
+void pullUpDnControl(int pin, int pud);
+int wiringPiISR(int pin, int mode, void (*function)(void));
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+void delay(unsigned int how_long);
+void delayMicroseconds(unsigned int how_long);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIRINGPI_STUB_H */
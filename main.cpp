@@ -1,53 +1,61 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 #include <time.h>
 #include <signal.h>
 #include <pthread.h>
+#include <poll.h>
 #include "Externs.h"
 #include "HTU21D.h"
 #include "SHT31D.h"
+#include "SimTHSensor.h"
+#include "THSampler.h"
 #include "CO2.h"
 #include "ILI9341.h"
 #include "WebServer.h"
 #include "Buzzer.h"
 #include "Logger.h"
+#include "Settings.h"
+#include "Config.h"
+#include "Snapshot.h"
+#include "Metrics.h"
+#include "Trace.h"
 
-#define TH_MSR_DUR  50000000 // Tempreture + Humidity mesuring duration
-#define CO2_MSR_DUR 30000000 // CO2 mesuring duration
+#define CO2_STALE_REQ 3      // CO2 reading older than this many request periods is reported as stale
+#define TH_RATE     5        // Tempreture + Humidity oversampling rate in Hz, decimated to 1 Hz
+
+// Readings are published to web and LCD only when they move out of these deadbands (logger gets everything).
+// MH-Z19B jitters by a few ppm from one measurement to the next and its accuracy is +-50 ppm + 5%, so 10 ppm
+// only hides noise. Fused and decimated T/H still wander by 0.1 in the last digit, sensors are +-2 %RH, +-0.3 *C.
+#define DB_CO2       10      // ppm
+#define DB_HUMD      3       // 0.1 %
+#define DB_TEMP      2       // 0.1 *C
+#define HEARTBEAT_MS 30000   // Maximum quiet interval, publish anyway after it
 #define NSEC_PASSED(ts0, ts1, tns0, tns1) ((ts1 - ts0) * 1000000000 + (tns1 - tns0))
 
 // Extern variables
 volatile bool allow_poweroff;
-volatile bool update_allowed = true;
 volatile bool lcd_is_on;
-
-volatile int lcd_on_off_time;
-pthread_mutex_t lcd_on_off_time_lock;
-
-volatile int co2_warning = 1000; // ASHRAE 2006 / EN 13779:2008 / WHO 1990
-volatile int humd_warning_low = 30;
-volatile int humd_warning_high = 50;
-volatile int temp_warning_low = 20;
-volatile int temp_warning_high = 27;
-pthread_mutex_t warning_levels_lock;
-
-volatile int co2_warning_song = SNG_BEEP;
-pthread_mutex_t co2_warning_song_lock;
+volatile bool readings_dirty;
 
 const int update_period_ms = 1000;
 pthread_attr_t master_thread_attr; // Will be used to create all threads
 
-HTU21D thsens1;
-SHT31D thsens2;
+#ifndef SIM_SENSORS
+I2CBus i2c_bus("/dev/i2c-1"); // Must be defined before sensors that borrow it
+HTU21D thsens1(&i2c_bus);
+SHT31D thsens2(&i2c_bus);
+#else
+SimTHSensor thsens1(0.1f, 1);
+SimTHSensor thsens2(-0.1f, 2);
+#endif
 MHZ19B co2sens;
 
 void sigCatcher(int signum);
-void initLocks();
-void destroyLocks();
-void loadConfig();
-void saveConfig();
+int warnLevels(const Settings* set, int ppm, float humd, float temp);
+long long waitCO2(int* ppm, long long wait_ns);
 
 int main()
 {	
@@ -56,25 +64,40 @@ int main()
 	signal(SIGTERM, sigCatcher);
 	signal(SIGQUIT, sigCatcher);
 	
-	// Prepare master thread attributes and mutex locks
+	// Prepare master thread attributes
 	pthread_attr_init(&master_thread_attr);
 	pthread_attr_setdetachstate(&master_thread_attr, PTHREAD_CREATE_DETACHED);
-	initLocks();
 	
-	loadConfig();
+	initSnapshot(); // First, start-up times are measured from here
+	initConfig();   // Loads saved settings before anyone reads them, over the ones from snapshot
 	
 	pthread_t servthd;
 	pthread_create(&servthd, &master_thread_attr, serverMain, NULL);
 	
-	initLCD();
+	initTHSampler(&thsens1, &thsens2, TH_RATE); // Starts sampling while LCD resources are loading
+	initLCD(warmPanel());
 	
-	int msec = 0;
-	int ppm = co2sens.GetPPM();
+	// Warm start shows last readings right away, fresh ones replace them within seconds
+	Settings set;
+	getSettings(&set);
+	co2sens.SetRequestPeriod(set.co2_req_period * 1000);
+	int ppm = 0;
 	float humd = 0.0f, temp = 0.0f;
+	bool warm = warmReadings(&ppm, &humd, &temp);
+	if(!warm && co2sens.Request() == 0)
+	{
+		waitCO2(&ppm, co2_reply_timeout_ms * 1000000LL); // Late reply is harvested by the first cycle
+	}
+	bool co2_stale = false;
+	
+	// Last published readings, humidity and temperature in tenths
+	int pub_ppm = -1, pub_humd = 0, pub_temp = 0, pub_warn = 0, quiet_ms = 0;
+	bool lcd_pending = true; // Change was published to web while LCD was off
 	
 	unsigned int upd_period_ns = update_period_ms * 1000000;
 	struct timespec beg, end; // No Hobbits live here!
-	struct timespec th, co, th_aw, end_wait = {0}, th_wait = {0}, co_wait = {0};
+	struct timespec end_wait = {0};
+	unsigned long long prev_beg_ns = 0;
 	
 	struct tm t;
 	time_t sec;
@@ -82,45 +105,65 @@ int main()
 	while(1)
 	{		
 		clock_gettime(CLOCK_MONOTONIC, &beg);
-		int th1_res = thsens1.Measure();
-		int th2_res = thsens2.Measure();
-		float h1, h2, t1, t2;
-		h1 = thsens1.GetHumd();
-		h2 = thsens2.GetHumd();
-		t1 = thsens1.GetTemp();
-		t2 = thsens2.GetTemp();
-		
-		if(th1_res == 0 && th2_res == 0)
+		unsigned long long beg_ns = (unsigned long long)beg.tv_sec * 1000000000ULL + beg.tv_nsec;
+		if(prev_beg_ns)
 		{
-			humd = roundf((h1 + h2)/2.0f * 10.0f)/10.0f;
-			temp = roundf((t1 + t2)/2.0f * 10.0f)/10.0f;
+			long long jit = (long long)(beg_ns - prev_beg_ns) - upd_period_ns;
+			metObserve(MH_LOOP_PERIOD, beg_ns - prev_beg_ns);
+			metObserve(MH_LOOP_JITTER, jit < 0 ? -jit : jit);
 		}
-		else if(th1_res < 0 && th2_res == 0)
+		prev_beg_ns = beg_ns;
+		
+		// Reply to CO2 request is normally harvested by the wait at the end of previous cycle,
+		// this only picks up one that came late or timed out
+		if(co2sens.Harvest() > 0)
 		{
-			humd = h2;
-			temp = t2;
+			ppm = co2sens.GetLastPPM();
 		}
-		else if(th1_res == 0 && th2_res < 0)
+		
+		float th_humd, th_temp;
+		if(getTHSample(&th_humd, &th_temp) || !warm) // Fused and decimated by sampler thread
 		{
-			humd = h1;
-			temp = t1;
+			humd = th_humd;
+			temp = th_temp;
 		}
+		humd = roundf(humd * 10.0f)/10.0f;
+		temp = roundf(temp * 10.0f)/10.0f;
 		
-		clock_gettime(CLOCK_MONOTONIC, &th);
-		th_wait.tv_nsec = TH_MSR_DUR - NSEC_PASSED(beg.tv_sec, th.tv_sec, beg.tv_nsec, th.tv_nsec);
-		nanosleep(&th_wait, NULL);
-		clock_gettime(CLOCK_MONOTONIC, &th_aw);
+		getSettings(&set);
 		
-		// CO2 sensor measures every 5 seconds no matter how often it's probed
-		if(msec >= 5000)
+		co2sens.SetRequestPeriod(set.co2_req_period * 1000);
+		int co2_age = co2sens.GetAgeMs();
+		if((co2_age > CO2_STALE_REQ * co2sens.GetRequestPeriod()) != co2_stale)
 		{
-			ppm = co2sens.GetPPM();
-			msec = 0;
+			co2_stale = !co2_stale;
+			logError(co2_stale ? "MHZ19B: CO2 reading is stale" : "MHZ19B: CO2 reading is fresh again", 0);
 		}
+		metGaugeSet(MG_CO2_AGE, co2_age);
+		metGaugeSet(MG_CO2_STALE, co2_stale);
+		metGaugeSet(MG_CO2_PERIOD, co2sens.GetRequestPeriod());
+		
+		// Warning crossing inside a deadband is published at once, LCD blinks and the alarm plays from published readings
+		int humd10 = (int)lroundf(humd * 10.0f);
+		int temp10 = (int)lroundf(temp * 10.0f);
+		int warn = warnLevels(&set, ppm, humd, temp);
+		bool changed = abs(ppm - pub_ppm) >= DB_CO2 || abs(humd10 - pub_humd) >= DB_HUMD ||
+		abs(temp10 - pub_temp) >= DB_TEMP || warn != pub_warn || quiet_ms >= HEARTBEAT_MS || readings_dirty;
 		
-		clock_gettime(CLOCK_MONOTONIC, &co);
-		co_wait.tv_nsec = CO2_MSR_DUR - NSEC_PASSED(th_aw.tv_sec, co.tv_sec, th_aw.tv_nsec, co.tv_nsec);
-		nanosleep(&co_wait, NULL);
+		if(changed)
+		{
+			readings_dirty = false;
+			pub_ppm = ppm;
+			pub_humd = humd10;
+			pub_temp = temp10;
+			pub_warn = warn;
+			quiet_ms = 0;
+			lcd_pending = true;
+		}
+		else
+		{
+			quiet_ms += update_period_ms;
+		}
 		
 		WebUpdate upd;
 		memset(&upd, 0, sizeof(WebUpdate));
@@ -128,23 +171,28 @@ int main()
 		upd.ppm = ppm;
 		upd.humd = humd;
 		upd.temp = temp;
-		putWebQueue(&upd);
+		upd.publish = changed;
+		putWebQueue(&upd); // Always queued, logger and charts need every sample
+		snapshotTick(ppm, humd, temp);
 		
-		if(lcd_is_on && update_allowed)
+		if(lcd_is_on)
 		{
-			updateReadings(ppm, humd, temp);
+			if(lcd_pending || lcdIsBlinking())
+			{
+				TRACE_SPAN("update_readings");
+				updateReadings(ppm, humd, temp);
+				lcd_pending = false;
+			}
+			else
+			{
+				skipReadings();
+			}
 		}
 		
-		// Critical Section Beg
-		pthread_mutex_lock(&lcd_on_off_time_lock);
-		
-		int onh = lcd_on_off_time >> 24;
-		int onm = (lcd_on_off_time & 0xFF0000) >> 16;
-		int offh = (lcd_on_off_time & 0xFF00) >> 8;
-		int offm = lcd_on_off_time & 0xFF;
-		
-		pthread_mutex_unlock(&lcd_on_off_time_lock);
-		// Critical Section End
+		int onh = set.lcd_on_off_time >> 24;
+		int onm = (set.lcd_on_off_time & 0xFF0000) >> 16;
+		int offh = (set.lcd_on_off_time & 0xFF00) >> 8;
+		int offm = set.lcd_on_off_time & 0xFF;
 		
 		if(onh == offh && onm == offm)
 		{
@@ -163,12 +211,19 @@ int main()
 		}
 		
 		loopend:
-		msec += update_period_ms;
+		if(co2sens.IsRequestDue())
+		{
+			co2sens.Request(); // Harvested by the wait below
+		}
 		clock_gettime(CLOCK_MONOTONIC, &end);
+		traceAdd("update_cycle", beg_ns, (unsigned long long)end.tv_sec * 1000000000ULL + end.tv_nsec);
 		
 		// This operation takes from 4000 to 1000 nano seconds, which is fine and shouldn't cause much desync
-		end_wait.tv_nsec = upd_period_ns - NSEC_PASSED(beg.tv_sec, end.tv_sec, beg.tv_nsec, end.tv_nsec);
-		nanosleep(&end_wait, NULL);
+		end_wait.tv_nsec = waitCO2(&ppm, upd_period_ns - NSEC_PASSED(beg.tv_sec, end.tv_sec, beg.tv_nsec, end.tv_nsec));
+		if(end_wait.tv_nsec > 0)
+		{
+			nanosleep(&end_wait, NULL);
+		}
 	}
 	
 	sigCatcher(0);
@@ -179,13 +234,15 @@ int main()
 void sigCatcher(int signum)
 {	
 	logError("SIGINT/SIGTERM/SIGQUIT catched, Deiniting", 0);
-	saveConfig();
+	deinitConfig(); // Writes pending changes
+	deinitTHSampler();
 	pthread_attr_destroy(&master_thread_attr);
-	destroyLocks();
-	deinitWebServer();
 	deinitLCD();
-	thsens1.DeInit();
-	thsens2.DeInit();
+	deinitWebServer();
+	deinitSnapshot(); // After display went to sleep, before logger closes its file
+#ifndef SIM_SENSORS
+	i2c_bus.DeInit();
+#endif
 	co2sens.DeInit();
 	
 	if(allow_poweroff)
@@ -204,94 +261,36 @@ void sigCatcher(int signum)
 	sleep(10);
 }
 
-void initLocks()
-{
-	pthread_mutex_init(&lcd_on_off_time_lock, NULL);
-	pthread_mutex_init(&warning_levels_lock, NULL);
-	pthread_mutex_init(&co2_warning_song_lock, NULL);
-}
-
-void destroyLocks()
+// Which warnings readings trigger, same comparisons as LCD makes in applyReadings()
+int warnLevels(const Settings* set, int ppm, float humd, float temp)
 {
-	pthread_mutex_destroy(&lcd_on_off_time_lock);
-	pthread_mutex_destroy(&warning_levels_lock);
-	pthread_mutex_destroy(&co2_warning_song_lock);
+	return (ppm > set->co2_warning) | ((int)humd > set->humd_warning_high) << 1 | ((int)humd < set->humd_warning_low) << 2 |
+	(temp > (float)set->temp_warning_high) << 3 | (temp < (float)set->temp_warning_low) << 4;
 }
 
-// Only Main Thread will be present on config load, so no need to lock
-void loadConfig()
+// Sleeps on CO2 UART while a reply is pending and harvests it the moment it arrives, returns ns left of wait_ns
+long long waitCO2(int* ppm, long long wait_ns)
 {
-	FILE* f = fopen("./log/config.cfg", "r");
-	if(f == NULL)
-	{
-		return;
-	}
+	struct timespec beg, now, left;
+	clock_gettime(CLOCK_MONOTONIC, &beg);
 	
-	char c[140];
-	fread(c, 1, 140, f);
-	
-	fclose(f);
-	
-	for(int i = 0; i < 140; ++i)
+	long long left_ns = wait_ns;
+	while(left_ns > 0 && co2sens.IsPending())
 	{
-		if(c[i] == '\n')
+		left.tv_sec = left_ns / 1000000000;
+		left.tv_nsec = left_ns % 1000000000;
+		struct pollfd pfd = { co2sens.GetReadyFd(), POLLIN, 0 };
+		ppoll(&pfd, 1, &left, NULL);
+		if(co2sens.Harvest() > 0)
 		{
-			c[i] = 0;
+			*ppm = co2sens.GetLastPPM();
 		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left_ns = wait_ns - NSEC_PASSED(beg.tv_sec, now.tv_sec, beg.tv_nsec, now.tv_nsec);
 	}
-	
-	lcd_on_off_time = atoi(c+12) << 24 | atoi(c+27) << 16 | atoi(c+43) << 8 | atoi(c+59);
-	co2_warning = atoi(c+68);
-	humd_warning_low = atoi(c+82);
-	humd_warning_high = atoi(c+95);
-	temp_warning_low = atoi(c+108);
-	temp_warning_high = atoi(c+121);
-	co2_warning_song = atoi(c+136);
-}
-
-void saveConfig()
-{
-	FILE* f = fopen("./log/config.cfg", "w");
-	
-	// Critical Section Beg
-	pthread_mutex_lock(&lcd_on_off_time_lock);
-	
-	int onh = lcd_on_off_time >> 24;
-	int onm = (lcd_on_off_time & 0xFF0000) >> 16;
-	int offh = (lcd_on_off_time & 0xFF00) >> 8;
-	int offm = lcd_on_off_time & 0xFF;
-	
-	pthread_mutex_unlock(&lcd_on_off_time_lock);
-	// Critical Section End
-	
-	fprintf(f, "lcd_on_hrs= %02d\nlcd_on_min= %02d\nlcd_off_hrs= %02d\nlcd_off_min= %02d\n",
-	onh, onm, offh, offm);
-	
-	// Critical Section Beg
-	pthread_mutex_lock(&warning_levels_lock);
-	
-	fprintf(f, "wco2= %04d\nwhumd_l= %03d\nwhumd_h= %03d\nwtemp_l= %03d\nwtemp_h= %03d\n",
-	co2_warning, humd_warning_low, humd_warning_high, temp_warning_low, temp_warning_high);
-	
-	pthread_mutex_unlock(&warning_levels_lock);
-	pthread_mutex_lock(&co2_warning_song_lock);
-	
-	fprintf(f, "wco2_song= %02d\n", co2_warning_song);
-	
-	pthread_mutex_unlock(&co2_warning_song_lock);
-	// Critical Section End
-	
-	fclose(f);
+	return left_ns;
 }
 
-/*printf("NSEC PASSED: %d\n", (end.tv_sec - beg.tv_sec) * 1000000000 + (end.tv_nsec - beg.tv_nsec));
-fprintf(f, "%lu,", (th_aw.tv_sec - beg.tv_sec) * 1000000000 + (th_aw.tv_nsec - beg.tv_nsec));
-fprintf(f, "%lu,", (co_aw.tv_sec - th_aw.tv_sec) * 1000000000 + (co_aw.tv_nsec - th_aw.tv_nsec));
-fprintf(f, "%lu,", (t3.tv_sec - co_aw.tv_sec) * 1000000000 + (t3.tv_nsec - co_aw.tv_nsec));
-fprintf(f, "%lu,", (t4.tv_sec - t3.tv_sec) * 1000000000 + (t4.tv_nsec - t3.tv_nsec));
-fprintf(f, "%lu,", (t5.tv_sec - t4.tv_sec) * 1000000000 + (t5.tv_nsec - t4.tv_nsec));
-fprintf(f, "%lu,", (end.tv_sec - t5.tv_sec) * 1000000000 + (end.tv_nsec - t5.tv_nsec));
-fprintf(f, "%lu\n", (end.tv_sec - beg.tv_sec) * 1000000000 + (end.tv_nsec - beg.tv_nsec));*/
 //printf("%-d ppm HTU: %-3.1f *C %-3.1f%% SHT: %-3.1f *C %-3.1f%%\n", ppm, t1, h1, t2, h2);
 //printf("h1 %.3f t1 %.3f h2 %.3f t2 %.3f avgh %.3f avgt %.3f\n", h1, t1, h2, t2, humd, temp);
 /* Measurements comparisons
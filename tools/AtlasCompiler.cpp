@@ -0,0 +1,74 @@
+// Build time tool: converts every sprite from ./img into screen format and packs them into one atlas file,
+// which initLCD() maps instead of parsing ~40 image files. Run from repository root: rws_atlas [out_path]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../Assets.h"
+
+int main(int argc, char** argv)
+{
+	const char* out_path = argc > 1 ? argv[1] : ATLAS_PATH;
+	
+	AssetDef defs[ASSET_MAX];
+	int n = listAssets(defs);
+	
+	unsigned char* imgs[ASSET_MAX];
+	AtlasEntry ents[ASSET_MAX];
+	memset(ents, 0, sizeof(ents));
+	
+	unsigned int off = sizeof(AtlasHeader) + n * sizeof(AtlasEntry);
+	for(int i = 0; i < n; ++i)
+	{
+		imgs[i] = loadAsset(defs + i);
+		if(imgs[i] == NULL)
+		{
+			fprintf(stderr, "rws_atlas: can't load %s\n", defs[i].path);
+			return 1;
+		}
+		
+		int w = *(unsigned short*)imgs[i];
+		int h = *(unsigned short*)(imgs[i]+2);
+		off = (off + ATLAS_ALIGN - 1) & ~(ATLAS_ALIGN - 1);
+		strncpy(ents[i].name, defs[i].name, ASSET_NAME - 1);
+		ents[i].offset = off;
+		ents[i].size = w * h * (defs[i].alpha || defs[i].pam ? 3 : 2) + 4;
+		off += ents[i].size;
+	}
+	
+	AtlasHeader hdr;
+	hdr.magic = ATLAS_MAGIC;
+	hdr.version = ATLAS_VERSION;
+	hdr.count = n;
+	hdr.size = off;
+	
+	// Written next to the target and renamed, running station never maps half-written atlas
+	char tmp_path[256];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+	FILE* out = fopen(tmp_path, "wb");
+	if(out == NULL)
+	{
+		perror("rws_atlas: can't create atlas");
+		return 1;
+	}
+	
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	fwrite(ents, sizeof(AtlasEntry), n, out);
+	for(int i = 0; i < n; ++i)
+	{
+		static const unsigned char zeros[ATLAS_ALIGN] = {0};
+		fwrite(zeros, 1, ents[i].offset - ftell(out), out);
+		fwrite(imgs[i], 1, ents[i].size, out);
+		free(imgs[i]);
+	}
+	
+	if(fclose(out) != 0 || rename(tmp_path, out_path) != 0)
+	{
+		perror("rws_atlas: can't write atlas");
+		unlink(tmp_path);
+		return 1;
+	}
+	
+	printf("rws_atlas: %d sprites, %u B -> %s\n", n, off, out_path);
+	return 0;
+}
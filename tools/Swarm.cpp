@@ -0,0 +1,545 @@
+// Load generator: forks a headless web server fed by a simulated sensor and connects a growing swarm of
+// /upd event stream clients to it, plus a trickle of page, chart and settings requests. For every swarm size it
+// reports how long a readings event takes from putWebQueue() until its bytes arrive at a client, delivered
+// events and bytes per second, how many clients were served, and what it cost the server (CPU, RSS).
+// Run from repository root: rws_swarm [-p port] [-t seconds] [-f feed_ms] [-r requests/s] [sizes ...]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../WebServer.h"
+#include "../Externs.h"
+
+#define SWARM_PORT       8080
+#define SWARM_STEP_S     5
+#define SWARM_FEED_MS    100  // Station publishes once a second, faster feed shows where fan-out saturates
+#define SWARM_REQ_HZ     4
+#define SWARM_MAX        256  // Clients of one step
+#define SWARM_SEQS       4096 // Enqueue times kept, readings carry the index as ppm
+#define SWARM_PPM0       400
+#define SWARM_SETTLE_MS  1000 // Between steps, server drops clients of the previous one
+#define SWARM_REQ_TMO_MS 2000
+#define SWARM_BUFF       65536
+
+using namespace std;
+
+pthread_attr_t master_thread_attr; // Normally defined in main.cpp of the station
+const int update_period_ms = 1000;
+volatile bool allow_poweroff;
+volatile bool lcd_is_on;
+volatile bool readings_dirty;
+
+// Shared with the forked server, CLOCK_MONOTONIC is the same clock in both processes
+struct SwarmShared
+{
+	unsigned long long enq_ns[SWARM_SEQS];
+};
+
+struct SwarmClient
+{
+	int sock;
+	int id;
+	int status; // 0 - waiting for a reader, 200 - streaming, 503 - refused
+	unsigned long long served_ns;
+	string buf;
+};
+
+struct SwarmReqs
+{
+	int port;
+	int hz;
+	volatile bool stop;
+	SwarmClient* clients;
+	int nclients;
+	int sent, ok, refused, failed;
+	vector<unsigned int> lat_us;
+};
+
+SwarmShared* swarm_shm;
+
+unsigned long long swarmNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void swarmSleepMs(int ms)
+{
+	struct timespec ts = { ms/1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+int swarmConnect(int port)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if(sock < 0)
+	{
+		return -1;
+	}
+	
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	int enable = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+	if(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+// Server process: the station's web server with a fake sensor loop publishing every reading
+void serverProc(int port, int feed_ms)
+{
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	pthread_attr_init(&master_thread_attr);
+	pthread_attr_setdetachstate(&master_thread_attr, PTHREAD_CREATE_DETACHED);
+	
+	pthread_t servthd;
+	pthread_create(&servthd, &master_thread_attr, serverMain, &port);
+	
+	int probe; // Queue is set up by serverMain() before it listens
+	while((probe = swarmConnect(port)) < 0)
+	{
+		swarmSleepMs(10);
+	}
+	close(probe);
+	
+	for(unsigned int seq = 0; ; ++seq)
+	{
+		WebUpdate upd;
+		memset(&upd, 0, sizeof(WebUpdate));
+		upd.op = WRT_RDINGS;
+		upd.ppm = SWARM_PPM0 + seq % SWARM_SEQS;
+		upd.humd = 45.0f;
+		upd.temp = 22.5f;
+		upd.publish = true;
+		__atomic_store_n(&swarm_shm->enq_ns[seq % SWARM_SEQS], swarmNow(), __ATOMIC_RELAXED);
+		putWebQueue(&upd);
+		swarmSleepMs(feed_ms);
+	}
+}
+
+bool swarmSend(int sock, const string& req)
+{
+	return send(sock, req.c_str(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size();
+}
+
+// Server answers with "\n" line ends, whole response is read so the connection ends cleanly
+int swarmRequest(int port, const string& path)
+{
+	int sock = swarmConnect(port);
+	if(sock < 0)
+	{
+		return -1;
+	}
+	
+	struct timeval tv = { SWARM_REQ_TMO_MS/1000, (SWARM_REQ_TMO_MS % 1000) * 1000 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if(!swarmSend(sock, "GET " + path + " HTTP/1.1\nHost: rws\n\n"))
+	{
+		close(sock);
+		return -1;
+	}
+	
+	string resp;
+	char buff[4096];
+	int code = -1;
+	size_t need = string::npos;
+	while(resp.size() < need)
+	{
+		ssize_t rd = read(sock, buff, sizeof(buff));
+		if(rd <= 0)
+		{
+			code = -1;
+			break;
+		}
+		resp.append(buff, rd);
+		
+		size_t hend = resp.find("\n\n");
+		if(need == string::npos && hend != string::npos)
+		{
+			code = atoi(resp.c_str() + 9); // "HTTP/1.1 "
+			size_t cl = resp.find("Content-Length: ");
+			need = hend + 2 + (cl != string::npos && cl < hend ? atoi(resp.c_str() + cl + 16) : 0);
+		}
+	}
+	close(sock);
+	return code;
+}
+
+// Same mix a browser produces: page loads, chart switches and scale changes of an open client, sound setting
+void* requestThread(void* param)
+{
+	SwarmReqs* r = (SwarmReqs*)param;
+	for(int i = 0; !r->stop; ++i)
+	{
+		int id = -1;
+		for(int c = 0; c < r->nclients && id < 0; ++c)
+		{
+			SwarmClient* sc = r->clients + (i + c) % r->nclients;
+			id = __atomic_load_n(&sc->status, __ATOMIC_RELAXED) == 200 ? sc->id : -1;
+		}
+		
+		char path[64];
+		switch(id < 0 ? 0 : i & 3)
+		{
+		case 0:
+			snprintf(path, sizeof(path), "/");
+			break;
+		case 1:
+			snprintf(path, sizeof(path), "/?sw=%d&id=%d", i % 3, id);
+			break;
+		case 2:
+			snprintf(path, sizeof(path), "/?sc=%d&id=%d", i % 3, id);
+			break;
+		default:
+			snprintf(path, sizeof(path), "/?cs=%d", i % 4);
+			break;
+		}
+		
+		unsigned long long beg = swarmNow();
+		int code = swarmRequest(r->port, path);
+		unsigned long long end = swarmNow();
+		++r->sent;
+		if(code == 200)
+		{
+			++r->ok;
+			r->lat_us.push_back((end - beg)/1000);
+		}
+		else if(code == 503)
+		{
+			++r->refused;
+		}
+		else
+		{
+			++r->failed;
+		}
+		
+		long left_ms = 1000/r->hz - (long)((end - beg)/1000000);
+		swarmSleepMs(left_ms > 0 ? left_ms : 0);
+	}
+	return NULL;
+}
+
+// Splits stream into events, readings ones are matched with the time their update was queued
+void parseStream(SwarmClient* c, unsigned long long now, vector<unsigned int>* lat_us)
+{
+	size_t pos = 0, end;
+	while((end = c->buf.find("\n\n", pos)) != string::npos)
+	{
+		const char* ev = c->buf.c_str() + pos;
+		if(!c->status && !strncmp(ev, "HTTP/1.1 ", 9))
+		{
+			__atomic_store_n(&c->status, atoi(ev + 9), __ATOMIC_RELAXED);
+			c->served_ns = now;
+		}
+		else if(!strncmp(ev, "event: readings\ndata: ", 22))
+		{
+			int seq = atoi(ev + 22) - SWARM_PPM0;
+			unsigned long long enq = seq >= 0 && seq < SWARM_SEQS ? __atomic_load_n(&swarm_shm->enq_ns[seq], __ATOMIC_RELAXED) : 0;
+			if(enq >= c->served_ns && now > enq) // Snapshot of the last readings every new client gets isn't fan-out
+			{
+				lat_us->push_back((now - enq)/1000);
+			}
+		}
+		pos = end + 2;
+	}
+	c->buf.erase(0, pos);
+}
+
+// utime + stime in clock ticks and VmRSS in kB of the server process
+void procUsage(pid_t pid, unsigned long long* ticks, long* rss_kb)
+{
+	char path[64], line[512];
+	*ticks = 0;
+	*rss_kb = 0;
+	
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE* f = fopen(path, "r");
+	if(f != NULL)
+	{
+		if(fgets(line, sizeof(line), f) != NULL)
+		{
+			unsigned long long ut = 0, st = 0;
+			const char* p = strrchr(line, ')'); // Process name may contain spaces
+			if(p != NULL && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &ut, &st) == 2)
+			{
+				*ticks = ut + st;
+			}
+		}
+		fclose(f);
+	}
+	
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	f = fopen(path, "r");
+	if(f != NULL)
+	{
+		while(fgets(line, sizeof(line), f) != NULL)
+		{
+			if(!strncmp(line, "VmRSS:", 6))
+			{
+				*rss_kb = atol(line + 6);
+			}
+		}
+		fclose(f);
+	}
+}
+
+unsigned int pct(vector<unsigned int>& v, int p)
+{
+	return v.empty() ? 0 : v[(v.size() - 1) * p/100];
+}
+
+void runStep(pid_t server, int port, int n, int secs, int req_hz, int id0)
+{
+	SwarmClient* clients = new SwarmClient[n];
+	int ep = epoll_create1(0);
+	int open = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		SwarmClient* c = clients + i;
+		c->id = id0 + i;
+		c->status = 0;
+		c->served_ns = 0;
+		c->sock = swarmConnect(port);
+		if(c->sock < 0 || !swarmSend(c->sock, "GET /upd?id=" + to_string(c->id) + " HTTP/1.1\nHost: rws\nAccept: text/event-stream\n\n"))
+		{
+			c->status = -1;
+			continue;
+		}
+		fcntl(c->sock, F_SETFL, fcntl(c->sock, F_GETFL) | O_NONBLOCK);
+		struct epoll_event ee;
+		ee.events = EPOLLIN;
+		ee.data.ptr = c;
+		epoll_ctl(ep, EPOLL_CTL_ADD, c->sock, &ee);
+		++open;
+	}
+	
+	SwarmReqs reqs;
+	reqs.port = port;
+	reqs.hz = req_hz;
+	reqs.stop = false;
+	reqs.clients = clients;
+	reqs.nclients = n;
+	reqs.sent = reqs.ok = reqs.refused = reqs.failed = 0;
+	pthread_t rthd;
+	if(req_hz > 0)
+	{
+		pthread_create(&rthd, NULL, requestThread, &reqs);
+	}
+	
+	unsigned long long ticks0, ticks1;
+	long rss0, rss1;
+	procUsage(server, &ticks0, &rss0);
+	
+	vector<unsigned int> lat_us;
+	unsigned long long bytes = 0;
+	int closed = 0;
+	char buff[SWARM_BUFF];
+	struct epoll_event evs[64];
+	unsigned long long beg = swarmNow(), end = beg + (unsigned long long)secs * 1000000000ULL, now = beg;
+	while(now < end)
+	{
+		int ne = epoll_wait(ep, evs, 64, (int)((end - now)/1000000) + 1);
+		now = swarmNow();
+		for(int e = 0; e < ne; ++e)
+		{
+			SwarmClient* c = (SwarmClient*)evs[e].data.ptr;
+			ssize_t rd;
+			while((rd = read(c->sock, buff, sizeof(buff))) > 0)
+			{
+				bytes += rd;
+				c->buf.append(buff, rd);
+			}
+			parseStream(c, now, &lat_us);
+			if(!rd) // 503 closes, readers shouldn't
+			{
+				epoll_ctl(ep, EPOLL_CTL_DEL, c->sock, NULL);
+				++closed;
+			}
+		}
+	}
+	double wall_s = (now - beg)/1e9;
+	procUsage(server, &ticks1, &rss1);
+	
+	reqs.stop = true;
+	if(req_hz > 0)
+	{
+		pthread_join(rthd, NULL);
+	}
+	
+	int served = 0, refused = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		served += clients[i].status == 200 ? 1 : 0;
+		refused += clients[i].status == 503 ? 1 : 0;
+		if(clients[i].sock >= 0)
+		{
+			close(clients[i].sock);
+		}
+	}
+	close(ep);
+	delete[] clients;
+	
+	sort(lat_us.begin(), lat_us.end());
+	sort(reqs.lat_us.begin(), reqs.lat_us.end());
+	double cpu = (ticks1 - ticks0) * 100.0/sysconf(_SC_CLK_TCK)/wall_s;
+	printf("%5d %6d %5d %5d %5d %8.1f %8u %8u %8u %8u %8.1f %4d/%-4d %3d %3d %7.1f %6.1f %7.1f\n",
+	n, served, refused, open - served - refused, closed - refused, lat_us.size()/wall_s, pct(lat_us, 50), pct(lat_us, 90),
+	pct(lat_us, 99), lat_us.empty() ? 0 : lat_us.back(), bytes/wall_s/1000.0, reqs.ok, reqs.sent, reqs.refused, reqs.failed,
+	pct(reqs.lat_us, 50)/1000.0, cpu, rss1/1024.0);
+	fflush(stdout);
+}
+
+// Server runs in its own directory, so it writes its database and error log there instead of the real ones
+bool makeServerDir(char* dir)
+{
+	char web[512];
+	if(getcwd(web, sizeof(web) - 4) == NULL || access("./web/main.html", R_OK))
+	{
+		fprintf(stderr, "rws_swarm: run it from repository root, ./web/main.html is served\n");
+		return false;
+	}
+	strcat(web, "/web");
+	if(mkdtemp(dir) == NULL)
+	{
+		perror("rws_swarm: can't create server directory");
+		return false;
+	}
+	
+	char log[300], lnk[300];
+	snprintf(log, sizeof(log), "%s/log", dir);
+	snprintf(lnk, sizeof(lnk), "%s/web", dir);
+	if(mkdir(log, 0755) || symlink(web, lnk))
+	{
+		perror("rws_swarm: can't set up server directory");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int port = SWARM_PORT, secs = SWARM_STEP_S, feed_ms = SWARM_FEED_MS, req_hz = SWARM_REQ_HZ;
+	int opt;
+	while((opt = getopt(argc, argv, "p:t:f:r:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg) > 0 ? atoi(optarg) : SWARM_STEP_S;
+			break;
+		case 'f':
+			feed_ms = atoi(optarg) > 0 ? atoi(optarg) : SWARM_FEED_MS;
+			break;
+		case 'r':
+			req_hz = atoi(optarg) >= 0 ? atoi(optarg) : SWARM_REQ_HZ;
+			break;
+		default:
+			fprintf(stderr, "Usage: rws_swarm [-p port] [-t seconds] [-f feed_ms] [-r requests/s] [clients ...]\n");
+			return 1;
+		}
+	}
+	
+	vector<int> sizes;
+	for(int i = optind; i < argc; ++i)
+	{
+		int n = atoi(argv[i]);
+		sizes.push_back(n < 1 ? 1 : n > SWARM_MAX ? SWARM_MAX : n);
+	}
+	if(sizes.empty())
+	{
+		int def[] = { 1, 4, 8, 16, 24, 48, 64 };
+		sizes.assign(def, def + sizeof(def)/sizeof(def[0]));
+	}
+	
+	char dir[] = "/tmp/rws_swarm.XXXXXX";
+	if(!makeServerDir(dir))
+	{
+		return 1;
+	}
+	
+	swarm_shm = (SwarmShared*)mmap(NULL, sizeof(SwarmShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(swarm_shm == MAP_FAILED)
+	{
+		perror("rws_swarm: can't map shared memory");
+		return 1;
+	}
+	memset(swarm_shm, 0, sizeof(SwarmShared));
+	
+	pid_t server = fork();
+	if(server == 0)
+	{
+		if(chdir(dir) || !freopen("./log/server.out", "w", stdout) || dup2(fileno(stdout), STDERR_FILENO) < 0)
+		{
+			_exit(1);
+		}
+		serverProc(port, feed_ms);
+	}
+	
+	int probe = -1;
+	for(int i = 0; i < 50 && probe < 0; ++i) // Up to 5 s for the listener
+	{
+		swarmSleepMs(100);
+		probe = swarmConnect(port);
+	}
+	if(probe < 0)
+	{
+		fprintf(stderr, "rws_swarm: server didn't start listening on port %d\n", port);
+		kill(server, SIGKILL);
+		return 1;
+	}
+	close(probe);
+	swarmSleepMs(SWARM_SETTLE_MS);
+	
+	printf("server pid %d in %s, port %d, readings every %d ms, %d requests/s, %d s per step\n", (int)server, dir, port, feed_ms, req_hz, secs);
+	printf("                               readings latency, putWebQueue -> client (us)               requests\n");
+	printf("  cli served   503  wait  drop  events/s      p50      p90      p99      max     kB/s   ok/sent  503 err  p50 ms  cpu %%  rss MB\n");
+	int id0 = 1000;
+	for(size_t s = 0; s < sizes.size(); ++s)
+	{
+		runStep(server, port, sizes[s], secs, req_hz, id0);
+		id0 += sizes[s];
+		swarmSleepMs(SWARM_SETTLE_MS);
+		
+		int st;
+		if(waitpid(server, &st, WNOHANG) == server)
+		{
+			fprintf(stderr, "rws_swarm: server died (%s %d), see %s/log/err.log\n",
+			WIFSIGNALED(st) ? "signal" : "exit code", WIFSIGNALED(st) ? WTERMSIG(st) : WEXITSTATUS(st), dir);
+			return 1;
+		}
+	}
+	
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+	
+	string rm = string("rm -rf ") + dir;
+	return system(rm.c_str()) ? 1 : 0;
+}